@@ -162,34 +162,95 @@ vector<string> CDB::findall(string &key)
   return ret;
 }
 
-bool CDB::keyExists(const string& key)
+static inline uint32_t cdbUnpack(const unsigned char* buf)
 {
-  int ret = cdb_find(&d_cdb, key.c_str(), key.size());
-  if (ret < 0) {
-    throw std::runtime_error("Error while looking up key '" + key + "' from CDB database: " + std::to_string(ret));
+  return static_cast<uint32_t>(buf[0]) | (static_cast<uint32_t>(buf[1]) << 8) | (static_cast<uint32_t>(buf[2]) << 16) | (static_cast<uint32_t>(buf[3]) << 24);
+}
+
+static inline uint32_t cdbHash(const std::string_view& key)
+{
+  uint32_t hash = 5381;
+  for (const auto c : key) {
+    hash = (hash + (hash << 5)) ^ static_cast<unsigned char>(c);
   }
-  if (ret == 0) {
-    /* no such key */
+  return hash;
+}
+
+/* Same lookup as cdb_find(), but directly on the memory-mapped file and without
+   storing the position of the value into d_cdb, so it is safe to call concurrently. */
+bool CDB::findFirst(const std::string_view& key, uint32_t& dataPos, uint32_t& dataLen) const
+{
+  const unsigned char* mem = d_cdb.cdb_mem;
+  const uint32_t fileSize = d_cdb.cdb_fsize;
+  const uint32_t dataEnd = d_cdb.cdb_dend;
+  const uint32_t hash = cdbHash(key);
+
+  /* the 256 entries of the first level table are located at the very beginning of the file */
+  const unsigned char* entry = mem + ((hash & 0xff) << 3);
+  const uint32_t slots = cdbUnpack(entry + 4);
+  if (slots == 0) {
     return false;
   }
 
-  return true;
+  const uint32_t tablePos = cdbUnpack(entry);
+  if (tablePos < dataEnd || tablePos > fileSize || (slots * 8) > (fileSize - tablePos)) {
+    throw std::runtime_error("Error while looking up key '" + std::string(key) + "' from CDB database: invalid hash table");
+  }
+
+  const unsigned char* tableStart = mem + tablePos;
+  const unsigned char* tableEnd = tableStart + (slots * 8);
+  const unsigned char* slot = tableStart + (((hash >> 8) % slots) << 3);
+
+  for (uint32_t probes = 0; probes < slots; probes++) {
+    const uint32_t recordPos = cdbUnpack(slot + 4);
+    if (recordPos == 0) {
+      /* empty slot, the key is not present */
+      return false;
+    }
+
+    if (cdbUnpack(slot) == hash) {
+      if (recordPos > (dataEnd - 8)) {
+        throw std::runtime_error("Error while looking up key '" + std::string(key) + "' from CDB database: invalid record position");
+      }
+      const uint32_t keyLen = cdbUnpack(mem + recordPos);
+      if (keyLen == key.size()) {
+        const uint32_t valueLen = cdbUnpack(mem + recordPos + 4);
+        if ((dataEnd - recordPos - 8) < keyLen || (dataEnd - recordPos - 8 - keyLen) < valueLen) {
+          throw std::runtime_error("Error while looking up key '" + std::string(key) + "' from CDB database: invalid record size");
+        }
+        if (memcmp(mem + recordPos + 8, key.data(), keyLen) == 0) {
+          dataPos = recordPos + 8 + keyLen;
+          dataLen = valueLen;
+          return true;
+        }
+      }
+    }
+
+    slot += 8;
+    if (slot >= tableEnd) {
+      slot = tableStart;
+    }
+  }
+
+  return false;
 }
 
-bool CDB::findOne(const string& key, string& value)
+bool CDB::keyExists(const std::string_view& key) const
 {
-  if (!keyExists(key)) {
-    return false;
-  }
+  uint32_t dataPos;
+  uint32_t dataLen;
+  return findFirst(key, dataPos, dataLen);
+}
 
-  unsigned int vpos = cdb_datapos(&d_cdb);
-  unsigned int vlen = cdb_datalen(&d_cdb);
-  value.resize(vlen);
-  int ret = cdb_read(&d_cdb, &value[0], vlen, vpos);
-  if (ret < 0) {
-    throw std::runtime_error("Error while reading value for key '" + key + "' from CDB database: " + std::to_string(ret));
+bool CDB::findOne(const std::string_view& key, string& value) const
+{
+  uint32_t dataPos;
+  uint32_t dataLen;
+  if (!findFirst(key, dataPos, dataLen)) {
+    return false;
   }
 
+  value.assign(reinterpret_cast<const char*>(d_cdb.cdb_mem + dataPos), dataLen);
   return true;
 }
 
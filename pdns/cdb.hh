@@ -21,6 +21,7 @@
  */
 #pragma once
 #include <cdb.h>
+#include <string_view>
 
 #include "misc.hh"
 
@@ -39,11 +40,15 @@ public:
   void searchAll();
   bool readNext(pair<string, string> &value);
   vector<string> findall(string &key);
-  bool keyExists(const string& key);
-  bool findOne(const string& key, string& value);
+
+  /* These two do not touch the search state and only read from the
+     memory-mapped file, so they can be called from several threads at once. */
+  bool keyExists(const std::string_view& key) const;
+  bool findOne(const std::string_view& key, string& value) const;
 
 private:
   bool moveToNext();
+  bool findFirst(const std::string_view& key, uint32_t& dataPos, uint32_t& dataLen) const;
 
   int d_fd{-1};
   struct cdb d_cdb;
@@ -216,6 +216,11 @@ inline uint16_t * getFlagsFromDNSHeader(struct dnsheader * dh)
   return (uint16_t*) (((char *) dh) + sizeof(uint16_t));
 }
 
+inline const uint16_t * getFlagsFromDNSHeader(const struct dnsheader * dh)
+{
+  return (const uint16_t*) (((const char *) dh) + sizeof(uint16_t));
+}
+
 #define DNS_TYPE_SIZE (2)
 #define DNS_CLASS_SIZE (2)
 #define DNS_TTL_SIZE (4)
@@ -69,6 +69,69 @@ DNSCryptExchangeVersion DNSCryptQuery::getVersion() const
 }
 
 #ifdef HAVE_CRYPTO_BOX_EASY_AFTERNM
+std::atomic<uint64_t> DNSCryptSharedKeyCache::s_hits{0};
+std::atomic<uint64_t> DNSCryptSharedKeyCache::s_misses{0};
+size_t DNSCryptSharedKeyCache::s_size{1024};
+thread_local std::unique_ptr<DNSCryptSharedKeyCache::Entry[], DNSCryptSharedKeyCache::Deleter> DNSCryptSharedKeyCache::t_entries{nullptr};
+thread_local size_t DNSCryptSharedKeyCache::t_size{0};
+
+DNSCryptSharedKeyCache::Entry* DNSCryptSharedKeyCache::getEntry(const unsigned char clientPK[DNSCRYPT_PUBLIC_KEY_SIZE], const unsigned char resolverPK[DNSCRYPT_PUBLIC_KEY_SIZE])
+{
+  if (t_entries == nullptr) {
+    if (s_size == 0) {
+      return nullptr;
+    }
+
+    /* sodium_allocarray() gives us guarded, mlock()'ed memory */
+    auto entries = static_cast<Entry*>(sodium_allocarray(s_size, sizeof(Entry)));
+    if (entries == nullptr) {
+      return nullptr;
+    }
+    sodium_memzero(entries, s_size * sizeof(Entry));
+    t_entries = std::unique_ptr<Entry[], Deleter>(entries);
+    t_size = s_size;
+  }
+
+  /* client public keys are Curve25519 points, and thus already uniformly distributed */
+  uint32_t clientPart;
+  uint32_t resolverPart;
+  memcpy(&clientPart, clientPK, sizeof(clientPart));
+  memcpy(&resolverPart, resolverPK, sizeof(resolverPart));
+
+  return &t_entries[(clientPart ^ resolverPart) % t_size];
+}
+
+bool DNSCryptSharedKeyCache::get(const unsigned char clientPK[DNSCRYPT_PUBLIC_KEY_SIZE], const unsigned char resolverPK[DNSCRYPT_PUBLIC_KEY_SIZE], DNSCryptExchangeVersion version, unsigned char sharedKey[DNSCRYPT_BEFORENM_SIZE])
+{
+  auto entry = getEntry(clientPK, resolverPK);
+  if (entry == nullptr) {
+    return false;
+  }
+
+  if (!entry->valid || entry->version != version || sodium_memcmp(entry->clientPK, clientPK, DNSCRYPT_PUBLIC_KEY_SIZE) != 0 || sodium_memcmp(entry->resolverPK, resolverPK, DNSCRYPT_PUBLIC_KEY_SIZE) != 0) {
+    ++s_misses;
+    return false;
+  }
+
+  memcpy(sharedKey, entry->sharedKey, DNSCRYPT_BEFORENM_SIZE);
+  ++s_hits;
+  return true;
+}
+
+void DNSCryptSharedKeyCache::insert(const unsigned char clientPK[DNSCRYPT_PUBLIC_KEY_SIZE], const unsigned char resolverPK[DNSCRYPT_PUBLIC_KEY_SIZE], DNSCryptExchangeVersion version, const unsigned char sharedKey[DNSCRYPT_BEFORENM_SIZE])
+{
+  auto entry = getEntry(clientPK, resolverPK);
+  if (entry == nullptr) {
+    return;
+  }
+
+  memcpy(entry->clientPK, clientPK, DNSCRYPT_PUBLIC_KEY_SIZE);
+  memcpy(entry->resolverPK, resolverPK, DNSCRYPT_PUBLIC_KEY_SIZE);
+  memcpy(entry->sharedKey, sharedKey, DNSCRYPT_BEFORENM_SIZE);
+  entry->version = version;
+  entry->valid = true;
+}
+
 DNSCryptQuery::~DNSCryptQuery()
 {
   if (d_sharedKeyComputed) {
@@ -90,6 +153,11 @@ int DNSCryptQuery::computeSharedKey()
 
   sodium_mlock(d_sharedKey, sizeof(d_sharedKey));
 
+  if (DNSCryptSharedKeyCache::get(d_header.clientPK, d_pair->publicKey, version, d_sharedKey)) {
+    d_sharedKeyComputed = true;
+    return res;
+  }
+
   if (version == DNSCryptExchangeVersion::VERSION1) {
     res = crypto_box_beforenm(d_sharedKey,
                               d_header.clientPK,
@@ -113,6 +181,7 @@ int DNSCryptQuery::computeSharedKey()
     return res;
   }
 
+  DNSCryptSharedKeyCache::insert(d_header.clientPK, d_pair->publicKey, version, d_sharedKey);
   d_sharedKeyComputed = true;
   return res;
 }
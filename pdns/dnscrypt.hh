@@ -43,6 +43,7 @@ private:
 
 #else /* HAVE_DNSCRYPT */
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -170,6 +171,57 @@ struct DNSCryptCertificatePair
   bool active;
 };
 
+#ifdef HAVE_CRYPTO_BOX_EASY_AFTERNM
+/* Per-thread cache of the shared keys computed via crypto_box_beforenm(), so that a client
+   reusing its key pair for several queries does not cost us one scalar multiplication per query.
+   The cache is direct-mapped, indexed by the client public key, and entries are simply
+   overwritten on collision. It is disabled when the size is set to 0. */
+class DNSCryptSharedKeyCache
+{
+public:
+  static bool get(const unsigned char clientPK[DNSCRYPT_PUBLIC_KEY_SIZE], const unsigned char resolverPK[DNSCRYPT_PUBLIC_KEY_SIZE], DNSCryptExchangeVersion version, unsigned char sharedKey[DNSCRYPT_BEFORENM_SIZE]);
+  static void insert(const unsigned char clientPK[DNSCRYPT_PUBLIC_KEY_SIZE], const unsigned char resolverPK[DNSCRYPT_PUBLIC_KEY_SIZE], DNSCryptExchangeVersion version, const unsigned char sharedKey[DNSCRYPT_BEFORENM_SIZE]);
+
+  /* needs to be called before the worker threads are started */
+  static void setSize(size_t size)
+  {
+    s_size = size;
+  }
+  static size_t getSize()
+  {
+    return s_size;
+  }
+
+  static std::atomic<uint64_t> s_hits;
+  static std::atomic<uint64_t> s_misses;
+
+private:
+  struct Entry
+  {
+    unsigned char clientPK[DNSCRYPT_PUBLIC_KEY_SIZE];
+    unsigned char resolverPK[DNSCRYPT_PUBLIC_KEY_SIZE];
+    unsigned char sharedKey[DNSCRYPT_BEFORENM_SIZE];
+    DNSCryptExchangeVersion version;
+    bool valid;
+  };
+
+  struct Deleter
+  {
+    void operator()(Entry* entries) const
+    {
+      /* sodium_free() zeroes the memory before releasing it */
+      sodium_free(entries);
+    }
+  };
+
+  static Entry* getEntry(const unsigned char clientPK[DNSCRYPT_PUBLIC_KEY_SIZE], const unsigned char resolverPK[DNSCRYPT_PUBLIC_KEY_SIZE]);
+
+  static thread_local std::unique_ptr<Entry[], Deleter> t_entries;
+  static thread_local size_t t_size;
+  static size_t s_size;
+};
+#endif /* HAVE_CRYPTO_BOX_EASY_AFTERNM */
+
 class DNSCryptQuery
 {
 public:
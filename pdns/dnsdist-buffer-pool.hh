@@ -0,0 +1,140 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+#include "noinitvector.hh"
+
+/* A pool of packet buffers, sorted into size classes (powers of two from 512 to 65536 bytes),
+   so that TCP and DoT connections only need to hold a buffer while they are actually reading
+   a query or a response, instead of keeping one for their whole lifetime.
+   There is one pool per thread, accessed via getThreadLocal(), so no locking is needed. */
+class PacketBufferPool
+{
+public:
+  static constexpr size_t s_minClassSize{512};
+  static constexpr size_t s_classesCount{8};
+  static constexpr size_t s_maxBuffersPerClass{128};
+
+  PacketBufferPool() = default;
+  PacketBufferPool(const PacketBufferPool&) = delete;
+  PacketBufferPool& operator=(const PacketBufferPool&) = delete;
+
+  ~PacketBufferPool()
+  {
+    for (const auto& buffers : d_free) {
+      for (const auto& buffer : buffers) {
+        s_pooledBytes -= buffer.capacity();
+      }
+    }
+  }
+
+  /* returns an empty buffer that can hold at least 'size' bytes without reallocating */
+  PacketBuffer acquire(size_t size)
+  {
+    auto idx = getClassForSize(size);
+    if (idx < s_classesCount && !d_free.at(idx).empty()) {
+      PacketBuffer buffer = std::move(d_free.at(idx).back());
+      d_free.at(idx).pop_back();
+      s_pooledBytes -= buffer.capacity();
+      ++s_hits;
+      return buffer;
+    }
+
+    ++s_misses;
+    PacketBuffer buffer;
+    buffer.reserve(idx < s_classesCount ? getClassSize(idx) : size);
+    return buffer;
+  }
+
+  /* the buffer is moved into the pool if there is room left for its class, and released otherwise */
+  void release(PacketBuffer&& buffer)
+  {
+    PacketBuffer tmp(std::move(buffer));
+    const auto capacity = tmp.capacity();
+    if (capacity < s_minClassSize) {
+      return;
+    }
+
+    /* a buffer goes into the largest class it can fully serve */
+    auto idx = getClassForCapacity(capacity);
+    auto& buffers = d_free.at(idx);
+    if (buffers.size() >= s_maxBuffersPerClass) {
+      return;
+    }
+
+    tmp.clear();
+    s_pooledBytes += capacity;
+    buffers.push_back(std::move(tmp));
+  }
+
+  size_t getBuffersCount() const
+  {
+    size_t count = 0;
+    for (const auto& buffers : d_free) {
+      count += buffers.size();
+    }
+    return count;
+  }
+
+  static PacketBufferPool& getThreadLocal()
+  {
+    static thread_local PacketBufferPool t_pool;
+    return t_pool;
+  }
+
+  static size_t getClassSize(size_t idx)
+  {
+    return s_minClassSize << idx;
+  }
+
+  /* smallest class whose buffers can hold 'size' bytes, s_classesCount if there is none */
+  static size_t getClassForSize(size_t size)
+  {
+    size_t idx = 0;
+    while (idx < s_classesCount && getClassSize(idx) < size) {
+      ++idx;
+    }
+    return idx;
+  }
+
+  /* largest class whose size is lower or equal to 'capacity', which needs to be at least s_minClassSize */
+  static size_t getClassForCapacity(size_t capacity)
+  {
+    size_t idx = 0;
+    while ((idx + 1) < s_classesCount && getClassSize(idx + 1) <= capacity) {
+      ++idx;
+    }
+    return idx;
+  }
+
+  /* bytes currently kept in the pools of all threads, ready to be reused */
+  static inline std::atomic<uint64_t> s_pooledBytes{0};
+  static inline std::atomic<uint64_t> s_hits{0};
+  static inline std::atomic<uint64_t> s_misses{0};
+
+private:
+  std::array<std::vector<PacketBuffer>, s_classesCount> d_free;
+};
@@ -30,6 +30,8 @@
 #include "ednssubnet.hh"
 #include "packetcache.hh"
 
+std::atomic<uint64_t> DNSDistPacketCache::s_nextID{1};
+
 DNSDistPacketCache::DNSDistPacketCache(size_t maxEntries, uint32_t maxTTL, uint32_t minTTL, uint32_t tempFailureTTL, uint32_t maxNegativeTTL, uint32_t staleTTL, bool dontAge, uint32_t shards, bool deferrableInsertLock, bool parseECS): d_maxEntries(maxEntries), d_shardCount(shards), d_maxTTL(maxTTL), d_tempFailureTTL(tempFailureTTL), d_maxNegativeTTL(maxNegativeTTL), d_minTTL(minTTL), d_staleTTL(staleTTL), d_dontAge(dontAge), d_deferrableInsertLock(deferrableInsertLock), d_parseECS(parseECS)
 {
   d_shards.resize(d_shardCount);
@@ -81,7 +83,34 @@ bool DNSDistPacketCache::getClientSubnet(const PacketBuffer& packet, size_t qnam
 
 bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const DNSName& qname, uint16_t qtype, uint16_t qclass, bool tcp, bool dnssecOK, const boost::optional<Netmask>& subnet) const
 {
-  if (cachedValue.queryFlags != queryFlags || cachedValue.dnssecOK != dnssecOK || cachedValue.tcp != tcp || cachedValue.qtype != qtype || cachedValue.qclass != qclass || cachedValue.qname != qname) {
+  if (cachedValue.qname != qname) {
+    return false;
+  }
+
+  return cachedValueMatches(cachedValue, queryFlags, qtype, qclass, tcp, dnssecOK, subnet);
+}
+
+bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const pdns_string_view& qnameWire, uint16_t qtype, uint16_t qclass, bool tcp, bool dnssecOK, const boost::optional<Netmask>& subnet) const
+{
+  /* the storage of a DNSName is its wire representation, so this is the same case-insensitive comparison than DNSName's operator== */
+  const auto& storage = cachedValue.qname.getStorage();
+  if (storage.size() != qnameWire.size()) {
+    return false;
+  }
+
+  const char* wire = qnameWire.data();
+  for (size_t idx = 0; idx < storage.size(); idx++) {
+    if (dns_tolower(storage[idx]) != dns_tolower(wire[idx])) {
+      return false;
+    }
+  }
+
+  return cachedValueMatches(cachedValue, queryFlags, qtype, qclass, tcp, dnssecOK, subnet);
+}
+
+bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, uint16_t qtype, uint16_t qclass, bool tcp, bool dnssecOK, const boost::optional<Netmask>& subnet) const
+{
+  if (cachedValue.queryFlags != queryFlags || cachedValue.dnssecOK != dnssecOK || cachedValue.tcp != tcp || cachedValue.qtype != qtype || cachedValue.qclass != qclass) {
     return false;
   }
 
@@ -95,17 +124,29 @@ bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, uint1
 void DNSDistPacketCache::insertLocked(CacheShard& shard, uint32_t key, CacheValue& newValue)
 {
   auto& map = shard.d_map;
-  /* check again now that we hold the lock to prevent a race */
-  if (map.size() >= (d_maxEntries / d_shardCount)) {
+  const size_t shardBudget = d_maxBytes / d_shardCount;
+  const size_t newSize = newValue.getPayloadSize();
+  if (d_maxBytes > 0 && newSize > shardBudget) {
     return;
   }
 
-  std::unordered_map<uint32_t,CacheValue>::iterator it;
-  bool result;
-  tie(it, result) = map.insert({key, newValue});
+  auto it = map.find(key);
+  if (it == map.end()) {
+    /* check again now that we hold the lock to prevent a race */
+    if (map.size() >= (d_maxEntries / d_shardCount)) {
+      return;
+    }
 
-  if (result) {
+    if (d_maxBytes > 0 && (shard.d_bytes + newSize) > shardBudget) {
+      evictForSpace(shard, shard.d_bytes + newSize - shardBudget, boost::none);
+      if ((shard.d_bytes + newSize) > shardBudget) {
+        return;
+      }
+    }
+
+    map.emplace(key, newValue);
     shard.d_entriesCount++;
+    shard.d_bytes += newSize;
     return;
   }
 
@@ -124,7 +165,97 @@ void DNSDistPacketCache::insertLocked(CacheShard& shard, uint32_t key, CacheValu
     return;
   }
 
+  const size_t oldSize = value.getPayloadSize();
+  if (d_maxBytes > 0 && newSize > oldSize && (shard.d_bytes + newSize - oldSize) > shardBudget) {
+    evictForSpace(shard, shard.d_bytes + newSize - oldSize - shardBudget, key);
+    if ((shard.d_bytes + newSize - oldSize) > shardBudget) {
+      return;
+    }
+  }
+
   value = newValue;
+  shard.d_bytes += newSize;
+  shard.d_bytes -= oldSize;
+}
+
+/* Generalized CLOCK over the buckets of the shard, called with the write lock held:
+   entries are evicted when the hand finds them with a counter of zero, otherwise their
+   counter is decreased, faster for entries much larger than the average so that a large
+   entry needs more hits than a small one to stay in the cache. Returns the number of
+   bytes that were freed. */
+size_t DNSDistPacketCache::evictForSpace(CacheShard& shard, size_t needed, const boost::optional<uint32_t>& keep)
+{
+  auto& map = shard.d_map;
+  const size_t bucketCount = map.bucket_count();
+  if (map.empty() || bucketCount == 0) {
+    return 0;
+  }
+
+  const uint64_t averageSize = shard.d_bytes / map.size();
+  size_t freed = 0;
+  std::vector<uint32_t> toRemove;
+
+  /* every complete turn decreases all the counters, so we are done after s_max + 1 turns at most */
+  for (size_t scanned = 0; freed < needed && scanned < (bucketCount * (ClockCounter::s_max + 1)); scanned++) {
+    const size_t bucket = shard.d_clockHand;
+    shard.d_clockHand = (shard.d_clockHand + 1) % bucketCount;
+
+    for (auto it = map.begin(bucket); it != map.end(bucket) && freed < needed; ++it) {
+      if (keep && it->first == *keep) {
+        continue;
+      }
+
+      const auto& value = it->second;
+      auto counter = value.clock.d_value.load(std::memory_order_relaxed);
+      if (counter == 0) {
+        freed += value.getPayloadSize();
+        toRemove.push_back(it->first);
+        continue;
+      }
+
+      const uint8_t decrease = value.getPayloadSize() > (2 * averageSize) ? 2 : 1;
+      value.clock.d_value.store(counter > decrease ? counter - decrease : 0, std::memory_order_relaxed);
+    }
+
+    /* erasing invalidates the iterators, so we do that once we are done with this bucket */
+    for (const auto key : toRemove) {
+      auto it = map.find(key);
+      shard.d_bytes -= it->second.getPayloadSize();
+      map.erase(it);
+      shard.d_entriesCount--;
+      ++d_spaceEvictions;
+    }
+    toRemove.clear();
+  }
+
+  return freed;
+}
+
+boost::optional<uint32_t> DNSDistPacketCache::getCacheTTL(const PacketBuffer& response, uint8_t rcode, bool* tooShort) const
+{
+  bool seenAuthSOA = false;
+  uint32_t minTTL = getMinTTL(reinterpret_cast<const char*>(response.data()), response.size(), &seenAuthSOA);
+
+  /* no TTL found, we don't want to cache this */
+  if (minTTL == std::numeric_limits<uint32_t>::max()) {
+    return boost::none;
+  }
+
+  if (rcode == RCode::NXDomain || (rcode == RCode::NoError && seenAuthSOA)) {
+    minTTL = std::min(minTTL, d_maxNegativeTTL);
+  }
+  else if (minTTL > d_maxTTL) {
+    minTTL = d_maxTTL;
+  }
+
+  if (minTTL < d_minTTL) {
+    if (tooShort != nullptr) {
+      *tooShort = true;
+    }
+    return boost::none;
+  }
+
+  return minTTL;
 }
 
 void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool tcp, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL)
@@ -142,25 +273,15 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
     }
   }
   else {
-    bool seenAuthSOA = false;
-    minTTL = getMinTTL(reinterpret_cast<const char*>(response.data()), response.size(), &seenAuthSOA);
-
-    /* no TTL found, we don't want to cache this */
-    if (minTTL == std::numeric_limits<uint32_t>::max()) {
-      return;
-    }
-
-    if (rcode == RCode::NXDomain || (rcode == RCode::NoError && seenAuthSOA)) {
-      minTTL = std::min(minTTL, d_maxNegativeTTL);
-    }
-    else if (minTTL > d_maxTTL) {
-      minTTL = d_maxTTL;
-    }
-
-    if (minTTL < d_minTTL) {
-      d_ttlTooShorts++;
+    bool tooShort = false;
+    auto ttl = getCacheTTL(response, rcode, &tooShort);
+    if (!ttl) {
+      if (tooShort) {
+        d_ttlTooShorts++;
+      }
       return;
     }
+    minTTL = *ttl;
   }
 
   uint32_t shardIndex = getShardIndex(key);
@@ -202,43 +323,146 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
   }
 }
 
-bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, uint32_t allowExpired, bool skipAging)
+void DNSDistPacketCache::copyResponse(const CacheValue& value, PacketBuffer& response, uint16_t queryId, const char* qname, size_t qnameLen)
 {
-  const auto& dnsQName = dq.qname->getStorage();
-  uint32_t key = getKey(dnsQName, dq.qname->wirelength(), dq.getData(), dq.tcp);
+  response.resize(value.len);
+  memcpy(&response.at(0), &queryId, sizeof(queryId));
+  memcpy(&response.at(sizeof(queryId)), &value.value.at(sizeof(queryId)), sizeof(dnsheader) - sizeof(queryId));
 
-  if (keyOut) {
-    *keyOut = key;
+  if (value.len == sizeof(dnsheader)) {
+    return;
   }
 
-  if (d_parseECS) {
-    getClientSubnet(dq.getData(), dq.qname->wirelength(), subnet);
+  if (qname != nullptr) {
+    memcpy(&response.at(sizeof(dnsheader)), qname, qnameLen);
+  }
+  if (value.len > (sizeof(dnsheader) + qnameLen)) {
+    memcpy(&response.at(sizeof(dnsheader) + qnameLen), &value.value.at(sizeof(dnsheader) + qnameLen), value.len - (sizeof(dnsheader) + qnameLen));
   }
+}
 
-  uint32_t shardIndex = getShardIndex(key);
+DNSDistPacketCache::LocalCache& DNSDistPacketCache::getLocalCache(time_t now)
+{
+  /* entries for caches that have been destroyed are never removed, but the number of caches is expected to be small */
+  static thread_local std::unordered_map<uint64_t, LocalCache> t_localCaches;
+
+  auto& local = t_localCaches[d_id];
+  if (local.d_entries.size() != d_localCacheSize) {
+    local.d_entries.clear();
+    local.d_entries.resize(d_localCacheSize);
+  }
+
+  if (local.d_lastFlush != now) {
+    if (local.d_pendingHits > 0) {
+      d_hits += local.d_pendingHits;
+      d_localHits += local.d_pendingHits;
+      local.d_pendingHits = 0;
+    }
+    local.d_lastFlush = now;
+  }
+
+  return local;
+}
+
+template<typename T>
+bool DNSDistPacketCache::getFromLocalCache(LocalCache& local, uint32_t key, PacketBuffer& response, uint16_t queryId, const char* qname, size_t qnameLen, time_t now, bool skipAging, const T& matches)
+{
+  auto& entry = local.d_entries[key & (d_localCacheSize - 1)];
+  if (entry.key != key || entry.localValidity <= now || entry.generation != d_localGeneration.load(std::memory_order_relaxed)) {
+    return false;
+  }
+
+  /* the length has already been checked against the qname when the entry was found in the shared cache,
+     and the qname is part of what has to match */
+  const CacheValue& value = entry.value;
+  if (!matches(value)) {
+    return false;
+  }
+
+  if (entry.hits < std::numeric_limits<uint8_t>::max()) {
+    entry.hits++;
+  }
+
+  copyResponse(value, response, queryId, qname, qnameLen);
+  if (value.len > sizeof(dnsheader) && !d_dontAge && !skipAging) {
+    ageDNSPacket(reinterpret_cast<char *>(&response[0]), response.size(), now - value.added);
+  }
+
+  local.d_pendingHits++;
+  return true;
+}
+
+/* called with the read lock of the shard held. A slot holding a valid entry that has been hit since
+   the last attempt is kept, so that the hottest entries are not evicted by less popular ones */
+void DNSDistPacketCache::insertIntoLocalCache(LocalCache& local, uint32_t key, const CacheValue& value, time_t now)
+{
+  auto& entry = local.d_entries[key & (d_localCacheSize - 1)];
+  const auto generation = d_localGeneration.load(std::memory_order_relaxed);
+
+  if (entry.key != key && entry.hits > 0 && entry.localValidity > now && entry.generation == generation) {
+    entry.hits /= 2;
+    return;
+  }
+
+  /* reusing the existing string avoids an allocation most of the time */
+  entry.value.value.assign(value.value);
+  entry.value.qname = value.qname;
+  entry.value.subnet = value.subnet;
+  entry.value.qtype = value.qtype;
+  entry.value.qclass = value.qclass;
+  entry.value.queryFlags = value.queryFlags;
+  entry.value.added = value.added;
+  entry.value.validity = value.validity;
+  entry.value.len = value.len;
+  entry.value.tcp = value.tcp;
+  entry.value.dnssecOK = value.dnssecOK;
+  entry.localValidity = std::min(value.validity, now + static_cast<time_t>(d_localCacheMaxTTL));
+  entry.generation = generation;
+  entry.key = key;
+  entry.hits = 0;
+}
+
+template<typename T>
+bool DNSDistPacketCache::getResponse(uint32_t key, PacketBuffer& response, uint16_t queryId, const char* qname, size_t qnameLen, uint32_t allowExpired, bool skipAging, bool countMisses, const T& matches)
+{
   time_t now = time(nullptr);
+  LocalCache* local = nullptr;
+
+  if (d_localCacheSize > 0) {
+    local = &getLocalCache(now);
+    if (getFromLocalCache(*local, key, response, queryId, qname, qnameLen, now, skipAging, matches)) {
+      return true;
+    }
+  }
+
+  uint32_t shardIndex = getShardIndex(key);
   time_t age;
   bool stale = false;
-  auto& response = dq.getMutableData();
   auto& shard = d_shards.at(shardIndex);
   auto& map = shard.d_map;
   {
     TryReadLock r(&shard.d_lock);
     if (!r.gotIt()) {
-      d_deferredLookups++;
+      if (countMisses) {
+        d_deferredLookups++;
+      }
       return false;
     }
 
     std::unordered_map<uint32_t,CacheValue>::const_iterator it = map.find(key);
     if (it == map.end()) {
-      d_misses++;
+      if (countMisses) {
+        d_misses++;
+      }
       return false;
     }
 
     const CacheValue& value = it->second;
     if (value.validity <= now) {
       if ((now - value.validity) >= static_cast<time_t>(allowExpired)) {
-        d_misses++;
+        if (countMisses) {
+          d_misses++;
+        }
         return false;
       }
       else {
@@ -250,15 +474,25 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
       return false;
     }
 
+    if (value.len > sizeof(dnsheader) && value.len < (sizeof(dnsheader) + qnameLen)) {
+      return false;
+    }
+
     /* check for collision */
-    if (!cachedValueMatches(value, *(getFlagsFromDNSHeader(dq.getHeader())), *dq.qname, dq.qtype, dq.qclass, dq.tcp, dnssecOK, subnet)) {
-      d_lookupCollisions++;
+    if (!matches(value)) {
+      if (countMisses) {
+        d_lookupCollisions++;
+      }
       return false;
     }
 
-    response.resize(value.len);
-    memcpy(&response.at(0), &queryId, sizeof(queryId));
-    memcpy(&response.at(sizeof(queryId)), &value.value.at(sizeof(queryId)), sizeof(dnsheader) - sizeof(queryId));
+    value.clock.hit();
+
+    if (local != nullptr && !stale) {
+      insertIntoLocalCache(*local, key, value, now);
+    }
+
+    copyResponse(value, response, queryId, qname, qnameLen);
 
     if (value.len == sizeof(dnsheader)) {
       /* DNS header only, our work here is done */
@@ -266,16 +500,6 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
       return true;
     }
 
-    const size_t dnsQNameLen = dnsQName.length();
-    if (value.len < (sizeof(dnsheader) + dnsQNameLen)) {
-      return false;
-    }
-
-    memcpy(&response.at(sizeof(dnsheader)), dnsQName.c_str(), dnsQNameLen);
-    if (value.len > (sizeof(dnsheader) + dnsQNameLen)) {
-      memcpy(&response.at(sizeof(dnsheader) + dnsQNameLen), &value.value.at(sizeof(dnsheader) + dnsQNameLen), value.len - (sizeof(dnsheader) + dnsQNameLen));
-    }
-
     if (!stale) {
       age = now - value.added;
     }
@@ -292,6 +516,77 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
   return true;
 }
 
+bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, uint32_t allowExpired, bool skipAging)
+{
+  const auto& dnsQName = dq.qname->getStorage();
+  uint32_t key = getKey(dnsQName, dq.qname->wirelength(), dq.getData(), dq.tcp);
+
+  if (keyOut) {
+    *keyOut = key;
+  }
+
+  if (d_parseECS) {
+    getClientSubnet(dq.getData(), dq.qname->wirelength(), subnet);
+  }
+
+  const uint16_t queryFlags = *(getFlagsFromDNSHeader(dq.getHeader()));
+  return getResponse(key, dq.getMutableData(), queryId, dnsQName.c_str(), dnsQName.length(), allowExpired, skipAging, true, [&](const CacheValue& value) {
+    return cachedValueMatches(value, queryFlags, *dq.qname, dq.qtype, dq.qclass, dq.tcp, dnssecOK, subnet);
+  });
+}
+
+bool DNSDistPacketCache::getFromWire(PacketBuffer& packet, bool tcp)
+{
+  if (packet.size() <= sizeof(dnsheader)) {
+    return false;
+  }
+
+  const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(packet.data());
+  if (ntohs(dh->qdcount) != 1) {
+    return false;
+  }
+
+  /* find the end of the qname without parsing it, refusing compression pointers
+     and anything that DNSName would not accept either */
+  size_t pos = sizeof(dnsheader);
+  while (pos < packet.size() && packet[pos] != 0) {
+    const uint8_t labelLen = packet[pos];
+    if (labelLen > 63) {
+      return false;
+    }
+    pos += labelLen + 1;
+    if ((pos - sizeof(dnsheader)) > 254) {
+      return false;
+    }
+  }
+  pos++;
+
+  const size_t qnameWireLength = pos - sizeof(dnsheader);
+  if (packet.size() < (pos + DNS_TYPE_SIZE + DNS_CLASS_SIZE)) {
+    return false;
+  }
+
+  const uint16_t qtype = packet[pos] * 256 + packet[pos + 1];
+  const uint16_t qclass = packet[pos + 2] * 256 + packet[pos + 3];
+  const uint16_t queryFlags = *(getFlagsFromDNSHeader(dh));
+  const uint16_t queryId = dh->id;
+  const bool dnssecOK = getEDNSZ(packet, qnameWireLength) & EDNS_HEADER_FLAG_DO;
+  boost::optional<Netmask> subnet;
+  if (d_parseECS) {
+    getClientSubnet(packet, qnameWireLength, subnet);
+  }
+
+  const pdns_string_view qnameWire(reinterpret_cast<const char*>(&packet.at(sizeof(dnsheader))), qnameWireLength);
+  const uint32_t key = getKey(qnameWire, qnameWireLength, packet, tcp);
+
+  /* this is a probe, the regular lookup will be done later if it fails so we don't want to count misses twice.
+     The qname is already at the right place in the packet so it does not need to be copied. */
+  return getResponse(key, packet, queryId, nullptr, qnameWireLength, 0, false, false, [&](const CacheValue& value) {
+    return cachedValueMatches(value, queryFlags, qnameWire, qtype, qclass, tcp, dnssecOK, subnet);
+  });
+}
+
+
 /* Remove expired entries, until the cache has at most
    upTo entries in it.
 */
@@ -318,10 +613,12 @@ size_t DNSDistPacketCache::purgeExpired(size_t upTo)
       const CacheValue& value = it->second;
 
       if (value.validity <= now) {
+        d_shards[shardIndex].d_bytes -= value.getPayloadSize();
         it = map.erase(it);
         --toRemove;
         d_shards[shardIndex].d_entriesCount--;
         ++removed;
+        ++d_expiredEvictions;
       } else {
         ++it;
       }
@@ -354,18 +651,28 @@ size_t DNSDistPacketCache::expunge(size_t upTo)
     auto endIt = beginIt;
     size_t removeFromThisShard = (toRemove - removed) / (d_shardCount - shardIndex);
     if (map.size() >= removeFromThisShard) {
-      std::advance(endIt, removeFromThisShard);
+      uint64_t bytes = 0;
+      for (size_t idx = 0; idx < removeFromThisShard; idx++) {
+        bytes += endIt->second.getPayloadSize();
+        ++endIt;
+      }
       map.erase(beginIt, endIt);
       d_shards[shardIndex].d_entriesCount -= removeFromThisShard;
+      d_shards[shardIndex].d_bytes -= bytes;
       removed += removeFromThisShard;
     }
     else {
       removed += map.size();
       map.clear();
       d_shards[shardIndex].d_entriesCount = 0;
+      d_shards[shardIndex].d_bytes = 0;
     }
   }
 
+  d_expungedEntries += removed;
+  if (removed > 0) {
+    d_localGeneration++;
+  }
   return removed;
 }
 
@@ -381,15 +688,21 @@ size_t DNSDistPacketCache::expungeByName(const DNSName& name, uint16_t qtype, bo
       const CacheValue& value = it->second;
 
       if ((value.qname == name || (suffixMatch && value.qname.isPartOf(name))) && (qtype == QType::ANY || qtype == value.qtype)) {
+        d_shards[shardIndex].d_bytes -= value.getPayloadSize();
         it = map.erase(it);
         d_shards[shardIndex].d_entriesCount--;
         ++removed;
+        ++d_expungedEntries;
       } else {
         ++it;
       }
     }
   }
 
+  if (removed > 0) {
+    d_localGeneration++;
+  }
+
   return removed;
 }
 
@@ -409,12 +722,28 @@ uint64_t DNSDistPacketCache::getSize()
   return count;
 }
 
+uint64_t DNSDistPacketCache::getBytes() const
+{
+  uint64_t bytes = 0;
+
+  for (const auto& shard : d_shards) {
+    bytes += shard.d_bytes;
+  }
+
+  return bytes;
+}
+
 uint32_t DNSDistPacketCache::getMinTTL(const char* packet, uint16_t length, bool* seenNoDataSOA)
 {
   return getDNSPacketMinTTL(packet, length, seenNoDataSOA);
 }
 
 uint32_t DNSDistPacketCache::getKey(const DNSName::string_t& qname, size_t qnameWireLength, const PacketBuffer& packet, bool tcp)
+{
+  return getKey(pdns_string_view(qname.c_str(), qname.length()), qnameWireLength, packet, tcp);
+}
+
+uint32_t DNSDistPacketCache::getKey(const pdns_string_view& qname, size_t qnameWireLength, const PacketBuffer& packet, bool tcp)
 {
   uint32_t result = 0;
   /* skip the query ID */
@@ -423,7 +752,7 @@ uint32_t DNSDistPacketCache::getKey(const DNSName::string_t& qname, size_t qname
   }
 
   result = burtle(&packet.at(2), sizeof(dnsheader) - 2, result);
-  result = burtleCI((const unsigned char*) qname.c_str(), qname.length(), result);
+  result = burtleCI(reinterpret_cast<const unsigned char*>(qname.data()), qname.size(), result);
   if (packet.size() < sizeof(dnsheader) + qnameWireLength) {
     throw std::range_error("Computing packet cache key for an invalid packet (" + std::to_string(packet.size()) + " < " + std::to_string(sizeof(dnsheader) + qnameWireLength) + ")");
   }
@@ -28,6 +28,7 @@
 #include "lock.hh"
 #include "noinitvector.hh"
 #include "stat_t.hh"
+#include "views.hh"
 
 struct DNSQuestion;
 
@@ -39,6 +40,10 @@ public:
 
   void insert(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool tcp, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL);
   bool get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, uint32_t allowExpired = 0, bool skipAging = false);
+  /* lookup done directly from the wire, before the query has been parsed, and replacing the query with the
+     response on a hit. The qname is validated by comparing its wire representation to the cached one.
+     Lookup failures are not accounted for, since the regular lookup is expected to be done on a miss. */
+  bool getFromWire(PacketBuffer& packet, bool tcp);
   size_t purgeExpired(size_t upTo=0);
   size_t expunge(size_t upTo=0);
   size_t expungeByName(const DNSName& name, uint16_t qtype=QType::ANY, bool suffixMatch=false);
@@ -53,7 +58,14 @@ public:
   uint64_t getInsertCollisions() const { return d_insertCollisions; }
   uint64_t getMaxEntries() const { return d_maxEntries; }
   uint64_t getTTLTooShorts() const { return d_ttlTooShorts; }
+  uint64_t getSpaceEvictions() const { return d_spaceEvictions; }
+  uint64_t getExpiredEvictions() const { return d_expiredEvictions; }
+  uint64_t getExpungedEntries() const { return d_expungedEntries; }
+  uint64_t getLocalHits() const { return d_localHits; }
+  uint64_t getLocalCacheSize() const { return d_localCacheSize; }
+  uint64_t getMaxBytes() const { return d_maxBytes; }
   uint64_t getEntriesCount();
+  uint64_t getBytes() const;
   uint64_t dump(int fd);
 
   bool isECSParsingEnabled() const { return d_parseECS; }
@@ -78,16 +90,74 @@ public:
     d_parseECS = enabled;
   }
 
+  /* memory budget for the responses and qnames stored in the cache, 0 means no limit.
+     Only meant to be called before the cache is used. */
+  void setMaxBytes(size_t maxBytes)
+  {
+    d_maxBytes = maxBytes;
+  }
+
+  /* number of entries of the per-thread cache consulted before the shared shards (rounded up to a power of two),
+     and the maximum time an entry can be served from it before the shared cache is looked up again. 0 means disabled.
+     Only meant to be called before the cache is used. */
+  void setLocalCache(size_t entries, uint32_t maxTTL)
+  {
+    size_t size = 0;
+    if (entries > 0) {
+      size = 1;
+      while (size < entries) {
+        size <<= 1;
+      }
+    }
+    d_localCacheSize = size;
+    d_localCacheMaxTTL = maxTTL;
+  }
+
   uint32_t getKey(const DNSName::string_t& qname, size_t qnameWireLength, const PacketBuffer& packet, bool tcp);
+  uint32_t getKey(const pdns_string_view& qname, size_t qnameWireLength, const PacketBuffer& packet, bool tcp);
+
+  /* the TTL a response that is neither a ServFail nor a Refused would be cached for, once the maximum and negative
+     TTLs have been applied, or none if it would not be cached: no TTL found, or lower than the minimum TTL */
+  boost::optional<uint32_t> getCacheTTL(const PacketBuffer& response, uint8_t rcode, bool* tooShort = nullptr) const;
 
   static uint32_t getMinTTL(const char* packet, uint16_t length, bool* seenNoDataSOA);
   static bool getClientSubnet(const PacketBuffer& packet, size_t qnameWireLength, boost::optional<Netmask>& subnet);
 
 private:
 
+  /* CLOCK reference counter, increased on hits while holding the read lock */
+  struct ClockCounter
+  {
+    static constexpr uint8_t s_max{3};
+
+    ClockCounter()
+    {
+    }
+    ClockCounter(const ClockCounter& rhs): d_value(rhs.d_value.load(std::memory_order_relaxed))
+    {
+    }
+    ClockCounter& operator=(const ClockCounter& rhs)
+    {
+      d_value.store(rhs.d_value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      return *this;
+    }
+
+    void hit() const
+    {
+      auto current = d_value.load(std::memory_order_relaxed);
+      if (current < s_max) {
+        d_value.store(current + 1, std::memory_order_relaxed);
+      }
+    }
+
+    mutable std::atomic<uint8_t> d_value{0};
+  };
+
   struct CacheValue
   {
     time_t getTTD() const { return validity; }
+    /* the bytes accounted for in the memory budget */
+    size_t getPayloadSize() const { return value.size() + qname.getStorage().size(); }
     std::string value;
     DNSName qname;
     boost::optional<Netmask> subnet;
@@ -97,6 +167,7 @@ private:
     time_t added{0};
     time_t validity{0};
     uint16_t len{0};
+    ClockCounter clock;
     bool tcp{false};
     bool dnssecOK{false};
   };
@@ -104,10 +175,10 @@ private:
   class CacheShard
   {
   public:
-    CacheShard(): d_entriesCount(0)
+    CacheShard(): d_entriesCount(0), d_bytes(0)
     {
     }
-    CacheShard(const CacheShard& old): d_entriesCount(0)
+    CacheShard(const CacheShard& old): d_entriesCount(0), d_bytes(0)
     {
     }
 
@@ -119,11 +190,44 @@ private:
     std::unordered_map<uint32_t,CacheValue> d_map;
     ReadWriteLock d_lock;
     std::atomic<uint64_t> d_entriesCount;
+    /* sum of the payload sizes of the entries, only updated with the write lock held */
+    std::atomic<uint64_t> d_bytes;
+    /* the bucket the CLOCK hand is pointing to, protected by the write lock */
+    size_t d_clockHand{0};
+  };
+
+  /* an entry of the per-thread cache, only valid if its generation matches the one of the shared cache */
+  struct LocalCacheEntry
+  {
+    CacheValue value;
+    uint64_t generation{0};
+    time_t localValidity{0};
+    uint32_t key{0};
+    uint8_t hits{0};
+  };
+
+  struct LocalCache
+  {
+    std::vector<LocalCacheEntry> d_entries;
+    /* hits are accounted locally and added to the shared counters once per second,
+       so that hits from the per-thread cache do not touch any shared cache line */
+    uint64_t d_pendingHits{0};
+    time_t d_lastFlush{0};
   };
 
   bool cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const DNSName& qname, uint16_t qtype, uint16_t qclass, bool tcp, bool dnssecOK, const boost::optional<Netmask>& subnet) const;
+  bool cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const pdns_string_view& qnameWire, uint16_t qtype, uint16_t qclass, bool tcp, bool dnssecOK, const boost::optional<Netmask>& subnet) const;
+  bool cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, uint16_t qtype, uint16_t qclass, bool tcp, bool dnssecOK, const boost::optional<Netmask>& subnet) const;
+  template<typename T>
+  bool getFromLocalCache(LocalCache& local, uint32_t key, PacketBuffer& response, uint16_t queryId, const char* qname, size_t qnameLen, time_t now, bool skipAging, const T& matches);
+  void insertIntoLocalCache(LocalCache& local, uint32_t key, const CacheValue& value, time_t now);
+  LocalCache& getLocalCache(time_t now);
+  template<typename T>
+  bool getResponse(uint32_t key, PacketBuffer& response, uint16_t queryId, const char* qname, size_t qnameLen, uint32_t allowExpired, bool skipAging, bool countMisses, const T& matches);
+  static void copyResponse(const CacheValue& value, PacketBuffer& response, uint16_t queryId, const char* qname, size_t qnameLen);
   uint32_t getShardIndex(uint32_t key) const;
   void insertLocked(CacheShard& shard, uint32_t key, CacheValue& newValue);
+  size_t evictForSpace(CacheShard& shard, size_t needed, const boost::optional<uint32_t>& keep);
 
   std::vector<CacheShard> d_shards;
 
@@ -134,8 +238,20 @@ private:
   pdns::stat_t d_insertCollisions{0};
   pdns::stat_t d_lookupCollisions{0};
   pdns::stat_t d_ttlTooShorts{0};
+  pdns::stat_t d_spaceEvictions{0};
+  pdns::stat_t d_expiredEvictions{0};
+  pdns::stat_t d_expungedEntries{0};
+  pdns::stat_t d_localHits{0};
+  /* bumped whenever entries are removed from the shared cache before their expiration,
+     invalidating all the entries of the per-thread caches */
+  std::atomic<uint64_t> d_localGeneration{1};
+  /* identifies this cache in the per-thread caches, unlike its address it is never reused */
+  const uint64_t d_id{s_nextID++};
+  static std::atomic<uint64_t> s_nextID;
 
   size_t d_maxEntries;
+  size_t d_maxBytes{0};
+  size_t d_localCacheSize{0};
   uint32_t d_expungeIndex{0};
   uint32_t d_shardCount;
   uint32_t d_maxTTL;
@@ -143,6 +259,7 @@ private:
   uint32_t d_maxNegativeTTL;
   uint32_t d_minTTL;
   uint32_t d_staleTTL;
+  uint32_t d_localCacheMaxTTL{0};
   bool d_dontAge;
   bool d_deferrableInsertLock;
   bool d_parseECS;
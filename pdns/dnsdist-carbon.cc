@@ -140,6 +140,7 @@ void carbonDumpThread()
             str<<base<<"tlsresumptions" << ' ' << front->tlsResumptions.load() << " " << now << "\r\n";
             str<<base<<"tlsunknownticketkeys" << ' ' << front->tlsUnknownTicketKey.load() << " " << now << "\r\n";
             str<<base<<"tlsinactiveticketkeys" << ' ' << front->tlsInactiveTicketKey.load() << " " << now << "\r\n";
+            str<<base<<"tlsktlsconnections" << ' ' << front->tlsKTLSConnections.load() << " " << now << "\r\n";
             const TLSErrorCounters* errorCounters = nullptr;
             if (front->tlsFrontend != nullptr) {
               errorCounters = &front->tlsFrontend->d_tlsCounters;
@@ -181,6 +182,11 @@ void carbonDumpThread()
               str<<base<<"cache-lookup-collisions" << " " << cache->getLookupCollisions() << " " << now << "\r\n";
               str<<base<<"cache-insert-collisions" << " " << cache->getInsertCollisions() << " " << now << "\r\n";
               str<<base<<"cache-ttl-too-shorts" << " " << cache->getTTLTooShorts() << " " << now << "\r\n";
+              str<<base<<"cache-bytes" << " " << cache->getBytes() << " " << now << "\r\n";
+              str<<base<<"cache-space-evictions" << " " << cache->getSpaceEvictions() << " " << now << "\r\n";
+              str<<base<<"cache-expired-evictions" << " " << cache->getExpiredEvictions() << " " << now << "\r\n";
+              str<<base<<"cache-expunged-entries" << " " << cache->getExpungedEntries() << " " << now << "\r\n";
+              str<<base<<"cache-local-hits" << " " << cache->getLocalHits() << " " << now << "\r\n";
             }
           }
 
@@ -219,6 +225,7 @@ void carbonDumpThread()
                 {"http2-other-responses", doh->d_http2Stats.d_nbOtherResponses},
                 {"get-queries", doh->d_getqueries},
                 {"post-queries", doh->d_postqueries},
+                {"get-cache-hits", doh->d_getcachehits},
                 {"bad-requests", doh->d_badrequests},
                 {"error-responses", doh->d_errorresponses},
                 {"redirect-responses", doh->d_redirectresponses},
@@ -986,26 +986,29 @@ bool addEDNSToQueryTurnedResponse(DNSQuestion& dq)
 
 // goal in life - if you send us a reasonably normal packet, we'll get Z for you, otherwise 0
 int getEDNSZ(const DNSQuestion& dq)
+{
+  return getEDNSZ(dq.getData(), dq.qname->wirelength());
+}
+
+int getEDNSZ(const PacketBuffer& packet, size_t qnameWireLength)
 {
   try
   {
-    const auto& dh = dq.getHeader();
-    if (ntohs(dh->qdcount) != 1 || dh->ancount != 0 || ntohs(dh->arcount) != 1 || dh->nscount != 0) {
+    if (packet.size() <= sizeof(dnsheader)) {
       return 0;
     }
 
-    if (dq.getData().size() <= sizeof(dnsheader)) {
+    const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(packet.data());
+    if (ntohs(dh->qdcount) != 1 || dh->ancount != 0 || ntohs(dh->arcount) != 1 || dh->nscount != 0) {
       return 0;
     }
 
-    size_t pos = sizeof(dnsheader) + dq.qname->wirelength() + DNS_TYPE_SIZE + DNS_CLASS_SIZE;
+    size_t pos = sizeof(dnsheader) + qnameWireLength + DNS_TYPE_SIZE + DNS_CLASS_SIZE;
 
-    if (dq.getData().size() <= (pos + /* root */ 1 + DNS_TYPE_SIZE + DNS_CLASS_SIZE)) {
+    if (packet.size() <= (pos + /* root */ 1 + DNS_TYPE_SIZE + DNS_CLASS_SIZE)) {
       return 0;
     }
 
-    auto& packet = dq.getData();
-
     if (packet.at(pos) != 0) {
       /* not root, so not a valid OPT record */
       return 0;
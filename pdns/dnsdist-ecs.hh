@@ -45,5 +45,6 @@ bool handleEDNSClientSubnet(PacketBuffer& packet, size_t maximumSize, size_t qna
 bool parseEDNSOptions(const DNSQuestion& dq);
 
 int getEDNSZ(const DNSQuestion& dq);
+int getEDNSZ(const PacketBuffer& packet, size_t qnameWireLength);
 bool queryHasEDNS(const DNSQuestion& dq);
 bool getEDNS0Record(const DNSQuestion& dq, EDNS0Record& edns0);
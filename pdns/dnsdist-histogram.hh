@@ -0,0 +1,222 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/* HDR-style latency histogram, in microseconds: values below 2^s_subBucketsBits
+   are counted exactly, then every power of two is split into 2^s_subBucketsBits
+   linear sub-buckets, giving a relative error below 1/2^s_subBucketsBits (about 6%)
+   over the whole range while using a fixed, small amount of memory.
+   Recording a value is lock-free and only touches one counter, so a histogram can be
+   updated concurrently by several threads and read at any time, for example to be
+   merged with other histograms into a HistogramSnapshot.
+   The counters are cumulative, as expected for a Prometheus histogram, but the
+   counters seen at the last two calls to rotate() are also kept so that percentiles
+   can be computed over a recent window instead of since the start of the process. */
+class LatencyHistogram
+{
+public:
+  static constexpr unsigned int s_subBucketsBits{4};
+  static constexpr uint64_t s_subBuckets{1U << s_subBucketsBits};
+  /* values larger than 2^s_maxExponent usec (a bit more than an hour) go to the last bucket */
+  static constexpr unsigned int s_maxExponent{32};
+  static constexpr size_t s_bucketsCount{s_subBuckets + (s_maxExponent - s_subBucketsBits) * s_subBuckets};
+  /* rotate() is called by the maintenance thread every s_rotationInterval seconds,
+     so the recent window covers between one and two of these intervals */
+  static constexpr unsigned int s_rotationInterval{60};
+
+  LatencyHistogram()
+  {
+    for (auto& bucket : d_buckets) {
+      bucket.store(0);
+    }
+    d_windowStart.fill(0);
+    d_nextWindowStart.fill(0);
+  }
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+
+  void record(uint64_t usec)
+  {
+    d_buckets[getBucketIndex(usec)].fetch_add(1, std::memory_order_relaxed);
+    d_sum.fetch_add(usec, std::memory_order_relaxed);
+  }
+
+  uint64_t getBucketCount(size_t idx) const
+  {
+    return d_buckets.at(idx).load(std::memory_order_relaxed);
+  }
+
+  /* sum of all the recorded values, in usec */
+  uint64_t getSum() const
+  {
+    return d_sum.load(std::memory_order_relaxed);
+  }
+
+  /* the current counters become the start of the next window */
+  void rotate()
+  {
+    std::lock_guard<std::mutex> lock(d_windowLock);
+    d_windowStart = d_nextWindowStart;
+    d_windowStartSum = d_nextWindowStartSum;
+    for (size_t idx = 0; idx < s_bucketsCount; idx++) {
+      d_nextWindowStart[idx] = getBucketCount(idx);
+    }
+    d_nextWindowStartSum = getSum();
+  }
+
+  /* counters as they were at the start of the recent window */
+  std::array<uint64_t, s_bucketsCount> getWindowStart(uint64_t& sum) const
+  {
+    std::lock_guard<std::mutex> lock(d_windowLock);
+    sum = d_windowStartSum;
+    return d_windowStart;
+  }
+
+  static size_t getBucketIndex(uint64_t usec)
+  {
+    if (usec < s_subBuckets) {
+      return usec;
+    }
+
+    unsigned int exponent = 63 - __builtin_clzll(usec);
+    if (exponent >= s_maxExponent) {
+      return s_bucketsCount - 1;
+    }
+
+    unsigned int shift = exponent - s_subBucketsBits;
+    uint64_t subBucket = (usec >> shift) - s_subBuckets;
+    return s_subBuckets + shift * s_subBuckets + subBucket;
+  }
+
+  /* highest value, in usec, counted in that bucket */
+  static uint64_t getBucketUpperBound(size_t idx)
+  {
+    if (idx < s_subBuckets) {
+      return idx;
+    }
+
+    uint64_t shift = (idx - s_subBuckets) / s_subBuckets;
+    uint64_t subBucket = (idx - s_subBuckets) % s_subBuckets;
+    return ((s_subBuckets + subBucket + 1) << shift) - 1;
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, s_bucketsCount> d_buckets;
+  std::atomic<uint64_t> d_sum{0};
+  mutable std::mutex d_windowLock;
+  std::array<uint64_t, s_bucketsCount> d_windowStart;
+  std::array<uint64_t, s_bucketsCount> d_nextWindowStart;
+  uint64_t d_windowStartSum{0};
+  uint64_t d_nextWindowStartSum{0};
+};
+
+/* a point-in-time copy of one or more merged histograms */
+class HistogramSnapshot
+{
+public:
+  HistogramSnapshot(): d_buckets(LatencyHistogram::s_bucketsCount, 0)
+  {
+  }
+
+  void add(const LatencyHistogram& histogram)
+  {
+    for (size_t idx = 0; idx < d_buckets.size(); idx++) {
+      auto value = histogram.getBucketCount(idx);
+      d_buckets[idx] += value;
+      d_count += value;
+    }
+    d_sum += histogram.getSum();
+  }
+
+  /* only the values recorded during the recent window of that histogram */
+  void addRecent(const LatencyHistogram& histogram)
+  {
+    uint64_t startSum = 0;
+    /* retrieved before the current counters, which only ever go up */
+    const auto start = histogram.getWindowStart(startSum);
+    for (size_t idx = 0; idx < d_buckets.size(); idx++) {
+      auto value = histogram.getBucketCount(idx) - start[idx];
+      d_buckets[idx] += value;
+      d_count += value;
+    }
+    d_sum += histogram.getSum() - startSum;
+  }
+
+  uint64_t getCount() const
+  {
+    return d_count;
+  }
+
+  /* in usec */
+  uint64_t getSum() const
+  {
+    return d_sum;
+  }
+
+  /* number of values lower than or equal to 'usec', which is only exact
+     when 'usec' is the upper bound of a bucket, as powers of two minus one are */
+  uint64_t getCountUpTo(uint64_t usec) const
+  {
+    uint64_t result = 0;
+    for (size_t idx = 0; idx < d_buckets.size() && LatencyHistogram::getBucketUpperBound(idx) <= usec; idx++) {
+      result += d_buckets[idx];
+    }
+    return result;
+  }
+
+  /* upper bound, in usec, of the bucket holding the requested percentile (0-100), 0 if empty */
+  uint64_t getPercentile(double percentile) const
+  {
+    if (d_count == 0) {
+      return 0;
+    }
+
+    uint64_t target = static_cast<uint64_t>(percentile / 100.0 * d_count);
+    if (target == 0) {
+      target = 1;
+    }
+    if (target > d_count) {
+      target = d_count;
+    }
+
+    uint64_t seen = 0;
+    for (size_t idx = 0; idx < d_buckets.size(); idx++) {
+      seen += d_buckets[idx];
+      if (seen >= target) {
+        return LatencyHistogram::getBucketUpperBound(idx);
+      }
+    }
+    return LatencyHistogram::getBucketUpperBound(d_buckets.size() - 1);
+  }
+
+private:
+  std::vector<uint64_t> d_buckets;
+  uint64_t d_count{0};
+  uint64_t d_sum{0};
+};
@@ -1429,13 +1429,8 @@ public:
 
   DNSAction::Action operator()(DNSQuestion* dq, std::string* ruleresult) const override
   {
-    std::vector<std::string> keys = d_key->getKeys(*dq);
     std::string result;
-    for (const auto& key : keys) {
-      if (d_kvs->getValue(key, result) == true) {
-        break;
-      }
-    }
+    d_key->lookup(*d_kvs, *dq, &result);
 
     if (!dq->qTag) {
       dq->qTag = std::make_shared<QTag>();
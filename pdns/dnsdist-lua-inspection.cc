@@ -235,9 +235,15 @@ void setupLuaInspection(LuaContext& luaCtx)
   luaCtx.writeFunction("topClients", [](boost::optional<unsigned int> top_) {
       setLuaNoSideEffect();
       auto top = top_.get_value_or(10);
-      map<ComboAddress, unsigned int,ComboAddress::addressOnlyLessThan > counts;
-      unsigned int total=0;
-      {
+      vector<pair<uint64_t, ComboAddress>> rcounts;
+      uint64_t total=0;
+      if (g_rings.hasSketches()) {
+        struct timespec now;
+        gettime(&now);
+        rcounts = g_rings.getTopClientsFromSketches(now, total);
+      }
+      else {
+        map<ComboAddress, unsigned int,ComboAddress::addressOnlyLessThan > counts;
         for (const auto& shard : g_rings.d_shards) {
           std::lock_guard<std::mutex> rl(shard->queryLock);
           for(const auto& c : shard->queryRing) {
@@ -245,32 +251,42 @@ void setupLuaInspection(LuaContext& luaCtx)
             total++;
           }
         }
-      }
-      vector<pair<unsigned int, ComboAddress>> rcounts;
-      rcounts.reserve(counts.size());
-      for(const auto& c : counts)
-	rcounts.push_back(make_pair(c.second, c.first));
 
-      sort(rcounts.begin(), rcounts.end(), [](const decltype(rcounts)::value_type& a,
-					      const decltype(rcounts)::value_type& b) {
-	     return b.first < a.first;
-	   });
-      unsigned int count=1, rest=0;
+        rcounts.reserve(counts.size());
+        for(const auto& c : counts)
+          rcounts.push_back(make_pair(c.second, c.first));
+
+        sort(rcounts.begin(), rcounts.end(), [](const decltype(rcounts)::value_type& a,
+                                                const decltype(rcounts)::value_type& b) {
+               return b.first < a.first;
+             });
+      }
+      unsigned int count=1;
+      uint64_t shown=0;
       boost::format fmt("%4d  %-40s %4d %4.1f%%\n");
       for(const auto& rc : rcounts) {
 	if(count==top+1)
-	  rest+=rc.first;
-	else
-	  g_outputBuffer += (fmt % (count++) % rc.second.toString() % rc.first % (100.0*rc.first/total)).str();
+	  break;
+	shown+=rc.first;
+	g_outputBuffer += (fmt % (count++) % rc.second.toString() % rc.first % (100.0*rc.first/total)).str();
       }
+      /* when using the sketches, not every client is tracked */
+      uint64_t rest = total > shown ? total - shown : 0;
       g_outputBuffer += (fmt % (count) % "Rest" % rest % (total > 0 ? 100.0*rest/total : 100.0)).str();
     });
 
   luaCtx.writeFunction("getTopQueries", [](unsigned int top, boost::optional<int> labels) {
       setLuaNoSideEffect();
       map<DNSName, unsigned int> counts;
-      unsigned int total=0;
-      if(!labels) {
+      uint64_t total=0;
+      if (!labels && g_rings.hasSketches()) {
+        struct timespec now;
+        gettime(&now);
+        for (const auto& entry : g_rings.getTopQueriesFromSketches(now, total)) {
+          counts[entry.second] = entry.first;
+        }
+      }
+      else if(!labels) {
         for (const auto& shard : g_rings.d_shards) {
           std::lock_guard<std::mutex> rl(shard->queryLock);
           for(const auto& a : shard->queryRing) {
@@ -302,14 +318,17 @@ void setupLuaInspection(LuaContext& luaCtx)
 	   });
 
       std::unordered_map<unsigned int, vector<boost::variant<string,double>>> ret;
-      unsigned int count=1, rest=0;
+      unsigned int count=1;
+      uint64_t shown=0;
       for(const auto& rc : rcounts) {
 	if(count==top+1)
-	  rest+=rc.first;
-	else
-	  ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
+	  break;
+	shown+=rc.first;
+	ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
       }
 
+      /* when using the sketches, not every name is tracked */
+      uint64_t rest = total > shown ? total - shown : 0;
       if (total > 0) {
         ret.insert({count, {"Rest", rest, 100.0*rest/total}});
       }
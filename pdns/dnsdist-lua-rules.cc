@@ -20,6 +20,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include "dnsdist.hh"
+#include "dnsdist-benchmark.hh"
 #include "dnsdist-lua.hh"
 #include "dnsdist-rules.hh"
 
@@ -454,6 +455,34 @@ void setupLuaRules(LuaContext& luaCtx)
 
     });
 
+  luaCtx.writeFunction("benchPcap", [](const std::string& fname, boost::optional<unsigned int> times_) {
+      unsigned int times = times_.get_value_or(1);
+      PcapBenchmarkResults results;
+      try {
+        results = benchmarkPcap(fname, times);
+      }
+      catch (const std::exception& e) {
+        g_outputBuffer = "Error while replaying '" + fname + "': " + e.what() + "\n";
+        errlog("Error while replaying '%s': %s", fname, e.what());
+        return;
+      }
+
+      const auto count = results.count;
+      if (count == 0) {
+        g_outputBuffer = (boost::format("No valid query found in '%s' (%d packets skipped)\n") % fname % results.skipped).str();
+        return;
+      }
+
+      /* the latencies are recorded in nanoseconds */
+      const auto& latencies = results.latencies;
+      ostringstream ret;
+      ret << (boost::format("Replayed %d queries (%d skipped) in %.1f usec, %.1f qps\n") % count % results.skipped % results.elapsedUSec % (1000000 * (1.0 * count / results.elapsedUSec)));
+      ret << (boost::format("Latency: p50 %.2f usec, p99 %.2f usec, max %.2f usec\n") % (latencies.getPercentile(50) / 1000.0) % (latencies.getPercentile(99) / 1000.0) % (latencies.getPercentile(100) / 1000.0));
+      ret << (boost::format("Allocations: %.2f per query\n") % (1.0 * results.allocations / count));
+      ret << (boost::format("Dropped %d, answered %d (%d from the cache), forwarded %d\n") % results.dropped % results.selfAnswered % results.cacheHits % results.forwarded);
+      g_outputBuffer = ret.str();
+    });
+
   luaCtx.writeFunction("AllRule", []() {
       return std::shared_ptr<DNSRule>(new AllRule());
     });
@@ -125,6 +125,15 @@ static void parseLocalBindVars(boost::optional<localbind_t> vars, bool& reusePor
   }
 }
 
+/* only for plain UDP frontends, see processUDPQuery() */
+static boost::optional<std::string> parseCacheFirstPool(boost::optional<localbind_t>& vars)
+{
+  if (vars && vars->count("cacheFirstPool")) {
+    return boost::get<std::string>((*vars)["cacheFirstPool"]);
+  }
+  return boost::none;
+}
+
 #if defined(HAVE_DNS_OVER_TLS) || defined(HAVE_DNS_OVER_HTTPS)
 static bool loadTLSCertificateAndKeys(const std::string& context, std::vector<std::pair<std::string, std::string>>& pairs, boost::variant<std::string, std::vector<std::pair<int,std::string>>> certFiles, boost::variant<std::string, std::vector<std::pair<int,std::string>>> keyFiles)
 {
@@ -477,6 +486,47 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
         ret->reconnectOnUp=boost::get<bool>(vars["reconnectOnUp"]);
       }
 
+      if(vars.count("healthCheckMode")) {
+        const auto& mode = boost::get<string>(vars["healthCheckMode"]);
+        if (pdns_iequals(mode, "active")) {
+          ret->healthCheckMode = DownstreamState::HealthCheckMode::Active;
+        }
+        else if (pdns_iequals(mode, "passive")) {
+          ret->healthCheckMode = DownstreamState::HealthCheckMode::Passive;
+        }
+        else if (pdns_iequals(mode, "both")) {
+          ret->healthCheckMode = DownstreamState::HealthCheckMode::Both;
+        }
+        else {
+          warnlog("Ignoring unknown value '%s' for 'healthCheckMode' on 'newServer'", mode);
+        }
+      }
+
+      if(vars.count("passiveHealthCheckMaxLatency")) {
+        ret->passiveHealthCheckMaxLatency = std::stoi(boost::get<string>(vars["passiveHealthCheckMaxLatency"]));
+      }
+
+      if(vars.count("passiveHealthCheckMinSamples")) {
+        ret->passiveHealthCheckMinSamples = std::stoi(boost::get<string>(vars["passiveHealthCheckMinSamples"]));
+      }
+
+      if(vars.count("passiveHealthCheckFailureRatio")) {
+        ret->passiveHealthCheckFailureRatio = std::stod(boost::get<string>(vars["passiveHealthCheckFailureRatio"]));
+      }
+
+      if (ret->healthCheckMode != DownstreamState::HealthCheckMode::Active) {
+        size_t windowSize = 100;
+        if(vars.count("passiveHealthCheckWindow")) {
+          windowSize = std::stoi(boost::get<string>(vars["passiveHealthCheckWindow"]));
+        }
+        if (windowSize == 0) {
+          warnlog("A 'passiveHealthCheckWindow' of 0 disables passive health checks on 'newServer'");
+        }
+        else {
+          ret->passiveHealthCheckWindow.setSize(windowSize);
+        }
+      }
+
       if(vars.count("cpus")) {
         for (const auto& cpu : boost::get<vector<pair<int,string>>>(vars["cpus"])) {
           cpus.insert(std::stoi(cpu.second));
@@ -598,6 +648,7 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
       std::set<int> cpus;
 
       parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize, maxInFlightQueriesPerConn);
+      auto cacheFirstPool = parseCacheFirstPool(vars);
 
       try {
 	ComboAddress loc(addr, 53);
@@ -612,7 +663,9 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
         }
 
         // only works pre-startup, so no sync necessary
-        g_frontends.push_back(std::unique_ptr<ClientState>(new ClientState(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus)));
+        auto udpCS = std::unique_ptr<ClientState>(new ClientState(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus));
+        udpCS->cacheFirstPool = cacheFirstPool;
+        g_frontends.push_back(std::move(udpCS));
         auto tcpCS = std::unique_ptr<ClientState>(new ClientState(loc, true, reusePort, tcpFastOpenQueueSize, interface, cpus));
         if (tcpListenQueueSize > 0) {
           tcpCS->tcpListenQueueSize = tcpListenQueueSize;
@@ -643,11 +696,14 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
       std::set<int> cpus;
 
       parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize, maxInFlightQueriesPerConn);
+      auto cacheFirstPool = parseCacheFirstPool(vars);
 
       try {
 	ComboAddress loc(addr, 53);
         // only works pre-startup, so no sync necessary
-        g_frontends.push_back(std::unique_ptr<ClientState>(new ClientState(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus)));
+        auto udpCS = std::unique_ptr<ClientState>(new ClientState(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus));
+        udpCS->cacheFirstPool = cacheFirstPool;
+        g_frontends.push_back(std::move(udpCS));
         auto tcpCS = std::unique_ptr<ClientState>(new ClientState(loc, true, reusePort, tcpFastOpenQueueSize, interface, cpus));
         if (tcpListenQueueSize > 0) {
           tcpCS->tcpListenQueueSize = tcpListenQueueSize;
@@ -728,6 +784,47 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
 
   typedef std::unordered_map<std::string, boost::variant<bool, std::string> > showserversopts_t;
 
+  luaCtx.writeFunction("showLatencyPercentiles", []() {
+      setLuaNoSideEffect();
+      try {
+        ostringstream ret;
+        boost::format fmt("%-40.40s %10d %10d %10d %10d %10d");
+        ret << (fmt % "Name" % "Responses" % "p50 (us)" % "p90 (us)" % "p99 (us)" % "p99.9 (us)") << endl;
+
+        auto addLine = [&ret, &fmt](const std::string& name, const HistogramSnapshot& snapshot) {
+          ret << (fmt % name % snapshot.getCount() % snapshot.getPercentile(50) % snapshot.getPercentile(90) % snapshot.getPercentile(99) % snapshot.getPercentile(99.9)) << endl;
+        };
+
+        auto states = g_dstates.getLocal();
+        for (const auto& state : *states) {
+          HistogramSnapshot snapshot;
+          snapshot.addRecent(state->latencyHistogram);
+          addLine("server " + state->getNameWithAddr(), snapshot);
+        }
+
+        for (const auto& front : g_frontends) {
+          HistogramSnapshot snapshot;
+          snapshot.addRecent(front->latencyHistogram);
+          addLine("frontend " + front->local.toStringWithPort() + " (" + front->getType() + ")", snapshot);
+        }
+
+        auto localPools = g_pools.getLocal();
+        for (const auto& entry : *localPools) {
+          HistogramSnapshot snapshot;
+          for (const auto& server : *entry.second->getServers()) {
+            snapshot.addRecent(server.second->latencyHistogram);
+          }
+          addLine("pool " + (entry.first.empty() ? std::string("_default_") : entry.first), snapshot);
+        }
+
+        g_outputBuffer = ret.str();
+      }
+      catch (const std::exception& e) {
+        g_outputBuffer = e.what();
+        throw;
+      }
+    });
+
   luaCtx.writeFunction("showServers", [](boost::optional<showserversopts_t> vars) {
       setLuaNoSideEffect();
       bool showUUIDs = false;
@@ -1421,6 +1518,20 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
 #endif
     });
 
+  luaCtx.writeFunction("setDNSCryptSharedKeyCacheSize", [](size_t size) {
+      if (g_configurationDone) {
+        errlog("setDNSCryptSharedKeyCacheSize() cannot be used at runtime!");
+        g_outputBuffer="setDNSCryptSharedKeyCacheSize() cannot be used at runtime!\n";
+        return;
+      }
+#if defined(HAVE_DNSCRYPT) && defined(HAVE_CRYPTO_BOX_EASY_AFTERNM)
+      setLuaSideEffect();
+      DNSCryptSharedKeyCache::setSize(size);
+#else
+      g_outputBuffer="Error: DNSCrypt shared key caching is not available.\n";
+#endif
+    });
+
   luaCtx.writeFunction("getDNSCryptBindCount", []() {
       setLuaNoSideEffect();
       return g_dnsCryptLocals.size();
@@ -1798,6 +1909,16 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
       g_rings.setCapacity(capacity, numberOfShards ? *numberOfShards : 1);
     });
 
+  luaCtx.writeFunction("setRingBuffersSketches", [](size_t capacity, boost::optional<size_t> seconds) {
+      setLuaSideEffect();
+      if (g_configurationDone) {
+        errlog("setRingBuffersSketches() cannot be used at runtime!");
+        g_outputBuffer="setRingBuffersSketches() cannot be used at runtime!\n";
+        return;
+      }
+      g_rings.setSketches(capacity, seconds ? *seconds : 10);
+    });
+
   luaCtx.writeFunction("setRingBuffersLockRetries", [](size_t retries) {
       setLuaSideEffect();
       g_rings.setNumberOfLockRetries(retries);
@@ -2162,6 +2283,17 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
         frontend->d_exactPathMatching = boost::get<bool>((*vars)["exactPathMatching"]);
       }
 
+      if (vars->count("getResponsesCacheSize")) {
+        auto value = boost::get<int>((*vars)["getResponsesCacheSize"]);
+        if (value < 0) {
+          errlog("Invalid value '%d' for addDOHLocal() parameter 'getResponsesCacheSize', should be >= 0, dismissing", value);
+          g_outputBuffer = "Invalid value '" + std::to_string(value) + "' for addDOHLocal() parameter 'getResponsesCacheSize', should be >= 0, dismissing";
+        }
+        else {
+          frontend->d_getResponsesCacheSize = value;
+        }
+      }
+
       parseTLSConfig(frontend->d_tlsConfig, "addDOHLocal", vars);
     }
     g_dohlocals.push_back(frontend);
@@ -2328,6 +2460,10 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
           }
 
           parseTLSConfig(frontend->d_tlsConfig, "addTLSLocal", vars);
+
+          if (vars->count("ktls")) {
+            frontend->d_tlsConfig.d_enableKTLS = boost::get<bool>((*vars)["ktls"]);
+          }
         }
 
         try {
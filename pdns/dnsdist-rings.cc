@@ -22,7 +22,9 @@
 
 #include <fstream>
 
+#include "dns.hh"
 #include "dnsdist-rings.hh"
+#include "gettime.hh"
 
 size_t Rings::numDistinctRequestors()
 {
@@ -40,19 +42,28 @@ std::unordered_map<int, vector<boost::variant<string,double>>> Rings::getTopBand
 {
   map<ComboAddress, unsigned int, ComboAddress::addressOnlyLessThan> counts;
   uint64_t total=0;
-  for (const auto& shard : d_shards) {
-    {
-      std::lock_guard<std::mutex> rl(shard->queryLock);
-      for(const auto& q : shard->queryRing) {
-        counts[q.requestor]+=q.size;
-        total+=q.size;
-      }
+  if (hasSketches()) {
+    struct timespec now;
+    gettime(&now);
+    for (const auto& entry : getTopBandwidthFromSketches(now, total)) {
+      counts[entry.second] = entry.first;
     }
-    {
-      std::lock_guard<std::mutex> rl(shard->respLock);
-      for(const auto& r : shard->respRing) {
-        counts[r.requestor]+=r.size;
-        total+=r.size;
+  }
+  else {
+    for (const auto& shard : d_shards) {
+      {
+        std::lock_guard<std::mutex> rl(shard->queryLock);
+        for(const auto& q : shard->queryRing) {
+          counts[q.requestor]+=q.size;
+          total+=q.size;
+        }
+      }
+      {
+        std::lock_guard<std::mutex> rl(shard->respLock);
+        for(const auto& r : shard->respRing) {
+          counts[r.requestor]+=r.size;
+          total+=r.size;
+        }
       }
     }
   }
@@ -70,15 +81,22 @@ std::unordered_map<int, vector<boost::variant<string,double>>> Rings::getTopBand
   std::unordered_map<int, vector<boost::variant<string,double>>> ret;
   uint64_t rest = 0;
   unsigned int count = 1;
+  uint64_t shown = 0;
   for(const auto& rc : rcounts) {
     if(count==numentries+1) {
       rest+=rc.first;
     }
     else {
+      shown+=rc.first;
       ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
     }
   }
 
+  if (hasSketches()) {
+    /* the sketches do not track every requestor */
+    rest = total > shown ? total - shown : 0;
+  }
+
   if (total > 0) {
     ret.insert({count, {"Rest", rest, 100.0*rest/total}});
   }
@@ -89,6 +107,253 @@ std::unordered_map<int, vector<boost::variant<string,double>>> Rings::getTopBand
   return ret;
 }
 
+static bool isSketchInWindow(time_t second, const struct timespec& now, unsigned int seconds)
+{
+  return second > (now.tv_sec - seconds) && second <= now.tv_sec;
+}
+
+template <typename Sketch, typename Map>
+static void mergeSketch(const Sketch& sketch, Map& counts, uint64_t& total)
+{
+  total += sketch.getTotal();
+  sketch.visit([&counts](const typename Sketch::Entry& entry) {
+    counts[entry.key] += entry.count;
+  });
+}
+
+template <typename K, typename Map>
+static std::vector<std::pair<uint64_t, K>> sortMergedCounts(const Map& counts)
+{
+  std::vector<std::pair<uint64_t, K>> ret;
+  ret.reserve(counts.size());
+  for (const auto& entry : counts) {
+    ret.push_back({entry.second, entry.first});
+  }
+
+  std::sort(ret.begin(), ret.end(), [](const std::pair<uint64_t, K>& a, const std::pair<uint64_t, K>& b) {
+    return b.first < a.first;
+  });
+
+  return ret;
+}
+
+unsigned int Rings::getSketchesWindow(unsigned int seconds) const
+{
+  if (seconds == 0 || seconds > d_sketchesSeconds) {
+    return d_sketchesSeconds;
+  }
+  return seconds;
+}
+
+std::vector<std::pair<uint64_t, ComboAddress>> Rings::getTopClientsFromSketches(const struct timespec& now, uint64_t& total, unsigned int seconds)
+{
+  std::unordered_map<ComboAddress, uint64_t, ComboAddress::addressOnlyHash, ComboAddress::addressOnlyEqual> counts;
+  total = 0;
+  seconds = getSketchesWindow(seconds);
+
+  for (const auto& shard : d_shards) {
+    std::lock_guard<std::mutex> rl(shard->queryLock);
+    for (const auto& sketches : shard->querySketches) {
+      if (isSketchInWindow(sketches.second, now, seconds)) {
+        mergeSketch(sketches.clients, counts, total);
+      }
+    }
+  }
+
+  return sortMergedCounts<ComboAddress>(counts);
+}
+
+std::vector<std::pair<uint64_t, DNSName>> Rings::getTopQueriesFromSketches(const struct timespec& now, uint64_t& total, unsigned int seconds)
+{
+  std::unordered_map<DNSName, uint64_t> counts;
+  total = 0;
+  seconds = getSketchesWindow(seconds);
+
+  for (const auto& shard : d_shards) {
+    std::lock_guard<std::mutex> rl(shard->queryLock);
+    for (const auto& sketches : shard->querySketches) {
+      if (isSketchInWindow(sketches.second, now, seconds)) {
+        mergeSketch(sketches.names, counts, total);
+      }
+    }
+  }
+
+  return sortMergedCounts<DNSName>(counts);
+}
+
+std::vector<std::pair<uint64_t, ComboAddress>> Rings::getTopBandwidthFromSketches(const struct timespec& now, uint64_t& total, unsigned int seconds)
+{
+  std::unordered_map<ComboAddress, uint64_t, ComboAddress::addressOnlyHash, ComboAddress::addressOnlyEqual> counts;
+  total = 0;
+  seconds = getSketchesWindow(seconds);
+
+  for (const auto& shard : d_shards) {
+    {
+      std::lock_guard<std::mutex> rl(shard->queryLock);
+      for (const auto& sketches : shard->querySketches) {
+        if (isSketchInWindow(sketches.second, now, seconds)) {
+          mergeSketch(sketches.bandwidth, counts, total);
+        }
+      }
+    }
+    {
+      std::lock_guard<std::mutex> rl(shard->respLock);
+      for (const auto& sketches : shard->respSketches) {
+        if (isSketchInWindow(sketches.second, now, seconds)) {
+          mergeSketch(sketches.bandwidth, counts, total);
+        }
+      }
+    }
+  }
+
+  return sortMergedCounts<ComboAddress>(counts);
+}
+
+time_t Rings::getSuffixesFromSketches(const struct timespec& now, StatNode& root, unsigned int seconds)
+{
+  std::unordered_map<DNSName, StatNode::Stat> suffixes;
+  seconds = getSketchesWindow(seconds);
+  time_t oldest = now.tv_sec;
+
+  for (const auto& shard : d_shards) {
+    std::lock_guard<std::mutex> rl(shard->respLock);
+    for (const auto& sketches : shard->respSketches) {
+      if (!isSketchInWindow(sketches.second, now, seconds)) {
+        continue;
+      }
+      if (sketches.suffixes.size() > 0 && sketches.second < oldest) {
+        oldest = sketches.second;
+      }
+      sketches.suffixes.visit([&suffixes](const SuffixesSketch::Entry& entry) {
+        suffixes[entry.key] += entry.payload;
+      });
+    }
+  }
+
+  /* the stats we have for a given name include the ones of its descendants, while
+     StatNode expects to be fed each name's own stats. Starting from the longest names,
+     subtract what has been accounted to the closest tracked ancestor. */
+  std::vector<std::pair<unsigned int, const DNSName*>> names;
+  names.reserve(suffixes.size());
+  for (const auto& entry : suffixes) {
+    names.push_back({entry.first.countLabels(), &entry.first});
+  }
+  std::sort(names.begin(), names.end(), [](const std::pair<unsigned int, const DNSName*>& a, const std::pair<unsigned int, const DNSName*>& b) {
+    return b.first < a.first;
+  });
+
+  std::unordered_map<DNSName, StatNode::Stat> descendants;
+  for (const auto& name : names) {
+    const auto& aggregated = suffixes.at(*name.second);
+    StatNode::Stat self(aggregated);
+    const auto& childrenIt = descendants.find(*name.second);
+    if (childrenIt != descendants.end()) {
+      const auto& children = childrenIt->second;
+      self.queries -= std::min(self.queries, children.queries);
+      self.noerrors -= std::min(self.noerrors, children.noerrors);
+      self.nxdomains -= std::min(self.nxdomains, children.nxdomains);
+      self.servfails -= std::min(self.servfails, children.servfails);
+      self.drops -= std::min(self.drops, children.drops);
+      self.bytes -= std::min(self.bytes, children.bytes);
+    }
+
+    DNSName parent(*name.second);
+    while (parent.chopOff()) {
+      if (suffixes.count(parent) > 0) {
+        descendants[parent] += aggregated;
+        break;
+      }
+    }
+
+    root.submit(*name.second, self);
+  }
+
+  return oldest;
+}
+
+void Rings::getNameSuffixes(const DNSName& name, NameSuffixes& suffixes)
+{
+  const auto& storage = name.getStorage();
+  size_t pos = 0;
+  suffixes.count = 0;
+  while (pos < storage.size() && storage[pos] != 0 && suffixes.count < suffixes.offsets.size()) {
+    suffixes.offsets[suffixes.count++] = pos;
+    pos += static_cast<uint8_t>(storage[pos]) + 1;
+  }
+}
+
+namespace {
+/* the wire representation of a suffix of a name, looked up in the sketch without building a DNSName */
+struct WireSuffix
+{
+  const char* data;
+  size_t size;
+};
+
+struct WireSuffixHash
+{
+  size_t operator()(const WireSuffix& suffix) const
+  {
+    /* has to be the same as DNSName::hash() */
+    return burtleCI(reinterpret_cast<const unsigned char*>(suffix.data), suffix.size, 0);
+  }
+};
+
+struct WireSuffixEqual
+{
+  bool operator()(const WireSuffix& suffix, const DNSName& name) const
+  {
+    const auto& storage = name.getStorage();
+    if (storage.size() != suffix.size) {
+      return false;
+    }
+    for (size_t idx = 0; idx < suffix.size; idx++) {
+      if (dns_tolower(suffix.data[idx]) != dns_tolower(storage[idx])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool operator()(const DNSName& name, const WireSuffix& suffix) const
+  {
+    return (*this)(suffix, name);
+  }
+};
+}
+
+void Rings::insertSuffixes(SuffixesSketch& sketch, const DNSName& name, const NameSuffixes& suffixes, int rcode, unsigned int size)
+{
+  const auto& storage = name.getStorage();
+
+  for (size_t idx = 0; idx < suffixes.count; idx++) {
+    const size_t offset = suffixes.offsets[idx];
+    if (offset >= storage.size()) {
+      break;
+    }
+    const WireSuffix suffix{storage.data() + offset, storage.size() - offset};
+
+    /* a DNSName is only built when that suffix is not tracked yet */
+    auto& stat = sketch.add(suffix, WireSuffixHash(), WireSuffixEqual(), [&storage, offset]() {
+      return DNSName(storage.data(), storage.size(), offset, false);
+    });
+    stat.queries++;
+    stat.bytes += size;
+    if (rcode < 0) {
+      stat.drops++;
+    }
+    else if (rcode == RCode::NoError) {
+      stat.noerrors++;
+    }
+    else if (rcode == RCode::ServFail) {
+      stat.servfails++;
+    }
+    else if (rcode == RCode::NXDomain) {
+      stat.nxdomains++;
+    }
+  }
+}
+
 size_t Rings::loadFromFile(const std::string& filepath, const struct timespec& now)
 {
   ifstream ifs(filepath);
@@ -21,6 +21,8 @@
  */
 #pragma once
 
+#include <array>
+#include <limits>
 #include <mutex>
 #include <time.h>
 #include <unordered_map>
@@ -28,9 +30,11 @@
 #include <boost/variant.hpp>
 
 #include "circular_buffer.hh"
+#include "dnsdist-sketches.hh"
 #include "dnsname.hh"
 #include "iputils.hh"
 #include "stat_t.hh"
+#include "statnode.hh"
 
 
 struct Rings {
@@ -55,10 +59,57 @@ struct Rings {
     ComboAddress ds; // who handled it
   };
 
+  typedef SpaceSavingSketch<ComboAddress, SpaceSavingNoPayload, ComboAddress::addressOnlyHash, ComboAddress::addressOnlyEqual> ClientsSketch;
+  typedef SpaceSavingSketch<DNSName> NamesSketch;
+  typedef SpaceSavingSketch<DNSName, StatNode::Stat> SuffixesSketch;
+
+  /* heavy hitters seen during a given second, updated on insertion so that
+     top-N and suffix-rate computations do not have to walk the whole rings */
+  struct QuerySketches
+  {
+    QuerySketches(size_t capacity): clients(capacity), names(capacity), bandwidth(capacity)
+    {
+    }
+
+    void clear()
+    {
+      clients.clear();
+      names.clear();
+      bandwidth.clear();
+    }
+
+    ClientsSketch clients;
+    NamesSketch names;
+    ClientsSketch bandwidth;
+    time_t second{0};
+  };
+
+  struct ResponseSketches
+  {
+    ResponseSketches(size_t capacity): bandwidth(capacity), suffixes(capacity)
+    {
+    }
+
+    void clear()
+    {
+      bandwidth.clear();
+      suffixes.clear();
+    }
+
+    ClientsSketch bandwidth;
+    /* every response is accounted to its name and to all the ancestors of that name */
+    SuffixesSketch suffixes;
+    time_t second{0};
+  };
+
   struct Shard
   {
     boost::circular_buffer<Query> queryRing;
     boost::circular_buffer<Response> respRing;
+    /* one entry per second of the sketches window, protected by queryLock */
+    std::vector<QuerySketches> querySketches;
+    /* protected by respLock */
+    std::vector<ResponseSketches> respSketches;
     std::mutex queryLock;
     std::mutex respLock;
   };
@@ -72,6 +123,43 @@ struct Rings {
   }
   std::unordered_map<int, vector<boost::variant<string,double> > > getTopBandwidth(unsigned int numentries);
   size_t numDistinctRequestors();
+
+  /* merge the sketches of all shards over the last 'seconds' seconds (the whole window if 0),
+     returning the tracked entries sorted by decreasing count and setting 'total'
+     to the number of queries (or bytes, for bandwidth) seen during that period */
+  std::vector<std::pair<uint64_t, ComboAddress>> getTopClientsFromSketches(const struct timespec& now, uint64_t& total, unsigned int seconds=0);
+  std::vector<std::pair<uint64_t, DNSName>> getTopQueriesFromSketches(const struct timespec& now, uint64_t& total, unsigned int seconds=0);
+  std::vector<std::pair<uint64_t, ComboAddress>> getTopBandwidthFromSketches(const struct timespec& now, uint64_t& total, unsigned int seconds=0);
+  /* fill 'root' with the suffixes tracked over the last 'seconds' seconds so that
+     visiting it yields, for every tracked name, the aggregated stats of that name
+     and its descendants */
+  /* returns the oldest second for which data has been merged, now if there was none */
+  time_t getSuffixesFromSketches(const struct timespec& now, StatNode& root, unsigned int seconds=0);
+
+  /* This function should only be called at configuration time before any query or response has been inserted.
+     'capacity' is the number of entries tracked by each sketch, 'seconds' the window covered by the sketches. */
+  void setSketches(size_t capacity, size_t seconds)
+  {
+    d_sketchesCapacity = capacity;
+    d_sketchesSeconds = capacity > 0 ? seconds : 0;
+
+    for (auto& shard : d_shards) {
+      allocateSketches(*shard);
+    }
+  }
+
+  bool hasSketches() const
+  {
+    return d_sketchesCapacity > 0 && d_sketchesSeconds > 0;
+  }
+
+  size_t getSketchesSeconds() const
+  {
+    return d_sketchesSeconds;
+  }
+
+  /* return the number of seconds to look at for a requested window, 0 meaning the whole window */
+  unsigned int getSketchesWindow(unsigned int seconds) const;
   /* This function should only be called at configuration time before any query or response has been inserted */
   void setCapacity(size_t newCapacity, size_t numberOfShards)
   {
@@ -93,6 +181,7 @@ struct Rings {
         std::lock_guard<std::mutex> wl(shard->respLock);
         shard->respRing.set_capacity(newCapacity / numberOfShards);
       }
+      allocateSketches(*shard);
     }
 
     /* we just recreated the shards so they are now empty */
@@ -124,13 +213,15 @@ struct Rings {
     return d_nbResponseEntries;
   }
 
-  void insertQuery(const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
+  /* the name is moved into the ring when passed as an rvalue, copied otherwise */
+  template <typename N>
+  void insertQuery(const struct timespec& when, const ComboAddress& requestor, N&& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
   {
     for (size_t idx = 0; idx < d_nbLockTries; idx++) {
       auto& shard = getOneShard();
       std::unique_lock<std::mutex> wl(shard->queryLock, std::try_to_lock);
       if (wl.owns_lock()) {
-        insertQueryLocked(shard, when, requestor, name, qtype, size, dh);
+        insertQueryLocked(shard, when, requestor, std::forward<N>(name), qtype, size, dh);
         return;
       }
       if (d_keepLockingStats) {
@@ -144,16 +235,22 @@ struct Rings {
     }
     auto& shard = getOneShard();
     std::lock_guard<std::mutex> wl(shard->queryLock);
-    insertQueryLocked(shard, when, requestor, name, qtype, size, dh);
+    insertQueryLocked(shard, when, requestor, std::forward<N>(name), qtype, size, dh);
   }
 
   void insertResponse(const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, unsigned int usec, unsigned int size, const struct dnsheader& dh, const ComboAddress& backend)
   {
+    /* computed before taking the lock */
+    NameSuffixes suffixes;
+    if (hasSketches()) {
+      getNameSuffixes(name, suffixes);
+    }
+
     for (size_t idx = 0; idx < d_nbLockTries; idx++) {
       auto& shard = getOneShard();
       std::unique_lock<std::mutex> wl(shard->respLock, std::try_to_lock);
       if (wl.owns_lock()) {
-        insertResponseLocked(shard, when, requestor, name, qtype, usec, size, dh, backend);
+        insertResponseLocked(shard, when, requestor, name, suffixes, qtype, usec, size, dh, backend);
         return;
       }
       if (d_keepLockingStats) {
@@ -167,7 +264,7 @@ struct Rings {
     }
     auto& shard = getOneShard();
     std::lock_guard<std::mutex> wl(shard->respLock);
-    insertResponseLocked(shard, when, requestor, name, qtype, usec, size, dh, backend);
+    insertResponseLocked(shard, when, requestor, name, suffixes, qtype, usec, size, dh, backend);
   }
 
   void clear()
@@ -176,10 +273,18 @@ struct Rings {
       {
         std::lock_guard<std::mutex> wl(shard->queryLock);
         shard->queryRing.clear();
+        for (auto& sketches : shard->querySketches) {
+          sketches.clear();
+          sketches.second = 0;
+        }
       }
       {
         std::lock_guard<std::mutex> wl(shard->respLock);
         shard->respRing.clear();
+        for (auto& sketches : shard->respSketches) {
+          sketches.clear();
+          sketches.second = 0;
+        }
       }
     }
 
@@ -203,6 +308,13 @@ struct Rings {
   pdns::stat_t d_deferredResponseInserts;
 
 private:
+  /* where each non-root suffix of a name starts in its wire representation */
+  struct NameSuffixes
+  {
+    std::array<uint8_t, 128> offsets;
+    size_t count{0};
+  };
+
   size_t getShardId()
   {
     return (d_currentShardId++ % d_numberOfShards);
@@ -213,28 +325,80 @@ private:
     return d_shards[getShardId()];
   }
 
-  void insertQueryLocked(std::unique_ptr<Shard>& shard, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
+  template <typename N>
+  void insertQueryLocked(std::unique_ptr<Shard>& shard, const struct timespec& when, const ComboAddress& requestor, N&& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
   {
+    /* before the name is moved into the ring */
+    if (!shard->querySketches.empty()) {
+      auto& sketches = getSketchesForSecond(shard->querySketches, when.tv_sec);
+      sketches.clients.add(requestor);
+      sketches.names.add(name);
+      sketches.bandwidth.add(requestor, size);
+    }
+
     if (!shard->queryRing.full()) {
       d_nbQueryEntries++;
     }
-    shard->queryRing.push_back({when, requestor, name, size, qtype, dh});
+    shard->queryRing.push_back({when, requestor, std::forward<N>(name), size, qtype, dh});
   }
 
-  void insertResponseLocked(std::unique_ptr<Shard>& shard, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, unsigned int usec, unsigned int size, const struct dnsheader& dh, const ComboAddress& backend)
+  void insertResponseLocked(std::unique_ptr<Shard>& shard, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, const NameSuffixes& suffixes, uint16_t qtype, unsigned int usec, unsigned int size, const struct dnsheader& dh, const ComboAddress& backend)
   {
     if (!shard->respRing.full()) {
       d_nbResponseEntries++;
     }
     shard->respRing.push_back({when, requestor, name, qtype, usec, size, dh, backend});
+
+    if (!shard->respSketches.empty()) {
+      auto& sketches = getSketchesForSecond(shard->respSketches, when.tv_sec);
+      sketches.bandwidth.add(requestor, size);
+      insertSuffixes(sketches.suffixes, name, suffixes, (dh.rcode == 0 && usec == std::numeric_limits<unsigned int>::max()) ? -1 : dh.rcode, size);
+    }
   }
 
+  void allocateSketches(Shard& shard)
+  {
+    {
+      std::lock_guard<std::mutex> wl(shard.queryLock);
+      shard.querySketches.clear();
+      shard.querySketches.reserve(d_sketchesSeconds);
+      for (size_t idx = 0; idx < d_sketchesSeconds; idx++) {
+        shard.querySketches.emplace_back(d_sketchesCapacity);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> wl(shard.respLock);
+      shard.respSketches.clear();
+      shard.respSketches.reserve(d_sketchesSeconds);
+      for (size_t idx = 0; idx < d_sketchesSeconds; idx++) {
+        shard.respSketches.emplace_back(d_sketchesCapacity);
+      }
+    }
+  }
+
+  template <typename T>
+  static T& getSketchesForSecond(std::vector<T>& sketches, time_t second)
+  {
+    auto& entry = sketches.at(second % sketches.size());
+    if (entry.second < second) {
+      /* this slot holds data from a previous window, recycle it */
+      entry.clear();
+      entry.second = second;
+    }
+    return entry;
+  }
+
+  static void getNameSuffixes(const DNSName& name, NameSuffixes& suffixes);
+  static void insertSuffixes(SuffixesSketch& sketch, const DNSName& name, const NameSuffixes& suffixes, int rcode, unsigned int size);
+
   std::atomic<size_t> d_nbQueryEntries;
   std::atomic<size_t> d_nbResponseEntries;
   std::atomic<size_t> d_currentShardId;
 
   size_t d_numberOfShards;
   size_t d_nbLockTries = 5;
+  size_t d_sketchesCapacity{0};
+  size_t d_sketchesSeconds{0};
   bool d_keepLockingStats{false};
 };
 
@@ -0,0 +1,148 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <functional>
+#include <stdexcept>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+struct SpaceSavingNoPayload
+{
+};
+
+/* Space-Saving top-k sketch (Metwally, Agrawal and El Abbadi): at most 'capacity'
+   counters are kept, and a key that is not tracked yet while the sketch is full takes
+   over the counter with the lowest count, inheriting that count as its error.
+   Counts are therefore over-estimated by at most 'error', and any key whose real
+   count exceeds total / capacity is guaranteed to be tracked.
+   Updates are O(log capacity), memory is O(capacity) regardless of the stream size.
+   This class is not thread-safe, callers are expected to provide locking. */
+template <typename K, typename Payload = SpaceSavingNoPayload, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class SpaceSavingSketch
+{
+public:
+  struct Entry
+  {
+    K key;
+    uint64_t count;
+    uint64_t error;
+    /* not part of any index, so it can be updated in place */
+    mutable Payload payload;
+  };
+
+  SpaceSavingSketch(size_t capacity): d_capacity(capacity)
+  {
+    if (d_capacity == 0) {
+      throw std::runtime_error("The capacity of a Space-Saving sketch should be greater than 0");
+    }
+  }
+
+  /* returns the payload associated to that key, which has been reset if the key
+     just took over the counter of an evicted one */
+  Payload& add(const K& key, uint64_t weight = 1)
+  {
+    return add(key, Hash(), KeyEqual(), [&key]() { return key; }, weight);
+  }
+
+  /* same, but the key is looked up via a compatible key, with the corresponding hash and
+     equality functors, so that the actual key only needs to be built, by calling makeKey(),
+     if it is not tracked yet */
+  template <typename CompatibleKey, typename CompatibleHash, typename CompatibleEqual, typename MakeKey>
+  Payload& add(const CompatibleKey& key, const CompatibleHash& hash, const CompatibleEqual& equal, const MakeKey& makeKey, uint64_t weight = 1)
+  {
+    d_total += weight;
+
+    auto& keyIndex = d_entries.template get<KeyTag>();
+    auto it = keyIndex.find(key, hash, equal);
+    if (it != keyIndex.end()) {
+      keyIndex.modify(it, [weight](Entry& entry) { entry.count += weight; });
+      return it->payload;
+    }
+
+    if (d_entries.size() < d_capacity) {
+      auto inserted = keyIndex.insert(Entry{makeKey(), weight, 0, Payload()});
+      return inserted.first->payload;
+    }
+
+    auto& countIndex = d_entries.template get<CountTag>();
+    auto smallest = countIndex.begin();
+    const uint64_t minimum = smallest->count;
+    countIndex.modify(smallest, [&makeKey, weight, minimum](Entry& entry) {
+      entry.key = makeKey();
+      entry.count = minimum + weight;
+      entry.error = minimum;
+      entry.payload = Payload();
+    });
+    return smallest->payload;
+  }
+
+  /* calls visitor(const Entry&) for every tracked key, in no particular order */
+  template <typename V>
+  void visit(V visitor) const
+  {
+    for (const auto& entry : d_entries) {
+      visitor(entry);
+    }
+  }
+
+  void clear()
+  {
+    d_entries.clear();
+    d_total = 0;
+  }
+
+  size_t size() const
+  {
+    return d_entries.size();
+  }
+
+  size_t getCapacity() const
+  {
+    return d_capacity;
+  }
+
+  /* sum of the weights of all the keys seen since the last clear(), tracked or not */
+  uint64_t getTotal() const
+  {
+    return d_total;
+  }
+
+private:
+  struct KeyTag {};
+  struct CountTag {};
+
+  typedef boost::multi_index_container<
+    Entry,
+    boost::multi_index::indexed_by<
+      boost::multi_index::hashed_unique<boost::multi_index::tag<KeyTag>, boost::multi_index::member<Entry, K, &Entry::key>, Hash, KeyEqual>,
+      boost::multi_index::ordered_non_unique<boost::multi_index::tag<CountTag>, boost::multi_index::member<Entry, uint64_t, &Entry::count>>
+      >
+    > entries_t;
+
+  entries_t d_entries;
+  uint64_t d_total{0};
+  size_t d_capacity;
+};
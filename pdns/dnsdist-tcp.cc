@@ -25,7 +25,9 @@
 #include <queue>
 
 #include "dnsdist.hh"
+#include "dnsdist-buffer-pool.hh"
 #include "dnsdist-ecs.hh"
+#include "dnsdist-healthchecks.hh"
 #include "dnsdist-proxy-protocol.hh"
 #include "dnsdist-rings.hh"
 #include "dnsdist-tcp-downstream.hh"
@@ -158,6 +160,7 @@ static void decrementTCPClientCount(const ComboAddress& client)
 IncomingTCPConnectionState::~IncomingTCPConnectionState()
 {
   decrementTCPClientCount(d_ci.remote);
+  PacketBufferPool::getThreadLocal().release(std::move(d_buffer));
 
   if (d_ci.cs != nullptr) {
     struct timeval now;
@@ -288,7 +291,10 @@ static IOState sendQueuedResponses(std::shared_ptr<IncomingTCPConnectionState>&
 
 static bool handleResponseSent(std::shared_ptr<IncomingTCPConnectionState>& state, const struct timeval& now)
 {
-  if (!state->d_isXFR) {
+  if (state->d_isXFR) {
+    PacketBufferPool::getThreadLocal().release(std::move(state->d_currentResponse.d_buffer));
+  }
+  else {
     --state->d_currentQueriesCount;
 
     const auto& currentResponse = state->d_currentResponse;
@@ -300,6 +306,10 @@ static bool handleResponseSent(std::shared_ptr<IncomingTCPConnectionState>& stat
       double udiff = ids.sentTime.udiff();
       g_rings.insertResponse(answertime, state->d_ci.remote, ids.qname, ids.qtype, static_cast<unsigned int>(udiff), static_cast<unsigned int>(currentResponse.d_buffer.size()), currentResponse.d_cleartextDH, ds->remote);
       vinfolog("Got answer from %s, relayed to %s (%s), took %f usec", ds->remote.toStringWithPort(), ids.origRemote.toStringWithPort(), (state->d_ci.cs->tlsFrontend ? "DoT" : "TCP"), udiff);
+      ds->latencyHistogram.record(static_cast<uint64_t>(udiff));
+      ds->updatePeakLatency(udiff);
+      state->d_ci.cs->latencyHistogram.record(static_cast<uint64_t>(udiff));
+      updatePassiveHealthCheckResult(ds, currentResponse.d_cleartextDH.rcode == RCode::ServFail || (ds->passiveHealthCheckMaxLatency > 0 && udiff > ds->passiveHealthCheckMaxLatency * 1000.0));
     }
 
     switch (currentResponse.d_cleartextDH.rcode) {
@@ -315,6 +325,9 @@ static bool handleResponseSent(std::shared_ptr<IncomingTCPConnectionState>& stat
       break;
     }
 
+    /* the response has been sent, its buffer can be reused */
+    PacketBufferPool::getThreadLocal().release(std::move(state->d_currentResponse.d_buffer));
+
     if (g_maxTCPQueriesPerConn && state->d_queriesCount > g_maxTCPQueriesPerConn) {
       vinfolog("Terminating TCP connection from %s because it reached the maximum number of queries per conn (%d / %d)", state->d_ci.remote.toStringWithPort(), state->d_queriesCount, g_maxTCPQueriesPerConn);
       return false;
@@ -346,7 +359,8 @@ bool IncomingTCPConnectionState::canAcceptNewQueries() const
 
 void IncomingTCPConnectionState::resetForNewQuery()
 {
-  d_buffer.resize(sizeof(uint16_t));
+  /* a buffer will be borrowed from the pool when we start reading the next query */
+  d_buffer.clear();
   d_currentPos = 0;
   d_querySize = 0;
   d_state = State::readingQuerySize;
@@ -683,6 +697,9 @@ void IncomingTCPConnectionState::handleIO(std::shared_ptr<IncomingTCPConnectionS
             if (state->d_handler.getUnknownTicketKey()) {
               ++state->d_ci.cs->tlsUnknownTicketKey;
             }
+            if (state->d_handler.isKTLSEnabled()) {
+              ++state->d_ci.cs->tlsKTLSConnections;
+            }
           }
 
           state->d_handshakeDoneTime = now;
@@ -746,6 +763,13 @@ void IncomingTCPConnectionState::handleIO(std::shared_ptr<IncomingTCPConnectionS
 
       if (state->d_state == IncomingTCPConnectionState::State::readingQuerySize) {
         DEBUGLOG("reading query size");
+        if (state->d_currentPos == 0 && state->d_buffer.capacity() < s_maxPacketCacheEntrySize) {
+          /* we only hold a buffer while we are actually reading a query */
+          auto& pool = PacketBufferPool::getThreadLocal();
+          pool.release(std::move(state->d_buffer));
+          state->d_buffer = pool.acquire(s_maxPacketCacheEntrySize);
+        }
+        state->d_buffer.resize(sizeof(uint16_t));
         iostate = state->d_handler.tryRead(state->d_buffer, state->d_currentPos, sizeof(uint16_t));
         if (iostate == IOState::Done) {
           DEBUGLOG("query size received");
@@ -767,6 +791,10 @@ void IncomingTCPConnectionState::handleIO(std::shared_ptr<IncomingTCPConnectionS
         }
         else {
           wouldBlock = true;
+          if (state->d_currentPos == 0) {
+            /* nothing to read yet, the connection is idle so let's give the buffer back */
+            PacketBufferPool::getThreadLocal().release(std::move(state->d_buffer));
+          }
         }
       }
 
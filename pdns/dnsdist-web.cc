@@ -153,6 +153,11 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::metrics{
   { "udp-recvbuf-errors",     MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp RcvbufErrors") },
   { "udp-sndbuf-errors",      MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp SndbufErrors") },
   { "proxy-protocol-invalid", MetricDefinition(PrometheusMetricType::counter, "Number of queries dropped because of an invalid Proxy Protocol header") },
+  { "dnscrypt-shared-key-cache-hits", MetricDefinition(PrometheusMetricType::counter, "Number of DNSCrypt shared keys found in the per-thread cache") },
+  { "dnscrypt-shared-key-cache-misses", MetricDefinition(PrometheusMetricType::counter, "Number of DNSCrypt shared keys that had to be computed because they were not in the per-thread cache") },
+  { "tcp-buffer-pool-bytes",  MetricDefinition(PrometheusMetricType::gauge,   "Number of bytes held in the per-thread pools of TCP packet buffers") },
+  { "tcp-buffer-pool-hits",   MetricDefinition(PrometheusMetricType::counter, "Number of TCP packet buffers reused from the per-thread pools") },
+  { "tcp-buffer-pool-misses", MetricDefinition(PrometheusMetricType::counter, "Number of TCP packet buffers that had to be allocated because the per-thread pool was empty") },
 };
 
 static bool apiWriteConfigFile(const string& filebasename, const string& content)
@@ -379,6 +384,25 @@ static void addRulesToPrometheusOutput(std::ostringstream& output, GlobalStateHo
   }
 }
 
+/* a number of usec as seconds, printed exactly instead of with the default precision of the stream (8.38861 for 8388608us) */
+static std::string usecToSeconds(uint64_t usec)
+{
+  return boost::str(boost::format("%d.%06d") % (usec / 1000000) % (usec % 1000000));
+}
+
+/* 'labels' is the list of labels, without the enclosing braces */
+static void addHistogramToPrometheusOutput(std::ostringstream& output, const std::string& name, const std::string& labels, const HistogramSnapshot& snapshot)
+{
+  /* powers of two from 128us to about 8s, which are aligned on the boundaries of the histogram's buckets */
+  for (unsigned int exponent = 7; exponent <= 23; exponent++) {
+    const uint64_t bound = 1ULL << exponent;
+    output << name << "_bucket{" << labels << ",le=\"" << usecToSeconds(bound) << "\"} " << snapshot.getCountUpTo(bound - 1) << "\n";
+  }
+  output << name << "_bucket{" << labels << ",le=\"+Inf\"} " << snapshot.getCount() << "\n";
+  output << name << "_sum{" << labels << "} " << usecToSeconds(snapshot.getSum()) << "\n";
+  output << name << "_count{" << labels << "} " << snapshot.getCount() << "\n";
+}
+
 static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
 {
   handleCORS(req, resp);
@@ -480,6 +504,8 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
   output << "# TYPE " << statesbase << "tcpavgqueriesperconn "   << "gauge"                                                             << "\n";
   output << "# HELP " << statesbase << "tcpavgconnduration "     << "The average duration of a TCP connection (ms)"                     << "\n";
   output << "# TYPE " << statesbase << "tcpavgconnduration "     << "gauge"                                                             << "\n";
+  output << "# HELP " << statesbase << "passivedowns "           << "The number of times live queries marked this server down"          << "\n";
+  output << "# TYPE " << statesbase << "passivedowns "           << "counter"                                                           << "\n";
 
   for (const auto& state : *states) {
     string serverName;
@@ -511,6 +537,18 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
     output << statesbase << "tcpcurrentconnections"  << label << " " << state->tcpCurrentConnections      << "\n";
     output << statesbase << "tcpavgqueriesperconn"   << label << " " << state->tcpAvgQueriesPerConnection << "\n";
     output << statesbase << "tcpavgconnduration"     << label << " " << state->tcpAvgConnectionDuration   << "\n";
+    output << statesbase << "passivedowns"           << label << " " << state->passiveHealthCheckDowns    << "\n";
+  }
+
+  output << "# HELP " << statesbase << "latency_seconds "        << "Histogram of the time taken by this server to answer queries" << "\n";
+  output << "# TYPE " << statesbase << "latency_seconds "        << "histogram"                                                   << "\n";
+  for (const auto& state : *states) {
+    string serverName = state->getName().empty() ? state->remote.toStringWithPort() : state->getName();
+    boost::replace_all(serverName, ".", "_");
+
+    HistogramSnapshot snapshot;
+    snapshot.add(state->latencyHistogram);
+    addHistogramToPrometheusOutput(output, statesbase + "latency_seconds", boost::str(boost::format("server=\"%1%\",address=\"%2%\"") % serverName % state->remote.toStringWithPort()), snapshot);
   }
 
   const string frontsbase = "dnsdist_frontend_";
@@ -544,10 +582,13 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
   output << "# TYPE " << frontsbase << "tlsunknownticketkeys " << "counter" << "\n";
   output << "# HELP " << frontsbase << "tlsinactiveticketkeys " << "Amount of TLS sessions resumed from an inactive key" << "\n";
   output << "# TYPE " << frontsbase << "tlsinactiveticketkeys " << "counter" << "\n";
+  output << "# HELP " << frontsbase << "tlsktlsconnections " << "Amount of TLS connections whose encryption has been offloaded to the kernel" << "\n";
+  output << "# TYPE " << frontsbase << "tlsktlsconnections " << "counter" << "\n";
 
   output << "# HELP " << frontsbase << "tlshandshakefailures " << "Amount of TLS handshake failures" << "\n";
   output << "# TYPE " << frontsbase << "tlshandshakefailures " << "counter" << "\n";
 
+  std::vector<std::pair<std::string, const LatencyHistogram*>> frontendHistograms;
   std::map<std::string,uint64_t> frontendDuplicates;
   for (const auto& front : g_frontends) {
     if (front->udpFD == -1 && front->tcpFD == -1)
@@ -567,6 +608,7 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
 
     output << frontsbase << "queries" << label << front->queries.load() << "\n";
     output << frontsbase << "responses" << label << front->responses.load() << "\n";
+    frontendHistograms.push_back({boost::str(boost::format("frontend=\"%1%\",proto=\"%2%\",thread=\"%3%\"") % frontName % proto % threadNumber), &front->latencyHistogram});
     if (front->isTCP()) {
       output << frontsbase << "tcpdiedreadingquery" << label << front->tcpDiedReadingQuery.load() << "\n";
       output << frontsbase << "tcpdiedsendingresponse" << label << front->tcpDiedSendingResponse.load() << "\n";
@@ -581,6 +623,7 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
         output << frontsbase << "tlsresumptions" << label << front->tlsResumptions.load() << "\n";
         output << frontsbase << "tlsunknownticketkeys" << label << front->tlsUnknownTicketKey.load() << "\n";
         output << frontsbase << "tlsinactiveticketkeys" << label << front->tlsInactiveTicketKey.load() << "\n";
+        output << frontsbase << "tlsktlsconnections" << label << front->tlsKTLSConnections.load() << "\n";
 
         output << frontsbase << "tlsqueries{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",tls=\"tls10\"} " << front->tls10queries.load() << "\n";
         output << frontsbase << "tlsqueries{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",tls=\"tls11\"} " << front->tls11queries.load() << "\n";
@@ -610,12 +653,23 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
     }
   }
 
+  output << "# HELP " << frontsbase << "latency_seconds " << "Histogram of the time taken by the backends to answer queries received by this frontend" << "\n";
+  output << "# TYPE " << frontsbase << "latency_seconds " << "histogram" << "\n";
+  for (const auto& entry : frontendHistograms) {
+    HistogramSnapshot snapshot;
+    snapshot.add(*entry.second);
+    addHistogramToPrometheusOutput(output, frontsbase + "latency_seconds", entry.first, snapshot);
+  }
+
   output << "# HELP " << frontsbase << "http_connects " << "Number of DoH TCP connections established to this frontend" << "\n";
   output << "# TYPE " << frontsbase << "http_connects " << "counter" << "\n";
 
   output << "# HELP " << frontsbase << "doh_http_method_queries " << "Number of DoH queries received by dnsdist, by HTTP method" << "\n";
   output << "# TYPE " << frontsbase << "doh_http_method_queries " << "counter" << "\n";
 
+  output << "# HELP " << frontsbase << "doh_get_cache_hits " << "Number of DoH GET queries answered from the responses cache of the DoH thread" << "\n";
+  output << "# TYPE " << frontsbase << "doh_get_cache_hits " << "counter" << "\n";
+
   output << "# HELP " << frontsbase << "doh_http_version_queries " << "Number of DoH queries received by dnsdist, by HTTP version" << "\n";
   output << "# TYPE " << frontsbase << "doh_http_version_queries " << "counter" << "\n";
 
@@ -644,6 +698,7 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
     output << frontsbase << "http_connects" << label << doh->d_httpconnects << "\n";
     output << frontsbase << "doh_http_method_queries{method=\"get\"," << addrlabel << "} " << doh->d_getqueries << "\n";
     output << frontsbase << "doh_http_method_queries{method=\"post\"," << addrlabel << "} " << doh->d_postqueries << "\n";
+    output << frontsbase << "doh_get_cache_hits" << label << doh->d_getcachehits << "\n";
 
     output << frontsbase << "doh_http_version_queries{version=\"1\"," << addrlabel << "} " << doh->d_http1Stats.d_nbQueries << "\n";
     output << frontsbase << "doh_http_version_queries{version=\"2\"," << addrlabel << "} " << doh->d_http2Stats.d_nbQueries << "\n";
@@ -694,6 +749,16 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
   output << "# TYPE dnsdist_pool_cache_insert_collisions " << "counter" << "\n";
   output << "# HELP dnsdist_pool_cache_ttl_too_shorts " << "Number of insertions into that cache skipped because the TTL of the answer was not long enough" << "\n";
   output << "# TYPE dnsdist_pool_cache_ttl_too_shorts " << "counter" << "\n";
+  output << "# HELP dnsdist_pool_cache_bytes " << "Number of bytes used by the responses and names stored in that cache" << "\n";
+  output << "# TYPE dnsdist_pool_cache_bytes " << "gauge" << "\n";
+  output << "# HELP dnsdist_pool_cache_space_evictions " << "Number of entries evicted from that cache to stay under its memory budget" << "\n";
+  output << "# TYPE dnsdist_pool_cache_space_evictions " << "counter" << "\n";
+  output << "# HELP dnsdist_pool_cache_expired_evictions " << "Number of expired entries removed from that cache" << "\n";
+  output << "# TYPE dnsdist_pool_cache_expired_evictions " << "counter" << "\n";
+  output << "# HELP dnsdist_pool_cache_expunged_entries " << "Number of entries removed from that cache by an explicit expunge" << "\n";
+  output << "# TYPE dnsdist_pool_cache_expunged_entries " << "counter" << "\n";
+  output << "# HELP dnsdist_pool_cache_local_hits " << "Number of hits served from the per-thread caches in front of that cache, also counted in the hits" << "\n";
+  output << "# TYPE dnsdist_pool_cache_local_hits " << "counter" << "\n";
 
   for (const auto& entry : *localPools) {
     string poolName = entry.first;
@@ -718,7 +783,24 @@ static void handlePrometheus(const YaHTTP::Request& req, YaHTTP::Response& resp)
       output << cachebase << "cache_lookup_collisions" <<label << " " << cache->getLookupCollisions() << "\n";
       output << cachebase << "cache_insert_collisions" <<label << " " << cache->getInsertCollisions() << "\n";
       output << cachebase << "cache_ttl_too_shorts"    <<label << " " << cache->getTTLTooShorts()     << "\n";
+      output << cachebase << "cache_bytes"             <<label << " " << cache->getBytes()            << "\n";
+      output << cachebase << "cache_space_evictions"   <<label << " " << cache->getSpaceEvictions()   << "\n";
+      output << cachebase << "cache_expired_evictions" <<label << " " << cache->getExpiredEvictions() << "\n";
+      output << cachebase << "cache_expunged_entries"  <<label << " " << cache->getExpungedEntries()  << "\n";
+      output << cachebase << "cache_local_hits"        <<label << " " << cache->getLocalHits()        << "\n";
+    }
+  }
+
+  output << "# HELP dnsdist_pool_latency_seconds " << "Histogram of the time taken by the servers of that pool to answer queries" << "\n";
+  output << "# TYPE dnsdist_pool_latency_seconds " << "histogram" << "\n";
+  for (const auto& entry : *localPools) {
+    const string poolName = entry.first.empty() ? "_default_" : entry.first;
+    /* merged on demand from the histograms of the servers currently in that pool */
+    HistogramSnapshot snapshot;
+    for (const auto& server : *entry.second->getServers()) {
+      snapshot.add(server.second->latencyHistogram);
     }
+    addHistogramToPrometheusOutput(output, "dnsdist_pool_latency_seconds", "pool=\"" + poolName + "\"", snapshot);
   }
 
   output << "# HELP dnsdist_rule_hits " << "Number of hits of that rule" << "\n";
@@ -900,6 +982,7 @@ static void handleStats(const YaHTTP::Request& req, YaHTTP::Response& resp)
       {"tcpCurrentConnections", (double)a->tcpCurrentConnections},
       {"tcpAvgQueriesPerConnection", (double)a->tcpAvgQueriesPerConnection},
       {"tcpAvgConnectionDuration", (double)a->tcpAvgConnectionDuration},
+      {"passiveHealthCheckDowns", (double)a->passiveHealthCheckDowns},
       {"dropRate", (double)a->dropRate}
     };
 
@@ -936,6 +1019,7 @@ static void handleStats(const YaHTTP::Request& req, YaHTTP::Response& resp)
       { "tlsResumptions", (double) front->tlsResumptions },
       { "tlsUnknownTicketKey", (double) front->tlsUnknownTicketKey },
       { "tlsInactiveTicketKey", (double) front->tlsInactiveTicketKey },
+      { "tlsKTLSConnections", (double) front->tlsKTLSConnections },
       { "tls10Queries", (double) front->tls10queries },
       { "tls11Queries", (double) front->tls11queries },
       { "tls12Queries", (double) front->tls12queries },
@@ -987,6 +1071,7 @@ static void handleStats(const YaHTTP::Request& req, YaHTTP::Response& resp)
         { "http2-other-responses", (double) doh->d_http2Stats.d_nbOtherResponses },
         { "get-queries", (double) doh->d_getqueries },
         { "post-queries", (double) doh->d_postqueries },
+        { "get-cache-hits", (double) doh->d_getcachehits },
         { "bad-requests", (double) doh->d_badrequests },
         { "error-responses", (double) doh->d_errorresponses },
         { "redirect-responses", (double) doh->d_redirectresponses },
@@ -1014,7 +1099,12 @@ static void handleStats(const YaHTTP::Request& req, YaHTTP::Response& resp)
       { "cacheDeferredLookups", (double) (cache ? cache->getDeferredLookups() : 0) },
       { "cacheLookupCollisions", (double) (cache ? cache->getLookupCollisions() : 0) },
       { "cacheInsertCollisions", (double) (cache ? cache->getInsertCollisions() : 0) },
-      { "cacheTTLTooShorts", (double) (cache ? cache->getTTLTooShorts() : 0) }
+      { "cacheTTLTooShorts", (double) (cache ? cache->getTTLTooShorts() : 0) },
+      { "cacheBytes", (double) (cache ? cache->getBytes() : 0) },
+      { "cacheSpaceEvictions", (double) (cache ? cache->getSpaceEvictions() : 0) },
+      { "cacheExpiredEvictions", (double) (cache ? cache->getExpiredEvictions() : 0) },
+      { "cacheExpungedEntries", (double) (cache ? cache->getExpungedEntries() : 0) },
+      { "cacheLocalHits", (double) (cache ? cache->getLocalHits() : 0) }
     };
     pools.push_back(entry);
   }
@@ -647,6 +647,9 @@ void responderThread(std::shared_ptr<DownstreamState> dss)
           if (du) {
 #ifdef HAVE_DNS_OVER_HTTPS
             // DoH query
+            if (dr.packetCache && !dr.skipCache && response.size() <= s_maxPacketCacheEntrySize) {
+              du->getCachePacketCache = dr.packetCache;
+            }
             du->response = std::move(response);
             static_assert(sizeof(du) <= PIPE_BUF, "Writes up to PIPE_BUF are guaranteed not to be interleaved and to either fully succeed or fail");
             ssize_t sent = write(du->rsock, &du, sizeof(du));
@@ -702,6 +705,12 @@ void responderThread(std::shared_ptr<DownstreamState> dss)
           break;
         }
         dss->latencyUsec = (127.0 * dss->latencyUsec / 128.0) + udiff/128.0;
+        dss->updatePeakLatency(udiff);
+        dss->latencyHistogram.record(static_cast<uint64_t>(udiff));
+        if (ids->cs) {
+          ids->cs->latencyHistogram.record(static_cast<uint64_t>(udiff));
+        }
+        updatePassiveHealthCheckResult(dss, cleartextDH.rcode == RCode::ServFail || (dss->passiveHealthCheckMaxLatency > 0 && udiff > dss->passiveHealthCheckMaxLatency * 1000.0));
 
         doLatencyStats(udiff);
       }
@@ -1122,6 +1131,27 @@ static void queueResponse(const ClientState& cs, const PacketBuffer& response, c
 }
 #endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
 
+void updateOutgoingResponseStats(const struct dnsheader* dh, bool cacheHit)
+{
+  if (cacheHit) {
+    ++g_stats.cacheHits;
+  }
+
+  switch (dh->rcode) {
+  case RCode::NXDomain:
+    ++g_stats.frontendNXDomain;
+    break;
+  case RCode::ServFail:
+    ++g_stats.frontendServFail;
+    break;
+  case RCode::NoError:
+    ++g_stats.frontendNoError;
+    break;
+  }
+
+  doLatencyStats(0);  // we're not going to measure this
+}
+
 /* self-generated responses or cache hits */
 static bool prepareOutgoingResponse(LocalHolders& holders, ClientState& cs, DNSQuestion& dq, bool cacheHit)
 {
@@ -1146,23 +1176,53 @@ static bool prepareOutgoingResponse(LocalHolders& holders, ClientState& cs, DNSQ
   }
 #endif /* HAVE_DNSCRYPT */
 
-  if (cacheHit) {
-    ++g_stats.cacheHits;
+  updateOutgoingResponseStats(dr.getHeader(), cacheHit);
+  return true;
+}
+
+/* Cache hits served before the query has been parsed, for frontends where a
+   'cache-first' pool has been set. The query rules are bypassed, so we refuse
+   to do that for clients that are dynamically blocked, if there are suffix-based
+   dynamic blocks, or if there are cache-hit response rules to apply. As for regular
+   cache hits, the query is still inserted into the rings, so that rate-based dynamic
+   blocks and top-N reports see that traffic. */
+static bool getCacheFirstResponse(ClientState& cs, LocalHolders& holders, PacketBuffer& query, const ComboAddress& remote)
+{
+  if (!holders.cacheHitRespRulactions->empty() || !holders.dynSMTBlock->empty()) {
+    return false;
   }
 
-  switch (dr.getHeader()->rcode) {
-  case RCode::NXDomain:
-    ++g_stats.frontendNXDomain;
-    break;
-  case RCode::ServFail:
-    ++g_stats.frontendServFail;
-    break;
-  case RCode::NoError:
-    ++g_stats.frontendNoError;
-    break;
+  if (auto got = holders.dynNMGBlock->lookup(remote)) {
+    struct timespec now;
+    gettime(&now);
+    if (now < got->second.until) {
+      return false;
+    }
   }
 
-  doLatencyStats(0);  // we're not going to measure this
+  const auto& pools = *holders.pools;
+  const auto it = pools.find(*cs.cacheFirstPool);
+  if (it == pools.end() || it->second->packetCache == nullptr) {
+    return false;
+  }
+
+  /* the query is overwritten by the response on a hit */
+  const struct dnsheader queryDH = *reinterpret_cast<const struct dnsheader*>(query.data());
+  const size_t querySize = query.size();
+  if (!it->second->packetCache->getFromWire(query, false)) {
+    return false;
+  }
+
+  struct timespec now;
+  gettime(&now);
+  /* a ring entry holds a DNSName, so one is built from the wire-format qname, which the
+     lookup has already validated and is at the same place in the response, and moved into the ring */
+  uint16_t qtype;
+  DNSName qname(reinterpret_cast<const char*>(query.data()), query.size(), sizeof(dnsheader), false, &qtype);
+  g_rings.insertQuery(now, remote, std::move(qname), qtype, querySize, queryDH);
+
+  updateOutgoingResponseStats(reinterpret_cast<const struct dnsheader*>(query.data()), true);
+  ++cs.responses;
   return true;
 }
 
@@ -1327,6 +1387,18 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
       }
     }
 
+    if (cs.cacheFirstPool && dnsCryptQuery == nullptr && !expectProxyProtocol && getCacheFirstResponse(cs, holders, query, remote)) {
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+      if (responsesVect != nullptr) {
+        queueResponse(cs, query, dest, remote, responsesVect[*queuedResponses], respIOV, respCBuf);
+        (*queuedResponses)++;
+        return;
+      }
+#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
+      sendUDPResponse(cs.udpFD, query, 0, dest, remote);
+      return;
+    }
+
     uint16_t qtype, qclass;
     unsigned int qnameWireLength = 0;
     DNSName qname(reinterpret_cast<const char*>(query.data()), query.size(), sizeof(dnsheader), false, &qtype, &qclass, &qnameWireLength);
@@ -1389,6 +1461,9 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
       ++ss->reuseds;
       ++g_stats.downstreamTimeouts;
       handleDOHTimeout(du);
+      /* the previous query sent with that state never got an answer */
+      ss->updatePeakLatencyOnTimeout(g_udpTimeout);
+      updatePassiveHealthCheckResult(ss, true);
     }
 
     ids->cs = &cs;
@@ -1595,10 +1670,22 @@ static void maintThread()
   int interval = 1;
   size_t counter = 0;
   int32_t secondsToWaitLog = 0;
+  time_t lastHistogramsRotation = time(nullptr);
 
   for (;;) {
     sleep(interval);
 
+    time_t now = time(nullptr);
+    if (now - lastHistogramsRotation >= LatencyHistogram::s_rotationInterval) {
+      for (const auto& state : *g_dstates.getLocal()) {
+        state->latencyHistogram.rotate();
+      }
+      for (const auto& front : g_frontends) {
+        front->latencyHistogram.rotate();
+      }
+      lastHistogramsRotation = now;
+    }
+
     {
       std::lock_guard<std::mutex> lock(g_luamutex);
       auto f = g_lua.readVariable<boost::optional<std::function<void()> > >("maintenance");
@@ -1700,7 +1787,8 @@ static void healthChecksThread()
 
       dss->lastCheck = 0;
 
-      if (dss->availability == DownstreamState::Availability::Auto) {
+      /* in passive mode, probes are only needed to find out when a backend marked down can be used again */
+      if (dss->availability == DownstreamState::Availability::Auto && (dss->healthCheckMode != DownstreamState::HealthCheckMode::Passive || !dss->upStatus)) {
         if (!queueHealthCheck(mplexer, dss)) {
           updateHealthCheckResult(dss, false);
         }
@@ -1709,6 +1797,9 @@ static void healthChecksThread()
       auto delta = dss->sw.udiffAndSet()/1000000.0;
       dss->queryLoad = 1.0*(dss->queries.load() - dss->prev.queries.load())/delta;
       dss->dropRate = 1.0*(dss->reuseds.load() - dss->prev.reuseds.load())/delta;
+      if (dss->queries.load() == dss->prev.queries.load()) {
+        dss->decayPeakLatency();
+      }
       dss->prev.queries.store(dss->queries.load());
       dss->prev.reuseds.store(dss->reuseds.load());
       
@@ -1744,6 +1835,8 @@ static void healthChecksThread()
           fake.id = ids.origID;
 
           g_rings.insertResponse(ts, ids.origRemote, ids.qname, ids.qtype, std::numeric_limits<unsigned int>::max(), 0, fake, dss->remote);
+          dss->updatePeakLatencyOnTimeout(g_udpTimeout);
+          updatePassiveHealthCheckResult(dss, true);
         }          
       }
     }
@@ -35,8 +35,10 @@
 #include "capabilities.hh"
 #include "circular_buffer.hh"
 #include "dnscrypt.hh"
+#include "dnsdist-buffer-pool.hh"
 #include "dnsdist-cache.hh"
 #include "dnsdist-dynbpf.hh"
+#include "dnsdist-histogram.hh"
 #include "dnsdist-lbpolicies.hh"
 #include "dnsname.hh"
 #include "doh.hh"
@@ -386,6 +388,13 @@ struct DNSDistStats
     {"security-status", &securityStatus},
     {"doh-query-pipe-full", &dohQueryPipeFull},
     {"doh-response-pipe-full", &dohResponsePipeFull},
+    {"tcp-buffer-pool-bytes", [](const std::string&) { return PacketBufferPool::s_pooledBytes.load(); }},
+    {"tcp-buffer-pool-hits", [](const std::string&) { return PacketBufferPool::s_hits.load(); }},
+    {"tcp-buffer-pool-misses", [](const std::string&) { return PacketBufferPool::s_misses.load(); }},
+#if defined(HAVE_DNSCRYPT) && defined(HAVE_CRYPTO_BOX_EASY_AFTERNM)
+    {"dnscrypt-shared-key-cache-hits", [](const std::string&) { return DNSCryptSharedKeyCache::s_hits.load(); }},
+    {"dnscrypt-shared-key-cache-misses", [](const std::string&) { return DNSCryptSharedKeyCache::s_misses.load(); }},
+#endif /* HAVE_DNSCRYPT && HAVE_CRYPTO_BOX_EASY_AFTERNM */
     // Latency histogram
     {"latency-sum", &latencySum},
     {"latency-count", getLatencyCount},
@@ -728,6 +737,8 @@ struct ClientState
   std::shared_ptr<TLSFrontend> tlsFrontend{nullptr};
   std::shared_ptr<DOHFrontend> dohFrontend{nullptr};
   std::string interface;
+  /* pool whose packet cache is looked up before parsing UDP queries and applying rules, if any */
+  boost::optional<std::string> cacheFirstPool{boost::none};
   stat_t queries{0};
   mutable stat_t responses{0};
   stat_t tcpDiedReadingQuery{0};
@@ -740,6 +751,7 @@ struct ClientState
   stat_t tlsResumptions{0}; // A TLS session has been resumed, either via session id or via a TLS ticket
   stat_t tlsUnknownTicketKey{0}; // A TLS ticket has been presented but we don't have the associated key (might have expired)
   stat_t tlsInactiveTicketKey{0}; // A TLS ticket has been successfully resumed but the key is no longer active, we should issue a new one
+  stat_t tlsKTLSConnections{0}; // The encryption of the responses sent over this TLS connection has been offloaded to the kernel
   stat_t tls10queries{0};   // valid DNS queries received via TLSv1.0
   stat_t tls11queries{0};   // valid DNS queries received via TLSv1.1
   stat_t tls12queries{0};   // valid DNS queries received via TLSv1.2
@@ -748,6 +760,9 @@ struct ClientState
   pdns::stat_t_trait<double> tcpAvgQueriesPerConnection{0.0};
   /* in ms */
   pdns::stat_t_trait<double> tcpAvgConnectionDuration{0.0};
+  /* time taken by the backends to answer the queries received over this frontend,
+     mutable because it is updated via the const ClientState pointer of an IDState */
+  mutable LatencyHistogram latencyHistogram;
   size_t d_maxInFlightQueriesPerConn{1};
   int udpFD{-1};
   int tcpFD{-1};
@@ -886,6 +901,67 @@ public:
 
 extern std::unique_ptr<TCPClientCollection> g_tcpclientthreads;
 
+/* sliding window over the outcomes of the last queries sent to a backend,
+   updated without locking from the responder, TCP and health-check threads */
+class PassiveHealthCheckWindow
+{
+public:
+  /* should only be called at configuration time */
+  void setSize(size_t size)
+  {
+    d_outcomes = std::unique_ptr<std::atomic<uint8_t>[]>(new std::atomic<uint8_t>[size]);
+    d_size = size;
+    reset();
+  }
+
+  size_t getSize() const
+  {
+    return d_size;
+  }
+
+  /* record the outcome of a query, setting 'failures' and 'samples' to the number of
+     failed queries and queries present in the window after that */
+  void submit(bool failed, uint64_t& failures, uint64_t& samples)
+  {
+    auto& slot = d_outcomes[d_pos++ % d_size];
+    auto previous = slot.exchange(failed ? s_failure : s_success);
+    if (previous == s_empty) {
+      ++d_samples;
+    }
+    else if (previous == s_failure) {
+      --d_failures;
+    }
+    if (failed) {
+      ++d_failures;
+    }
+
+    auto currentFailures = d_failures.load();
+    failures = currentFailures > 0 ? currentFailures : 0;
+    samples = d_samples.load();
+  }
+
+  void reset()
+  {
+    for (size_t idx = 0; idx < d_size; idx++) {
+      d_outcomes[idx].store(s_empty);
+    }
+    d_failures.store(0);
+    d_samples.store(0);
+  }
+
+private:
+  static constexpr uint8_t s_empty{0};
+  static constexpr uint8_t s_success{1};
+  static constexpr uint8_t s_failure{2};
+
+  std::unique_ptr<std::atomic<uint8_t>[]> d_outcomes{nullptr};
+  std::atomic<uint64_t> d_pos{0};
+  /* signed since a concurrent update might briefly get it below zero */
+  std::atomic<int64_t> d_failures{0};
+  std::atomic<uint64_t> d_samples{0};
+  size_t d_size{0};
+};
+
 struct DownstreamState
 {
    typedef std::function<std::tuple<DNSName, uint16_t, uint16_t>(const DNSName&, uint16_t, uint16_t, dnsheader*)> checkfunc_t;
@@ -931,11 +1007,14 @@ struct DownstreamState
   pdns::stat_t_trait<double> tcpAvgQueriesPerConnection{0.0};
   /* in ms */
   pdns::stat_t_trait<double> tcpAvgConnectionDuration{0.0};
+  LatencyHistogram latencyHistogram;
   size_t socketsOffset{0};
   size_t d_maxInFlightQueriesPerConn{1};
   double queryLoad{0.0};
   double dropRate{0.0};
   double latencyUsec{0.0};
+  /* peak-sensitive moving average of the latency, used by the 'peakEWMA' policy */
+  std::atomic<double> peakLatencyUsec{0.0};
   int order{1};
   int weight{1};
   int tcpConnectTimeout{5};
@@ -953,9 +1032,25 @@ struct DownstreamState
   uint8_t minRiseSuccesses{1};
   StopWatch sw;
   set<string> pools;
+  PassiveHealthCheckWindow passiveHealthCheckWindow;
+  stat_t passiveHealthCheckDowns{0};
+  /* set when live queries marked the backend down, cleared when it is marked up again */
+  std::atomic<bool> passivelyDown{false};
+  /* a query taking longer than that (in ms) counts as a failure, 0 means disabled */
+  unsigned int passiveHealthCheckMaxLatency{0};
+  /* minimum number of outcomes in the window before the backend can be marked down */
+  uint16_t passiveHealthCheckMinSamples{20};
+  /* ratio of failures in the window above which the backend is marked down */
+  double passiveHealthCheckFailureRatio{0.5};
+  /* Active: periodic probes only. Passive: the outcome of live queries marks the backend down,
+     probes are only sent while it is down to decide when it can be marked up again.
+     Both: probes are always sent, live queries can mark the backend down before they notice. */
+  enum class HealthCheckMode : uint8_t { Active, Passive, Both } healthCheckMode{HealthCheckMode::Active};
   enum class Availability { Up, Down, Auto} availability{Availability::Auto};
   bool mustResolve{false};
-  bool upStatus{false};
+  /* written by the health-check thread and, with passive health checks, by any thread
+     seeing a live query fail, read by every thread selecting a backend */
+  std::atomic<bool> upStatus{false};
   bool useECS{false};
   bool useProxyProtocol{false};
   bool setCD{false};
@@ -1022,6 +1117,44 @@ struct DownstreamState
     qps.addHit();
   }
 
+  /* upper bound of the latency, in usec, below which 'percentile' percent of the recent responses were received */
+  uint64_t getLatencyPercentile(double percentile) const
+  {
+    HistogramSnapshot snapshot;
+    snapshot.addRecent(latencyHistogram);
+    return snapshot.getPercentile(percentile);
+  }
+
+  /* a sample higher than the current value replaces it right away,
+     so that a backend getting slower is avoided quickly, while lower
+     ones are only slowly averaged in */
+  void updatePeakLatency(double udiff)
+  {
+    /* several threads might be updating it at the same time */
+    auto current = peakLatencyUsec.load();
+    double updated;
+    do {
+      updated = udiff > current ? udiff : current + (udiff - current) / 16.0;
+    }
+    while (!peakLatencyUsec.compare_exchange_weak(current, updated));
+  }
+
+  /* a query that timed out counts as a response received after the timeout,
+     otherwise a backend silently dropping queries would look cheap */
+  void updatePeakLatencyOnTimeout(int timeoutSeconds)
+  {
+    updatePeakLatency(timeoutSeconds * 1000000.0);
+  }
+
+  /* called periodically for backends that did not get any query, so that
+     a backend which has been avoided because it was slow is tried again */
+  void decayPeakLatency()
+  {
+    auto current = peakLatencyUsec.load();
+    while (!peakLatencyUsec.compare_exchange_weak(current, current / 2.0)) {
+    }
+  }
+
 private:
   std::string name;
   std::string nameWithAddr;
@@ -1274,6 +1407,7 @@ static const size_t s_maxPacketCacheEntrySize{4096}; // don't cache responses la
 
 enum class ProcessQueryResult { Drop, SendAnswer, PassToBackend };
 ProcessQueryResult processQuery(DNSQuestion& dq, ClientState& cs, LocalHolders& holders, std::shared_ptr<DownstreamState>& selectedBackend);
+void updateOutgoingResponseStats(const struct dnsheader* dh, bool cacheHit);
 
 DNSResponse makeDNSResponseFromIDState(IDState& ids, PacketBuffer& data, bool isTCP);
 void setIDStateFromDNSQuestion(IDState& ids, DNSQuestion& dq, DNSName&& qname);
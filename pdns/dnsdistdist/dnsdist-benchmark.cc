@@ -0,0 +1,208 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <new>
+
+#include "dnsdist.hh"
+#include "dnsdist-benchmark.hh"
+#include "dnspcap.hh"
+#include "dnswriter.hh"
+
+/* Count the allocations done by the thread replaying the queries, so that the
+   benchmark can report the number of allocations per query. Only the basic
+   operator new is replaced: the array and nothrow versions call it, and the
+   default operator delete releases memory with free(). Outside of a replay the
+   counter is not set, so the cost for the other threads is a single test. */
+static thread_local uint64_t* t_allocations{nullptr};
+
+void* operator new(std::size_t size)
+{
+  if (t_allocations != nullptr) {
+    ++(*t_allocations);
+  }
+
+  if (size == 0) {
+    size = 1;
+  }
+
+  for (;;) {
+    void* ptr = malloc(size);
+    if (ptr != nullptr) {
+      return ptr;
+    }
+
+    auto handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+struct BenchmarkQuery
+{
+  PacketBuffer packet;
+  ComboAddress source;
+  ComboAddress destination;
+};
+
+static std::vector<BenchmarkQuery> loadQueriesFromPcap(const std::string& fname, uint64_t& skipped)
+{
+  std::vector<BenchmarkQuery> queries;
+  PcapPacketReader pr(fname);
+
+  while (pr.getUDPPacket()) {
+    if (pr.d_len < sizeof(dnsheader)) {
+      ++skipped;
+      continue;
+    }
+
+    const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(pr.d_payload);
+    /* the capture might contain the responses as well */
+    if (dh->qr || dh->qdcount == 0) {
+      ++skipped;
+      continue;
+    }
+
+    try {
+      DNSName qname(reinterpret_cast<const char*>(pr.d_payload), pr.d_len, sizeof(dnsheader), false);
+    }
+    catch (const std::exception& e) {
+      ++skipped;
+      continue;
+    }
+
+    BenchmarkQuery query;
+    query.packet.insert(query.packet.begin(), pr.d_payload, pr.d_payload + pr.d_len);
+    query.source = pr.getSource();
+    query.destination = pr.getDest();
+    queries.push_back(std::move(query));
+  }
+
+  return queries;
+}
+
+/* what a backend would have sent back: the question with a single record, so
+   that the answer can be cached */
+static void insertStubResponse(const DNSQuestion& dq)
+{
+  static const uint32_t stubTTL = 3600;
+  PacketBuffer response;
+  GenericDNSPacketWriter<PacketBuffer> pw(response, *dq.qname, dq.qtype, dq.qclass);
+  pw.getHeader()->id = dq.getHeader()->id;
+  pw.getHeader()->qr = true;
+  pw.getHeader()->rd = dq.getHeader()->rd;
+  pw.getHeader()->ra = true;
+  pw.startRecord(*dq.qname, QType::TXT, stubTTL, dq.qclass, DNSResourceRecord::ANSWER);
+  pw.xfrText("\"dnsdist benchmark\"");
+  pw.commit();
+
+  dq.packetCache->insert(dq.cacheKey, dq.subnet, dq.origFlags, dq.dnssecOK, *dq.qname, dq.qtype, dq.qclass, response, dq.tcp, RCode::NoError, dq.tempFailureTTL);
+}
+
+/* the same pools, using the same servers and policies, but with a private packet
+   cache so that the stub responses never end up in the real ones */
+static pools_t getBenchmarkPools(const pools_t& pools)
+{
+  pools_t result;
+  for (const auto& entry : pools) {
+    const auto& pool = entry.second;
+    auto copy = std::make_shared<ServerPool>();
+    copy->policy = pool->policy;
+    copy->setECS(pool->getECS());
+    for (const auto& server : *pool->getServers()) {
+      auto backend = server.second;
+      copy->addServer(backend);
+    }
+    if (pool->packetCache) {
+      copy->packetCache = std::make_shared<DNSDistPacketCache>(pool->packetCache->getMaxEntries());
+      copy->packetCache->setECSParsingEnabled(pool->packetCache->isECSParsingEnabled());
+      copy->packetCache->setMaxBytes(pool->packetCache->getMaxBytes());
+    }
+    result[entry.first] = copy;
+  }
+  return result;
+}
+
+PcapBenchmarkResults benchmarkPcap(const std::string& fname, unsigned int times)
+{
+  PcapBenchmarkResults results;
+  const auto queries = loadQueriesFromPcap(fname, results.skipped);
+  if (queries.empty()) {
+    return results;
+  }
+
+  LocalHolders holders;
+  GlobalStateHolder<pools_t> pools;
+  pools.setState(getBenchmarkPools(*holders.pools));
+  holders.pools = pools.getLocal();
+
+  ClientState cs(ComboAddress("127.0.0.1:53"), false, false, 0, "", {});
+  LatencyHistogram latencies;
+  PacketBuffer packet;
+  StopWatch sw(true);
+  sw.start();
+
+  for (unsigned int iteration = 0; iteration < times; iteration++) {
+    for (const auto& query : queries) {
+      packet = query.packet;
+      struct timespec start, end;
+      gettime(&start, true);
+      t_allocations = &results.allocations;
+
+      uint16_t qtype, qclass;
+      DNSName qname(reinterpret_cast<const char*>(packet.data()), packet.size(), sizeof(dnsheader), false, &qtype, &qclass);
+      DNSQuestion dq(&qname, qtype, qclass, &query.destination, &query.source, packet, false, &start);
+      std::shared_ptr<DownstreamState> selectedBackend{nullptr};
+      auto result = processQuery(dq, cs, holders, selectedBackend);
+
+      t_allocations = nullptr;
+      gettime(&end, true);
+      /* recorded in nanoseconds */
+      latencies.record((end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec);
+      ++results.count;
+
+      if (result == ProcessQueryResult::Drop) {
+        ++results.dropped;
+      }
+      else if (result == ProcessQueryResult::SendAnswer) {
+        ++results.selfAnswered;
+      }
+      else {
+        ++results.forwarded;
+        if (dq.packetCache && !dq.skipCache) {
+          insertStubResponse(dq);
+        }
+      }
+    }
+  }
+
+  results.elapsedUSec = sw.udiff();
+  results.latencies.add(latencies);
+  for (const auto& entry : *holders.pools) {
+    if (entry.second->packetCache) {
+      results.cacheHits += entry.second->packetCache->getHits();
+    }
+  }
+  return results;
+}
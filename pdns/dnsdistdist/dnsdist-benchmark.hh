@@ -0,0 +1,54 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "dnsdist-histogram.hh"
+
+struct PcapBenchmarkResults
+{
+  /* per-query processing time, in nanoseconds */
+  HistogramSnapshot latencies;
+  uint64_t count{0};
+  /* allocations done while processing the queries */
+  uint64_t allocations{0};
+  uint64_t dropped{0};
+  uint64_t selfAnswered{0};
+  /* answers coming from the packet cache, included in selfAnswered */
+  uint64_t cacheHits{0};
+  uint64_t forwarded{0};
+  /* packets from the capture that were not valid DNS queries */
+  uint64_t skipped{0};
+  double elapsedUSec{0};
+};
+
+/* Replay the UDP DNS queries found in a pcap file 'times' times through the
+   whole query path (rules, packet cache, load-balancing policy), without
+   sending anything on the wire: queries that would be sent to a backend are
+   answered by a stub, and that answer is inserted into a private copy of the
+   pool's packet cache, so that replaying the same capture exercises cache hits
+   as well without touching the real cache.
+   Note that statistics, rings and backend counters are updated as they would
+   be for real traffic. */
+PcapBenchmarkResults benchmarkPcap(const std::string& fname, unsigned int times);
@@ -0,0 +1 @@
+../dnsdist-buffer-pool.hh
\ No newline at end of file
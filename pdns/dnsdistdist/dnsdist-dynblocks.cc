@@ -314,7 +314,17 @@ void DynBlockRulesGroup::processQueryRules(counts_t& counts, const struct timesp
 
 void DynBlockRulesGroup::processResponseRules(counts_t& counts, StatNode& root, const struct timespec& now)
 {
-  if (!hasResponseRules() && !hasSuffixMatchRules()) {
+  bool suffixMatchFromRing = hasSuffixMatchRules();
+  if (suffixMatchFromRing && g_rings.hasSketches() && d_suffixMatchRule.d_seconds <= g_rings.getSketchesSeconds()) {
+    /* the heaviest suffixes are already tracked by the rings' sketches, no need to walk the response ring for them */
+    d_suffixMatchRule.d_cutOff = d_suffixMatchRule.d_minTime = now;
+    d_suffixMatchRule.d_cutOff.tv_sec -= d_suffixMatchRule.d_seconds;
+    d_suffixMatchRule.d_minTime.tv_sec = g_rings.getSuffixesFromSketches(now, root, d_suffixMatchRule.d_seconds);
+    d_suffixMatchRule.d_minTime.tv_nsec = 0;
+    suffixMatchFromRing = false;
+  }
+
+  if (!hasResponseRules() && !suffixMatchFromRing) {
     return;
   }
 
@@ -326,10 +336,12 @@ void DynBlockRulesGroup::processResponseRules(counts_t& counts, StatNode& root,
     responseCutOff = d_respRateRule.d_cutOff;
   }
 
-  d_suffixMatchRule.d_cutOff = d_suffixMatchRule.d_minTime = now;
-  d_suffixMatchRule.d_cutOff.tv_sec -= d_suffixMatchRule.d_seconds;
-  if (d_suffixMatchRule.d_cutOff < responseCutOff) {
-    responseCutOff = d_suffixMatchRule.d_cutOff;
+  if (suffixMatchFromRing) {
+    d_suffixMatchRule.d_cutOff = d_suffixMatchRule.d_minTime = now;
+    d_suffixMatchRule.d_cutOff.tv_sec -= d_suffixMatchRule.d_seconds;
+    if (d_suffixMatchRule.d_cutOff < responseCutOff) {
+      responseCutOff = d_suffixMatchRule.d_cutOff;
+    }
   }
 
   for (auto& rule : d_rcodeRules) {
@@ -363,7 +375,7 @@ void DynBlockRulesGroup::processResponseRules(counts_t& counts, StatNode& root,
       ++entry.responses;
 
       bool respRateMatches = d_respRateRule.matches(c.when);
-      bool suffixMatchRuleMatches = d_suffixMatchRule.matches(c.when);
+      bool suffixMatchRuleMatches = suffixMatchFromRing && d_suffixMatchRule.matches(c.when);
       bool rcodeRuleMatches = checkIfResponseCodeMatches(c);
 
       if (respRateMatches || rcodeRuleMatches) {
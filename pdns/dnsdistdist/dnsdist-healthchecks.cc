@@ -71,12 +71,54 @@ void updateHealthCheckResult(const std::shared_ptr<DownstreamState>& dss, bool n
     dss->upStatus = newState;
     dss->currentCheckFailures = 0;
     dss->consecutiveSuccessfulChecks = 0;
+    if (dss->healthCheckMode != DownstreamState::HealthCheckMode::Active) {
+      /* start from a clean slate, so that at least passiveHealthCheckMinSamples
+         queries are needed before the backend can be passively marked down again */
+      dss->passiveHealthCheckWindow.reset();
+      dss->passivelyDown.store(false);
+    }
     if (g_snmpAgent && g_snmpTrapsEnabled) {
       g_snmpAgent->sendBackendStatusChangeTrap(dss);
     }
   }
 }
 
+/* Called from the threads handling live queries. ServFail and slow responses are reported
+   as soon as they are received, but a UDP query that never gets an answer is only reported
+   when its state is reused or when the maintenance thread notices it is older than the UDP
+   timeout, so detecting a backend that silently drops queries takes at least that long. */
+void updatePassiveHealthCheckResult(const std::shared_ptr<DownstreamState>& dss, bool failed)
+{
+  if (dss->healthCheckMode == DownstreamState::HealthCheckMode::Active || dss->passiveHealthCheckWindow.getSize() == 0) {
+    return;
+  }
+
+  uint64_t failures = 0;
+  uint64_t samples = 0;
+  dss->passiveHealthCheckWindow.submit(failed, failures, samples);
+
+  if (!failed || !dss->upStatus || dss->availability != DownstreamState::Availability::Auto) {
+    return;
+  }
+
+  if (samples < dss->passiveHealthCheckMinSamples || failures < dss->passiveHealthCheckFailureRatio * samples) {
+    return;
+  }
+
+  /* several threads might reach that point at the same time, only one of them gets to mark it down */
+  bool expected = false;
+  if (!dss->passivelyDown.compare_exchange_strong(expected, true)) {
+    return;
+  }
+
+  warnlog("Marking downstream %s as 'down' after %d failures out of the last %d queries", dss->getNameWithAddr(), failures, samples);
+  dss->upStatus = false;
+  ++dss->passiveHealthCheckDowns;
+  if (g_snmpAgent && g_snmpTrapsEnabled) {
+    g_snmpAgent->sendBackendStatusChangeTrap(dss);
+  }
+}
+
 static bool handleResponse(std::shared_ptr<HealthCheckData>& data)
 {
   auto& ds = data->d_ds;
@@ -43,6 +43,9 @@ struct HealthCheckData
 extern bool g_verboseHealthChecks;
 
 void updateHealthCheckResult(const std::shared_ptr<DownstreamState>& dss, bool newState);
+/* record the outcome of a live query, marking the backend down right away
+   if too many queries failed recently and passive health checks are enabled */
+void updatePassiveHealthCheckResult(const std::shared_ptr<DownstreamState>& dss, bool failed);
 bool queueHealthCheck(std::shared_ptr<FDMultiplexer>& mplexer, const std::shared_ptr<DownstreamState>& ds, bool initial=false);
 void handleQueuedHealthChecks(std::shared_ptr<FDMultiplexer>& mplexer, bool initial=false);
 
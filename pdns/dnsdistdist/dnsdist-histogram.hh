@@ -0,0 +1 @@
+../dnsdist-histogram.hh
\ No newline at end of file
@@ -25,6 +25,29 @@
 
 #include <sys/stat.h>
 
+bool KeyValueLookupKey::lookup(KeyValueStore& kvs, const DNSQuestion& dq, std::string* value)
+{
+  for (const auto& key : getKeys(dq)) {
+    if (value != nullptr ? kvs.getValue(key, *value) : kvs.keyExists(key)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool KeyValueStore::getLongestSuffixMatch(const std::string& name, const std::vector<size_t>& offsets, std::string* value)
+{
+  for (const auto offset : offsets) {
+    const auto key = name.substr(offset);
+    if (value != nullptr ? getValue(key, *value) : keyExists(key)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 std::vector<std::string> KeyValueLookupKeySourceIP::getKeys(const ComboAddress& addr)
 {
   std::vector<std::string> result;
@@ -71,54 +94,300 @@ std::vector<std::string> KeyValueLookupKeySuffix::getKeys(const DNSName& qname)
   return result;
 }
 
+bool KeyValueLookupKeySuffix::getSuffixes(const DNSName& qname, std::string& name, std::vector<size_t>& offsets) const
+{
+  offsets.clear();
+
+  if (qname.empty() || qname.isRoot()) {
+    return false;
+  }
+
+  size_t labelsCount = qname.countLabels();
+  if (d_minLabels != 0) {
+    if (labelsCount < d_minLabels) {
+      return false;
+    }
+    labelsCount -= (d_minLabels - 1);
+  }
+
+  offsets.reserve(labelsCount);
+
+  if (d_wireFormat) {
+    name = qname.toDNSStringLC();
+    size_t pos = 0;
+    while (labelsCount > 0 && pos < name.size() && name.at(pos) != 0) {
+      offsets.push_back(pos);
+      pos += static_cast<uint8_t>(name.at(pos)) + 1;
+      labelsCount--;
+    }
+  }
+  else {
+    name = qname.makeLowerCase().toStringRootDot();
+    /* a suffix starts after every unescaped dot, escaped characters being either '\X' or '\DDD' */
+    size_t pos = 0;
+    offsets.push_back(pos);
+    labelsCount--;
+    while (labelsCount > 0 && pos < name.size()) {
+      if (name.at(pos) == '\\') {
+        pos += (pos + 1 < name.size() && isdigit(static_cast<unsigned char>(name.at(pos + 1)))) ? 4 : 2;
+      }
+      else if (name.at(pos) == '.') {
+        pos++;
+        if (pos < name.size()) {
+          offsets.push_back(pos);
+          labelsCount--;
+        }
+      }
+      else {
+        pos++;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool KeyValueLookupKeySuffix::lookup(const DNSName& qname, KeyValueStore& kvs, std::string* value) const
+{
+  std::string name;
+  std::vector<size_t> offsets;
+  if (!getSuffixes(qname, name, offsets)) {
+    return false;
+  }
+
+  return kvs.getLongestSuffixMatch(name, offsets, value);
+}
+
 #ifdef HAVE_LMDB
 
-bool LMDBKVStore::getValue(const std::string& key, std::string& value)
+thread_local std::unordered_map<uint64_t, std::unique_ptr<LMDBKVStore::LocalTransaction>> LMDBKVStore::t_transactions;
+std::atomic<uint64_t> LMDBKVStore::s_nextID{0};
+
+LMDBKVStore::LocalTransaction::~LocalTransaction()
 {
-  try {
-    auto transaction = d_env.getROTransaction();
-    auto dbi = transaction->openDB(d_dbName, 0);
-    MDBOutVal result;
-    int rc = transaction->get(dbi, MDBInVal(key), result);
+  if (d_txn != nullptr) {
+    mdb_txn_abort(d_txn);
+  }
+}
+
+MDB_txn* LMDBKVStore::LocalTransaction::renew()
+{
+  if (d_txn != nullptr) {
+    int rc = mdb_txn_renew(d_txn);
     if (rc == 0) {
-      value = result.get<std::string>();
-      return true;
+      d_active = true;
+      return d_txn;
     }
-    else if (rc == MDB_NOTFOUND) {
-      return false;
+    /* most likely the map has been resized by a writer, start over with a new transaction */
+    mdb_txn_abort(d_txn);
+    d_txn = nullptr;
+  }
+
+  for (size_t tries = 0; tries < 3; tries++) {
+    int rc = mdb_txn_begin(d_env->d_env, nullptr, MDB_RDONLY, &d_txn);
+    if (rc == 0) {
+      d_active = true;
+      return d_txn;
+    }
+    d_txn = nullptr;
+    if (rc != MDB_MAP_RESIZED) {
+      throw std::runtime_error("Unable to start RO transaction: " + std::string(mdb_strerror(rc)));
     }
+    /* adopt the new size */
+    mdb_env_set_mapsize(d_env->d_env, 0);
   }
-  catch(const std::exception& e) {
-    warnlog("Error while looking up key '%s' from LMDB file '%s', database '%s': %s", key, d_fname, d_dbName, e.what());
+
+  throw std::runtime_error("Unable to start RO transaction after the map has been resized");
+}
+
+void LMDBKVStore::LocalTransaction::reset()
+{
+  if (d_active) {
+    mdb_txn_reset(d_txn);
+    d_active = false;
   }
-  return false;
 }
 
-bool LMDBKVStore::keyExists(const std::string& key)
+LMDBKVStore::LMDBKVStore(const std::string& fname, const std::string& dbName): d_env(std::make_shared<MDBEnv>(fname.c_str(), MDB_NOSUBDIR, 0600)), d_fname(fname), d_dbName(dbName), d_id(s_nextID++)
 {
   try {
-    auto transaction = d_env.getROTransaction();
-    auto dbi = transaction->openDB(d_dbName, 0);
-    MDBOutVal result;
-    int rc = transaction->get(dbi, MDBInVal(key), result);
-    if (rc == 0) {
-      return true;
+    /* the handle stays valid for the lifetime of the environment */
+    openDB();
+  }
+  catch (const std::exception& e) {
+    warnlog("Error while opening database '%s' from LMDB file '%s': %s", d_dbName, d_fname, e.what());
+  }
+}
+
+LMDBKVStore::~LMDBKVStore()
+{
+  /* the transactions of the other threads keep the environment open until they exit */
+  t_transactions.erase(d_id);
+}
+
+/* The database could not be opened at setup time, most likely because it did not exist yet.
+   This is called from the query path, so it uses a read-only transaction and does not try
+   more than once per second. */
+bool LMDBKVStore::openDBIfNeeded()
+{
+  if (d_dbiOpened) {
+    return true;
+  }
+
+  const time_t now = time(nullptr);
+  if (d_lastOpenAttempt == now) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(d_dbiLock);
+  if (d_dbiOpened) {
+    return true;
+  }
+  if (d_lastOpenAttempt == now) {
+    return false;
+  }
+  d_lastOpenAttempt = now;
+
+  openDB();
+  return true;
+}
+
+/* opens the database from a read-only transaction, so we never take the writer lock */
+void LMDBKVStore::openDB()
+{
+  MDB_txn* txn = nullptr;
+  int rc = mdb_txn_begin(d_env->d_env, nullptr, MDB_RDONLY, &txn);
+  if (rc != 0) {
+    throw std::runtime_error("Unable to start RO transaction: " + std::string(mdb_strerror(rc)));
+  }
+
+  rc = mdb_dbi_open(txn, d_dbName.empty() ? nullptr : d_dbName.c_str(), 0, &d_dbi.d_dbi);
+  if (rc != 0) {
+    mdb_txn_abort(txn);
+    throw std::runtime_error("Unable to open named database: " + std::string(mdb_strerror(rc)));
+  }
+
+  /* committing makes the handle available to the other transactions */
+  rc = mdb_txn_commit(txn);
+  if (rc != 0) {
+    throw std::runtime_error("Unable to commit RO transaction: " + std::string(mdb_strerror(rc)));
+  }
+
+  d_dbiOpened = true;
+}
+
+bool LMDBKVStore::get(MDB_txn* txn, const std::string_view& key, std::string* value)
+{
+  MDB_val keyVal;
+  keyVal.mv_size = key.size();
+  keyVal.mv_data = const_cast<char*>(key.data());
+  MDB_val result;
+
+  int rc = mdb_get(txn, d_dbi, &keyVal, &result);
+  if (rc == 0) {
+    /* the data is only valid until the transaction is reset */
+    if (value != nullptr) {
+      value->assign(static_cast<const char*>(result.mv_data), result.mv_size);
     }
-    else if (rc == MDB_NOTFOUND) {
+    return true;
+  }
+  else if (rc == MDB_NOTFOUND) {
+    return false;
+  }
+
+  throw std::runtime_error("getting data: " + std::string(mdb_strerror(rc)));
+}
+
+template<typename F> bool LMDBKVStore::lookup(const std::string& key, F&& func)
+{
+  struct timespec start;
+  gettime(&start);
+
+  bool found = false;
+  LocalTransaction* transaction = nullptr;
+  try {
+    if (!openDBIfNeeded()) {
+      /* we tried less than a second ago, no need to log again */
+      ++d_errors;
       return false;
     }
+
+    auto& local = t_transactions[d_id];
+    if (!local) {
+      local = std::make_unique<LocalTransaction>(d_env);
+    }
+    transaction = local.get();
+
+    found = func(transaction->renew());
+    if (found) {
+      ++d_hits;
+    }
+    else {
+      ++d_misses;
+    }
   }
   catch(const std::exception& e) {
+    ++d_errors;
     warnlog("Error while looking up key '%s' from LMDB file '%s', database '%s': %s", key, d_fname, d_dbName, e.what());
   }
-  return false;
+
+  if (transaction != nullptr) {
+    transaction->reset();
+  }
+
+  struct timespec end;
+  gettime(&end);
+  d_lookupTimeNSec += (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
+
+  return found;
+}
+
+bool LMDBKVStore::getValue(const std::string& key, std::string& value)
+{
+  return lookup(key, [this, &key, &value](MDB_txn* txn) {
+    return get(txn, key, &value);
+  });
+}
+
+bool LMDBKVStore::keyExists(const std::string& key)
+{
+  return lookup(key, [this, &key](MDB_txn* txn) {
+    return get(txn, key, nullptr);
+  });
+}
+
+bool LMDBKVStore::getLongestSuffixMatch(const std::string& name, const std::vector<size_t>& offsets, std::string* value)
+{
+  /* all the suffixes are looked up inside the same transaction */
+  return lookup(name, [this, &name, &offsets, value](MDB_txn* txn) {
+    const std::string_view view(name);
+    for (const auto offset : offsets) {
+      if (get(txn, view.substr(offset), value)) {
+        return true;
+      }
+    }
+    return false;
+  });
+}
+
+std::unordered_map<std::string, uint64_t> LMDBKVStore::getStats() const
+{
+  return {
+    {"hits", d_hits.load()},
+    {"misses", d_misses.load()},
+    {"errors", d_errors.load()},
+    {"lookupTimeNSec", d_lookupTimeNSec.load()},
+  };
 }
 
 #endif /* HAVE_LMDB */
 
 #ifdef HAVE_CDB
 
-CDBKVStore::CDBKVStore(const std::string& fname, time_t refreshDelay): d_fname(fname), d_refreshDelay(refreshDelay)
+thread_local std::unordered_map<uint64_t, CDBKVStore::LocalCDB> CDBKVStore::t_localCDBs;
+std::atomic<uint64_t> CDBKVStore::s_nextID{0};
+
+CDBKVStore::CDBKVStore(const std::string& fname, time_t refreshDelay): d_fname(fname), d_id(s_nextID++), d_refreshDelay(refreshDelay)
 {
   d_refreshing.clear();
 
@@ -131,19 +400,34 @@ CDBKVStore::CDBKVStore(const std::string& fname, time_t refreshDelay): d_fname(f
 }
 
 CDBKVStore::~CDBKVStore() {
+  t_localCDBs.erase(d_id);
 }
 
 bool CDBKVStore::reload(const struct stat& st)
 {
-  auto newCDB = std::unique_ptr<CDB>(new CDB(d_fname));
+  auto newCDB = std::make_shared<const CDB>(d_fname);
   {
-    WriteLock wl(&d_lock);
+    std::lock_guard<std::mutex> lock(d_lock);
     d_cdb = std::move(newCDB);
+    ++d_generation;
   }
   d_mtime = st.st_mtime;
   return true;
 }
 
+/* the returned pointer is only valid until the next call from the same thread */
+const CDB* CDBKVStore::getCDB()
+{
+  auto& local = t_localCDBs[d_id];
+  auto generation = d_generation.load();
+  if (local.d_generation != generation) {
+    std::lock_guard<std::mutex> lock(d_lock);
+    local.d_cdb = d_cdb;
+    local.d_generation = d_generation.load();
+  }
+  return local.d_cdb.get();
+}
+
 bool CDBKVStore::reload()
 {
   struct stat st;
@@ -182,7 +466,7 @@ void CDBKVStore::refreshDBIfNeeded(time_t now)
   }
 }
 
-bool CDBKVStore::getValue(const std::string& key, std::string& value)
+template<typename F> bool CDBKVStore::lookup(const std::string& key, F&& func)
 {
   time_t now = time(nullptr);
 
@@ -191,12 +475,12 @@ bool CDBKVStore::getValue(const std::string& key, std::string& value)
       refreshDBIfNeeded(now);
     }
 
-    {
-      ReadLock rl(&d_lock);
-      if (d_cdb && d_cdb->findOne(key, value)) {
-        return true;
-      }
+    const auto cdb = getCDB();
+    if (!cdb) {
+      return false;
     }
+
+    return func(*cdb);
   }
   catch(const std::exception& e) {
     warnlog("Error while looking up key '%s' from CDB file '%s': %s", key, d_fname, e.what());
@@ -204,28 +488,33 @@ bool CDBKVStore::getValue(const std::string& key, std::string& value)
   return false;
 }
 
-bool CDBKVStore::keyExists(const std::string& key)
+bool CDBKVStore::getValue(const std::string& key, std::string& value)
 {
-  time_t now = time(nullptr);
+  return lookup(key, [&key, &value](const CDB& cdb) {
+    return cdb.findOne(key, value);
+  });
+}
 
-  try {
-    if (d_nextCheck != 0 && now >= d_nextCheck) {
-      refreshDBIfNeeded(now);
-    }
+bool CDBKVStore::keyExists(const std::string& key)
+{
+  return lookup(key, [&key](const CDB& cdb) {
+    return cdb.keyExists(key);
+  });
+}
 
-    {
-      ReadLock rl(&d_lock);
-      if (!d_cdb) {
-        return false;
+bool CDBKVStore::getLongestSuffixMatch(const std::string& name, const std::vector<size_t>& offsets, std::string* value)
+{
+  /* the suffixes are probed directly in the mapping, without building a key for each of them */
+  return lookup(name, [&name, &offsets, value](const CDB& cdb) {
+    const std::string_view view(name);
+    for (const auto offset : offsets) {
+      const auto key = view.substr(offset);
+      if (value != nullptr ? cdb.findOne(key, *value) : cdb.keyExists(key)) {
+        return true;
       }
-
-      return d_cdb->keyExists(key);
     }
-  }
-  catch(const std::exception& e) {
-    warnlog("Error while looking up key '%s' from CDB file '%s': %s", key, d_fname, e.what());
-  }
-  return false;
+    return false;
+  });
 }
 
 #endif /* HAVE_CDB */
@@ -23,6 +23,8 @@
 
 #include "dnsdist.hh"
 
+class KeyValueStore;
+
 class KeyValueLookupKey
 {
 public:
@@ -31,6 +33,10 @@ public:
   }
   virtual std::vector<std::string> getKeys(const DNSQuestion&) = 0;
   virtual std::string toString() const = 0;
+  /* Look up our keys into the store, stopping at the first match. If value is not nullptr,
+     it is filled with the value associated to that key. The default implementation does one
+     store lookup per key returned by getKeys(). */
+  virtual bool lookup(KeyValueStore& kvs, const DNSQuestion& dq, std::string* value);
 };
 
 class KeyValueLookupKeySourceIP: public KeyValueLookupKey
@@ -103,6 +109,18 @@ public:
     return getKeys(*dq.qname);
   }
 
+  /* Every key returned by getKeys() is a suffix of the first one, so instead of
+     building them all we can return the longest one, along with the offset at which
+     each of the keys starts, from the longest to the shortest. */
+  bool getSuffixes(const DNSName& qname, std::string& name, std::vector<size_t>& offsets) const;
+
+  bool lookup(const DNSName& qname, KeyValueStore& kvs, std::string* value) const;
+
+  bool lookup(KeyValueStore& kvs, const DNSQuestion& dq, std::string* value) override
+  {
+    return lookup(*dq.qname, kvs, value);
+  }
+
   std::string toString() const override
   {
     if (d_minLabels > 0) {
@@ -152,10 +170,20 @@ public:
 
   virtual bool keyExists(const std::string& key) = 0;
   virtual bool getValue(const std::string& key, std::string& value) = 0;
+  /* Look for the longest suffix of 'name' present in the store, the suffixes to consider
+     starting at the positions listed in 'offsets', from the longest to the shortest.
+     If value is not nullptr, it is filled with the value associated to that suffix.
+     Stores should override this to do all the lookups in a single operation, the default
+     implementation doing one keyExists() or getValue() call per suffix. */
+  virtual bool getLongestSuffixMatch(const std::string& name, const std::vector<size_t>& offsets, std::string* value);
   virtual bool reload()
   {
     return false;
   }
+  virtual std::unordered_map<std::string, uint64_t> getStats() const
+  {
+    return {};
+  }
 };
 
 #ifdef HAVE_LMDB
@@ -165,17 +193,58 @@ public:
 class LMDBKVStore: public KeyValueStore
 {
 public:
-  LMDBKVStore(const std::string& fname, const std::string& dbName): d_env(fname.c_str(), MDB_NOSUBDIR, 0600), d_fname(fname), d_dbName(dbName)
-  {
-  }
+  LMDBKVStore(const std::string& fname, const std::string& dbName);
+  ~LMDBKVStore();
 
   bool keyExists(const std::string& key) override;
   bool getValue(const std::string& key, std::string& value) override;
+  bool getLongestSuffixMatch(const std::string& name, const std::vector<size_t>& offsets, std::string* value) override;
+  std::unordered_map<std::string, uint64_t> getStats() const override;
 
 private:
-  MDBEnv d_env;
+  /* A read-only transaction owned by a given thread, which is reset after every lookup
+     and renewed before the next one, so that a lookup does not have to allocate a new
+     transaction and a reader slot, but only costs a B-tree walk. It holds a reference to
+     the environment because it might outlive the store. */
+  class LocalTransaction
+  {
+  public:
+    LocalTransaction(std::shared_ptr<MDBEnv> env): d_env(std::move(env))
+    {
+    }
+    ~LocalTransaction();
+    LocalTransaction(const LocalTransaction&) = delete;
+    LocalTransaction& operator=(const LocalTransaction&) = delete;
+
+    MDB_txn* renew();
+    void reset();
+
+  private:
+    std::shared_ptr<MDBEnv> d_env;
+    MDB_txn* d_txn{nullptr};
+    bool d_active{false};
+  };
+
+  template<typename F> bool lookup(const std::string& key, F&& func);
+  bool get(MDB_txn* txn, const std::string_view& key, std::string* value);
+  void openDB();
+  bool openDBIfNeeded();
+
+  static thread_local std::unordered_map<uint64_t, std::unique_ptr<LocalTransaction>> t_transactions;
+  static std::atomic<uint64_t> s_nextID;
+
+  std::shared_ptr<MDBEnv> d_env;
   std::string d_fname;
   std::string d_dbName;
+  std::mutex d_dbiLock;
+  MDBDbi d_dbi;
+  const uint64_t d_id;
+  std::atomic<bool> d_dbiOpened{false};
+  std::atomic<time_t> d_lastOpenAttempt{0};
+  stat_t d_hits{0};
+  stat_t d_misses{0};
+  stat_t d_errors{0};
+  stat_t d_lookupTimeNSec{0};
 };
 
 #endif /* HAVE_LMDB */
@@ -192,19 +261,36 @@ public:
 
   bool keyExists(const std::string& key) override;
   bool getValue(const std::string& key, std::string& value) override;
+  bool getLongestSuffixMatch(const std::string& name, const std::vector<size_t>& offsets, std::string* value) override;
   bool reload() override;
 
 private:
   void refreshDBIfNeeded(time_t now);
   bool reload(const struct stat& st);
+  const CDB* getCDB();
+  template<typename F> bool lookup(const std::string& key, F&& func);
+
+  /* Lookups are done without any lock: every thread keeps its own reference to the
+     current database, and only takes d_lock to pick up a new one after a reload has
+     bumped d_generation. The old mapping goes away once the last thread has let go of it,
+     which for a thread that never does a lookup again only happens when it exits. */
+  struct LocalCDB
+  {
+    std::shared_ptr<const CDB> d_cdb{nullptr};
+    uint64_t d_generation{0};
+  };
+  static thread_local std::unordered_map<uint64_t, LocalCDB> t_localCDBs;
+  static std::atomic<uint64_t> s_nextID;
 
-  std::unique_ptr<CDB> d_cdb{nullptr};
+  std::shared_ptr<const CDB> d_cdb{nullptr};
   std::string d_fname;
-  ReadWriteLock d_lock;
+  std::mutex d_lock;
+  const uint64_t d_id;
+  std::atomic<uint64_t> d_generation{0};
   time_t d_mtime{0};
   time_t d_nextCheck{0};
   time_t d_refreshDelay{0};
   std::atomic_flag d_refreshing;
 };
 
-#endif /* HAVE_LMDB */
+#endif /* HAVE_CDB */
@@ -66,6 +66,73 @@ shared_ptr<DownstreamState> firstAvailable(const ServerPolicy::NumberedServerVec
   return leastOutstanding(servers, dq);
 }
 
+static double peakEWMACost(const DownstreamState& server)
+{
+  /* a backend we have no latency data for yet is assumed to be fast, but its cost
+     still grows with the number of queries we already sent its way */
+  auto latency = server.peakLatencyUsec.load();
+  if (latency < 1.0) {
+    latency = 1.0;
+  }
+  return latency * (server.outstanding.load() + 1);
+}
+
+// pick two distinct available servers at random, and keep the one with the lowest peak latency * (outstanding + 1) cost
+shared_ptr<DownstreamState> peakEWMA(const ServerPolicy::NumberedServerVector& servers, const DNSQuestion* dq)
+{
+  size_t usable = 0;
+  for (const auto& d : servers) {
+    if (d.second->isUp()) {
+      ++usable;
+    }
+  }
+
+  if (usable == 0) {
+    return shared_ptr<DownstreamState>();
+  }
+
+  size_t firstChoice = 0;
+  size_t secondChoice = 0;
+  if (usable > 1) {
+    firstChoice = random() % usable;
+    secondChoice = random() % (usable - 1);
+    if (secondChoice >= firstChoice) {
+      ++secondChoice;
+    }
+  }
+
+  const DownstreamState* first = nullptr;
+  const DownstreamState* second = nullptr;
+  size_t firstPosition = 0;
+  size_t secondPosition = 0;
+  size_t position = 0;
+  size_t upIndex = 0;
+  for (const auto& d : servers) {
+    if (d.second->isUp()) {
+      if (upIndex == firstChoice) {
+        first = d.second.get();
+        firstPosition = position;
+      }
+      if (upIndex == secondChoice) {
+        second = d.second.get();
+        secondPosition = position;
+      }
+      ++upIndex;
+    }
+    ++position;
+  }
+
+  /* the availability of a server might have changed while we were looking */
+  if (first == nullptr || second == nullptr) {
+    return leastOutstanding(servers, dq);
+  }
+
+  if (peakEWMACost(*second) < peakEWMACost(*first)) {
+    return servers.at(secondPosition).second;
+  }
+  return servers.at(firstPosition).second;
+}
+
 double g_weightedBalancingFactor = 0;
 
 static shared_ptr<DownstreamState> valrandom(unsigned int val, const ServerPolicy::NumberedServerVector& servers)
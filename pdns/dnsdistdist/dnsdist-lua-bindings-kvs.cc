@@ -96,11 +96,7 @@ void setupLuaBindingsKVS(LuaContext& luaCtx, bool client)
     }
 
     KeyValueLookupKeySuffix lookup(minLabels ? *minLabels : 0, wireFormat ? *wireFormat : true);
-    for (const auto& key : lookup.getKeys(dn)) {
-      if (kvs->getValue(key, result)) {
-        return result;
-      }
-    }
+    lookup.lookup(dn, *kvs, &result);
 
     return result;
   });
@@ -112,4 +108,12 @@ void setupLuaBindingsKVS(LuaContext& luaCtx, bool client)
 
     return kvs->reload();
   });
+
+  luaCtx.registerFunction<std::unordered_map<std::string, uint64_t>(std::shared_ptr<KeyValueStore>::*)()const>("getStats", [](const std::shared_ptr<KeyValueStore>& kvs) {
+    if (!kvs) {
+      return std::unordered_map<std::string, uint64_t>();
+    }
+
+    return kvs->getStats();
+  });
 }
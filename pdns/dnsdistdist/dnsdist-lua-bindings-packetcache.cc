@@ -34,6 +34,7 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx)
 
       bool keepStaleData = false;
       size_t maxTTL = 86400;
+      size_t maxBytes = 0;
       size_t minTTL = 0;
       size_t tempFailTTL = 60;
       size_t maxNegativeTTL = 3600;
@@ -43,6 +44,8 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx)
       bool deferrableInsertLock = true;
       bool ecsParsing = false;
       bool cookieHashing = false;
+      size_t localCacheSize = 0;
+      size_t localCacheMaxTTL = 5;
 
       if (vars) {
 
@@ -58,6 +61,18 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx)
           keepStaleData = boost::get<bool>((*vars)["keepStaleData"]);
         }
 
+        if (vars->count("localCacheMaxTTL")) {
+          localCacheMaxTTL = boost::get<size_t>((*vars)["localCacheMaxTTL"]);
+        }
+
+        if (vars->count("localCacheSize")) {
+          localCacheSize = boost::get<size_t>((*vars)["localCacheSize"]);
+        }
+
+        if (vars->count("maxBytes")) {
+          maxBytes = boost::get<size_t>((*vars)["maxBytes"]);
+        }
+
         if (vars->count("maxNegativeTTL")) {
           maxNegativeTTL = boost::get<size_t>((*vars)["maxNegativeTTL"]);
         }
@@ -95,6 +110,8 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx)
 
       res->setKeepStaleData(keepStaleData);
       res->setCookieHashing(cookieHashing);
+      res->setMaxBytes(maxBytes);
+      res->setLocalCache(localCacheSize, localCacheMaxTTL);
 
       return res;
     });
@@ -148,6 +165,11 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx)
         g_outputBuffer+="Lookup Collisions: " + std::to_string(cache->getLookupCollisions()) + "\n";
         g_outputBuffer+="Insert Collisions: " + std::to_string(cache->getInsertCollisions()) + "\n";
         g_outputBuffer+="TTL Too Shorts: " + std::to_string(cache->getTTLTooShorts()) + "\n";
+        g_outputBuffer+="Bytes: " + std::to_string(cache->getBytes()) + "/" + std::to_string(cache->getMaxBytes()) + "\n";
+        g_outputBuffer+="Evictions for space: " + std::to_string(cache->getSpaceEvictions()) + "\n";
+        g_outputBuffer+="Expired evictions: " + std::to_string(cache->getExpiredEvictions()) + "\n";
+        g_outputBuffer+="Expunged entries: " + std::to_string(cache->getExpungedEntries()) + "\n";
+        g_outputBuffer+="Local hits: " + std::to_string(cache->getLocalHits()) + "\n";
       }
     });
   luaCtx.registerFunction<std::unordered_map<std::string, uint64_t>(std::shared_ptr<DNSDistPacketCache>::*)()const>("getStats", [](const std::shared_ptr<DNSDistPacketCache>& cache) {
@@ -162,6 +184,12 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx)
         stats["lookupCollisions"] = cache->getLookupCollisions();
         stats["insertCollisions"] = cache->getInsertCollisions();
         stats["ttlTooShorts"] = cache->getTTLTooShorts();
+        stats["bytes"] = cache->getBytes();
+        stats["maxBytes"] = cache->getMaxBytes();
+        stats["spaceEvictions"] = cache->getSpaceEvictions();
+        stats["expiredEvictions"] = cache->getExpiredEvictions();
+        stats["expungedEntries"] = cache->getExpungedEntries();
+        stats["localHits"] = cache->getLocalHits();
       }
       return stats;
     });
@@ -1101,14 +1101,7 @@ public:
 
   bool matches(const DNSQuestion* dq) const override
   {
-    std::vector<std::string> keys = d_key->getKeys(*dq);
-    for (const auto& key : keys) {
-      if (d_kvs->keyExists(key) == true) {
-        return true;
-      }
-    }
-
-    return false;
+    return d_key->lookup(*d_kvs, *dq, nullptr);
   }
 
   string toString() const override
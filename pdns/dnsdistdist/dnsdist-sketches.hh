@@ -0,0 +1 @@
+../dnsdist-sketches.hh
\ No newline at end of file
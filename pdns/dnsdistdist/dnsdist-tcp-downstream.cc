@@ -1,4 +1,6 @@
 
+#include "dnsdist-buffer-pool.hh"
+#include "dnsdist-healthchecks.hh"
 #include "dnsdist-tcp-downstream.hh"
 #include "dnsdist-tcp-upstream.hh"
 
@@ -147,6 +149,12 @@ void TCPConnectionToBackend::handleIO(std::shared_ptr<TCPConnectionToBackend>& c
       // backend dies on us)
       // We also might need to read and send to the client more than one response in case of XFR (yeah!)
       // should very likely be a TCPIOHandler
+      if (conn->d_currentPos == 0 && conn->d_responseBuffer.capacity() < s_maxPacketCacheEntrySize) {
+        /* the previous buffer has been handed over with the response, borrow a new one */
+        auto& pool = PacketBufferPool::getThreadLocal();
+        pool.release(std::move(conn->d_responseBuffer));
+        conn->d_responseBuffer = pool.acquire(s_maxPacketCacheEntrySize);
+      }
       conn->d_responseBuffer.resize(sizeof(uint16_t));
       iostate = tryRead(fd, conn->d_responseBuffer, conn->d_currentPos, sizeof(uint16_t) - conn->d_currentPos);
       if (iostate == IOState::Done) {
@@ -390,6 +398,11 @@ void TCPConnectionToBackend::handleTimeout(const struct timeval& now, bool write
     ++d_ds->tcpReadTimeouts;
   }
 
+  if (!d_usedForXFR && (!d_pendingResponses.empty() || d_state == State::sendingQueryToBackend)) {
+    d_ds->updatePeakLatencyOnTimeout(write ? d_ds->tcpSendTimeout : d_ds->tcpRecvTimeout);
+    updatePassiveHealthCheckResult(d_ds, true);
+  }
+
   if (d_ioState) {
     d_ioState->reset();
   }
@@ -489,6 +502,8 @@ IOState TCPConnectionToBackend::handleResponse(std::shared_ptr<TCPConnectionToBa
     }
 
     auto ids = std::move(it->second.d_idstate);
+    /* the query will not need to be sent again, so its buffer can be reused */
+    PacketBufferPool::getThreadLocal().release(std::move(it->second.d_buffer));
     d_pendingResponses.erase(it);
     DEBUGLOG("passing response to client connection for "<<ids.qname);
     /* marking as idle for now, so we can accept new queries if our queues are empty */
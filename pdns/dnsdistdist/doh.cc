@@ -9,6 +9,10 @@
 #include <thread>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
 #include <h2o.h>
 //#include <h2o/http1.h>
 #include <h2o/http2.h>
@@ -24,7 +28,9 @@
 #include "dns.hh"
 #include "dolog.hh"
 #include "dnsdist-ecs.hh"
+#include "dnsdist-healthchecks.hh"
 #include "dnsdist-proxy-protocol.hh"
+#include "dnsdist-rings.hh"
 #include "dnsdist-rules.hh"
 #include "dnsdist-xpf.hh"
 #include "libssl.hh"
@@ -165,12 +171,131 @@ private:
   std::atomic_flag d_rotatingTicketsKey;
 };
 
+/* Cache of the final responses to GET queries, keyed on the raw request path and the
+   address of the client, so that a hit does not require base64 decoding nor parsing
+   the query, while still returning the same response that the client got before even
+   if rules, ECS or the selected pool depend on its address. The ID of the query is not
+   part of the key, and is restored in the response when serving a hit.
+   A hit skips every rule except dynamic blocks, so only responses that have been inserted into
+   the packet cache of a pool are stored, with the TTL limits of that cache.
+   When the cache is full the oldest entry is evicted.
+   Only ever accessed from the main DoH thread, so no locking is needed. */
+class DOHGetResponsesCache
+{
+public:
+  DOHGetResponsesCache(size_t maxEntries): d_maxEntries(maxEntries)
+  {
+  }
+
+  bool get(const std::string& key, uint16_t queryId, time_t now, PacketBuffer& response, DNSName& qname, uint16_t& qtype)
+  {
+    auto& index = d_entries.get<KeyTag>();
+    auto it = index.find(key);
+    if (it == index.end()) {
+      return false;
+    }
+
+    if (now < it->d_added || now >= it->d_validity) {
+      index.erase(it);
+      return false;
+    }
+
+    response = it->d_response;
+    qname = it->d_qname;
+    qtype = it->d_qtype;
+    dnsheader* dh = reinterpret_cast<dnsheader*>(response.data());
+    dh->id = queryId;
+
+    const uint32_t age = static_cast<uint32_t>(now - it->d_added);
+    if (age > 0) {
+      ageDNSPacket(reinterpret_cast<char*>(response.data()), response.size(), age);
+    }
+    return true;
+  }
+
+  /* the TTL limits of the pool packet cache the response was inserted into are applied, so that an entry
+     does not outlive the one in that cache */
+  void insert(std::string&& key, const PacketBuffer& response, time_t now, const DNSDistPacketCache& packetCache)
+  {
+    if (response.size() < sizeof(dnsheader)) {
+      return;
+    }
+
+    const dnsheader* dh = reinterpret_cast<const dnsheader*>(response.data());
+    if (!dh->qr || dh->tc || ntohs(dh->qdcount) != 1 || (dh->rcode != RCode::NoError && dh->rcode != RCode::NXDomain)) {
+      return;
+    }
+
+    auto minTTL = packetCache.getCacheTTL(response, dh->rcode);
+    if (!minTTL || *minTTL == 0) {
+      return;
+    }
+
+    Entry entry;
+    try {
+      /* kept so that a hit can be checked against dynamic blocks and inserted into the rings */
+      entry.d_qname = DNSName(reinterpret_cast<const char*>(response.data()), response.size(), sizeof(dnsheader), false, &entry.d_qtype);
+    }
+    catch (const std::exception& e) {
+      return;
+    }
+
+    entry.d_key = std::move(key);
+    entry.d_response = response;
+    entry.d_added = now;
+    entry.d_validity = now + *minTTL;
+    reinterpret_cast<dnsheader*>(entry.d_response.data())->id = 0;
+
+    auto& index = d_entries.get<KeyTag>();
+    auto it = index.find(entry.d_key);
+    if (it != index.end()) {
+      index.replace(it, std::move(entry));
+      return;
+    }
+
+    auto& sequence = d_entries.get<SequencedTag>();
+    if (sequence.size() >= d_maxEntries) {
+      sequence.pop_front();
+    }
+    sequence.push_back(std::move(entry));
+  }
+
+private:
+  struct Entry
+  {
+    std::string d_key;
+    PacketBuffer d_response;
+    DNSName d_qname;
+    time_t d_added{0};
+    time_t d_validity{0};
+    uint16_t d_qtype{0};
+  };
+
+  struct KeyTag {};
+  struct SequencedTag {};
+
+  typedef boost::multi_index_container<
+    Entry,
+    boost::multi_index::indexed_by<
+      boost::multi_index::hashed_unique<boost::multi_index::tag<KeyTag>, boost::multi_index::member<Entry, std::string, &Entry::d_key>>,
+      boost::multi_index::sequenced<boost::multi_index::tag<SequencedTag>>
+    >
+  > entries_t;
+
+  entries_t d_entries;
+  const size_t d_maxEntries;
+};
+
 // we create one of these per thread, and pass around a pointer to it
 // through the bowels of h2o
 struct DOHServerConfig
 {
-  DOHServerConfig(uint32_t idleTimeout, uint32_t internalPipeBufferSize): accept_ctx(std::make_shared<DOHAcceptContext>())
+  DOHServerConfig(uint32_t idleTimeout, uint32_t internalPipeBufferSize, size_t getResponsesCacheSize): accept_ctx(std::make_shared<DOHAcceptContext>())
   {
+    if (getResponsesCacheSize > 0) {
+      getResponsesCache = std::unique_ptr<DOHGetResponsesCache>(new DOHGetResponsesCache(getResponsesCacheSize));
+    }
+
     int fd[2];
     if (pipe(fd) < 0) {
       unixDie("Creating a pipe for DNS over HTTPS");
@@ -212,6 +337,7 @@ struct DOHServerConfig
   std::shared_ptr<DOHAcceptContext> accept_ctx{nullptr};
   ClientState* cs{nullptr};
   std::shared_ptr<DOHFrontend> df{nullptr};
+  std::unique_ptr<DOHGetResponsesCache> getResponsesCache{nullptr};
   int dohquerypair[2]{-1,-1};
   int dohresponsepair[2]{-1,-1};
 };
@@ -526,6 +652,7 @@ static int processDOHQuery(DOHUnit* du)
       ++ss->reuseds;
       ++g_stats.downstreamTimeouts;
       handleDOHTimeout(oldDU);
+      updatePassiveHealthCheckResult(ss, true);
     }
 
     ids->origFD = 0;
@@ -655,7 +782,7 @@ static void on_generator_dispose(void *_self)
 /* This executes in the main DoH thread.
    We allocate a DOHUnit and send it to dnsdistclient() function in the doh client thread
    via a pipe */
-static void doh_dispatch_query(DOHServerConfig* dsc, h2o_handler_t* self, h2o_req_t* req, PacketBuffer&& query, const ComboAddress& local, const ComboAddress& remote, std::string&& path)
+static void doh_dispatch_query(DOHServerConfig* dsc, h2o_handler_t* self, h2o_req_t* req, PacketBuffer&& query, const ComboAddress& local, const ComboAddress& remote, std::string&& path, std::string&& getCacheKey)
 {
   try {
     /* we only parse it there as a sanity check, we will parse it again later */
@@ -670,6 +797,7 @@ static void doh_dispatch_query(DOHServerConfig* dsc, h2o_handler_t* self, h2o_re
     du->rsock = dsc->dohresponsepair[0];
     du->query = std::move(query);
     du->path = std::move(path);
+    du->getCacheKey = std::move(getCacheKey);
     /* we are doing quite some copies here, sorry about that,
        but we can't keep accessing the req object once we are in a different thread
        because the request might get killed by h2o at pretty much any time */
@@ -770,6 +898,80 @@ static void processForwardedForHeader(const h2o_req_t* req, ComboAddress& remote
   }
 }
 
+static int8_t getBase64URLValue(char c)
+{
+  if (c >= 'A' && c <= 'Z') {
+    return c - 'A';
+  }
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a' + 26;
+  }
+  if (c >= '0' && c <= '9') {
+    return c - '0' + 52;
+  }
+  if (c == '-' || c == '+') {
+    return 62;
+  }
+  if (c == '_' || c == '/') {
+    return 63;
+  }
+  return -1;
+}
+
+/* The first three base64url characters of the 'dns' parameter hold the 16 bits of the query ID
+   and the first two bits of the flags. We extract the ID and blank it from the key so that
+   identical queries using different IDs share the same cache entry. The address of the client
+   is appended, since the response might depend on it. */
+static bool getGetResponsesCacheKey(const std::string& path, size_t payloadPos, const ComboAddress& remote, std::string& key, uint16_t& queryId)
+{
+  if (path.size() < payloadPos + 4) {
+    return false;
+  }
+
+  int8_t values[3];
+  for (size_t idx = 0; idx < 3; idx++) {
+    values[idx] = getBase64URLValue(path.at(payloadPos + idx));
+    if (values[idx] < 0) {
+      return false;
+    }
+  }
+
+  queryId = htons(static_cast<uint16_t>((values[0] << 10) | (values[1] << 4) | (values[2] >> 2)));
+  key = path;
+  key.at(payloadPos) = 'A';
+  key.at(payloadPos + 1) = 'A';
+  key.at(payloadPos + 2) = "ABCD"[values[2] & 0x3];
+  if (remote.isIPv4()) {
+    key.append(reinterpret_cast<const char*>(&remote.sin4.sin_addr.s_addr), sizeof(remote.sin4.sin_addr.s_addr));
+  }
+  else {
+    key.append(reinterpret_cast<const char*>(&remote.sin6.sin6_addr.s6_addr), sizeof(remote.sin6.sin6_addr.s6_addr));
+  }
+  return true;
+}
+
+/* whether an active dynamic block applies to that client or name, in which case
+   a cached response should not be served and the query goes through the regular path */
+static bool isDynBlocked(LocalHolders& holders, const ComboAddress& remote, const DNSName& qname)
+{
+  struct timespec now;
+  gettime(&now);
+
+  if (auto got = holders.dynNMGBlock->lookup(remote)) {
+    if (now < got->second.until) {
+      return true;
+    }
+  }
+
+  if (auto got = holders.dynSMTBlock->lookup(qname)) {
+    if (now < got->until) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 /*
   A query has been parsed by h2o, this executes in the main DoH thread.
   For GET, the base64url-encoded payload is in the 'dns' parameter, which might be the first parameter, or not.
@@ -872,13 +1074,54 @@ static int doh_handler(h2o_handler_t *self, h2o_req_t *req)
       query.reserve(std::max(req->entity.len + 512, s_maxPacketCacheEntrySize));
       query.resize(req->entity.len);
       memcpy(query.data(), req->entity.base, req->entity.len);
-      doh_dispatch_query(dsc, self, req, std::move(query), local, remote, std::move(path));
+      doh_dispatch_query(dsc, self, req, std::move(query), local, remote, std::move(path), std::string());
     }
     else if(req->query_at != SIZE_MAX && (req->path.len - req->query_at > 5)) {
       auto pos = path.find("?dns=");
       if(pos == string::npos)
         pos = path.find("&dns=");
       if(pos != string::npos) {
+        std::string getCacheKey;
+        if (dsc->getResponsesCache) {
+          uint16_t queryId;
+          if (getGetResponsesCacheKey(path, pos + 5, remote, getCacheKey, queryId)) {
+            PacketBuffer cached;
+            DNSName qname;
+            uint16_t qtype;
+            if (dsc->getResponsesCache->get(getCacheKey, queryId, time(nullptr), cached, qname, qtype) && !isDynBlocked(holders, remote, qname)) {
+              ++dsc->df->d_getqueries;
+              ++dsc->df->d_getcachehits;
+              if(req->version >= 0x0200)
+                ++dsc->df->d_http2Stats.d_nbQueries;
+              else
+                ++dsc->df->d_http1Stats.d_nbQueries;
+
+              ++dsc->cs->queries;
+              ++g_stats.queries;
+              ++dsc->cs->responses;
+
+              struct timespec now;
+              gettime(&now);
+              /* the size of the decoded query, without padding, the 'dns' parameter might be followed by other ones */
+              const size_t payloadEnd = path.find('&', pos + 5);
+              const size_t querySize = (((payloadEnd == std::string::npos ? path.size() : payloadEnd) - (pos + 5)) * 3) / 4;
+              struct dnsheader queryDH;
+              memcpy(&queryDH, cached.data(), sizeof(queryDH));
+              queryDH.qr = false;
+              queryDH.aa = false;
+              queryDH.ra = false;
+              queryDH.rcode = RCode::NoError;
+              /* only the query is inserted into the rings, as is done for packet cache hits */
+              g_rings.insertQuery(now, remote, std::move(qname), qtype, querySize, queryDH);
+              /* not a hit of the packet cache */
+              updateOutgoingResponseStats(reinterpret_cast<const struct dnsheader*>(cached.data()), false);
+
+              handleResponse(*dsc->df, req, 200, cached, dsc->df->d_customResponseHeaders, std::string(), true);
+              return 0;
+            }
+          }
+        }
+
         // need to base64url decode this
         string sdns(path.substr(pos+5));
         boost::replace_all(sdns,"-", "+");
@@ -912,7 +1155,7 @@ static int doh_handler(h2o_handler_t *self, h2o_req_t *req)
           else
             ++dsc->df->d_http1Stats.d_nbQueries;
 
-          doh_dispatch_query(dsc, self, req, std::move(decoded), local, remote, std::move(path));
+          doh_dispatch_query(dsc, self, req, std::move(decoded), local, remote, std::move(path), std::move(getCacheKey));
         }
       }
       else
@@ -1157,6 +1400,10 @@ static void on_dnsdist(h2o_socket_t *listener, const char *err)
 
   handleResponse(*dsc->df, du->req, du->status_code, du->response, dsc->df->d_customResponseHeaders, du->contentType, true);
 
+  if (dsc->getResponsesCache && !du->getCacheKey.empty() && du->getCachePacketCache && du->status_code == 200 && du->contentType.empty()) {
+    dsc->getResponsesCache->insert(std::move(du->getCacheKey), du->response, time(nullptr), *du->getCachePacketCache);
+  }
+
   du->release();
 }
 
@@ -1350,7 +1597,7 @@ void DOHFrontend::setup()
 {
   registerOpenSSLUser();
 
-  d_dsc = std::make_shared<DOHServerConfig>(d_idleTimeout, d_internalPipeBufferSize);
+  d_dsc = std::make_shared<DOHServerConfig>(d_idleTimeout, d_internalPipeBufferSize, d_getResponsesCacheSize);
 
   if  (!d_tlsConfig.d_certKeyPairs.empty()) {
     try {
@@ -3,6 +3,8 @@
 #define BOOST_TEST_NO_MAIN
 
 #include <boost/test/unit_test.hpp>
+#include <fcntl.h>
+#include <thread>
 
 #include "dnsdist-kvs.hh"
 
@@ -219,6 +221,44 @@ static void doKVSChecks(std::unique_ptr<KeyValueStore>& kvs, const ComboAddress&
     BOOST_CHECK_EQUAL(kvs->getValue(keys.at(1), value), true);
     BOOST_CHECK_EQUAL(value, "this is the value for the qname");
   }
+
+  /* longest suffix match in a single operation */
+  {
+    for (const auto& params : std::vector<std::pair<size_t, bool>>{ {0, true}, {0, false}, {2, true}, {2, false}, {5, true} }) {
+      KeyValueLookupKeySuffix lookupKey(params.first, params.second);
+      for (const auto& name : { *dq.qname, subdomain, notPDNS, plaintextDomain, DNSName("sub.sub.PowerDNS.com."), DNSName("a\\.b.s\\032b.PowerDNS.com.") }) {
+        /* the suffixes have to be the same as the keys we would have done one lookup for */
+        auto keys = lookupKey.getKeys(name);
+        std::string wholeName;
+        std::vector<size_t> offsets;
+        lookupKey.getSuffixes(name, wholeName, offsets);
+        BOOST_REQUIRE_EQUAL(offsets.size(), keys.size());
+        for (size_t idx = 0; idx < keys.size(); idx++) {
+          BOOST_CHECK_EQUAL(wholeName.substr(offsets.at(idx)), keys.at(idx));
+        }
+
+        std::string expected;
+        for (const auto& key : keys) {
+          if (kvs->getValue(key, expected)) {
+            break;
+          }
+        }
+
+        std::string value;
+        BOOST_CHECK_EQUAL(lookupKey.lookup(name, *kvs, &value), !expected.empty());
+        BOOST_CHECK_EQUAL(value, expected);
+        BOOST_CHECK_EQUAL(lookupKey.lookup(name, *kvs, nullptr), !expected.empty());
+      }
+    }
+
+    KeyValueLookupKeySuffix lookupKey(0, true);
+    std::string value;
+    BOOST_CHECK(lookupKey.lookup(subdomain, *kvs, &value));
+    BOOST_CHECK_EQUAL(value, "this is the value for the qname");
+    value.clear();
+    BOOST_CHECK(!lookupKey.lookup(notPDNS, *kvs, &value));
+    BOOST_CHECK(value.empty());
+  }
 }
 #endif // defined(HAVE_LMDB) || defined(HAVE_CDB)
 
@@ -262,6 +302,25 @@ BOOST_AUTO_TEST_CASE(test_LMDB) {
 
   auto lmdb = std::unique_ptr<KeyValueStore>(new LMDBKVStore(dbPath, "db-name"));
   doKVSChecks(lmdb, lc, rem, dq, plaintextDomain);
+
+  /* the per-thread transaction is reused across lookups, and the
+     results are accounted for */
+  auto stats = lmdb->getStats();
+  BOOST_CHECK_GT(stats.at("hits"), 0U);
+  BOOST_CHECK_GT(stats.at("misses"), 0U);
+  BOOST_CHECK_EQUAL(stats.at("errors"), 0U);
+  std::string value;
+  BOOST_CHECK(lmdb->getValue(qname.toDNSStringLC(), value));
+  BOOST_CHECK_EQUAL(value, "this is the value for the qname");
+  BOOST_CHECK_EQUAL(lmdb->getStats().at("hits"), stats.at("hits") + 1);
+
+  /* lookups from another thread get their own transaction */
+  std::thread thread([&lmdb, &plaintextDomain]() {
+    std::string value;
+    BOOST_CHECK(lmdb->getValue(plaintextDomain.toStringRootDot(), value));
+    BOOST_CHECK_EQUAL(value, "this is the value for the plaintext domain");
+  });
+  thread.join();
   /*
   std::string value;
   DTime dt;
@@ -339,6 +398,72 @@ BOOST_AUTO_TEST_CASE(test_CDB) {
   cerr<<dt.udiff()/1000/1000<<endl;
   */
 }
+
+BOOST_AUTO_TEST_CASE(test_CDB_ConcurrentLookupsAndReload) {
+  char db[] = "/tmp/test_cdb.XXXXXX";
+  const size_t numberOfKeys = 1000;
+  {
+    int fd = mkstemp(db);
+    BOOST_REQUIRE(fd >= 0);
+    CDBWriter writer(fd);
+    for (size_t idx = 0; idx < numberOfKeys; idx++) {
+      BOOST_REQUIRE(writer.addEntry("key-" + std::to_string(idx), "old-value-" + std::to_string(idx)));
+    }
+    writer.close();
+  }
+
+  auto cdb = std::unique_ptr<KeyValueStore>(new CDBKVStore(db, 0));
+
+  std::atomic<size_t> failures{0};
+  std::vector<std::thread> threads;
+  for (size_t threadIdx = 0; threadIdx < 4; threadIdx++) {
+    threads.emplace_back([&cdb, &failures, numberOfKeys]() {
+      std::string value;
+      for (size_t round = 0; round < 10; round++) {
+        for (size_t idx = 0; idx < numberOfKeys; idx++) {
+          if (!cdb->getValue("key-" + std::to_string(idx), value) || value != "old-value-" + std::to_string(idx)) {
+            ++failures;
+          }
+          if (cdb->keyExists("not-a-key-" + std::to_string(idx))) {
+            ++failures;
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  BOOST_CHECK_EQUAL(failures.load(), 0U);
+
+  /* write a new version of the database and reload it */
+  {
+    int fd = open(db, O_WRONLY | O_TRUNC);
+    BOOST_REQUIRE(fd >= 0);
+    CDBWriter writer(fd);
+    for (size_t idx = 0; idx < numberOfKeys; idx++) {
+      BOOST_REQUIRE(writer.addEntry("key-" + std::to_string(idx), "new-value-" + std::to_string(idx)));
+    }
+    writer.close();
+  }
+  BOOST_REQUIRE(cdb->reload());
+
+  std::string value;
+  BOOST_CHECK(cdb->getValue("key-42", value));
+  BOOST_CHECK_EQUAL(value, "new-value-42");
+
+  /* and so do lookups from any other thread */
+  std::thread thread([&cdb, &failures]() {
+    std::string value;
+    if (!cdb->getValue("key-1", value) || value != "new-value-1") {
+      ++failures;
+    }
+  });
+  thread.join();
+  BOOST_CHECK_EQUAL(failures.load(), 0U);
+
+  unlink(db);
+}
 #endif /* HAVE_CDB */
 
 BOOST_AUTO_TEST_SUITE_END()
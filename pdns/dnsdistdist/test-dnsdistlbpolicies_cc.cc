@@ -327,6 +327,91 @@ BOOST_AUTO_TEST_CASE(test_leastOutstanding) {
   benchPolicy(pol);
 }
 
+BOOST_AUTO_TEST_CASE(test_peakEWMA) {
+  auto dq = getDQ();
+
+  ServerPolicy pol{"peakEWMA", peakEWMA, false};
+  ServerPolicy::NumberedServerVector servers;
+  servers.push_back({ 1, std::make_shared<DownstreamState>(ComboAddress("192.0.2.1:53")) });
+
+  /* servers start as 'down' */
+  auto server = pol.getSelectedBackend(servers, dq);
+  BOOST_CHECK(server == nullptr);
+
+  /* mark the server as 'up' */
+  servers.at(0).second->setUp();
+  server = pol.getSelectedBackend(servers, dq);
+  BOOST_CHECK(server == servers.at(0).second);
+
+  /* add a second server, still 'down', we should still get the first one */
+  servers.push_back({ 2, std::make_shared<DownstreamState>(ComboAddress("192.0.2.2:53")) });
+  for (size_t idx = 0; idx < 100; idx++) {
+    server = pol.getSelectedBackend(servers, dq);
+    BOOST_REQUIRE(server != nullptr);
+    BOOST_CHECK(server == servers.at(0).second);
+  }
+
+  /* mark both servers as 'up', the first one is much slower than the second one */
+  servers.at(1).second->setUp();
+  servers.at(0).second->updatePeakLatency(50000);
+  servers.at(1).second->updatePeakLatency(1000);
+  for (size_t idx = 0; idx < 100; idx++) {
+    server = pol.getSelectedBackend(servers, dq);
+    BOOST_REQUIRE(server != nullptr);
+    BOOST_CHECK(server == servers.at(1).second);
+  }
+
+  /* but not if the second one has way too many outstanding queries */
+  servers.at(1).second->outstanding = 100;
+  for (size_t idx = 0; idx < 100; idx++) {
+    server = pol.getSelectedBackend(servers, dq);
+    BOOST_REQUIRE(server != nullptr);
+    BOOST_CHECK(server == servers.at(0).second);
+  }
+  servers.at(1).second->outstanding = 0;
+
+  /* a single slow response is enough to make the second one look bad */
+  servers.at(1).second->updatePeakLatency(100000);
+  server = pol.getSelectedBackend(servers, dq);
+  BOOST_CHECK(server == servers.at(0).second);
+
+  /* while faster ones are only slowly taken into account */
+  servers.at(1).second->updatePeakLatency(1000);
+  BOOST_CHECK_GT(servers.at(1).second->peakLatencyUsec.load(), 50000.0);
+  server = pol.getSelectedBackend(servers, dq);
+  BOOST_CHECK(server == servers.at(0).second);
+
+  /* until it decays */
+  servers.at(1).second->decayPeakLatency();
+  server = pol.getSelectedBackend(servers, dq);
+  BOOST_CHECK(server == servers.at(1).second);
+
+  /* a timeout counts as a very slow response */
+  servers.at(1).second->updatePeakLatencyOnTimeout(2);
+  BOOST_CHECK_EQUAL(servers.at(1).second->peakLatencyUsec.load(), 2000000.0);
+  server = pol.getSelectedBackend(servers, dq);
+  BOOST_CHECK(server == servers.at(0).second);
+  servers.at(1).second->peakLatencyUsec.store(1000.0);
+
+  /* with more servers, the slow one should never be selected since it would
+     always lose against the other server that was randomly picked */
+  for (size_t idx = 3; idx <= 10; idx++) {
+    servers.push_back({ idx, std::make_shared<DownstreamState>(ComboAddress("192.0.2." + std::to_string(idx) + ":53")) });
+    servers.at(idx - 1).second->setUp();
+    servers.at(idx - 1).second->updatePeakLatency(1000);
+  }
+  std::map<std::shared_ptr<DownstreamState>, uint64_t> serversMap;
+  for (size_t idx = 0; idx < 1000; idx++) {
+    server = pol.getSelectedBackend(servers, dq);
+    BOOST_REQUIRE(server != nullptr);
+    serversMap[server]++;
+  }
+  BOOST_CHECK_EQUAL(serversMap.count(servers.at(0).second), 0U);
+  BOOST_CHECK_EQUAL(serversMap.size(), servers.size() - 1);
+
+  benchPolicy(pol);
+}
+
 BOOST_AUTO_TEST_CASE(test_wrandom) {
   auto dq = getDQ();
 
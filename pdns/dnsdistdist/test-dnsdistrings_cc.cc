@@ -273,4 +273,94 @@ BOOST_AUTO_TEST_CASE(test_Rings_Threaded) {
 #endif
 }
 
+BOOST_AUTO_TEST_CASE(test_Rings_Sketches) {
+  const size_t capacity = 10;
+  const size_t seconds = 5;
+  Rings rings(1000, 2);
+  BOOST_CHECK(!rings.hasSketches());
+  rings.setSketches(capacity, seconds);
+  BOOST_CHECK(rings.hasSketches());
+  BOOST_CHECK_EQUAL(rings.getSketchesSeconds(), seconds);
+
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  ComboAddress heavyHitter("192.0.2.1");
+  DNSName heavyName("heavy.powerdns.com.");
+  uint16_t qtype = QType::A;
+  uint16_t size = 42;
+  struct timespec now;
+  gettime(&now);
+
+  /* this one is outside of the window and should be ignored */
+  struct timespec old = now;
+  old.tv_sec -= seconds * 2;
+  for (size_t idx = 0; idx < 1000; idx++) {
+    rings.insertQuery(old, ComboAddress("192.0.2.2"), DNSName("old.powerdns.com."), qtype, size, dh);
+  }
+
+  for (size_t idx = 0; idx < 500; idx++) {
+    rings.insertQuery(now, heavyHitter, heavyName, qtype, size, dh);
+  }
+  /* a lot of distinct, light clients and names that will keep evicting each other */
+  for (size_t idx = 0; idx < 100; idx++) {
+    rings.insertQuery(now, ComboAddress("2001:db8::" + std::to_string(idx + 1)), DNSName("light-" + std::to_string(idx) + ".powerdns.com."), qtype, size, dh);
+  }
+
+  uint64_t total = 0;
+  auto clients = rings.getTopClientsFromSketches(now, total);
+  BOOST_CHECK_EQUAL(total, 600U);
+  BOOST_REQUIRE(!clients.empty());
+  /* two shards, so at most two counters per second */
+  BOOST_CHECK_LE(clients.size(), capacity * 2);
+  BOOST_CHECK_EQUAL(clients.at(0).second.toString(), heavyHitter.toString());
+  BOOST_CHECK_GE(clients.at(0).first, 500U);
+
+  auto names = rings.getTopQueriesFromSketches(now, total);
+  BOOST_CHECK_EQUAL(total, 600U);
+  BOOST_REQUIRE(!names.empty());
+  BOOST_CHECK_EQUAL(names.at(0).second, heavyName);
+  BOOST_CHECK_GE(names.at(0).first, 500U);
+
+  auto bandwidth = rings.getTopBandwidthFromSketches(now, total);
+  BOOST_CHECK_EQUAL(total, 600U * size);
+  BOOST_REQUIRE(!bandwidth.empty());
+  BOOST_CHECK_EQUAL(bandwidth.at(0).second.toString(), heavyHitter.toString());
+
+  /* responses: 200 ServFail for random names below victim.powerdns.com., 10 NoError for www.powerdns.com.,
+     the latter with a different case that should not matter */
+  ComboAddress server("192.0.2.42");
+  dh.rcode = RCode::ServFail;
+  for (size_t idx = 0; idx < 200; idx++) {
+    rings.insertResponse(now, heavyHitter, DNSName(std::to_string(idx) + ".victim.powerdns.com."), qtype, 100, size, dh, server);
+  }
+  dh.rcode = RCode::NoError;
+  for (size_t idx = 0; idx < 10; idx++) {
+    rings.insertResponse(now, heavyHitter, DNSName("WWW.PowerDNS.com."), qtype, 100, size, dh, server);
+  }
+
+  StatNode root;
+  rings.getSuffixesFromSketches(now, root);
+  std::map<DNSName, std::pair<StatNode::Stat, StatNode::Stat>> visited;
+  StatNode::Stat node;
+  root.visit([&visited](const StatNode* node_, const StatNode::Stat& self, const StatNode::Stat& children) {
+    if (!node_->fullname.empty()) {
+      visited[DNSName(node_->fullname)] = {self, children};
+    }
+  }, node);
+
+  /* the suffixes are always tracked since they are hit by every response */
+  BOOST_REQUIRE(visited.count(DNSName("victim.powerdns.com.")) == 1);
+  BOOST_CHECK_EQUAL(visited.at(DNSName("victim.powerdns.com.")).second.servfails, 200U);
+  BOOST_CHECK_EQUAL(visited.at(DNSName("victim.powerdns.com.")).second.queries, 200U);
+  BOOST_REQUIRE(visited.count(DNSName("powerdns.com.")) == 1);
+  BOOST_CHECK_EQUAL(visited.at(DNSName("powerdns.com.")).second.queries, 210U);
+  BOOST_CHECK_EQUAL(visited.at(DNSName("powerdns.com.")).second.noerrors, 10U);
+  BOOST_CHECK_EQUAL(visited.at(DNSName("powerdns.com.")).second.bytes, 210U * size);
+
+  rings.clear();
+  clients = rings.getTopClientsFromSketches(now, total);
+  BOOST_CHECK(clients.empty());
+  BOOST_CHECK_EQUAL(total, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
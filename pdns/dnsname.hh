@@ -366,6 +366,11 @@ struct SuffixMatchTree
     child->remove(labels);
   }
 
+  bool empty() const
+  {
+    return children.empty() && !endNode;
+  }
+
   T* lookup(const DNSName& name)  const
   {
     if (children.empty()) { // speed up empty set
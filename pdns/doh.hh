@@ -25,6 +25,7 @@
 #include "noinitvector.hh"
 #include "stat_t.hh"
 
+class DNSDistPacketCache;
 struct DOHServerConfig;
 
 class DOHResponseMapEntry
@@ -89,6 +90,7 @@ struct DOHFrontend
   pdns::stat_t d_errorresponses{0}; // dnsdist set 'error' on response
   pdns::stat_t d_redirectresponses{0}; // dnsdist set 'redirect' on response
   pdns::stat_t d_validresponses{0}; // valid responses sent out
+  pdns::stat_t d_getcachehits{0};   // GET queries answered from the responses cache of the DoH thread
 
   struct HTTPVersionStats
   {
@@ -104,6 +106,8 @@ struct DOHFrontend
   HTTPVersionStats d_http1Stats;
   HTTPVersionStats d_http2Stats;
   uint32_t d_internalPipeBufferSize{0};
+  /* maximum number of entries in the cache of responses to GET queries, 0 means disabled */
+  size_t d_getResponsesCacheSize{0};
   bool d_sendCacheControlHeaders{true};
   bool d_trustForwardedForHeader{false};
   /* whether we require tue query path to exactly match one of configured ones,
@@ -206,6 +210,12 @@ struct DOHUnit
   DOHUnit** self{nullptr};
   DOHServerConfig* dsc{nullptr};
   std::string contentType;
+  /* key in the GET responses cache of the DoH thread, empty if the response should not be cached */
+  std::string getCacheKey;
+  /* packet cache of the pool the response has been inserted into, set from the responder thread.
+     Responses that did not make it into a packet cache (self-generated, skipCache, ...) are not
+     inserted into the GET responses cache either */
+  std::shared_ptr<DNSDistPacketCache> getCachePacketCache{nullptr};
   std::atomic<uint64_t> d_refcnt{1};
   size_t query_at{0};
   int rsock{-1};
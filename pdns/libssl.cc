@@ -678,7 +678,17 @@ std::unique_ptr<SSL_CTX, void(*)(SSL_CTX*)> libssl_init_server_context(const TLS
 #endif /* SSL_OP_PRIORITIZE_CHACHA */
   }
 
+  if (config.d_enableKTLS) {
+#ifdef SSL_OP_ENABLE_KTLS
+    sslOptions |= SSL_OP_ENABLE_KTLS;
+#else
+    throw std::runtime_error("Kernel TLS offload has been requested but this version of OpenSSL does not support it");
+#endif /* SSL_OP_ENABLE_KTLS */
+  }
+
   SSL_CTX_set_options(ctx.get(), sslOptions);
+  /* do not keep the read and write buffers around while the connection is idle */
+  SSL_CTX_set_mode(ctx.get(), SSL_MODE_RELEASE_BUFFERS);
   if (!libssl_set_min_tls_version(ctx, config.d_minTLSVersion)) {
     throw std::runtime_error("Failed to set the minimum version to '" + libssl_tls_version_to_string(config.d_minTLSVersion));
   }
@@ -31,6 +31,8 @@ public:
 
   bool d_preferServerCiphers{true};
   bool d_enableTickets{true};
+  /* offload the records encryption to the kernel (kTLS), if supported */
+  bool d_enableKTLS{false};
 };
 
 struct TLSErrorCounters
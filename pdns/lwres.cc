@@ -48,6 +48,7 @@
 #include "validate-recursor.hh"
 #include "ednssubnet.hh"
 #include "query-local-address.hh"
+#include "rec-tcpout.hh"
 
 #include "rec-protozero.hh"
 #include "uuid-utils.hh"
@@ -57,8 +58,6 @@
 #include "fstrm_logger.hh"
 
 
-bool g_syslog;
-
 static bool isEnabledForQueries(const std::shared_ptr<std::vector<std::unique_ptr<FrameStreamLogger>>>& fstreamLoggers)
 {
   if (fstreamLoggers == nullptr) {
@@ -230,6 +229,121 @@ static void logIncomingResponse(const std::shared_ptr<std::vector<std::unique_pt
   }
 }
 
+static LWResult::Result tcpSendRecv(Socket& sock, const vector<uint8_t>& vpacket, std::string& buf, size_t& len)
+{
+  uint16_t tlen=htons(vpacket.size());
+  char *lenP=(char*)&tlen;
+  const char *msgP=(const char*)&*vpacket.begin();
+  string packet=string(lenP, lenP+2)+string(msgP, msgP+vpacket.size());
+  LWResult::Result ret = asendtcp(packet, &sock);
+  if (ret != LWResult::Result::Success) {
+    return ret;
+  }
+
+  packet.clear();
+  ret = arecvtcp(packet, 2, &sock, false);
+  if (ret != LWResult::Result::Success) {
+    return ret;
+  }
+
+  memcpy(&tlen, packet.c_str(), sizeof(tlen));
+  len=ntohs(tlen); // switch to the 'len' shared with the rest of the function
+
+  ret = arecvtcp(packet, len, &sock, false);
+  if (ret != LWResult::Result::Success) {
+    return ret;
+  }
+
+  buf.resize(len);
+  memcpy(const_cast<char*>(buf.data()), packet.c_str(), len);
+
+  return LWResult::Result::Success;
+}
+
+#ifdef HAVE_DNS_OVER_TLS
+/* used for the servers listed in dot-server-names, whose certificate is validated against the configured name */
+static std::shared_ptr<TLSCtx> getValidatingDoTContext()
+{
+  static const std::shared_ptr<TLSCtx> ctx = []() {
+    TLSContextParameters params;
+    params.d_validateCertificates = true;
+    params.d_caStore = SyncRes::s_dot_ca_store;
+    return getTLSContext(params);
+  }();
+  return ctx;
+}
+
+/* for the other servers we only know the address, so there is no name to validate the certificate
+   against: the traffic is encrypted but an active attacker can impersonate the server */
+static std::shared_ptr<TLSCtx> getOpportunisticDoTContext()
+{
+  static const std::shared_ptr<TLSCtx> ctx = []() {
+    TLSContextParameters params;
+    params.d_validateCertificates = false;
+    return getTLSContext(params);
+  }();
+  return ctx;
+}
+#endif /* HAVE_DNS_OVER_TLS */
+
+static LWResult::Result tlsSendRecv(Socket& sock, TCPIOHandler& handler, bool isNew, const ComboAddress& ip, const vector<uint8_t>& vpacket, std::string& buf, size_t& len)
+{
+  try {
+    LWResult::Result ret;
+    IOState state;
+    if (isNew) {
+      while ((state = handler.tryConnect(false, ip)) != IOState::Done) {
+        ret = awaittcp(&sock, state);
+        if (ret != LWResult::Result::Success) {
+          return ret;
+        }
+      }
+    }
+
+    PacketBuffer packet(vpacket.size() + 2);
+    packet[0] = vpacket.size() / 256;
+    packet[1] = vpacket.size() % 256;
+    memcpy(&packet.at(2), vpacket.data(), vpacket.size());
+    size_t pos = 0;
+    while ((state = handler.tryWrite(packet, pos, packet.size())) != IOState::Done) {
+      ret = awaittcp(&sock, state);
+      if (ret != LWResult::Result::Success) {
+        return ret;
+      }
+    }
+
+    packet.resize(2);
+    pos = 0;
+    while ((state = handler.tryRead(packet, pos, packet.size())) != IOState::Done) {
+      ret = awaittcp(&sock, state);
+      if (ret != LWResult::Result::Success) {
+        return ret;
+      }
+    }
+
+    len = packet[0] * 256 + packet[1];
+    if (len == 0) {
+      return LWResult::Result::PermanentError;
+    }
+
+    packet.resize(len);
+    pos = 0;
+    while ((state = handler.tryRead(packet, pos, packet.size())) != IOState::Done) {
+      ret = awaittcp(&sock, state);
+      if (ret != LWResult::Result::Success) {
+        return ret;
+      }
+    }
+
+    buf.assign(packet.begin(), packet.end());
+    return LWResult::Result::Success;
+  }
+  catch (const std::exception& e) {
+    /* TLS or network error, or the remote end closed the connection */
+    return LWResult::Result::PermanentError;
+  }
+}
+
 /** lwr is only filled out in case 1 was returned, and even when returning 1 for 'success', lwr might contain DNS errors
     Never throws! 
  */
@@ -323,47 +437,73 @@ LWResult::Result asyncresolve(const ComboAddress& ip, const DNSName& domain, int
                     domain, type, queryfd, now);
   }
   else {
+    bool isDoT = false;
+#ifdef HAVE_DNS_OVER_TLS
+    isDoT = SyncRes::s_dot_to_port_853 && ip.getPort() == 853;
+#endif /* HAVE_DNS_OVER_TLS */
     try {
-      Socket s(ip.sin4.sin_family, SOCK_STREAM);
-
-      s.setNonBlocking();
-      ComboAddress local = pdns::getQueryLocalAddress(ip.sin4.sin_family, 0);
-
-      s.bind(local);
-        
-      s.connect(ip);
-      
-      uint16_t tlen=htons(vpacket.size());
-      char *lenP=(char*)&tlen;
-      const char *msgP=(const char*)&*vpacket.begin();
-      string packet=string(lenP, lenP+2)+string(msgP, msgP+vpacket.size());
-      ret = asendtcp(packet, &s);
-      if (ret != LWResult::Result::Success) {
-        return ret;
-      }
-      
-      packet.clear();
-      ret = arecvtcp(packet, 2, &s, false);
-      if (ret != LWResult::Result::Success) {
-        return ret;
-      }
+      while (true) {
+        TCPOutConnectionManager::Connection connection = t_tcp_manager.get(ip);
+        const bool isNew = connection.d_socket == nullptr;
+        if (isNew) {
+          connection.d_socket = std::make_unique<Socket>(ip.sin4.sin_family, SOCK_STREAM);
+          connection.d_socket->setNonBlocking();
+          ComboAddress local = pdns::getQueryLocalAddress(ip.sin4.sin_family, 0);
+          connection.d_socket->bind(local);
+          connection.d_socket->connect(ip);
+#ifdef HAVE_DNS_OVER_TLS
+          if (isDoT) {
+            const auto name = SyncRes::s_dot_names.find(ip);
+            if (name != SyncRes::s_dot_names.end()) {
+              connection.d_handler = std::make_shared<TCPIOHandler>(name->second, connection.d_socket->getHandle(), 0, getValidatingDoTContext(), now->tv_sec);
+            }
+            else {
+              connection.d_handler = std::make_shared<TCPIOHandler>(std::string(), connection.d_socket->getHandle(), 0, getOpportunisticDoTContext(), now->tv_sec);
+            }
+            auto session = t_tcp_manager.getTLSSession(ip);
+            if (session) {
+              connection.d_handler->setTLSSession(session);
+            }
+          }
+#endif /* HAVE_DNS_OVER_TLS */
+          g_stats.tcpOutNewConnections++;
+        }
+        else {
+          g_stats.tcpOutReusedConnections++;
+        }
 
-      memcpy(&tlen, packet.c_str(), sizeof(tlen));
-      len=ntohs(tlen); // switch to the 'len' shared with the rest of the function
+        if (isDoT) {
+          ret = tlsSendRecv(*connection.d_socket, *connection.d_handler, isNew, ip, vpacket, buf, len);
+        }
+        else {
+          ret = tcpSendRecv(*connection.d_socket, vpacket, buf, len);
+        }
+        if (ret == LWResult::Result::Success) {
+          if (isDoT) {
+            if (isNew && connection.d_handler->hasTLSSessionBeenResumed()) {
+              g_stats.dotResumedSessions++;
+            }
+            t_tcp_manager.storeTLSSession(ip, connection.d_handler->getTLSSession());
+          }
+          struct timeval done;
+          Utility::gettimeofday(&done, nullptr);
+          t_tcp_manager.store(done, ip, std::move(connection));
+          break;
+        }
 
-      ret = arecvtcp(packet, len, &s, false);
-      if (ret != LWResult::Result::Success) {
-        return ret;
+        /* an idle connection might have been closed by the remote end after we checked it,
+           so try again over another one, but not after a timeout */
+        if (isNew || ret != LWResult::Result::PermanentError) {
+          break;
+        }
       }
-
-      buf.resize(len);
-      memcpy(const_cast<char*>(buf.data()), packet.c_str(), len);
-
-      ret = LWResult::Result::Success;
     }
     catch (const NetworkError& ne) {
       ret = LWResult::Result::OSLimitError; // OS limits error
     }
+    catch (const std::exception& e) {
+      ret = LWResult::Result::PermanentError; // setting up the TLS connection failed
+    }
   }
 
   
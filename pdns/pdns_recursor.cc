@@ -100,6 +100,9 @@
 
 #include "rec-snmp.hh"
 #include "rec-taskqueue.hh"
+#include "rec-tcpout.hh"
+#include "rec-replication.hh"
+#include "rec-snapshot.hh"
 
 #ifdef HAVE_SYSTEMD
 #include <systemd/sd-daemon.h>
@@ -131,8 +134,10 @@ static thread_local uint64_t t_frameStreamServersGeneration;
 thread_local std::unique_ptr<MT_t> MT; // the big MTasker
 std::unique_ptr<MemRecursorCache> g_recCache;
 std::unique_ptr<NegCache> g_negCache;
+std::unique_ptr<AggressiveNSECCache> g_aggressiveNSECCache;
 
 thread_local std::unique_ptr<RecursorPacketCache> t_packetCache;
+std::unique_ptr<SharedRecursorPacketCache> g_packetCache;
 thread_local FDMultiplexer* t_fdm{nullptr};
 thread_local std::unique_ptr<addrringbuf_t> t_remotes, t_servfailremotes, t_largeanswerremotes, t_bogusremotes;
 thread_local std::unique_ptr<boost::circular_buffer<pair<DNSName, uint16_t> > > t_queryring, t_servfailqueryring, t_bogusqueryring;
@@ -204,6 +209,9 @@ static DNSName g_dns64PrefixReverse;
 static size_t g_proxyProtocolMaximumSize;
 static size_t g_tcpMaxQueriesPerConn;
 static size_t s_maxUDPQueriesPerRound;
+static size_t s_udpBatchSize{1};
+/* the kernel silently caps the number of messages recvmmsg() reads at UIO_MAXIOV */
+static const size_t s_maxUDPBatchSize{1024};
 static uint64_t g_latencyStatSize;
 static uint32_t g_disthashseed;
 static unsigned int g_maxTCPPerClient;
@@ -245,6 +253,7 @@ static double s_balancingFactor;
 static bool s_addExtendedResolutionDNSErrors;
 
 RecursorControlChannel s_rcc; // only active in the handler thread
+static std::unique_ptr<pdns::CacheReplication::Receiver> s_cacheReplicationReceiver; // only used by the handler thread
 RecursorStats g_stats;
 string s_programname="pdns_recursor";
 string s_pidfname;
@@ -253,6 +262,9 @@ unsigned int g_networkTimeoutMsec;
 unsigned int g_numThreads;
 uint16_t g_outgoingEDNSBufsize;
 bool g_logRPZChanges{false};
+/* used by the logging macros of dolog.hh, in the dnstap and DoT code */
+bool g_syslog;
+bool g_verbose;
 
 // Used in Syncres to counts DNSSEC stats for names in a different "universe"
 GlobalStateHolder<SuffixMatchNode> g_xdnssec;
@@ -443,6 +455,39 @@ LWResult::Result arecvtcp(string& data, const size_t len, Socket* sock, const bo
   return LWResult::Result::Success;
 }
 
+static void handleTCPClientIOReady(int fd, FDMultiplexer::funcparam_t& var);
+
+LWResult::Result awaittcp(Socket* sock, IOState state)
+{
+  if (state == IOState::Done) {
+    return LWResult::Result::Success;
+  }
+
+  PacketID pident;
+  pident.sock=sock;
+  /* tells handleTCPClientIOReady() which side to remove */
+  pident.inNeeded = state == IOState::NeedRead ? 1 : 0;
+  if (state == IOState::NeedRead) {
+    t_fdm->addReadFD(sock->getHandle(), handleTCPClientIOReady, pident);
+  }
+  else {
+    t_fdm->addWriteFD(sock->getHandle(), handleTCPClientIOReady, pident);
+  }
+
+  int ret = MT->waitEvent(pident, nullptr, g_networkTimeoutMsec);
+  if (ret != 1) {
+    if (state == IOState::NeedRead) {
+      t_fdm->removeReadFD(sock->getHandle());
+    }
+    else {
+      t_fdm->removeWriteFD(sock->getHandle());
+    }
+    return ret == 0 ? LWResult::Result::Timeout : LWResult::Result::PermanentError;
+  }
+
+  return LWResult::Result::Success;
+}
+
 static void handleGenUDPQueryResponse(int fd, FDMultiplexer::funcparam_t& var)
 {
   PacketID pident=*boost::any_cast<PacketID>(&var);
@@ -1166,6 +1211,24 @@ static std::shared_ptr<std::vector<std::unique_ptr<RemoteLogger>>> startProtobuf
   return result;
 }
 
+static thread_local std::unique_ptr<std::vector<std::unique_ptr<RemoteLogger>>> t_cacheReplicationPeers{nullptr};
+
+/* called by every thread inserting into the record and negative caches, each one having its own connections */
+static void sendCacheReplicationUpdate(const std::string& update)
+{
+  if (!t_cacheReplicationPeers) {
+    t_cacheReplicationPeers = std::make_unique<std::vector<std::unique_ptr<RemoteLogger>>>();
+    for (const auto& peer : pdns::CacheReplication::g_config->peers) {
+      /* connect asynchronously, we don't want to block while resolving. Updates are dropped until we are connected */
+      t_cacheReplicationPeers->push_back(std::make_unique<RemoteLogger>(peer, 2, 1000000, 1, true));
+    }
+  }
+
+  for (auto& peer : *t_cacheReplicationPeers) {
+    peer->queueData(update);
+  }
+}
+
 static bool checkProtobufExport(LocalStateHolder<LuaConfigItems>& luaconfsLocal)
 {
   if (!luaconfsLocal->protobufExportConfig.enabled) {
@@ -2124,14 +2187,25 @@ static void startDoResolve(void *p)
       g_stats.variableResponses++;
     }
     if (!SyncRes::s_nopacketcache && !variableAnswer && !sr.wasVariable()) {
-      t_packetCache->insertResponsePacket(dc->d_tag, dc->d_qhash, std::move(dc->d_query), dc->d_mdp.d_qname,
-                                          dc->d_mdp.d_qtype, dc->d_mdp.d_qclass,
-                                          string((const char*)&*packet.begin(), packet.size()),
-                                          g_now.tv_sec,
-                                          pw.getHeader()->rcode == RCode::ServFail ? SyncRes::s_packetcacheservfailttl :
-                                          min(minTTL,SyncRes::s_packetcachettl),
-                                          dq.validationState,
-                                          std::move(pbDataForCache), dc->d_tcp);
+      const uint32_t packetCacheTTL = pw.getHeader()->rcode == RCode::ServFail ? SyncRes::s_packetcacheservfailttl : min(minTTL, SyncRes::s_packetcachettl);
+      if (g_packetCache) {
+        g_packetCache->insertResponsePacket(dc->d_tag, dc->d_qhash, std::move(dc->d_query), dc->d_mdp.d_qname,
+                                            dc->d_mdp.d_qtype, dc->d_mdp.d_qclass,
+                                            string((const char*)&*packet.begin(), packet.size()),
+                                            g_now.tv_sec,
+                                            packetCacheTTL,
+                                            dq.validationState,
+                                            std::move(pbDataForCache), dc->d_tcp);
+      }
+      else {
+        t_packetCache->insertResponsePacket(dc->d_tag, dc->d_qhash, std::move(dc->d_query), dc->d_mdp.d_qname,
+                                            dc->d_mdp.d_qtype, dc->d_mdp.d_qclass,
+                                            string((const char*)&*packet.begin(), packet.size()),
+                                            g_now.tv_sec,
+                                            packetCacheTTL,
+                                            dq.validationState,
+                                            std::move(pbDataForCache), dc->d_tcp);
+      }
     }
     if (!dc->d_tcp) {
       struct msghdr msgh;
@@ -2355,10 +2429,20 @@ static bool checkForCacheHit(bool qnameParsed, unsigned int tag, const string& d
   uint32_t age;
   vState valState;
   
-  if (qnameParsed) {
-    cacheHit = !SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(tag, data, qname, qtype, qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
+  if (SyncRes::s_nopacketcache) {
+    cacheHit = false;
+  }
+  else if (g_packetCache) {
+    if (qnameParsed) {
+      cacheHit = g_packetCache->getResponsePacket(tag, data, qname, qtype, qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
+    } else {
+      cacheHit = g_packetCache->getResponsePacket(tag, data, qname, &qtype, &qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
+    }
+  }
+  else if (qnameParsed) {
+    cacheHit = t_packetCache->getResponsePacket(tag, data, qname, qtype, qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
   } else {
-    cacheHit = !SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(tag, data, qname, &qtype, &qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
+    cacheHit = t_packetCache->getResponsePacket(tag, data, qname, &qtype, &qclass, now.tv_sec, &response, &age, &valState, &qhash, &pbData, tcp);
   }
 
   if (cacheHit) {
@@ -2776,7 +2860,17 @@ static void handleNewTCPQuestion(int fd, FDMultiplexer::funcparam_t& )
   }
 }
 
-static string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fromaddr, const ComboAddress& destaddr, ComboAddress source, ComboAddress destination, struct timeval tv, int fd, std::vector<ProxyProtocolValue>& proxyProtocolValues)
+/* packet cache answers to queries received in the same recvmmsg() batch, sent together via sendmmsg() */
+struct UDPBatchedResponse
+{
+  std::string packet;
+  ComboAddress remote;
+  ComboAddress local;
+  ComboAddress source;
+};
+using UDPResponseBatch = std::vector<UDPBatchedResponse>;
+
+static string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fromaddr, const ComboAddress& destaddr, ComboAddress source, ComboAddress destination, struct timeval tv, int fd, std::vector<ProxyProtocolValue>& proxyProtocolValues, UDPResponseBatch* responses = nullptr)
 {
   gettimeofday(&g_now, 0);
   if (tv.tv_sec) {
@@ -2907,6 +3001,10 @@ static string* doProcessUDPQuestion(const std::string& question, const ComboAddr
       if (!g_quiet) {
         g_log<<Logger::Notice<<t_id<< " question answered from packet cache tag="<<ctag<<" from "<<source.toStringWithPort()<<(source != fromaddr ? " (via "+fromaddr.toStringWithPort()+")" : "")<<endl;
       }
+      if (responses != nullptr) {
+        responses->push_back({std::move(response), fromaddr, destaddr, source});
+        return 0;
+      }
       struct msghdr msgh;
       struct iovec iov;
       cmsgbuf_aligned cbuf;
@@ -2982,172 +3080,303 @@ static string* doProcessUDPQuestion(const std::string& question, const ComboAddr
 }
 
 
-static void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
+/* returns false if we should stop reading from this socket for now */
+static bool handleUDPQuestionPacket(int fd, std::string& data, ssize_t len, struct msghdr& msgh, const ComboAddress& fromaddr, std::vector<ProxyProtocolValue>& proxyProtocolValues, UDPResponseBatch* responses)
 {
-  ssize_t len;
-  static const size_t maxIncomingQuerySize = g_proxyProtocolACL.empty() ? 512 : (512 + g_proxyProtocolMaximumSize);
-  static thread_local std::string data;
-  ComboAddress fromaddr;
+  bool proxyProto = false;
   ComboAddress source;
   ComboAddress destination;
-  struct msghdr msgh;
-  struct iovec iov;
-  cmsgbuf_aligned cbuf;
-  bool firstQuery = true;
-  std::vector<ProxyProtocolValue> proxyProtocolValues;
-
-  for(size_t queriesCounter = 0; queriesCounter < s_maxUDPQueriesPerRound; queriesCounter++) {
-    bool proxyProto = false;
-    data.resize(maxIncomingQuerySize);
-    fromaddr.sin6.sin6_family=AF_INET6; // this makes sure fromaddr is big enough
-    fillMSGHdr(&msgh, &iov, &cbuf, sizeof(cbuf), &data[0], data.size(), &fromaddr);
 
-    if((len=recvmsg(fd, &msgh, 0)) >= 0) {
+  if (msgh.msg_flags & MSG_TRUNC) {
+    g_stats.truncatedDrops++;
+    if (!g_quiet) {
+      g_log<<Logger::Error<<"Ignoring truncated query from "<<fromaddr.toString()<<endl;
+    }
+    return false;
+  }
 
-      firstQuery = false;
+  data.resize(static_cast<size_t>(len));
 
-      if (msgh.msg_flags & MSG_TRUNC) {
-        g_stats.truncatedDrops++;
-        if (!g_quiet) {
-          g_log<<Logger::Error<<"Ignoring truncated query from "<<fromaddr.toString()<<endl;
-        }
-        return;
+  if (expectProxyProtocol(fromaddr)) {
+    bool tcp;
+    ssize_t used = parseProxyHeader(data, proxyProto, source, destination, tcp, proxyProtocolValues);
+    if (used <= 0) {
+      ++g_stats.proxyProtocolInvalidCount;
+      if (!g_quiet) {
+        g_log<<Logger::Error<<"Ignoring invalid proxy protocol ("<<std::to_string(len)<<", "<<std::to_string(used)<<") query from "<<fromaddr.toStringWithPort()<<endl;
       }
+      return false;
+    }
+    else if (static_cast<size_t>(used) > g_proxyProtocolMaximumSize) {
+      if (g_quiet) {
+        g_log<<Logger::Error<<"Proxy protocol header in UDP packet from "<< fromaddr.toStringWithPort() << " is larger than proxy-protocol-maximum-size (" << used << "), dropping"<< endl;
+      }
+      ++g_stats.proxyProtocolInvalidCount;
+      return false;
+    }
 
-      data.resize(static_cast<size_t>(len));
+    data.erase(0, used);
+  }
+  else if (len > 512) {
+    /* we only allow UDP packets larger than 512 for those with a proxy protocol header */
+    g_stats.truncatedDrops++;
+    if (!g_quiet) {
+      g_log<<Logger::Error<<"Ignoring truncated query from "<<fromaddr.toStringWithPort()<<endl;
+    }
+    return false;
+  }
 
-      if (expectProxyProtocol(fromaddr)) {
-        bool tcp;
-        ssize_t used = parseProxyHeader(data, proxyProto, source, destination, tcp, proxyProtocolValues);
-        if (used <= 0) {
-          ++g_stats.proxyProtocolInvalidCount;
-          if (!g_quiet) {
-            g_log<<Logger::Error<<"Ignoring invalid proxy protocol ("<<std::to_string(len)<<", "<<std::to_string(used)<<") query from "<<fromaddr.toStringWithPort()<<endl;
-          }
-          return;
-        }
-        else if (static_cast<size_t>(used) > g_proxyProtocolMaximumSize) {
-          if (g_quiet) {
-            g_log<<Logger::Error<<"Proxy protocol header in UDP packet from "<< fromaddr.toStringWithPort() << " is larger than proxy-protocol-maximum-size (" << used << "), dropping"<< endl;
-          }
-          ++g_stats.proxyProtocolInvalidCount;
-          return;
-        }
+  if (data.size() < sizeof(dnsheader)) {
+    g_stats.ignoredCount++;
+    if (!g_quiet) {
+      g_log<<Logger::Error<<"Ignoring too-short ("<<std::to_string(data.size())<<") query from "<<fromaddr.toString()<<endl;
+    }
+    return false;
+  }
+
+  if (!proxyProto) {
+    source = fromaddr;
+  }
 
-        data.erase(0, used);
+  if(t_remotes) {
+    t_remotes->push_back(fromaddr);
+  }
+
+  if(t_allowFrom && !t_allowFrom->match(&source)) {
+    if(!g_quiet) {
+      g_log<<Logger::Error<<"["<<MT->getTid()<<"] dropping UDP query from "<<source.toString()<<", address not matched by allow-from"<<endl;
+    }
+
+    g_stats.unauthorizedUDP++;
+    return false;
+  }
+
+  BOOST_STATIC_ASSERT(offsetof(sockaddr_in, sin_port) == offsetof(sockaddr_in6, sin6_port));
+  if(!fromaddr.sin4.sin_port) { // also works for IPv6
+    if(!g_quiet) {
+      g_log<<Logger::Error<<"["<<MT->getTid()<<"] dropping UDP query from "<<fromaddr.toStringWithPort()<<", can't deal with port 0"<<endl;
+    }
+
+    g_stats.clientParseError++; // not quite the best place to put it, but needs to go somewhere
+    return false;
+  }
+
+  try {
+    dnsheader* dh=(dnsheader*)&data[0];
+
+    if(dh->qr) {
+      g_stats.ignoredCount++;
+      if(g_logCommonErrors) {
+        g_log<<Logger::Error<<"Ignoring answer from "<<fromaddr.toString()<<" on server socket!"<<endl;
+      }
+    }
+    else if(dh->opcode) {
+      g_stats.ignoredCount++;
+      if(g_logCommonErrors) {
+        g_log<<Logger::Error<<"Ignoring non-query opcode "<<dh->opcode<<" from "<<fromaddr.toString()<<" on server socket!"<<endl;
       }
-      else if (len > 512) {
-        /* we only allow UDP packets larger than 512 for those with a proxy protocol header */
-        g_stats.truncatedDrops++;
-        if (!g_quiet) {          g_log<<Logger::Error<<"Ignoring truncated query from "<<fromaddr.toStringWithPort()<<endl;
+    }
+    else if (dh->qdcount == 0) {
+      g_stats.emptyQueriesCount++;
+      if(g_logCommonErrors) {
+        g_log<<Logger::Error<<"Ignoring empty (qdcount == 0) query from "<<fromaddr.toString()<<" on server socket!"<<endl;
+      }
+    }
+    else {
+      struct timeval tv={0,0};
+      HarvestTimestamp(&msgh, &tv);
+      ComboAddress dest;
+      dest.reset(); // this makes sure we ignore this address if not returned by recvmsg above
+      auto loc = rplookup(g_listenSocketsAddresses, fd);
+      if(HarvestDestinationAddress(&msgh, &dest)) {
+        // but.. need to get port too
+        if(loc) {
+          dest.sin4.sin_port = loc->sin4.sin_port;
         }
-        return;
       }
-
-      if (data.size() < sizeof(dnsheader)) {
-        g_stats.ignoredCount++;
-        if (!g_quiet) {
-          g_log<<Logger::Error<<"Ignoring too-short ("<<std::to_string(data.size())<<") query from "<<fromaddr.toString()<<endl;
+      else {
+        if(loc) {
+          dest = *loc;
+        }
+        else {
+          dest.sin4.sin_family = fromaddr.sin4.sin_family;
+          socklen_t slen = dest.getSocklen();
+          getsockname(fd, (sockaddr*)&dest, &slen); // if this fails, we're ok with it
         }
-        return;
       }
-
       if (!proxyProto) {
-        source = fromaddr;
+        destination = dest;
       }
 
-      if(t_remotes) {
-        t_remotes->push_back(fromaddr);
+      if(g_weDistributeQueries) {
+        std::string localdata = data;
+        distributeAsyncFunction(data, [localdata, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues]() mutable
+          { return doProcessUDPQuestion(localdata, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues); });
+      }
+      else {
+        ++s_threadInfos[t_id].numberOfDistributedQueries;
+        doProcessUDPQuestion(data, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues, responses);
       }
+    }
+  }
+  catch(const MOADNSException &mde) {
+    g_stats.clientParseError++;
+    if(g_logCommonErrors) {
+      g_log<<Logger::Error<<"Unable to parse packet from remote UDP client "<<fromaddr.toString() <<": "<<mde.what()<<endl;
+    }
+  }
+  catch(const std::runtime_error& e) {
+    g_stats.clientParseError++;
+    if(g_logCommonErrors) {
+      g_log<<Logger::Error<<"Unable to parse packet from remote UDP client "<<fromaddr.toString() <<": "<<e.what()<<endl;
+    }
+  }
 
-      if(t_allowFrom && !t_allowFrom->match(&source)) {
-        if(!g_quiet) {
-          g_log<<Logger::Error<<"["<<MT->getTid()<<"] dropping UDP query from "<<source.toString()<<", address not matched by allow-from"<<endl;
-        }
+  return true;
+}
 
-        g_stats.unauthorizedUDP++;
-        return;
-      }
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+static void sendUDPResponseBatch(int fd, UDPResponseBatch& responses)
+{
+  static thread_local std::vector<struct mmsghdr> msgVec;
+  static thread_local std::vector<struct iovec> iovs;
+  static thread_local std::vector<cmsgbuf_aligned> cbufs;
 
-      BOOST_STATIC_ASSERT(offsetof(sockaddr_in, sin_port) == offsetof(sockaddr_in6, sin6_port));
-      if(!fromaddr.sin4.sin_port) { // also works for IPv6
-        if(!g_quiet) {
-          g_log<<Logger::Error<<"["<<MT->getTid()<<"] dropping UDP query from "<<fromaddr.toStringWithPort()<<", can't deal with port 0"<<endl;
-        }
+  const size_t count = responses.size();
+  if (count == 0) {
+    return;
+  }
 
-        g_stats.clientParseError++; // not quite the best place to put it, but needs to go somewhere
-        return;
-      }
+  msgVec.resize(count);
+  iovs.resize(count);
+  cbufs.resize(count);
+  const bool fromto = g_fromtosockets.count(fd) > 0;
 
-      try {
-        dnsheader* dh=(dnsheader*)&data[0];
+  for (size_t idx = 0; idx < count; idx++) {
+    auto& response = responses.at(idx);
+    fillMSGHdr(&msgVec[idx].msg_hdr, &iovs[idx], &cbufs[idx], 0, &response.packet[0], response.packet.size(), &response.remote);
+    msgVec[idx].msg_hdr.msg_control = nullptr;
+    msgVec[idx].msg_len = 0;
+    if (fromto) {
+      addCMsgSrcAddr(&msgVec[idx].msg_hdr, &cbufs[idx], &response.local, 0);
+    }
+  }
 
-        if(dh->qr) {
-          g_stats.ignoredCount++;
-          if(g_logCommonErrors) {
-            g_log<<Logger::Error<<"Ignoring answer from "<<fromaddr.toString()<<" on server socket!"<<endl;
-          }
-        }
-        else if(dh->opcode) {
-          g_stats.ignoredCount++;
-          if(g_logCommonErrors) {
-            g_log<<Logger::Error<<"Ignoring non-query opcode "<<dh->opcode<<" from "<<fromaddr.toString()<<" on server socket!"<<endl;
-          }
-        }
-        else if (dh->qdcount == 0) {
-          g_stats.emptyQueriesCount++;
-          if(g_logCommonErrors) {
-            g_log<<Logger::Error<<"Ignoring empty (qdcount == 0) query from "<<fromaddr.toString()<<" on server socket!"<<endl;
-          }
-        }
-        else {
-          struct timeval tv={0,0};
-          HarvestTimestamp(&msgh, &tv);
-          ComboAddress dest;
-          dest.reset(); // this makes sure we ignore this address if not returned by recvmsg above
-          auto loc = rplookup(g_listenSocketsAddresses, fd);
-          if(HarvestDestinationAddress(&msgh, &dest)) {
-            // but.. need to get port too
-            if(loc) {
-              dest.sin4.sin_port = loc->sin4.sin_port;
-            }
-          }
-          else {
-            if(loc) {
-              dest = *loc;
-            }
-            else {
-              dest.sin4.sin_family = fromaddr.sin4.sin_family;
-              socklen_t slen = dest.getSocklen();
-              getsockname(fd, (sockaddr*)&dest, &slen); // if this fails, we're ok with it
-            }
-          }
-          if (!proxyProto) {
-            destination = dest;
-          }
+  size_t sent = 0;
+  while (sent < count) {
+    int res = sendmmsg(fd, &msgVec[sent], count - sent, 0);
+    if (res > 0) {
+      g_stats.udpBatchAnswers += res;
+      sent += res;
+      continue;
+    }
 
-          if(g_weDistributeQueries) {
-            std::string localdata = data;
-            distributeAsyncFunction(data, [localdata, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues]() mutable
-              { return doProcessUDPQuestion(localdata, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues); });
-          }
-          else {
-            ++s_threadInfos[t_id].numberOfDistributedQueries;
-            doProcessUDPQuestion(data, fromaddr, dest, source, destination, tv, fd, proxyProtocolValues);
-          }
-        }
+    /* the first remaining message could not be sent, skip it and carry on with the next ones */
+    int sendErr = res < 0 ? errno : EAGAIN;
+    if (g_logCommonErrors) {
+      const auto& response = responses.at(sent);
+      g_log << Logger::Warning << "Sending UDP reply to client " << response.source.toStringWithPort()
+            << (response.source != response.remote ? " (via " + response.remote.toStringWithPort() + ")" : "") << " failed with: "
+            << strerror(sendErr) << endl;
+    }
+    sent++;
+  }
+
+  responses.clear();
+}
+
+static void handleNewUDPQuestionBatch(int fd)
+{
+  struct UDPBatchSlot
+  {
+    std::string data;
+    ComboAddress fromaddr;
+    struct iovec iov;
+    /* used by HarvestDestinationAddress and HarvestTimestamp */
+    cmsgbuf_aligned cbuf;
+  };
+
+  static const size_t maxIncomingQuerySize = g_proxyProtocolACL.empty() ? 512 : (512 + g_proxyProtocolMaximumSize);
+  static thread_local std::vector<UDPBatchSlot> slots;
+  static thread_local std::vector<struct mmsghdr> msgVec;
+  static thread_local UDPResponseBatch responses;
+  std::vector<ProxyProtocolValue> proxyProtocolValues;
+  bool firstBatch = true;
+  bool keepReading = true;
+
+  slots.resize(s_udpBatchSize);
+  msgVec.resize(s_udpBatchSize);
+
+  for (size_t queriesCounter = 0; keepReading && queriesCounter < s_maxUDPQueriesPerRound; ) {
+    const size_t wanted = std::min(s_udpBatchSize, s_maxUDPQueriesPerRound - queriesCounter);
+    for (size_t idx = 0; idx < wanted; idx++) {
+      auto& slot = slots[idx];
+      slot.data.resize(maxIncomingQuerySize);
+      slot.fromaddr.sin6.sin6_family = AF_INET6; // this makes sure fromaddr is big enough
+      fillMSGHdr(&msgVec[idx].msg_hdr, &slot.iov, &slot.cbuf, sizeof(slot.cbuf), &slot.data[0], slot.data.size(), &slot.fromaddr);
+      msgVec[idx].msg_len = 0;
+    }
+
+    int got = recvmmsg(fd, msgVec.data(), wanted, MSG_WAITFORONE, nullptr);
+    if (got <= 0) {
+      if (got < 0 && firstBatch && errno == EAGAIN) {
+        g_stats.noPacketError++;
       }
-      catch(const MOADNSException &mde) {
-        g_stats.clientParseError++;
-        if(g_logCommonErrors) {
-          g_log<<Logger::Error<<"Unable to parse packet from remote UDP client "<<fromaddr.toString() <<": "<<mde.what()<<endl;
-        }
+      break;
+    }
+
+    firstBatch = false;
+    ++g_stats.udpBatchReceives;
+    g_stats.udpBatchQueries += got;
+    queriesCounter += got;
+
+    /* the packets we already have are processed even if one of them tells us to stop reading */
+    for (int idx = 0; idx < got; idx++) {
+      if (!handleUDPQuestionPacket(fd, slots[idx].data, msgVec[idx].msg_len, msgVec[idx].msg_hdr, slots[idx].fromaddr, proxyProtocolValues, &responses)) {
+        keepReading = false;
       }
-      catch(const std::runtime_error& e) {
-        g_stats.clientParseError++;
-        if(g_logCommonErrors) {
-          g_log<<Logger::Error<<"Unable to parse packet from remote UDP client "<<fromaddr.toString() <<": "<<e.what()<<endl;
-        }
+    }
+
+    sendUDPResponseBatch(fd, responses);
+
+    if (static_cast<size_t>(got) < wanted) {
+      /* nothing left to read for now */
+      break;
+    }
+  }
+}
+#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
+
+static void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
+{
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+  if (s_udpBatchSize > 1) {
+    handleNewUDPQuestionBatch(fd);
+    return;
+  }
+#endif
+
+  ssize_t len;
+  static const size_t maxIncomingQuerySize = g_proxyProtocolACL.empty() ? 512 : (512 + g_proxyProtocolMaximumSize);
+  static thread_local std::string data;
+  ComboAddress fromaddr;
+  struct msghdr msgh;
+  struct iovec iov;
+  cmsgbuf_aligned cbuf;
+  bool firstQuery = true;
+  std::vector<ProxyProtocolValue> proxyProtocolValues;
+
+  for(size_t queriesCounter = 0; queriesCounter < s_maxUDPQueriesPerRound; queriesCounter++) {
+    data.resize(maxIncomingQuerySize);
+    fromaddr.sin6.sin6_family=AF_INET6; // this makes sure fromaddr is big enough
+    fillMSGHdr(&msgh, &iov, &cbuf, sizeof(cbuf), &data[0], data.size(), &fromaddr);
+
+    if((len=recvmsg(fd, &msgh, 0)) >= 0) {
+
+      firstQuery = false;
+
+      if (!handleUDPQuestionPacket(fd, data, len, msgh, fromaddr, proxyProtocolValues, nullptr)) {
+        return;
       }
     }
     else {
@@ -3423,10 +3652,10 @@ static void doStats(void)
     g_log << Logger::Notice<< "stats: cache contended/acquired " << rc_stats.first << '/' << rc_stats.second << " = " << r << '%' << endl;
 
     g_log<<Logger::Notice<<"stats: throttle map: "
-      << broadcastAccFunction<uint64_t>(pleaseGetThrottleSize) <<", ns speeds: "
-      << broadcastAccFunction<uint64_t>(pleaseGetNsSpeedsSize)<<", failed ns: "
-      << broadcastAccFunction<uint64_t>(pleaseGetFailedServersSize)<<", ednsmap: "
-      <<broadcastAccFunction<uint64_t>(pleaseGetEDNSStatusesSize)<<endl;
+      << SyncRes::getThrottledServersSize() <<", ns speeds: "
+      << SyncRes::getNSSpeedsSize()<<", failed ns: "
+      << SyncRes::getFailedServersSize()<<", ednsmap: "
+      << SyncRes::getEDNSStatusesSize()<<endl;
     g_log<<Logger::Notice<<"stats: outpacket/query ratio "<<ratePercentage(SyncRes::s_outqueries, SyncRes::s_queries)<<"%";
     g_log<<Logger::Notice<<", "<<ratePercentage(SyncRes::s_throttledqueries, SyncRes::s_outqueries+SyncRes::s_throttledqueries)<<"% throttled, "
      <<SyncRes::s_nodelegated<<" no-delegation drops"<<endl;
@@ -3435,6 +3664,10 @@ static void doStats(void)
 
     uint64_t pcSize = broadcastAccFunction<uint64_t>(pleaseGetPacketCacheSize);
     uint64_t pcHits = broadcastAccFunction<uint64_t>(pleaseGetPacketCacheHits);
+    if (g_packetCache) {
+      pcSize += g_packetCache->size();
+      pcHits += g_packetCache->getHits();
+    }
     g_log<<Logger::Notice<<"stats: " <<  pcSize <<
       " packet cache entries, "<< ratePercentage(pcHits, SyncRes::s_queries) << "% packet cache hits"<<endl;
 
@@ -3487,19 +3720,10 @@ static void houseKeeping(void *)
     past = now;
     past.tv_sec -= 5;
     if (last_prune < past) {
-      t_packetCache->doPruneTo(g_maxPacketCacheEntries / g_numWorkerThreads);
-
-      time_t limit;
-      if(!((cleanCounter++)%40)) {  // this is a full scan!
-	limit=now.tv_sec-300;
-        SyncRes::pruneNSSpeeds(limit);
-      }
-      limit = now.tv_sec - SyncRes::s_serverdownthrottletime * 10;
-      SyncRes::pruneFailedServers(limit);
-      limit = now.tv_sec - 2*3600;
-      SyncRes::pruneEDNSStatuses(limit);
-      SyncRes::pruneThrottledServers();
-      SyncRes::pruneNonResolving(now.tv_sec - SyncRes::s_nonresolvingnsthrottletime);
+      if (t_packetCache) {
+        t_packetCache->doPruneTo(g_maxPacketCacheEntries / g_numWorkerThreads);
+      }
+      t_tcp_manager.cleanup(now);
       Utility::gettimeofday(&last_prune, nullptr);
     }
 
@@ -3507,6 +3731,25 @@ static void houseKeeping(void *)
       if (now.tv_sec - last_RC_prune > 5) {
         g_recCache->doPrune(g_maxCacheEntries);
         g_negCache->prune(g_maxCacheEntries / 10);
+        if (g_aggressiveNSECCache) {
+          g_aggressiveNSECCache->prune(now.tv_sec);
+        }
+        if (g_packetCache) {
+          g_packetCache->doPruneTo(g_maxPacketCacheEntries);
+        }
+
+        // what we know about the authoritative servers is shared by all threads
+        time_t limit;
+        if(!((cleanCounter++)%40)) {  // this is a full scan!
+          limit=now.tv_sec-300;
+          SyncRes::pruneNSSpeeds(limit);
+        }
+        limit = now.tv_sec - SyncRes::s_serverdownthrottletime * 10;
+        SyncRes::pruneFailedServers(limit);
+        limit = now.tv_sec - 2*3600;
+        SyncRes::pruneEDNSStatuses(limit);
+        SyncRes::pruneThrottledServers();
+        SyncRes::pruneNonResolving(now.tv_sec - SyncRes::s_nonresolvingnsthrottletime);
         last_RC_prune = now.tv_sec;
       }
       // XXX !!! global
@@ -3966,6 +4209,18 @@ static void handleTCPClientWritable(int fd, FDMultiplexer::funcparam_t& var)
   }
 }
 
+static void handleTCPClientIOReady(int fd, FDMultiplexer::funcparam_t& var)
+{
+  PacketID pid=*boost::any_cast<PacketID>(&var);
+  if (pid.inNeeded) {
+    t_fdm->removeReadFD(fd);
+  }
+  else {
+    t_fdm->removeWriteFD(fd);
+  }
+  MT->sendEvent(pid);
+}
+
 // resend event to everybody chained onto it
 static void doResends(MT_t::waiters_t::iterator& iter, PacketID resend, const string& content)
 {
@@ -4529,6 +4784,15 @@ static int serviceMain(int argc, char*argv[])
   g_maxCacheEntries = ::arg().asNum("max-cache-entries");
   g_maxPacketCacheEntries = ::arg().asNum("max-packetcache-entries");
 
+  if (::arg().asNum("aggressive-nsec-cache-size") > 0) {
+    if (g_dnssecmode == DNSSECMode::ValidateAll || g_dnssecmode == DNSSECMode::ValidateForLog || g_dnssecmode == DNSSECMode::Process) {
+      g_aggressiveNSECCache = std::unique_ptr<AggressiveNSECCache>(new AggressiveNSECCache(::arg().asNum("aggressive-nsec-cache-size")));
+    }
+    else {
+      g_log<<Logger::Warning<<"Aggressive NSEC/NSEC3 caching is enabled but will not be used since DNSSEC validation is not set to 'validate', 'log-fail' or 'process'"<<endl;
+    }
+  }
+
   luaConfigDelayedThreads delayedLuaThreads;
   try {
     loadRecursorLuaConfig(::arg()["lua-config-file"], delayedLuaThreads);
@@ -4607,6 +4871,9 @@ static int serviceMain(int argc, char*argv[])
   SyncRes::s_rootNXTrust = ::arg().mustDo( "root-nx-trust");
   SyncRes::s_refresh_ttlperc = ::arg().asNum("refresh-on-ttl-perc");
   RecursorPacketCache::s_refresh_ttlperc = SyncRes::s_refresh_ttlperc;
+  MemRecursorCache::s_maxServedStaleExtensions = ::arg().asNum("serve-stale-extensions");
+  SyncRes::s_serveStaleDeadlineUsec = 1000 * ::arg().asNum("serve-stale-deadline-msec");
+  MemRecursorCache::s_clockEviction = ::arg().mustDo("record-cache-clock-eviction");
 
   if(SyncRes::s_serverID.empty()) {
     SyncRes::s_serverID = myHostname;
@@ -4622,6 +4889,35 @@ static int serviceMain(int argc, char*argv[])
   SyncRes::s_ecscachelimitttl = ::arg().asNum("ecs-cache-limit-ttl");
 
   SyncRes::s_qnameminimization = ::arg().mustDo("qname-minimization");
+#ifdef HAVE_DNS_OVER_TLS
+  SyncRes::s_dot_to_port_853 = ::arg().mustDo("dot-to-port-853");
+  SyncRes::s_dot_ca_store = ::arg()["dot-ca-store"];
+  {
+    std::vector<std::string> entries;
+    stringtok(entries, ::arg()["dot-server-names"], ", ");
+    for (const auto& entry : entries) {
+      auto pos = entry.find('=');
+      if (pos == std::string::npos || pos == 0 || pos == entry.size() - 1) {
+        g_log<<Logger::Error<<"Invalid entry '"<<entry<<"' in dot-server-names, expected address=name"<<endl;
+        exit(1);
+      }
+      try {
+        SyncRes::s_dot_names[ComboAddress(entry.substr(0, pos), 853)] = entry.substr(pos + 1);
+      }
+      catch (const PDNSException& e) {
+        g_log<<Logger::Error<<"Invalid address in dot-server-names entry '"<<entry<<"': "<<e.reason<<endl;
+        exit(1);
+      }
+    }
+  }
+  if (SyncRes::s_dot_to_port_853 && SyncRes::s_dot_names.empty()) {
+    g_log<<Logger::Warning<<"dot-to-port-853 is set but dot-server-names is empty: DNS over TLS will be used opportunistically, without validating the certificate of the servers"<<endl;
+  }
+#else
+  if (::arg().mustDo("dot-to-port-853")) {
+    g_log<<Logger::Warning<<"dot-to-port-853 is set but DNS over TLS support is not compiled in, servers on port 853 will be queried over plain TCP"<<endl;
+  }
+#endif /* HAVE_DNS_OVER_TLS */
 
   if (SyncRes::s_qnameminimization) {
     // With an empty cache, a rev ipv6 query with dnssec enabled takes
@@ -4699,6 +4995,11 @@ static int serviceMain(int argc, char*argv[])
 
   g_networkTimeoutMsec = ::arg().asNum("network-timeout");
 
+  TCPOutConnectionManager::s_maxIdleTimeMsec = ::arg().asNum("tcp-out-max-idle-ms");
+  TCPOutConnectionManager::s_maxIdlePerAuth = ::arg().asNum("tcp-out-max-idle-per-auth");
+  TCPOutConnectionManager::s_maxIdlePerThread = ::arg().asNum("tcp-out-max-idle-per-thread");
+  TCPOutConnectionManager::s_maxQueries = ::arg().asNum("tcp-out-max-queries");
+
   g_initialDomainMap = parseAuthAndForwards();
 
   g_latencyStatSize=::arg().asNum("latency-statistic-size");
@@ -4754,6 +5055,54 @@ static int serviceMain(int argc, char*argv[])
     g_dontThrottleNetmasks.setState(std::move(dontThrottleNetmasks));
   }
 
+  {
+    vector<string> parts;
+    stringtok(parts, ::arg()["cache-replication-peers"], " ,");
+    if (!parts.empty()) {
+      auto config = std::make_unique<pdns::CacheReplication::Config>();
+      for (const auto& p : parts) {
+        ComboAddress peer(p, 0);
+        if (peer.getPort() == 0) {
+          g_log<<Logger::Error<<"Cache replication peer '"<<p<<"' has no port, exiting"<<endl;
+          exit(1);
+        }
+        config->peers.push_back(peer);
+      }
+
+      parts.clear();
+      stringtok(parts, ::arg()["cache-replication-zones"], " ,");
+      for (const auto& p : parts) {
+        config->zones.add(DNSName(p));
+      }
+      config->allZones = parts.empty();
+      config->minTTL = ::arg().asNum("cache-replication-min-ttl");
+      config->send = sendCacheReplicationUpdate;
+      pdns::CacheReplication::g_config = std::move(config);
+      g_log<<Logger::Warning<<"Replicating cache updates to "<<::arg()["cache-replication-peers"]<<endl;
+    }
+
+    if (!::arg()["cache-replication-listen"].empty()) {
+      ComboAddress local(::arg()["cache-replication-listen"], 0);
+      if (local.getPort() == 0) {
+        g_log<<Logger::Error<<"The cache-replication-listen address has no port, exiting"<<endl;
+        exit(1);
+      }
+      parts.clear();
+      NetmaskGroup allowFrom;
+      stringtok(parts, ::arg()["cache-replication-allow-from"], " ,");
+      for (const auto& p : parts) {
+        allowFrom.addMask(Netmask(p));
+      }
+      if (allowFrom.empty()) {
+        g_log<<Logger::Error<<"cache-replication-listen is set but cache-replication-allow-from is empty, exiting"<<endl;
+        exit(1);
+      }
+      /* bind now, before chrooting and dropping privileges */
+      s_cacheReplicationReceiver = std::make_unique<pdns::CacheReplication::Receiver>(local, allowFrom);
+      g_log<<Logger::Warning<<"Accepting cache replication updates on "<<local.toStringWithPort()<<" from "<<allowFrom.toString()<<endl;
+    }
+  }
+
   {
     SuffixMatchNode xdnssecNames;
     vector<string> parts;
@@ -4923,6 +5272,21 @@ static int serviceMain(int argc, char*argv[])
     g_log<<Logger::Warning<<e.what()<<endl;
   }
 
+  /* after chrooting and dropping privileges, so we see the same file we will be writing at exit */
+  const auto& snapshotFile = ::arg()["cache-snapshot-file"];
+  if (!snapshotFile.empty()) {
+    try {
+      auto count = pdns::CacheSnapshot::loadFromFile(snapshotFile, time(nullptr));
+      g_log<<Logger::Warning<<"Loaded "<<count<<" cache entries from snapshot file '"<<snapshotFile<<"'"<<endl;
+    }
+    catch (const std::exception& e) {
+      g_log<<Logger::Error<<"Error loading the cache snapshot from '"<<snapshotFile<<"', continuing with what has been loaded so far: "<<e.what()<<endl;
+    }
+    catch (const PDNSException& e) {
+      g_log<<Logger::Error<<"Error loading the cache snapshot from '"<<snapshotFile<<"', continuing with what has been loaded so far: "<<e.reason<<endl;
+    }
+  }
+
   startLuaConfigDelayedThreads(delayedLuaThreads, g_luaconfs.getCopy().generation);
 
   makeThreadPipes();
@@ -4931,6 +5295,17 @@ static int serviceMain(int argc, char*argv[])
   g_maxTCPPerClient=::arg().asNum("max-tcp-per-client");
   g_tcpMaxQueriesPerConn=::arg().asNum("max-tcp-queries-per-connection");
   s_maxUDPQueriesPerRound=::arg().asNum("max-udp-queries-per-round");
+  s_udpBatchSize = std::max(::arg().asNum("udp-batch-size"), 1);
+  if (s_udpBatchSize > s_maxUDPBatchSize) {
+    g_log<<Logger::Warning<<"udp-batch-size is set to "<<s_udpBatchSize<<", which is more than recvmmsg() reads at once, using "<<s_maxUDPBatchSize<<" instead"<<endl;
+    s_udpBatchSize = s_maxUDPBatchSize;
+  }
+#if !(defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE))
+  if (s_udpBatchSize > 1) {
+    g_log<<Logger::Warning<<"udp-batch-size is set to "<<s_udpBatchSize<<" but recvmmsg() and sendmmsg() are not available, receiving queries one by one"<<endl;
+    s_udpBatchSize = 1;
+  }
+#endif
 
   g_useKernelTimestamp = ::arg().mustDo("protobuf-use-kernel-timestamp");
 
@@ -5080,7 +5455,9 @@ try
     g_log<<Logger::Warning<<"Done priming cache with root hints"<<endl;
   }
 
-  t_packetCache = std::unique_ptr<RecursorPacketCache>(new RecursorPacketCache());
+  if (!g_packetCache) {
+    t_packetCache = std::unique_ptr<RecursorPacketCache>(new RecursorPacketCache());
+  }
 
 
 #ifdef NOD_ENABLED
@@ -5181,6 +5558,9 @@ try
 
   if(threadInfo.isHandler) {
     t_fdm->addReadFD(s_rcc.d_fd, handleRCC); // control channel
+    if (s_cacheReplicationReceiver) {
+      s_cacheReplicationReceiver->addToMultiplexer(*t_fdm);
+    }
   }
 
   unsigned int maxTcpClients=::arg().asNum("max-tcp-clients");
@@ -5380,10 +5760,13 @@ int main(int argc, char **argv)
     ::arg().set("hint-file", "If set, load root hints from this file")="";
     ::arg().set("max-cache-entries", "If set, maximum number of entries in the main cache")="1000000";
     ::arg().set("max-negative-ttl", "maximum number of seconds to keep a negative cached entry in memory")="3600";
+    ::arg().set("aggressive-nsec-cache-size", "The number of records to cache in the aggressive cache. If set to a value greater than 0, and DNSSEC processing or validation is enabled, the recursor will cache NSEC and NSEC3 records to generate negative answers, as defined in RFC 8198")="100000";
     ::arg().set("max-cache-bogus-ttl", "maximum number of seconds to keep a Bogus (positive or negative) cached entry in memory")="3600";
     ::arg().set("max-cache-ttl", "maximum number of seconds to keep a cached entry in memory")="86400";
     ::arg().set("packetcache-ttl", "maximum number of seconds to keep a cached entry in packetcache")="3600";
     ::arg().set("max-packetcache-entries", "maximum number of entries to keep in the packetcache")="500000";
+    ::arg().setSwitch("packetcache-shared", "Use a single packet cache shared by all worker threads instead of one per thread")="no";
+    ::arg().set("packetcache-shards", "Number of shards in the shared packet cache")="1024";
     ::arg().set("packetcache-servfail-ttl", "maximum number of seconds to keep a cached servfail entry in packetcache")="60";
     ::arg().set("server-id", "Returned when queried for 'id.server' TXT or NSID, defaults to hostname, set custom or 'disabled'")="";
     ::arg().set("stats-ringbuffer-entries", "maximum number of packets to store statistics for")="10000";
@@ -5437,6 +5820,7 @@ int main(int argc, char **argv)
     ::arg().set("max-total-msec", "Maximum total wall-clock time per query in milliseconds, 0 for unlimited")="7000";
     ::arg().set("max-recursion-depth", "Maximum number of internal recursion calls per query, 0 for unlimited")="40";
     ::arg().set("max-udp-queries-per-round", "Maximum number of UDP queries processed per recvmsg() round, before returning back to normal processing")="10000";
+    ::arg().set("udp-batch-size", "Maximum number of UDP queries received with a single recvmmsg() call, 1 to use recvmsg()")="1";
     ::arg().set("protobuf-use-kernel-timestamp", "Compute the latency of queries in protobuf messages by using the timestamp set by the kernel when the query was received (when available)")="";
     ::arg().set("distribution-pipe-buffer-size", "Size in bytes of the internal buffer of the pipe used by the distributor to pass incoming queries to a worker thread")="0";
 
@@ -5467,6 +5851,13 @@ int main(int argc, char **argv)
     ::arg().set("stats-snmp-disabled-list", "List of statistics that are prevented from being exported via SNMP")=defaultBlacklistedStats;
 
     ::arg().set("tcp-fast-open", "Enable TCP Fast Open support on the listening sockets, using the supplied numerical value as the queue size")="0";
+    ::arg().set("tcp-out-max-idle-ms", "Time outgoing TCP connections to authoritative servers are kept open while idle, in milliseconds")="10000";
+    ::arg().set("tcp-out-max-idle-per-auth", "Maximum number of idle outgoing TCP connections to a given authoritative server kept open per thread, 0 disables connection reuse")="10";
+    ::arg().set("tcp-out-max-idle-per-thread", "Maximum number of idle outgoing TCP connections kept open per thread, 0 disables connection reuse")="100";
+    ::arg().set("tcp-out-max-queries", "Maximum number of queries sent over a single outgoing TCP connection, 0 means unlimited")="0";
+    ::arg().setSwitch("dot-to-port-853", "Use DNS over TLS for outgoing queries to servers on port 853, such as forwarders")="no";
+    ::arg().set("dot-server-names", "Comma separated list of address=name pairs, the certificate of these DNS over TLS servers is validated against that name")="";
+    ::arg().set("dot-ca-store", "File holding the CA certificates used to validate the certificate of DNS over TLS servers, empty for the system store")="";
     ::arg().set("nsec3-max-iterations", "Maximum number of iterations allowed for an NSEC3 record")="2500";
 
     ::arg().set("cpu-map", "Thread to CPU mapping, space separated thread-id=cpu1,cpu2..cpuN pairs")="";
@@ -5492,7 +5883,16 @@ int main(int argc, char **argv)
     ::arg().setSwitch("nothing-below-nxdomain", "When an NXDOMAIN exists in cache for a name with fewer labels than the qname, send NXDOMAIN without doing a lookup (see RFC 8020)")="dnssec";
     ::arg().set("max-generate-steps", "Maximum number of $GENERATE steps when loading a zone from a file")="0";
     ::arg().set("record-cache-shards", "Number of shards in the record cache")="1024";
+    ::arg().set("cache-replication-peers", "Send record and negative cache updates to these recursors, as IP:port")="";
+    ::arg().set("cache-replication-zones", "Only replicate cache entries for names under these zones, all names if empty")="";
+    ::arg().set("cache-replication-min-ttl", "Only replicate cache entries with at least this many seconds left")="60";
+    ::arg().set("cache-replication-listen", "Accept cache updates from other recursors on this IP:port")="";
+    ::arg().set("cache-replication-allow-from", "Netmasks of the recursors allowed to send cache updates")="";
+    ::arg().set("cache-snapshot-file", "If set, load the record cache, negative cache and NS speeds from this file at startup and save them to it on quit-nicely")="";
+    ::arg().setSwitch("record-cache-clock-eviction", "Use CLOCK instead of LRU eviction for the record cache, allowing lookups to share the shard locks")="no";
     ::arg().set("refresh-on-ttl-perc", "If a record is requested from the cache and only this % of original TTL remains, refetch") = "0";
+    ::arg().set("serve-stale-extensions", "Number of times a record's TTL is extended by 30s to be served stale") = "0";
+    ::arg().set("serve-stale-deadline-msec", "If stale data is available, serve it once resolving has taken this long (0 to only serve it on failure)") = "0";
 
     ::arg().set("x-dnssec-names", "Collect DNSSEC statistics for names or suffixes in this list in separate x-dnssec counters")="";
 
@@ -5599,6 +5999,9 @@ int main(int argc, char **argv)
     }
     g_recCache = std::unique_ptr<MemRecursorCache>(new MemRecursorCache(::arg().asNum("record-cache-shards")));
     g_negCache = std::unique_ptr<NegCache>(new NegCache(::arg().asNum("record-cache-shards")));
+    if (::arg().mustDo("packetcache-shared")) {
+      g_packetCache = std::unique_ptr<SharedRecursorPacketCache>(new SharedRecursorPacketCache(::arg().asNum("packetcache-shards")));
+    }
 
     Logger::Urgency logUrgency = (Logger::Urgency)::arg().asNum("loglevel");
 
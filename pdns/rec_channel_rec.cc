@@ -38,6 +38,9 @@
 #include "pubsuffix.hh"
 #include "namespaces.hh"
 #include "rec-taskqueue.hh"
+#include "rec-tcpout.hh"
+#include "rec-replication.hh"
+#include "rec-snapshot.hh"
 
 std::mutex g_carbon_config_lock;
 
@@ -300,38 +303,39 @@ static uint64_t dumpNegCache(int fd)
   return g_negCache->dumpToFile(fp.get(), now);
 }
 
-static uint64_t* pleaseDump(int fd)
-{
-  return new uint64_t(t_packetCache->doDump(fd));
-}
-
-static uint64_t* pleaseDumpEDNSMap(int fd)
+static uint64_t dumpAggressiveNSECCache(int fd)
 {
-  return new uint64_t(SyncRes::doEDNSDump(fd));
-}
+  if (!g_aggressiveNSECCache) {
+    return 0;
+  }
 
-static uint64_t* pleaseDumpNSSpeeds(int fd)
-{
-  return new uint64_t(SyncRes::doDumpNSSpeeds(fd));
-}
+  int newfd = dup(fd);
+  if (newfd == -1) {
+    return 0;
+  }
+  auto fp = std::unique_ptr<FILE, int(*)(FILE*)>(fdopen(newfd, "w"), fclose);
+  if (!fp) {
+    return 0;
+  }
+  fprintf(fp.get(), "; aggressive NSEC cache dump follows\n;\n");
 
-static uint64_t* pleaseDumpThrottleMap(int fd)
-{
-  return new uint64_t(SyncRes::doDumpThrottleMap(fd));
+  struct timeval now;
+  Utility::gettimeofday(&now, nullptr);
+  return g_aggressiveNSECCache->dumpToFile(fp.get(), now);
 }
 
-static uint64_t* pleaseDumpFailedServers(int fd)
+static uint64_t saveCacheSnapshot(int fd)
 {
-  return new uint64_t(SyncRes::doDumpFailedServers(fd));
+  return pdns::CacheSnapshot::save(fd, time(nullptr));
 }
 
-static uint64_t* pleaseDumpNonResolvingNS(int fd)
+static uint64_t* pleaseDump(int fd)
 {
-  return new uint64_t(SyncRes::doDumpNonResolvingNS(fd));
+  return new uint64_t(t_packetCache ? t_packetCache->doDump(fd) : 0);
 }
 
-// Generic dump to file command
-static RecursorControlChannel::Answer doDumpToFile(int s, uint64_t* (*function)(int s), const string& name)
+// Generic dump to file command, for the tables shared by all threads
+static RecursorControlChannel::Answer doDumpToFile(int s, uint64_t (*function)(int s), const string& name)
 {
   auto fdw = getfd(s);
 
@@ -341,8 +345,7 @@ static RecursorControlChannel::Answer doDumpToFile(int s, uint64_t* (*function)(
 
   uint64_t total = 0;
   try {
-    int fd = fdw;
-    total = broadcastAccFunction<uint64_t>([function, fd]{ return function(fd); });
+    total = function(fdw);
   }
   catch(std::exception& e)
   {
@@ -367,7 +370,10 @@ static RecursorControlChannel::Answer doDumpCache(int s)
   uint64_t total = 0;
   try {
     int fd = fdw;
-    total = g_recCache->doDump(fd) + dumpNegCache(fd) + broadcastAccFunction<uint64_t>([fd]{ return pleaseDump(fd); });
+    total = g_recCache->doDump(fd) + dumpNegCache(fd) + dumpAggressiveNSECCache(fd) + broadcastAccFunction<uint64_t>([fd]{ return pleaseDump(fd); });
+    if (g_packetCache) {
+      total += g_packetCache->doDump(fd);
+    }
   }
   catch(...){}
 
@@ -411,7 +417,12 @@ static RecursorControlChannel::Answer doDumpRPZ(int s, T begin, T end)
 
 uint64_t* pleaseWipePacketCache(const DNSName& canon, bool subtree, uint16_t qtype)
 {
-  return new uint64_t(t_packetCache->doWipePacketCache(canon, qtype, subtree));
+  if (g_packetCache) {
+    /* this is called from every thread: the first call removes the entries from the shared cache,
+       the next ones will not find anything so the total count is still correct */
+    return new uint64_t(g_packetCache->doWipePacketCache(canon, qtype, subtree));
+  }
+  return new uint64_t(t_packetCache ? t_packetCache->doWipePacketCache(canon, qtype, subtree) : 0);
 }
 
 template<typename T>
@@ -441,6 +452,9 @@ static string doWipeCache(T begin, T end, uint16_t qtype)
       count += g_recCache->doWipeCache(wipe.first, wipe.second, qtype);
       pcount += broadcastAccFunction<uint64_t>([=]{ return pleaseWipePacketCache(wipe.first, wipe.second, qtype);});
       countNeg += g_negCache->wipe(wipe.first, wipe.second);
+      if (g_aggressiveNSECCache) {
+        g_aggressiveNSECCache->removeZoneInfo(wipe.first, wipe.second);
+      }
     }
     catch (const std::exception& e) {
       g_log<<Logger::Warning<<", failed: "<<e.what()<<endl;
@@ -549,6 +563,9 @@ static string doAddNTA(T begin, T end)
     g_recCache->doWipeCache(who, true, 0xffff);
     broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(who, true, 0xffff);});
     g_negCache->wipe(who, true);
+    if (g_aggressiveNSECCache) {
+      g_aggressiveNSECCache->removeZoneInfo(who, true);
+    }
   }
   catch (std::exception& e) {
     g_log<<Logger::Warning<<", failed: "<<e.what()<<endl;
@@ -603,6 +620,9 @@ static string doClearNTA(T begin, T end)
       g_recCache->doWipeCache(entry, true, 0xffff);
       broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(entry, true, 0xffff);});
       g_negCache->wipe(entry, true);
+      if (g_aggressiveNSECCache) {
+        g_aggressiveNSECCache->removeZoneInfo(entry, true);
+      }
       if (!first) {
         first = false;
         removed += ",";
@@ -666,6 +686,9 @@ static string doAddTA(T begin, T end)
     g_recCache->doWipeCache(who, true, 0xffff);
     broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(who, true, 0xffff);});
     g_negCache->wipe(who, true);
+    if (g_aggressiveNSECCache) {
+      g_aggressiveNSECCache->removeZoneInfo(who, true);
+    }
     g_log<<Logger::Warning<<endl;
     return "Added Trust Anchor for " + who.toStringRootDot() + " with data " + what + "\n";
   }
@@ -713,6 +736,9 @@ static string doClearTA(T begin, T end)
       g_recCache->doWipeCache(entry, true, 0xffff);
       broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(entry, true, 0xffff);});
       g_negCache->wipe(entry, true);
+      if (g_aggressiveNSECCache) {
+        g_aggressiveNSECCache->removeZoneInfo(entry, true);
+      }
       if (!first) {
         first = false;
         removed += ",";
@@ -897,14 +923,9 @@ static string doCurrentQueries()
   return broadcastAccFunction<string>(pleaseGetCurrentQueries);
 }
 
-uint64_t* pleaseGetThrottleSize()
-{
-  return new uint64_t(SyncRes::getThrottledServersSize());
-}
-
 static uint64_t getThrottleSize()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetThrottleSize);
+  return SyncRes::getThrottledServersSize();
 }
 
 static uint64_t getNegCacheSize()
@@ -912,35 +933,14 @@ static uint64_t getNegCacheSize()
   return g_negCache->size();
 }
 
-static uint64_t* pleaseGetFailedHostsSize()
-{
-  uint64_t tmp=(SyncRes::getThrottledServersSize());
-  return new uint64_t(tmp);
-}
-
 static uint64_t getFailedHostsSize()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetFailedHostsSize);
-}
-
-uint64_t* pleaseGetNsSpeedsSize()
-{
-  return new uint64_t(SyncRes::getNSSpeedsSize());
+  return SyncRes::getThrottledServersSize();
 }
 
 static uint64_t getNsSpeedsSize()
 {
-  return broadcastAccFunction<uint64_t>(pleaseGetNsSpeedsSize);
-}
-
-uint64_t* pleaseGetFailedServersSize()
-{
-  return new uint64_t(SyncRes::getFailedServersSize());
-}
-
-uint64_t* pleaseGetEDNSStatusesSize()
-{
-  return new uint64_t(SyncRes::getEDNSStatusesSize());
+  return SyncRes::getNSSpeedsSize();
 }
 
 uint64_t* pleaseGetConcurrentQueries()
@@ -985,11 +985,17 @@ static uint64_t* pleaseGetPacketCacheBytes()
 
 static uint64_t doGetPacketCacheSize()
 {
+  if (g_packetCache) {
+    return g_packetCache->size();
+  }
   return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheSize);
 }
 
 static uint64_t doGetPacketCacheBytes()
 {
+  if (g_packetCache) {
+    return g_packetCache->bytes();
+  }
   return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheBytes);
 }
 
@@ -1000,6 +1006,9 @@ uint64_t* pleaseGetPacketCacheHits()
 
 static uint64_t doGetPacketCacheHits()
 {
+  if (g_packetCache) {
+    return g_packetCache->getHits();
+  }
   return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheHits);
 }
 
@@ -1010,6 +1019,9 @@ static uint64_t* pleaseGetPacketCacheMisses()
 
 static uint64_t doGetPacketCacheMisses()
 {
+  if (g_packetCache) {
+    return g_packetCache->getMisses();
+  }
   return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheMisses);
 }
 
@@ -1037,11 +1049,16 @@ static void registerAllStats1()
   addGetStat("cache-bytes", doGetCacheBytes); 
   addGetStat("record-cache-contended", []() { return g_recCache->stats().first;});
   addGetStat("record-cache-acquired", []() { return g_recCache->stats().second;});
+  addGetStat("record-cache-served-stale", []() { return g_recCache->servedStale.load(); });
+  addGetStat("cache-replication-sent", []() { return pdns::CacheReplication::g_updatesSent.load(); });
+  addGetStat("cache-replication-received", []() { return pdns::CacheReplication::g_updatesReceived.load(); });
   
   addGetStat("packetcache-hits", doGetPacketCacheHits);
   addGetStat("packetcache-misses", doGetPacketCacheMisses); 
   addGetStat("packetcache-entries", doGetPacketCacheSize); 
   addGetStat("packetcache-bytes", doGetPacketCacheBytes); 
+  addGetStat("packetcache-contended", []() { return g_packetCache ? g_packetCache->stats().first : 0; });
+  addGetStat("packetcache-acquired", []() { return g_packetCache ? g_packetCache->stats().second : 0; });
   
   addGetStat("malloc-bytes", doGetMallocated);
   
@@ -1103,6 +1120,12 @@ static void registerAllStats1()
   addGetStat("max-mthread-stack", &g_stats.maxMThreadStackUsage);
   
   addGetStat("negcache-entries", getNegCacheSize);
+
+  addGetStat("aggressive-nsec-cache-entries", []() { return g_aggressiveNSECCache ? g_aggressiveNSECCache->getEntriesCount() : 0; });
+  addGetStat("aggressive-nsec-cache-nsec-hits", []() { return g_aggressiveNSECCache ? g_aggressiveNSECCache->getNSECHits() : 0; });
+  addGetStat("aggressive-nsec-cache-nsec3-hits", []() { return g_aggressiveNSECCache ? g_aggressiveNSECCache->getNSEC3Hits() : 0; });
+  addGetStat("aggressive-nsec-cache-nsec-wc-hits", []() { return g_aggressiveNSECCache ? g_aggressiveNSECCache->getNSECWildcardHits() : 0; });
+  addGetStat("aggressive-nsec-cache-nsec3-wc-hits", []() { return g_aggressiveNSECCache ? g_aggressiveNSECCache->getNSEC3WildcardHits() : 0; });
   addGetStat("throttle-entries", getThrottleSize);
 
   addGetStat("nsspeeds-entries", getNsSpeedsSize);
@@ -1115,6 +1138,14 @@ static void registerAllStats1()
   addGetStat("outgoing6-timeouts", &SyncRes::s_outgoing6timeouts);
   addGetStat("auth-zone-queries", &SyncRes::s_authzonequeries);
   addGetStat("tcp-outqueries", &SyncRes::s_tcpoutqueries);
+  addGetStat("tcp-out-new-connections", &g_stats.tcpOutNewConnections);
+  addGetStat("tcp-out-reused-connections", &g_stats.tcpOutReusedConnections);
+  addGetStat("tcp-out-idle-connections", []{ return broadcastAccFunction<uint64_t>(pleaseGetTCPOutIdleConnections); });
+  addGetStat("udp-batch-receives", &g_stats.udpBatchReceives);
+  addGetStat("udp-batch-queries", &g_stats.udpBatchQueries);
+  addGetStat("udp-batch-answers", &g_stats.udpBatchAnswers);
+  addGetStat("dot-outqueries", &SyncRes::s_dotoutqueries);
+  addGetStat("dot-resumed-sessions", &g_stats.dotResumedSessions);
   addGetStat("all-outqueries", &SyncRes::s_outqueries);
   addGetStat("ipv6-outqueries", &g_stats.ipv6queries);
   addGetStat("throttled-outqueries", &SyncRes::s_throttledqueries);
@@ -1282,6 +1313,19 @@ void doExitGeneric(bool nicely)
   if(!s_pidfname.empty())
     unlink(s_pidfname.c_str()); // we can at least try..
   if(nicely) {
+    const auto& snapshotFile = ::arg()["cache-snapshot-file"];
+    if (!snapshotFile.empty()) {
+      try {
+        auto count = pdns::CacheSnapshot::saveToFile(snapshotFile, time(nullptr));
+        g_log<<Logger::Warning<<"Saved "<<count<<" cache entries to snapshot file '"<<snapshotFile<<"'"<<endl;
+      }
+      catch (const std::exception& e) {
+        g_log<<Logger::Error<<"Error saving the cache snapshot to '"<<snapshotFile<<"': "<<e.what()<<endl;
+      }
+      catch (const PDNSException& e) {
+        g_log<<Logger::Error<<"Error saving the cache snapshot to '"<<snapshotFile<<"': "<<e.reason<<endl;
+      }
+    }
     RecursorControlChannel::stop = 1;
   } else {
     _exit(1);
@@ -1744,6 +1788,7 @@ RecursorControlChannel::Answer RecursorControlParser::getAnswer(int s, const str
 "reload-lua-script [filename]     (re)load Lua script\n"
 "reload-lua-config [filename]     (re)load Lua configuration file\n"
 "reload-zones                     reload all auth and forward zones\n"
+"save-cache-snapshot <filename>   save the record cache, negative cache and NS speeds to the named file\n"
 "set-ecs-minimum-ttl value        set ecs-minimum-ttl-override\n"
 "set-max-cache-entries value      set new maximum cache size\n"
 "set-max-packetcache-entries val  set new maximum packet cache size\n"      
@@ -1791,22 +1836,25 @@ RecursorControlChannel::Answer RecursorControlParser::getAnswer(int s, const str
     return doDumpCache(s);
   }
   if (cmd == "dump-ednsstatus" || cmd == "dump-edns") {
-    return doDumpToFile(s, pleaseDumpEDNSMap, cmd);
+    return doDumpToFile(s, SyncRes::doEDNSDump, cmd);
+  }
+  if (cmd == "save-cache-snapshot") {
+    return doDumpToFile(s, saveCacheSnapshot, cmd);
   }
   if (cmd == "dump-nsspeeds") {
-    return doDumpToFile(s, pleaseDumpNSSpeeds, cmd);
+    return doDumpToFile(s, SyncRes::doDumpNSSpeeds, cmd);
   }
   if (cmd == "dump-failedservers") {
-    return doDumpToFile(s, pleaseDumpFailedServers, cmd);
+    return doDumpToFile(s, SyncRes::doDumpFailedServers, cmd);
   }
   if (cmd == "dump-rpz") {
     return doDumpRPZ(s, begin, end);
   }
   if (cmd == "dump-throttlemap") {
-    return doDumpToFile(s, pleaseDumpThrottleMap, cmd);
+    return doDumpToFile(s, SyncRes::doDumpThrottleMap, cmd);
   }
   if (cmd == "dump-non-resolving") {
-    return doDumpToFile(s, pleaseDumpNonResolvingNS, cmd);
+    return doDumpToFile(s, SyncRes::doDumpNonResolvingNS, cmd);
   }
   if (cmd == "wipe-cache" || cmd == "flushname") {
     return {0, doWipeCache(begin, end, 0xffff)};
@@ -91,7 +91,8 @@ int main(int argc, char** argv)
     "dump-failedservers",
     "dump-rpz",
     "dump-throttlemap",
-    "dump-non-resolving"
+    "dump-non-resolving",
+    "save-cache-snapshot"
   };
   try {
     initArguments(argc, argv);
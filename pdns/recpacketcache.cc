@@ -125,8 +125,21 @@ bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string&
                                             std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData* pbdata, bool tcp)
 {
   *qhash = canHashPacket(queryPacket, true);
+  return getResponsePacketForHash(tag, queryPacket, qname, qtype, qclass, now, responsePacket, age, valState, *qhash, pbdata, tcp);
+}
+
+bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string& queryPacket, DNSName& qname, uint16_t* qtype, uint16_t* qclass, time_t now,
+                                            std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData *pbdata, bool tcp)
+{
+  *qhash = canHashPacket(queryPacket, true);
+  return getResponsePacketForHash(tag, queryPacket, qname, qtype, qclass, now, responsePacket, age, valState, *qhash, pbdata, tcp);
+}
+
+bool RecursorPacketCache::getResponsePacketForHash(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now,
+                                                   std::string* responsePacket, uint32_t* age, vState* valState, uint32_t qhash, OptPBData* pbdata, bool tcp)
+{
   const auto& idx = d_packetCache.get<HashTag>();
-  auto range = idx.equal_range(tie(tag, *qhash, tcp));
+  auto range = idx.equal_range(tie(tag, qhash, tcp));
 
   if(range.first == range.second) {
     d_misses++;
@@ -136,12 +149,11 @@ bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string&
   return checkResponseMatches(range, queryPacket, qname, qtype, qclass, now, responsePacket, age, valState, pbdata);
 }
 
-bool RecursorPacketCache::getResponsePacket(unsigned int tag, const std::string& queryPacket, DNSName& qname, uint16_t* qtype, uint16_t* qclass, time_t now,
-                                            std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData *pbdata, bool tcp)
+bool RecursorPacketCache::getResponsePacketForHash(unsigned int tag, const std::string& queryPacket, DNSName& qname, uint16_t* qtype, uint16_t* qclass, time_t now,
+                                                   std::string* responsePacket, uint32_t* age, vState* valState, uint32_t qhash, OptPBData *pbdata, bool tcp)
 {
-  *qhash = canHashPacket(queryPacket, true);
   const auto& idx = d_packetCache.get<HashTag>();
-  auto range = idx.equal_range(tie(tag, *qhash, tcp));
+  auto range = idx.equal_range(tie(tag, qhash, tcp));
 
   if(range.first == range.second) {
     d_misses++;
@@ -224,18 +236,141 @@ uint64_t RecursorPacketCache::doDump(int fd)
 
   fprintf(fp.get(), "; main packet cache dump from thread follows\n;\n");
 
+  return doDump(fp.get(), time(nullptr));
+}
+
+uint64_t RecursorPacketCache::doDump(FILE* fp, time_t now)
+{
   const auto& sidx = d_packetCache.get<SequencedTag>();
   uint64_t count = 0;
-  time_t now = time(nullptr);
 
   for (const auto& i : sidx) {
     count++;
     try {
-      fprintf(fp.get(), "%s %" PRId64 " %s  ; tag %d %s\n", i.d_name.toString().c_str(), static_cast<int64_t>(i.d_ttd - now), DNSRecordContent::NumberToType(i.d_type).c_str(), i.d_tag, i.d_tcp ? "tcp" : "udp");
+      fprintf(fp, "%s %" PRId64 " %s  ; tag %d %s\n", i.d_name.toString().c_str(), static_cast<int64_t>(i.d_ttd - now), DNSRecordContent::NumberToType(i.d_type).c_str(), i.d_tag, i.d_tcp ? "tcp" : "udp");
     }
     catch(...) {
-      fprintf(fp.get(), "; error printing '%s'\n", i.d_name.empty() ? "EMPTY" : i.d_name.toString().c_str());
+      fprintf(fp, "; error printing '%s'\n", i.d_name.empty() ? "EMPTY" : i.d_name.toString().c_str());
     }
   }
   return count;
 }
+
+SharedRecursorPacketCache::SharedRecursorPacketCache(size_t shardsCount) :
+  d_shards(shardsCount > 0 ? shardsCount : 1)
+{
+}
+
+bool SharedRecursorPacketCache::getResponsePacket(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now,
+                                                  std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, RecursorPacketCache::OptPBData* pbdata, bool tcp)
+{
+  *qhash = PacketCache::canHashPacket(queryPacket, true);
+  auto& shard = getShard(*qhash);
+  const lock l(shard);
+  return shard.d_cache.getResponsePacketForHash(tag, queryPacket, qname, qtype, qclass, now, responsePacket, age, valState, *qhash, pbdata, tcp);
+}
+
+bool SharedRecursorPacketCache::getResponsePacket(unsigned int tag, const std::string& queryPacket, DNSName& qname, uint16_t* qtype, uint16_t* qclass, time_t now,
+                                                  std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, RecursorPacketCache::OptPBData* pbdata, bool tcp)
+{
+  *qhash = PacketCache::canHashPacket(queryPacket, true);
+  auto& shard = getShard(*qhash);
+  const lock l(shard);
+  return shard.d_cache.getResponsePacketForHash(tag, queryPacket, qname, qtype, qclass, now, responsePacket, age, valState, *qhash, pbdata, tcp);
+}
+
+void SharedRecursorPacketCache::insertResponsePacket(unsigned int tag, uint32_t qhash, std::string&& query, const DNSName& qname, uint16_t qtype, uint16_t qclass, std::string&& responsePacket, time_t now, uint32_t ttl, const vState& valState, RecursorPacketCache::OptPBData&& pbdata, bool tcp)
+{
+  auto& shard = getShard(qhash);
+  const lock l(shard);
+  shard.d_cache.insertResponsePacket(tag, qhash, std::move(query), qname, qtype, qclass, std::move(responsePacket), now, ttl, valState, std::move(pbdata), tcp);
+}
+
+void SharedRecursorPacketCache::doPruneTo(size_t maxSize)
+{
+  /* with fewer entries than shards, keep at most one entry per shard instead of emptying all of them */
+  const size_t maxPerShard = maxSize == 0 ? 0 : std::max(maxSize / d_shards.size(), static_cast<size_t>(1));
+  for (auto& shard : d_shards) {
+    const lock l(shard);
+    shard.d_cache.doPruneTo(maxPerShard);
+  }
+}
+
+uint64_t SharedRecursorPacketCache::doDump(int fd)
+{
+  auto fp = std::unique_ptr<FILE, int(*)(FILE*)>(fdopen(dup(fd), "w"), fclose);
+  if (!fp) { // dup probably failed
+    return 0;
+  }
+
+  fprintf(fp.get(), "; shared packet cache dump follows\n;\n");
+
+  uint64_t count = 0;
+  time_t now = time(nullptr);
+  for (auto& shard : d_shards) {
+    const lock l(shard);
+    count += shard.d_cache.doDump(fp.get(), now);
+  }
+  return count;
+}
+
+uint64_t SharedRecursorPacketCache::doWipePacketCache(const DNSName& name, uint16_t qtype, bool subtree)
+{
+  uint64_t count = 0;
+  for (auto& shard : d_shards) {
+    const lock l(shard);
+    count += shard.d_cache.doWipePacketCache(name, qtype, subtree);
+  }
+  return count;
+}
+
+uint64_t SharedRecursorPacketCache::size()
+{
+  uint64_t count = 0;
+  for (auto& shard : d_shards) {
+    const lock l(shard);
+    count += shard.d_cache.size();
+  }
+  return count;
+}
+
+uint64_t SharedRecursorPacketCache::bytes()
+{
+  uint64_t count = 0;
+  for (auto& shard : d_shards) {
+    const lock l(shard);
+    count += shard.d_cache.bytes();
+  }
+  return count;
+}
+
+uint64_t SharedRecursorPacketCache::getHits()
+{
+  uint64_t count = 0;
+  for (auto& shard : d_shards) {
+    const lock l(shard);
+    count += shard.d_cache.d_hits;
+  }
+  return count;
+}
+
+uint64_t SharedRecursorPacketCache::getMisses()
+{
+  uint64_t count = 0;
+  for (auto& shard : d_shards) {
+    const lock l(shard);
+    count += shard.d_cache.d_misses;
+  }
+  return count;
+}
+
+std::pair<uint64_t, uint64_t> SharedRecursorPacketCache::stats()
+{
+  uint64_t contended = 0, acquired = 0;
+  for (auto& shard : d_shards) {
+    const lock l(shard);
+    contended += shard.d_contended_count;
+    acquired += shard.d_acquired_count;
+  }
+  return {contended, acquired};
+}
@@ -21,6 +21,7 @@
  */
 #pragma once
 #include <string>
+#include <mutex>
 #include <inttypes.h>
 #include "dns.hh"
 #include "namespaces.hh"
@@ -63,10 +64,14 @@ public:
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, uint32_t* qhash);
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData* pbdata, bool tcp);
   bool getResponsePacket(unsigned int tag, const std::string& queryPacket, DNSName& qname, uint16_t *qtype, uint16_t* qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, OptPBData* pbdata, bool tcp);
-  
+  /* same as the two above, for callers that already computed the hash of the query */
+  bool getResponsePacketForHash(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, uint32_t qhash, OptPBData* pbdata, bool tcp);
+  bool getResponsePacketForHash(unsigned int tag, const std::string& queryPacket, DNSName& qname, uint16_t *qtype, uint16_t* qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, uint32_t qhash, OptPBData* pbdata, bool tcp);
+
   void insertResponsePacket(unsigned int tag, uint32_t qhash, std::string&& query, const DNSName& qname, uint16_t qtype, uint16_t qclass, std::string&& responsePacket, time_t now, uint32_t ttl, const vState& valState, OptPBData&& pbdata, bool tcp);
   void doPruneTo(size_t maxSize=250000);
   uint64_t doDump(int fd);
+  uint64_t doDump(FILE* fp, time_t now);
   int doWipePacketCache(const DNSName& name, uint16_t qtype=0xffff, bool subtree=false);
   
   void prune();
@@ -134,3 +139,65 @@ public:
   {
   }
 };
+
+/* A packet cache shared by all worker threads, instead of one RecursorPacketCache per thread.
+   Entries are spread over shards based on the hash of the query, each shard being a
+   RecursorPacketCache protected by its own mutex. */
+class SharedRecursorPacketCache
+{
+public:
+  SharedRecursorPacketCache(size_t shardsCount = 1024);
+
+  bool getResponsePacket(unsigned int tag, const std::string& queryPacket, const DNSName& qname, uint16_t qtype, uint16_t qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, RecursorPacketCache::OptPBData* pbdata, bool tcp);
+  bool getResponsePacket(unsigned int tag, const std::string& queryPacket, DNSName& qname, uint16_t* qtype, uint16_t* qclass, time_t now, std::string* responsePacket, uint32_t* age, vState* valState, uint32_t* qhash, RecursorPacketCache::OptPBData* pbdata, bool tcp);
+  void insertResponsePacket(unsigned int tag, uint32_t qhash, std::string&& query, const DNSName& qname, uint16_t qtype, uint16_t qclass, std::string&& responsePacket, time_t now, uint32_t ttl, const vState& valState, RecursorPacketCache::OptPBData&& pbdata, bool tcp);
+  void doPruneTo(size_t maxSize);
+  uint64_t doDump(int fd);
+  uint64_t doWipePacketCache(const DNSName& name, uint16_t qtype = 0xffff, bool subtree = false);
+
+  uint64_t size();
+  uint64_t bytes();
+  uint64_t getHits();
+  uint64_t getMisses();
+  /* number of lock acquisitions that had to wait, and total number of lock acquisitions */
+  std::pair<uint64_t, uint64_t> stats();
+
+private:
+  struct Shard
+  {
+    Shard() {}
+    Shard(const Shard&) = delete;
+    Shard& operator=(const Shard&) = delete;
+    RecursorPacketCache d_cache;
+    std::mutex d_mutex;
+    uint64_t d_contended_count{0};
+    uint64_t d_acquired_count{0};
+  };
+
+  struct lock
+  {
+    lock(Shard& shard) :
+      m(shard.d_mutex)
+    {
+      if (!m.try_lock()) {
+        m.lock();
+        shard.d_contended_count++;
+      }
+      shard.d_acquired_count++;
+    }
+    ~lock()
+    {
+      m.unlock();
+    }
+
+  private:
+    std::mutex& m;
+  };
+
+  Shard& getShard(uint32_t qhash)
+  {
+    return d_shards[qhash % d_shards.size()];
+  }
+
+  std::vector<Shard> d_shards;
+};
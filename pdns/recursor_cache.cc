@@ -14,6 +14,11 @@
 #include "namespaces.hh"
 #include "cachecleaner.hh"
 #include "rec-taskqueue.hh"
+#include "rec-replication.hh"
+#include "rec-snapshot.hh"
+
+uint16_t MemRecursorCache::s_maxServedStaleExtensions;
+bool MemRecursorCache::s_clockEviction;
 
 MemRecursorCache::MemRecursorCache(size_t mapsCount) : d_maps(mapsCount)
 {
@@ -155,12 +160,20 @@ time_t MemRecursorCache::handleHit(MapCombo& map, MemRecursorCache::OrderedTagIt
     *fromAuthZone = entry->d_authZone;
   }
 
-  moveCacheItemToBack<SequencedTag>(map.d_map, entry);
+  if (s_clockEviction) {
+    // only touch the entry if needed, we might be holding a shared lock
+    if (!entry->d_referenced) {
+      entry->d_referenced = true;
+    }
+  }
+  else {
+    moveCacheItemToBack<SequencedTag>(map.d_map, entry);
+  }
 
   return ttd;
 }
 
-MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSIndex(MapCombo& map, time_t now, const DNSName &qname, const QType qtype, bool requireAuth, const ComboAddress& who)
+MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSIndex(MapCombo& map, time_t now, const DNSName &qname, const QType qtype, bool requireAuth, const ComboAddress& who, bool serveStale)
 {
   // MUTEX SHOULD BE ACQUIRED
   auto ecsIndexKey = tie(qname, qtype);
@@ -185,7 +198,7 @@ MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSInde
         continue;
       }
 
-      if (entry->d_ttd > now) {
+      if (entry->isEntryUsable(now, serveStale)) {
         if (!requireAuth || entry->d_auth) {
           return entry;
         }
@@ -208,7 +221,7 @@ MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSInde
   auto key = boost::make_tuple(qname, qtype, boost::none, Netmask());
   auto entry = map.d_map.find(key);
   if (entry != map.d_map.end()) {
-    if (entry->d_ttd > now) {
+    if (entry->isEntryUsable(now, serveStale)) {
       if (!requireAuth || entry->d_auth) {
         return entry;
       }
@@ -222,9 +235,14 @@ MemRecursorCache::cache_t::const_iterator MemRecursorCache::getEntryUsingECSInde
   return map.d_map.end();
 }
 
-MemRecursorCache::Entries MemRecursorCache::getEntries(MapCombo& map, const DNSName &qname, const QType qt, const OptTag& rtag )
+MemRecursorCache::Entries MemRecursorCache::getEntries(MapCombo& map, const DNSName &qname, const QType qt, const OptTag& rtag, bool exclusive)
 {
   // MUTEX SHOULD BE ACQUIRED
+  if (!exclusive) {
+    // the d_cachecache hack can't be updated under a shared lock
+    const auto& idx = map.d_map.get<NameAndRTagOnlyHashedTag>();
+    return idx.equal_range(tie(qname, rtag));
+  }
   if (!map.d_cachecachevalid || map.d_cachedqname != qname || map.d_cachedrtag != rtag) {
     map.d_cachedqname = qname;
     map.d_cachedrtag = rtag;
@@ -260,20 +278,38 @@ time_t MemRecursorCache::fakeTTD(MemRecursorCache::OrderedTagIterator_t& entry,
       if (refresh) {
         return -1;
       } else {
-        if (!entry->d_submitted) {
+        if (!entry->d_submitted.exchange(true)) {
           pushTask(qname, qtype, entry->d_ttd);
-          entry->d_submitted = true;
         }
       }
     }
   }
   return ttl;
 }
+
+// When serving an expired entry, give it a short new lease of life and schedule a refresh
+void MemRecursorCache::handleServeStaleBookkeeping(time_t now, bool serveStale, MemRecursorCache::OrderedTagIterator_t& entry)
+{
+  // MUTEX SHOULD BE ACQUIRED
+  if (!serveStale || entry->d_ttd > now) {
+    return;
+  }
+
+  entry->d_ttd = now + std::min(entry->d_orig_ttl, s_serveStaleExtensionPeriod);
+  entry->d_servedStale++;
+  servedStale++;
+  // the entry looks fresh again, so make sure it gets refreshed in the background
+  pushTask(entry->d_qname, entry->d_qtype.getCode(), entry->d_ttd);
+  entry->d_submitted = true;
+}
+
 // returns -1 for no hits
-time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, bool refresh, const OptTag& routingTag, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, vState* state, bool* wasAuth, DNSName* fromAuthZone)
+time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, Flags flags, const OptTag& routingTag, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, vState* state, bool* wasAuth, DNSName* fromAuthZone)
 {
   boost::optional<vState> cachedState{boost::none};
   uint32_t origTTL;
+  const bool refresh = flags & Refresh;
+  const bool serveStale = flags & ServeStale;
 
   if(res) {
     res->clear();
@@ -286,7 +322,21 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
   }
 
   auto& map = getMap(qname);
-  const lock l(map);
+  /* With CLOCK eviction a hit does not modify the map, so unless we might have to update
+     the ECS index or extend a stale entry a shared lock is enough */
+  bool exclusive = !s_clockEviction || serveStale;
+  boost::optional<sharedLock> sl;
+  boost::optional<lock> l;
+  if (!exclusive) {
+    sl.emplace(map);
+    if (qtype != QType::ANY && !map.d_ecsIndex.empty() && !routingTag) {
+      sl = boost::none;
+      exclusive = true;
+    }
+  }
+  if (exclusive) {
+    l.emplace(map);
+  }
 
   /* If we don't have any netmask-specific entries at all, let's just skip this
      to be able to use the nice d_cachecache hack. */
@@ -294,12 +344,14 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
     if (qtype == QType::ADDR) {
       time_t ret = -1;
 
-      auto entryA = getEntryUsingECSIndex(map, now, qname, QType::A, requireAuth, who);
+      auto entryA = getEntryUsingECSIndex(map, now, qname, QType::A, requireAuth, who, serveStale);
       if (entryA != map.d_map.end()) {
+        handleServeStaleBookkeeping(now, serveStale, entryA);
         ret = handleHit(map, entryA, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
       }
-      auto entryAAAA = getEntryUsingECSIndex(map, now, qname, QType::AAAA, requireAuth, who);
+      auto entryAAAA = getEntryUsingECSIndex(map, now, qname, QType::AAAA, requireAuth, who, serveStale);
       if (entryAAAA != map.d_map.end()) {
+        handleServeStaleBookkeeping(now, serveStale, entryAAAA);
         time_t ttdAAAA = handleHit(map, entryAAAA, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
         if (ret > 0) {
           ret = std::min(ret, ttdAAAA);
@@ -315,8 +367,9 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
       return ret > 0 ? (ret - now) : ret;
     }
     else {
-      auto entry = getEntryUsingECSIndex(map, now, qname, qtype, requireAuth, who);
+      auto entry = getEntryUsingECSIndex(map, now, qname, qtype, requireAuth, who, serveStale);
       if (entry != map.d_map.end()) {
+        handleServeStaleBookkeeping(now, serveStale, entry);
         time_t ret = handleHit(map, entry, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
         if (state && cachedState) {
           *state = *cachedState;
@@ -328,7 +381,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
   }
 
   if (routingTag) {
-    auto entries = getEntries(map, qname, qt, routingTag);
+    auto entries = getEntries(map, qname, qt, routingTag, exclusive);
     bool found = false;
     time_t ttd;
 
@@ -337,8 +390,10 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
       for (auto i=entries.first; i != entries.second; ++i) {
         firstIndexIterator = map.d_map.project<OrderedTag>(i);
 
-        if (i->d_ttd <= now) {
-          moveCacheItemToFront<SequencedTag>(map.d_map, firstIndexIterator);
+        if (!i->isEntryUsable(now, serveStale)) {
+          if (exclusive) {
+            moveCacheItemToFront<SequencedTag>(map.d_map, firstIndexIterator);
+          }
           continue;
         }
 
@@ -346,6 +401,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
           continue;
         }
         found = true;
+        handleServeStaleBookkeeping(now, serveStale, firstIndexIterator);
         ttd = handleHit(map, firstIndexIterator, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
 
         if (qt != QType::ANY && qt != QType::ADDR) { // normally if we have a hit, we are done
@@ -363,7 +419,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
     }
   }
   // Try (again) without tag
-  auto entries = getEntries(map, qname, qt, boost::none);
+  auto entries = getEntries(map, qname, qt, boost::none, exclusive);
 
   if (entries.first != entries.second) {
     OrderedTagIterator_t firstIndexIterator;
@@ -373,8 +429,10 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
     for (auto i=entries.first; i != entries.second; ++i) {
       firstIndexIterator = map.d_map.project<OrderedTag>(i);
 
-      if (i->d_ttd <= now) {
-        moveCacheItemToFront<SequencedTag>(map.d_map, firstIndexIterator);
+      if (!i->isEntryUsable(now, serveStale)) {
+        if (exclusive) {
+          moveCacheItemToFront<SequencedTag>(map.d_map, firstIndexIterator);
+        }
         continue;
       }
 
@@ -383,6 +441,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
       }
 
       found = true;
+      handleServeStaleBookkeeping(now, serveStale, firstIndexIterator);
       ttd = handleHit(map, firstIndexIterator, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone);
 
       if (qt != QType::ANY && qt != QType::ADDR) { // normally if we have a hit, we are done
@@ -402,7 +461,9 @@ time_t MemRecursorCache::get(time_t now, const DNSName &qname, const QType qt, b
 void MemRecursorCache::replace(time_t now, const DNSName &qname, const QType qt, const vector<DNSRecord>& content, const vector<shared_ptr<RRSIGRecordContent>>& signatures, const std::vector<std::shared_ptr<DNSRecord>>& authorityRecs, bool auth, const DNSName& authZone, boost::optional<Netmask> ednsmask, const OptTag& routingTag, vState state, boost::optional<ComboAddress> from)
 {
   auto& map = getMap(qname);
-  const lock l(map);
+  /* released before building the replication update, if any */
+  boost::optional<lock> l;
+  l.emplace(map);
 
   map.d_cachecachevalid = false;
   if (ednsmask) {
@@ -494,7 +555,18 @@ void MemRecursorCache::replace(time_t now, const DNSName &qname, const QType qt,
     moveCacheItemToBack<SequencedTag>(map.d_map, stored);
   }
   ce.d_submitted = false;
+  ce.d_servedStale = 0;
   map.d_map.replace(stored, ce);
+  l.reset();
+
+  if (pdns::CacheReplication::wanted(qname, ce.d_ttd, now)) {
+    pdns::CacheReplication::Update update;
+    {
+      protozero::pbf_writer message(update.get(), static_cast<protozero::pbf_tag_type>(pdns::CacheSnapshot::Field::recordCacheEntry));
+      encodeSnapshotEntry(message, ce);
+    }
+    update.send();
+  }
 }
 
 size_t MemRecursorCache::doWipeCache(const DNSName& name, bool sub, const QType qtype)
@@ -604,7 +676,7 @@ bool MemRecursorCache::updateValidationStatus(time_t now, const DNSName &qname,
 
   bool updated = false;
   if (!map.d_ecsIndex.empty() && !routingTag) {
-    auto entry = getEntryUsingECSIndex(map, now, qname, qtype, requireAuth, who);
+    auto entry = getEntryUsingECSIndex(map, now, qname, qtype, requireAuth, who, false);
     if (entry == map.d_map.end()) {
       return false;
     }
@@ -616,7 +688,7 @@ bool MemRecursorCache::updateValidationStatus(time_t now, const DNSName &qname,
     return true;
   }
 
-  auto entries = getEntries(map, qname, qt, routingTag);
+  auto entries = getEntries(map, qname, qt, routingTag, true);
 
   for(auto i = entries.first; i != entries.second; ++i) {
     auto firstIndexIterator = map.d_map.project<OrderedTag>(i);
@@ -681,13 +753,257 @@ uint64_t MemRecursorCache::doDump(int fd)
   return count;
 }
 
+enum class SnapshotEntryField : protozero::pbf_tag_type
+{
+  qname = 1,
+  qtype = 2,
+  rtag = 3,
+  netmask = 4,
+  record = 5,
+  signature = 6,
+  authorityRecord = 7,
+  authZone = 8,
+  from = 9,
+  state = 10,
+  ttd = 11,
+  origTTL = 12,
+  auth = 13,
+  servedStale = 14
+};
+
+void MemRecursorCache::encodeSnapshotEntry(protozero::pbf_writer& message, const CacheEntry& entry)
+{
+  pdns::CacheSnapshot::encodeName(message, static_cast<protozero::pbf_tag_type>(SnapshotEntryField::qname), entry.d_qname);
+  message.add_uint32(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::qtype), entry.d_qtype.getCode());
+  if (entry.d_rtag) {
+    message.add_string(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::rtag), *entry.d_rtag);
+  }
+  if (!entry.d_netmask.empty()) {
+    message.add_string(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::netmask), entry.d_netmask.toString());
+  }
+  for (const auto& record : entry.d_records) {
+    message.add_bytes(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::record), record->serialize(entry.d_qname));
+  }
+  for (const auto& signature : entry.d_signatures) {
+    message.add_bytes(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::signature), signature->serialize(entry.d_qname));
+  }
+  for (const auto& record : entry.d_authorityRecs) {
+    pdns::CacheSnapshot::encodeRecord(message, static_cast<protozero::pbf_tag_type>(SnapshotEntryField::authorityRecord), *record);
+  }
+  pdns::CacheSnapshot::encodeName(message, static_cast<protozero::pbf_tag_type>(SnapshotEntryField::authZone), entry.d_authZone);
+  message.add_string(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::from), entry.d_from.toStringWithPort());
+  message.add_uint32(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::state), static_cast<uint32_t>(entry.d_state));
+  message.add_int64(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::ttd), entry.d_ttd);
+  message.add_uint32(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::origTTL), entry.d_orig_ttl);
+  message.add_bool(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::auth), entry.d_auth);
+  message.add_uint32(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::servedStale), entry.d_servedStale);
+}
+
+uint64_t MemRecursorCache::saveSnapshot(pdns::CacheSnapshot::Writer& writer)
+{
+  uint64_t count = 0;
+
+  for (auto& map : d_maps) {
+    {
+      const lock l(map);
+      for (const auto& entry : map.d_map) {
+        protozero::pbf_writer message(writer.get(), static_cast<protozero::pbf_tag_type>(pdns::CacheSnapshot::Field::recordCacheEntry));
+        encodeSnapshotEntry(message, entry);
+        count++;
+      }
+    }
+    // don't hold the lock while writing to disk
+    writer.flushIfNeeded();
+  }
+
+  return count;
+}
+
+bool MemRecursorCache::loadSnapshotEntry(const protozero::data_view& data, time_t now)
+{
+  DNSName qname;
+  QType qtype;
+  OptTag rtag;
+  Netmask netmask;
+  std::vector<std::string> records;
+  std::vector<std::string> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authorityRecs;
+  DNSName authZone;
+  ComboAddress from;
+  vState state = vState::Indeterminate;
+  time_t ttd = 0;
+  uint32_t origTTL = 0;
+  bool auth = false;
+  uint16_t servedStale = 0;
+
+  protozero::pbf_reader message(data);
+  while (message.next()) {
+    switch (static_cast<SnapshotEntryField>(message.tag())) {
+    case SnapshotEntryField::qname:
+      qname = pdns::CacheSnapshot::decodeName(message.get_view());
+      break;
+    case SnapshotEntryField::qtype:
+      qtype = message.get_uint32();
+      break;
+    case SnapshotEntryField::rtag:
+      rtag = message.get_string();
+      break;
+    case SnapshotEntryField::netmask:
+      netmask = Netmask(message.get_string());
+      break;
+    case SnapshotEntryField::record:
+      records.push_back(message.get_bytes());
+      break;
+    case SnapshotEntryField::signature:
+      signatures.push_back(message.get_bytes());
+      break;
+    case SnapshotEntryField::authorityRecord:
+      authorityRecs.push_back(std::make_shared<DNSRecord>(pdns::CacheSnapshot::decodeRecord(message.get_message())));
+      break;
+    case SnapshotEntryField::authZone:
+      authZone = pdns::CacheSnapshot::decodeName(message.get_view());
+      break;
+    case SnapshotEntryField::from:
+      from = ComboAddress(message.get_string());
+      break;
+    case SnapshotEntryField::state:
+      state = static_cast<vState>(message.get_uint32());
+      break;
+    case SnapshotEntryField::ttd:
+      ttd = static_cast<time_t>(message.get_int64());
+      break;
+    case SnapshotEntryField::origTTL:
+      origTTL = message.get_uint32();
+      break;
+    case SnapshotEntryField::auth:
+      auth = message.get_bool();
+      break;
+    case SnapshotEntryField::servedStale:
+      servedStale = static_cast<uint16_t>(message.get_uint32());
+      break;
+    default:
+      message.skip();
+    }
+  }
+
+  if (qname.empty() || records.empty()) {
+    throw std::runtime_error("Invalid record cache entry in snapshot");
+  }
+
+  CacheEntry ce(boost::make_tuple(qname, qtype, rtag, netmask), auth);
+  ce.d_ttd = ttd;
+  ce.d_orig_ttl = origTTL;
+  ce.d_servedStale = servedStale;
+  /* expired entries are only kept if they can still be served stale, taking into account
+     the number of times they have already been extended */
+  if (!ce.isEntryUsable(now, s_maxServedStaleExtensions > 0)) {
+    return false;
+  }
+
+  ce.d_records.reserve(records.size());
+  for (const auto& record : records) {
+    ce.d_records.push_back(DNSRecordContent::deserialize(qname, qtype.getCode(), record));
+  }
+  ce.d_signatures.reserve(signatures.size());
+  for (const auto& signature : signatures) {
+    auto rrsig = std::dynamic_pointer_cast<RRSIGRecordContent>(DNSRecordContent::deserialize(qname, QType::RRSIG, signature));
+    if (rrsig) {
+      ce.d_signatures.push_back(std::move(rrsig));
+    }
+  }
+  ce.d_authorityRecs = std::move(authorityRecs);
+  ce.d_authZone = authZone;
+  ce.d_from = from;
+  ce.d_state = state;
+
+  auto& map = getMap(qname);
+  const lock l(map);
+  auto stored = map.d_map.find(boost::make_tuple(qname, qtype.getCode(), rtag, netmask));
+  if (stored != map.d_map.end()) {
+    /* we already have fresher data, or valid auth data that we don't want to replace with unauth one */
+    if (stored->d_ttd >= ce.d_ttd || (stored->d_auth && !ce.d_auth && stored->d_ttd > now)) {
+      return false;
+    }
+    moveCacheItemToBack<SequencedTag>(map.d_map, stored);
+    map.d_map.replace(stored, ce);
+  }
+  else {
+    map.d_map.insert(ce);
+    map.d_entriesCount++;
+  }
+  map.d_cachecachevalid = false;
+
+  if (!rtag && !netmask.empty()) {
+    auto ecsIndexKey = boost::make_tuple(qname, qtype.getCode());
+    auto ecsIndex = map.d_ecsIndex.find(ecsIndexKey);
+    if (ecsIndex == map.d_ecsIndex.end()) {
+      ecsIndex = map.d_ecsIndex.insert(ECSIndexEntry(qname, qtype.getCode())).first;
+    }
+    ecsIndex->addMask(netmask);
+  }
+
+  return true;
+}
+
 void MemRecursorCache::doPrune(size_t keep)
 {
+  if (s_clockEviction) {
+    doPruneClock(keep);
+    return;
+  }
+
   //size_t maxCached = d_maxEntries;
   size_t cacheSize = size();
   pruneMutexCollectionsVector<SequencedTag>(*this, d_maps, keep, cacheSize);
 }
 
+/* CLOCK (second chance) eviction: the sequenced index is the clock and its front is the hand.
+   Expired entries are removed. If we are over the limit, entries that have been hit since the
+   last sweep get their reference bit cleared and are moved to the back, the other ones are evicted.
+   Like pruneMutexCollectionsVector() we only look at a bounded number of entries per shard, so
+   it might take a few runs to get back under the limit. */
+void MemRecursorCache::doPruneClock(size_t keep)
+{
+  const time_t now = time(nullptr);
+  const size_t cacheSize = size();
+  const size_t toTrim = cacheSize > keep ? cacheSize - keep : 0;
+
+  for (auto& map : d_maps) {
+    const lock l(map);
+    map.invalidate();
+    auto& sidx = map.d_map.get<SequencedTag>();
+    const size_t shardSize = sidx.size();
+    if (shardSize == 0) {
+      continue;
+    }
+
+    // trim each shard in proportion to its size
+    const size_t toTrimHere = toTrim > 0 ? (shardSize * toTrim + cacheSize - 1) / cacheSize : 0;
+    const size_t lookAt = toTrimHere > 0 ? 5 * toTrimHere : (shardSize + 9) / 10;
+    size_t erased = 0;
+    size_t lookedAt = 0;
+
+    for (auto i = sidx.begin(); i != sidx.end() && lookedAt < lookAt; lookedAt++) {
+      if (i->isStale(now) || (erased < toTrimHere && !i->d_referenced)) {
+        preRemoval(*i);
+        i = sidx.erase(i);
+        erased++;
+        map.d_entriesCount--;
+      }
+      else if (erased < toTrimHere) {
+        // second chance
+        i->d_referenced = false;
+        auto next = std::next(i);
+        sidx.relocate(sidx.end(), i);
+        i = next;
+      }
+      else {
+        ++i;
+      }
+    }
+  }
+}
+
 namespace boost {
   size_t hash_value(const MemRecursorCache::OptTag& o)
   {
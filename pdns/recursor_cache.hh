@@ -23,6 +23,7 @@
 #include <string>
 #include <set>
 #include <mutex>
+#include <shared_mutex>
 #include "dns.hh"
 #include "qtype.hh"
 #include "misc.hh"
@@ -44,6 +45,20 @@
 #include "namespaces.hh"
 using namespace ::boost::multi_index;
 
+namespace protozero
+{
+class data_view;
+template <typename TBuffer>
+class basic_pbf_writer;
+}
+namespace pdns
+{
+namespace CacheSnapshot
+{
+  class Writer;
+}
+}
+
 class MemRecursorCache : public boost::noncopyable //  : public RecursorCache
 {
 public:
@@ -55,36 +70,105 @@ public:
   pair<uint64_t,uint64_t> stats();
   size_t ecsIndexSize();
 
+  // The time a stale cache entry is extended
+  static constexpr uint32_t s_serveStaleExtensionPeriod = 30;
+  // The number of times a stale cache entry can be extended
+  static uint16_t s_maxServedStaleExtensions;
+  // Whether hits only mark entries as referenced (CLOCK) instead of moving them in the LRU list,
+  // which allows lookups to proceed under a shared lock
+  static bool s_clockEviction;
+
   typedef boost::optional<std::string> OptTag;
 
-  time_t get(time_t, const DNSName &qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, bool refresh = false, const OptTag& routingTag = boost::none, vector<std::shared_ptr<RRSIGRecordContent>>* signatures=nullptr, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs=nullptr, bool* variable=nullptr, vState* state=nullptr, bool* wasAuth=nullptr, DNSName* fromAuthZone=nullptr);
+  typedef uint8_t Flags;
+  static constexpr Flags None = 0;
+  static constexpr Flags Refresh = 1 << 0;
+  static constexpr Flags ServeStale = 1 << 1;
+
+  time_t get(time_t, const DNSName &qname, const QType qt, bool requireAuth, vector<DNSRecord>* res, const ComboAddress& who, Flags flags = None, const OptTag& routingTag = boost::none, vector<std::shared_ptr<RRSIGRecordContent>>* signatures=nullptr, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs=nullptr, bool* variable=nullptr, vState* state=nullptr, bool* wasAuth=nullptr, DNSName* fromAuthZone=nullptr);
 
   void replace(time_t, const DNSName &qname, const QType qt,  const vector<DNSRecord>& content, const vector<shared_ptr<RRSIGRecordContent>>& signatures, const std::vector<std::shared_ptr<DNSRecord>>& authorityRecs, bool auth, const DNSName& authZone, boost::optional<Netmask> ednsmask=boost::none, const OptTag& routingTag = boost::none, vState state=vState::Indeterminate, boost::optional<ComboAddress> from=boost::none);
 
   void doPrune(size_t keep);
   uint64_t doDump(int fd);
 
+  uint64_t saveSnapshot(pdns::CacheSnapshot::Writer& writer);
+  /* returns false if the entry had expired, or if we already have a fresher one for the same key */
+  bool loadSnapshotEntry(const protozero::data_view& message, time_t now);
+
   size_t doWipeCache(const DNSName& name, bool sub, QType qtype=0xffff);
   bool doAgeCache(time_t now, const DNSName& name, QType qtype, uint32_t newTTL);
   bool updateValidationStatus(time_t now, const DNSName &qname, QType qt, const ComboAddress& who, const OptTag& routingTag, bool requireAuth, vState newState, boost::optional<time_t> capTTD);
 
   std::atomic<uint64_t> cacheHits{0}, cacheMisses{0};
+  std::atomic<uint64_t> servedStale{0};
 
 private:
 
+  // std::atomic<bool> that can be copied along with the cache entry holding it
+  struct AtomicFlag
+  {
+    AtomicFlag(bool value = false) : d_value(value)
+    {
+    }
+    AtomicFlag(const AtomicFlag& rhs) : d_value(rhs.d_value.load())
+    {
+    }
+    AtomicFlag& operator=(const AtomicFlag& rhs)
+    {
+      d_value.store(rhs.d_value.load());
+      return *this;
+    }
+    AtomicFlag& operator=(bool value)
+    {
+      d_value.store(value, std::memory_order_relaxed);
+      return *this;
+    }
+    operator bool() const
+    {
+      return d_value.load(std::memory_order_relaxed);
+    }
+    bool exchange(bool value)
+    {
+      return d_value.exchange(value, std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<bool> d_value;
+  };
+
   struct CacheEntry
   {
     CacheEntry(const boost::tuple<DNSName, QType, OptTag, Netmask>& key, bool auth):
-      d_qname(key.get<0>()), d_netmask(key.get<3>().getNormalized()), d_rtag(key.get<2>()), d_state(vState::Indeterminate), d_ttd(0), d_qtype(key.get<1>()), d_auth(auth), d_submitted(false)
+      d_qname(key.get<0>()), d_netmask(key.get<3>().getNormalized()), d_rtag(key.get<2>()), d_state(vState::Indeterminate), d_ttd(0), d_qtype(key.get<1>()), d_servedStale(0), d_auth(auth), d_submitted(false), d_referenced(false)
     {
     }
 
     typedef vector<std::shared_ptr<DNSRecordContent>> records_t;
+
+    /* the time after which this entry can be removed, which is later than
+       its TTD when expired entries are kept around to be served stale */
     time_t getTTD() const
     {
+      if (s_maxServedStaleExtensions > 0) {
+        return d_ttd + static_cast<time_t>(s_maxServedStaleExtensions) * std::min(s_serveStaleExtensionPeriod, d_orig_ttl);
+      }
       return d_ttd;
     }
 
+    bool isStale(time_t now) const
+    {
+      return getTTD() < now;
+    }
+
+    bool isEntryUsable(time_t now, bool serveStale) const
+    {
+      if (d_ttd > now) {
+        return true;
+      }
+      return serveStale && d_servedStale < s_maxServedStaleExtensions && !isStale(now);
+    }
+
     records_t d_records;
     std::vector<std::shared_ptr<RRSIGRecordContent>> d_signatures;
     std::vector<std::shared_ptr<DNSRecord>> d_authorityRecs;
@@ -97,8 +181,10 @@ private:
     mutable time_t d_ttd;
     uint32_t d_orig_ttl;
     QType d_qtype;
+    mutable uint16_t d_servedStale; // number of times this entry has been extended while expired
     bool d_auth;
-    mutable bool d_submitted;     // whether this entry has been queued for refetch
+    mutable AtomicFlag d_submitted;     // whether this entry has been queued for refetch
+    mutable AtomicFlag d_referenced;    // whether this entry has been hit since the last CLOCK sweep
   };
 
   /* The ECS Index (d_ecsIndex) keeps track of whether there is any ECS-specific
@@ -213,11 +299,11 @@ private:
     DNSName d_cachedqname;
     OptTag d_cachedrtag;
     Entries d_cachecache;
-    std::mutex mutex;
+    std::shared_mutex mutex;
     bool d_cachecachevalid{false};
     std::atomic<uint64_t> d_entriesCount{0};
-    uint64_t d_contended_count{0};
-    uint64_t d_acquired_count{0};
+    std::atomic<uint64_t> d_contended_count{0};
+    std::atomic<uint64_t> d_acquired_count{0};
 
     void invalidate()
     {
@@ -232,10 +318,14 @@ private:
   }
 
   static time_t fakeTTD(OrderedTagIterator_t& entry, const DNSName& qname, QType qtype, time_t ret, time_t now, uint32_t origTTL, bool refresh);
+  void handleServeStaleBookkeeping(time_t now, bool serveStale, OrderedTagIterator_t& entry);
 
   bool entryMatches(OrderedTagIterator_t& entry, QType qt, bool requireAuth, const ComboAddress& who);
-  Entries getEntries(MapCombo& map, const DNSName &qname, const QType qt, const OptTag& rtag);
-  cache_t::const_iterator getEntryUsingECSIndex(MapCombo& map, time_t now, const DNSName &qname, QType qtype, bool requireAuth, const ComboAddress& who);
+  Entries getEntries(MapCombo& map, const DNSName &qname, const QType qt, const OptTag& rtag, bool exclusive);
+  cache_t::const_iterator getEntryUsingECSIndex(MapCombo& map, time_t now, const DNSName &qname, QType qtype, bool requireAuth, const ComboAddress& who, bool serveStale);
+
+  void doPruneClock(size_t keep);
+  static void encodeSnapshotEntry(protozero::basic_pbf_writer<std::string>& message, const CacheEntry& entry);
 
   time_t handleHit(MapCombo& map, OrderedTagIterator_t& entry, const DNSName& qname, uint32_t& origTTL, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, boost::optional<vState>& state, bool* wasAuth, DNSName* authZone);
 
@@ -253,7 +343,23 @@ public:
       m.unlock();
     }
   private:
-    std::mutex &m;
+    std::shared_mutex &m;
+  };
+
+  struct sharedLock {
+    sharedLock(MapCombo& map) : m(map.mutex)
+    {
+      if (!m.try_lock_shared()) {
+        m.lock_shared();
+        map.d_contended_count++;
+      }
+      map.d_acquired_count++;
+    }
+    ~sharedLock() {
+      m.unlock_shared();
+    }
+  private:
+    std::shared_mutex &m;
   };
 
   void preRemoval(const CacheEntry& entry)
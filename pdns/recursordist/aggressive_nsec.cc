@@ -0,0 +1,640 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <cinttypes>
+#include <set>
+
+#include "aggressive_nsec.hh"
+#include "base32.hh"
+#include "cachecleaner.hh"
+#include "dnssecinfra.hh"
+#include "recursor_cache.hh"
+#include "syncres.hh"
+#include "validate.hh"
+
+std::shared_ptr<AggressiveNSECCache::ZoneEntry> AggressiveNSECCache::getZone(const DNSName& zone)
+{
+  {
+    ReadLock rl(d_lock);
+    auto it = d_zones.find(zone);
+    if (it != d_zones.end()) {
+      return it->second;
+    }
+  }
+
+  auto entry = std::make_shared<ZoneEntry>(zone);
+
+  WriteLock wl(d_lock);
+  /* another thread might have inserted it in the meantime, in which case we return that one */
+  auto inserted = d_zones.emplace(zone, std::move(entry));
+  return inserted.first->second;
+}
+
+std::shared_ptr<AggressiveNSECCache::ZoneEntry> AggressiveNSECCache::getBestZone(const DNSName& name)
+{
+  DNSName zone(name);
+  ReadLock rl(d_lock);
+  do {
+    auto it = d_zones.find(zone);
+    if (it != d_zones.end()) {
+      return it->second;
+    }
+  } while (zone.chopOff());
+
+  return nullptr;
+}
+
+void AggressiveNSECCache::insertNSEC(const DNSName& zone, const DNSRecord& record, const std::vector<std::shared_ptr<RRSIGRecordContent>>& signatures, bool nsec3)
+{
+  DNSName next;
+  std::string salt;
+  uint16_t iterations = 0;
+
+  if (nsec3) {
+    auto content = getRR<NSEC3RecordContent>(record);
+    if (!content) {
+      return;
+    }
+    /* we can't deny anything using opt-out records, and we don't want to spend a lot of CPU hashing names */
+    if (content->d_algorithm != 1 || (content->d_flags & 1) || (g_maxNSEC3Iterations && content->d_iterations > g_maxNSEC3Iterations)) {
+      return;
+    }
+    /* the owner of a NSEC3 record is always the hash directly under the zone */
+    if (record.d_name.countLabels() != zone.countLabels() + 1 || !record.d_name.isPartOf(zone)) {
+      return;
+    }
+    next = DNSName(toBase32Hex(content->d_nexthash)) + zone;
+    salt = content->d_salt;
+    iterations = content->d_iterations;
+  }
+  else {
+    auto content = getRR<NSECRecordContent>(record);
+    if (!content) {
+      return;
+    }
+    next = content->d_next;
+  }
+
+  auto zoneEntry = getZone(zone);
+  std::lock_guard<std::mutex> lock(zoneEntry->d_lock);
+
+  if (zoneEntry->d_nsec3 != nsec3 || zoneEntry->d_salt != salt || zoneEntry->d_iterations != iterations) {
+    /* the zone switched between NSEC and NSEC3, or the NSEC3 parameters changed,
+       so the entries we already have are useless */
+    d_entriesCount -= zoneEntry->d_entries.size();
+    zoneEntry->d_entries.clear();
+    zoneEntry->d_nsec3 = nsec3;
+    zoneEntry->d_salt = std::move(salt);
+    zoneEntry->d_iterations = iterations;
+  }
+
+  ZoneEntry::CacheEntry entry{record.d_content, signatures, record.d_name, std::move(next), record.d_ttl};
+  auto inserted = zoneEntry->d_entries.insert(entry);
+  if (inserted.second) {
+    ++d_entriesCount;
+  }
+  else {
+    zoneEntry->d_entries.replace(inserted.first, std::move(entry));
+    moveCacheItemToBack<ZoneEntry::SequencedTag>(zoneEntry->d_entries, inserted.first);
+  }
+}
+
+/* Returns the entry whose owner is the closest one before (or equal to) name, wrapping
+   around to the last entry of the zone, which might then cover name. */
+bool AggressiveNSECCache::getEntryBefore(time_t now, ZoneEntry& zoneEntry, const DNSName& name, ZoneEntry::CacheEntry& entry)
+{
+  std::lock_guard<std::mutex> lock(zoneEntry.d_lock);
+  auto& idx = zoneEntry.d_entries.get<ZoneEntry::OrderedTag>();
+  if (idx.empty()) {
+    return false;
+  }
+
+  auto it = idx.upper_bound(name);
+  if (it == idx.begin()) {
+    it = idx.end();
+  }
+  --it;
+
+  if (it->d_ttd <= now) {
+    idx.erase(it);
+    --d_entriesCount;
+    return false;
+  }
+
+  entry = *it;
+  moveCacheItemToBack<ZoneEntry::SequencedTag>(zoneEntry.d_entries, it);
+  return true;
+}
+
+template <typename T>
+static bool isTypeDenied(const T& content, const QType& type)
+{
+  if (content.isSet(type.getCode()) || content.isSet(QType::CNAME) || content.isSet(QType::DNAME)) {
+    return false;
+  }
+
+  if (type == QType::DS) {
+    /* this is the apex of the child zone, not the delegation point in the parent one */
+    return !content.isSet(QType::SOA);
+  }
+
+  /* a delegation point: the parent is not authoritative for anything but the DS */
+  return !content.isSet(QType::NS) || content.isSet(QType::SOA);
+}
+
+template <typename T>
+static bool isDelegationOrDNAME(const T& content)
+{
+  return (content.isSet(QType::NS) && !content.isSet(QType::SOA)) || content.isSet(QType::DNAME);
+}
+
+static void addToAnswer(const DNSName& name, std::vector<DNSRecord>& records, const std::vector<std::shared_ptr<RRSIGRecordContent>>& signatures, uint32_t ttl, DNSResourceRecord::Place place, bool doDNSSEC, std::vector<DNSRecord>& ret)
+{
+  for (auto& record : records) {
+    record.d_name = name;
+    record.d_ttl = ttl;
+    record.d_place = place;
+    ret.push_back(std::move(record));
+  }
+
+  if (!doDNSSEC) {
+    return;
+  }
+
+  for (const auto& signature : signatures) {
+    DNSRecord dr;
+    dr.d_type = QType::RRSIG;
+    dr.d_name = name;
+    dr.d_ttl = ttl;
+    dr.d_content = signature;
+    dr.d_place = place;
+    dr.d_class = QClass::IN;
+    ret.push_back(std::move(dr));
+  }
+}
+
+void AggressiveNSECCache::addProofs(const std::vector<ZoneEntry::CacheEntry>& proofs, const QType& type, uint32_t ttl, std::vector<DNSRecord>& ret)
+{
+  std::set<DNSName> seen;
+  for (const auto& proof : proofs) {
+    if (!seen.insert(proof.d_owner).second) {
+      continue;
+    }
+
+    DNSRecord dr;
+    dr.d_type = type.getCode();
+    dr.d_name = proof.d_owner;
+    dr.d_ttl = ttl;
+    dr.d_content = proof.d_record;
+    dr.d_place = DNSResourceRecord::AUTHORITY;
+    dr.d_class = QClass::IN;
+    std::vector<DNSRecord> records{std::move(dr)};
+    addToAnswer(proof.d_owner, records, proof.d_signatures, ttl, DNSResourceRecord::AUTHORITY, true, ret);
+  }
+}
+
+static uint32_t getRemainingTTL(time_t now, time_t ttd)
+{
+  return ttd > now ? static_cast<uint32_t>(ttd - now) : 0;
+}
+
+bool AggressiveNSECCache::synthesizeFromWildcard(time_t now, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, const ComboAddress& who, const boost::optional<std::string>& routingTag, bool doDNSSEC, const DNSName& wildcardName, uint32_t& ttl)
+{
+  std::vector<DNSRecord> wcSet;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> wcSignatures;
+  vState cachedState;
+
+  if (g_recCache->get(now, wildcardName, type, true, &wcSet, who, MemRecursorCache::None, routingTag, &wcSignatures, nullptr, nullptr, &cachedState) <= 0 || cachedState != vState::Secure || wcSet.empty()) {
+    return false;
+  }
+
+  for (const auto& record : wcSet) {
+    ttl = std::min(ttl, getRemainingTTL(now, record.d_ttl));
+  }
+  if (ttl == 0) {
+    return false;
+  }
+
+  addToAnswer(name, wcSet, wcSignatures, ttl, DNSResourceRecord::ANSWER, doDNSSEC, ret);
+  return true;
+}
+
+bool AggressiveNSECCache::getNSECDenial(time_t now, ZoneEntry& zoneEntry, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, const ComboAddress& who, const boost::optional<std::string>& routingTag, bool doDNSSEC, std::vector<ZoneEntry::CacheEntry>& proofs, uint32_t& ttl, bool& synthesized)
+{
+  ZoneEntry::CacheEntry entry;
+  if (!getEntryBefore(now, zoneEntry, name, entry)) {
+    return false;
+  }
+
+  auto content = std::dynamic_pointer_cast<NSECRecordContent>(entry.d_record);
+  if (!content) {
+    return false;
+  }
+
+  if (entry.d_owner == name) {
+    if (!isTypeDenied(*content, type)) {
+      return false;
+    }
+    res = RCode::NoError;
+    proofs.push_back(std::move(entry));
+    return true;
+  }
+
+  if (!isCoveredByNSEC(name, entry.d_owner, entry.d_next)) {
+    return false;
+  }
+
+  /* the owner of the covering NSEC is a delegation or a DNAME above name, the proof comes from the wrong zone */
+  if (name.isPartOf(entry.d_owner) && isDelegationOrDNAME(*content)) {
+    return false;
+  }
+
+  if (nsecProvesENT(name, entry.d_owner, entry.d_next)) {
+    res = RCode::NoError;
+    proofs.push_back(std::move(entry));
+    return true;
+  }
+
+  /* the closest encloser is the longest ancestor of name shared with either end of the covering NSEC */
+  DNSName closestEncloser = name.getCommonLabels(entry.d_owner);
+  DNSName commonWithNext = name.getCommonLabels(entry.d_next);
+  if (commonWithNext.countLabels() > closestEncloser.countLabels()) {
+    closestEncloser = std::move(commonWithNext);
+  }
+  if (!closestEncloser.isPartOf(zoneEntry.d_zone)) {
+    return false;
+  }
+
+  DNSName wildcardName = g_wildcarddnsname + closestEncloser;
+  ZoneEntry::CacheEntry wcEntry;
+  if (!getEntryBefore(now, zoneEntry, wildcardName, wcEntry)) {
+    return false;
+  }
+  auto wcContent = std::dynamic_pointer_cast<NSECRecordContent>(wcEntry.d_record);
+  if (!wcContent) {
+    return false;
+  }
+
+  if (wcEntry.d_owner == wildcardName) {
+    /* the wildcard exists */
+    if (wcContent->isSet(type.getCode())) {
+      if (!synthesizeFromWildcard(now, name, type, ret, who, routingTag, doDNSSEC, wildcardName, ttl)) {
+        return false;
+      }
+      res = RCode::NoError;
+      synthesized = true;
+      proofs.push_back(std::move(entry));
+      return true;
+    }
+    if (!isTypeDenied(*wcContent, type)) {
+      return false;
+    }
+    res = RCode::NoError;
+  }
+  else if (isCoveredByNSEC(wildcardName, wcEntry.d_owner, wcEntry.d_next)) {
+    res = RCode::NXDomain;
+  }
+  else {
+    return false;
+  }
+
+  proofs.push_back(std::move(entry));
+  proofs.push_back(std::move(wcEntry));
+  return true;
+}
+
+bool AggressiveNSECCache::getNSEC3(time_t now, ZoneEntry& zoneEntry, const DNSName& name, const std::string& salt, uint16_t iterations, ZoneEntry::CacheEntry& entry, std::string& hash, bool& exact)
+{
+  hash = hashQNameWithSalt(salt, iterations, name);
+  DNSName hashedName = DNSName(toBase32Hex(hash)) + zoneEntry.d_zone;
+
+  if (!getEntryBefore(now, zoneEntry, hashedName, entry)) {
+    return false;
+  }
+
+  exact = entry.d_owner == hashedName;
+  return true;
+}
+
+bool AggressiveNSECCache::isNSEC3Covering(const ZoneEntry::CacheEntry& entry, const std::string& hash)
+{
+  auto content = std::dynamic_pointer_cast<NSEC3RecordContent>(entry.d_record);
+  if (!content || (content->d_flags & 1)) {
+    return false;
+  }
+
+  return isCoveredByNSEC3Hash(hash, fromBase32Hex(entry.d_owner.getRawLabel(0)), content->d_nexthash);
+}
+
+bool AggressiveNSECCache::getNSEC3Denial(time_t now, ZoneEntry& zoneEntry, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, const ComboAddress& who, const boost::optional<std::string>& routingTag, bool doDNSSEC, std::vector<ZoneEntry::CacheEntry>& proofs, uint32_t& ttl, bool& synthesized)
+{
+  std::string salt;
+  uint16_t iterations;
+  {
+    std::lock_guard<std::mutex> lock(zoneEntry.d_lock);
+    salt = zoneEntry.d_salt;
+    iterations = zoneEntry.d_iterations;
+  }
+
+  ZoneEntry::CacheEntry entry;
+  std::string hash;
+  bool exact = false;
+  if (!getNSEC3(now, zoneEntry, name, salt, iterations, entry, hash, exact)) {
+    return false;
+  }
+
+  if (exact) {
+    auto content = std::dynamic_pointer_cast<NSEC3RecordContent>(entry.d_record);
+    if (!content || !isTypeDenied(*content, type)) {
+      return false;
+    }
+    res = RCode::NoError;
+    proofs.push_back(std::move(entry));
+    return true;
+  }
+
+  /* look for the closest encloser, which needs to exist, and the next closer name, which needs to be covered */
+  DNSName closestEncloser(name);
+  DNSName nextCloser(name);
+  ZoneEntry::CacheEntry ceEntry;
+  bool found = false;
+  while (closestEncloser.chopOff() && closestEncloser.isPartOf(zoneEntry.d_zone)) {
+    std::string ceHash;
+    if (getNSEC3(now, zoneEntry, closestEncloser, salt, iterations, ceEntry, ceHash, exact) && exact) {
+      auto ceContent = std::dynamic_pointer_cast<NSEC3RecordContent>(ceEntry.d_record);
+      if (!ceContent || isDelegationOrDNAME(*ceContent)) {
+        return false;
+      }
+      found = true;
+      break;
+    }
+    nextCloser = closestEncloser;
+  }
+
+  if (!found) {
+    return false;
+  }
+
+  ZoneEntry::CacheEntry ncEntry;
+  std::string ncHash;
+  if (!getNSEC3(now, zoneEntry, nextCloser, salt, iterations, ncEntry, ncHash, exact) || exact || !isNSEC3Covering(ncEntry, ncHash)) {
+    return false;
+  }
+
+  DNSName wildcardName = g_wildcarddnsname + closestEncloser;
+  ZoneEntry::CacheEntry wcEntry;
+  std::string wcHash;
+  if (!getNSEC3(now, zoneEntry, wildcardName, salt, iterations, wcEntry, wcHash, exact)) {
+    return false;
+  }
+
+  if (exact) {
+    /* the wildcard exists */
+    auto wcContent = std::dynamic_pointer_cast<NSEC3RecordContent>(wcEntry.d_record);
+    if (!wcContent) {
+      return false;
+    }
+    if (wcContent->isSet(type.getCode())) {
+      if (!synthesizeFromWildcard(now, name, type, ret, who, routingTag, doDNSSEC, wildcardName, ttl)) {
+        return false;
+      }
+      res = RCode::NoError;
+      synthesized = true;
+      proofs.push_back(std::move(ncEntry));
+      return true;
+    }
+    if (!isTypeDenied(*wcContent, type)) {
+      return false;
+    }
+    res = RCode::NoError;
+  }
+  else if (isNSEC3Covering(wcEntry, wcHash)) {
+    res = RCode::NXDomain;
+  }
+  else {
+    return false;
+  }
+
+  proofs.push_back(std::move(ceEntry));
+  proofs.push_back(std::move(ncEntry));
+  proofs.push_back(std::move(wcEntry));
+  return true;
+}
+
+bool AggressiveNSECCache::getDenial(time_t now, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, const ComboAddress& who, const boost::optional<std::string>& routingTag, bool doDNSSEC)
+{
+  DNSName zone(name);
+  if (type == QType::DS && !zone.isRoot()) {
+    /* the DS lives in the parent zone */
+    zone.chopOff();
+  }
+
+  auto zoneEntry = getBestZone(zone);
+  if (!zoneEntry) {
+    return false;
+  }
+
+  bool nsec3;
+  {
+    std::lock_guard<std::mutex> lock(zoneEntry->d_lock);
+    if (zoneEntry->d_entries.empty()) {
+      return false;
+    }
+    nsec3 = zoneEntry->d_nsec3;
+  }
+
+  /* we need a Secure SOA to put in the answer, and to be sure that the zone still exists */
+  std::vector<DNSRecord> soaSet;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> soaSignatures;
+  vState cachedState;
+  if (g_recCache->get(now, zoneEntry->d_zone, QType::SOA, true, &soaSet, who, MemRecursorCache::None, routingTag, &soaSignatures, nullptr, nullptr, &cachedState) <= 0 || cachedState != vState::Secure || soaSet.empty()) {
+    return false;
+  }
+
+  std::vector<ZoneEntry::CacheEntry> proofs;
+  std::vector<DNSRecord> answer;
+  uint32_t ttl = std::numeric_limits<uint32_t>::max();
+  int rcode = RCode::NoError;
+  bool synthesized = false;
+  if (nsec3) {
+    if (!getNSEC3Denial(now, *zoneEntry, name, type, answer, rcode, who, routingTag, doDNSSEC, proofs, ttl, synthesized)) {
+      return false;
+    }
+  }
+  else {
+    if (!getNSECDenial(now, *zoneEntry, name, type, answer, rcode, who, routingTag, doDNSSEC, proofs, ttl, synthesized)) {
+      return false;
+    }
+  }
+
+  for (const auto& proof : proofs) {
+    ttl = std::min(ttl, getRemainingTTL(now, proof.d_ttd));
+  }
+  if (!synthesized) {
+    for (const auto& record : soaSet) {
+      ttl = std::min(ttl, getRemainingTTL(now, record.d_ttl));
+    }
+  }
+  if (ttl == 0) {
+    return false;
+  }
+
+  if (synthesized) {
+    /* the TTL of the wildcard records has already been capped by the one of the wildcard records themselves */
+    for (auto& record : answer) {
+      record.d_ttl = std::min(record.d_ttl, ttl);
+    }
+    ret.insert(ret.end(), std::make_move_iterator(answer.begin()), std::make_move_iterator(answer.end()));
+    if (nsec3) {
+      ++d_nsec3WildcardHits;
+    }
+    else {
+      ++d_nsecWildcardHits;
+    }
+  }
+  else {
+    addToAnswer(zoneEntry->d_zone, soaSet, soaSignatures, ttl, DNSResourceRecord::AUTHORITY, doDNSSEC, ret);
+    if (nsec3) {
+      ++d_nsec3Hits;
+    }
+    else {
+      ++d_nsecHits;
+    }
+  }
+
+  if (doDNSSEC) {
+    addProofs(proofs, QType(nsec3 ? QType::NSEC3 : QType::NSEC), ttl, ret);
+  }
+
+  res = rcode;
+  return true;
+}
+
+void AggressiveNSECCache::removeZoneInfo(const DNSName& zone, bool subzones)
+{
+  WriteLock wl(d_lock);
+
+  if (!subzones) {
+    auto it = d_zones.find(zone);
+    if (it != d_zones.end()) {
+      std::lock_guard<std::mutex> lock(it->second->d_lock);
+      d_entriesCount -= it->second->d_entries.size();
+      d_zones.erase(it);
+    }
+    return;
+  }
+
+  for (auto it = d_zones.begin(); it != d_zones.end();) {
+    if (it->first.isPartOf(zone)) {
+      std::lock_guard<std::mutex> lock(it->second->d_lock);
+      d_entriesCount -= it->second->d_entries.size();
+      it = d_zones.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+void AggressiveNSECCache::prune(time_t now)
+{
+  uint64_t maxNumberOfEntries = d_maxEntries;
+  std::vector<DNSName> emptyZones;
+
+  {
+    ReadLock rl(d_lock);
+
+    /* first pass, remove expired entries */
+    for (const auto& zone : d_zones) {
+      std::lock_guard<std::mutex> lock(zone.second->d_lock);
+      auto& sidx = zone.second->d_entries.get<ZoneEntry::SequencedTag>();
+      for (auto it = sidx.begin(); it != sidx.end();) {
+        if (it->d_ttd <= now) {
+          it = sidx.erase(it);
+          --d_entriesCount;
+        }
+        else {
+          ++it;
+        }
+      }
+
+      if (sidx.empty()) {
+        emptyZones.push_back(zone.first);
+      }
+    }
+
+    /* second pass, if we are still over the limit, remove the least recently used entries of each zone */
+    if (d_entriesCount > maxNumberOfEntries && !d_zones.empty()) {
+      uint64_t toErasePerZone = (d_entriesCount - maxNumberOfEntries) / d_zones.size() + 1;
+      for (const auto& zone : d_zones) {
+        std::lock_guard<std::mutex> lock(zone.second->d_lock);
+        auto& sidx = zone.second->d_entries.get<ZoneEntry::SequencedTag>();
+        for (uint64_t erased = 0; erased < toErasePerZone && !sidx.empty(); ++erased) {
+          sidx.erase(sidx.begin());
+          --d_entriesCount;
+        }
+      }
+    }
+  }
+
+  if (!emptyZones.empty()) {
+    WriteLock wl(d_lock);
+    for (const auto& zone : emptyZones) {
+      auto it = d_zones.find(zone);
+      if (it == d_zones.end()) {
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(it->second->d_lock);
+      if (it->second->d_entries.empty()) {
+        d_zones.erase(it);
+      }
+    }
+  }
+}
+
+size_t AggressiveNSECCache::dumpToFile(FILE* fp, const struct timeval& now)
+{
+  size_t ret = 0;
+
+  ReadLock rl(d_lock);
+  for (const auto& zone : d_zones) {
+    std::lock_guard<std::mutex> lock(zone.second->d_lock);
+    fprintf(fp, "; Zone %s\n", zone.first.toString().c_str());
+
+    for (const auto& entry : zone.second->d_entries) {
+      int64_t ttl = entry.d_ttd - now.tv_sec;
+      try {
+        fprintf(fp, "%s %" PRId64 " IN %s %s\n", entry.d_owner.toString().c_str(), ttl, zone.second->d_nsec3 ? "NSEC3" : "NSEC", entry.d_record->getZoneRepresentation().c_str());
+        for (const auto& signature : entry.d_signatures) {
+          fprintf(fp, "- RRSIG %s\n", signature->getZoneRepresentation().c_str());
+        }
+        ++ret;
+      }
+      catch (const std::exception& e) {
+        fprintf(fp, "; Error dumping record from zone %s: %s\n", zone.first.toString().c_str(), e.what());
+      }
+      catch (...) {
+        fprintf(fp, "; Error dumping record from zone %s\n", zone.first.toString().c_str());
+      }
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,164 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/optional.hpp>
+
+#include "dnsname.hh"
+#include "dnsrecords.hh"
+#include "iputils.hh"
+#include "lock.hh"
+
+/* Aggressive use of DNSSEC-validated cache, RFC 8198.
+ *
+ * Validated NSEC and NSEC3 records are stored per zone, sorted by owner name (hashed owner
+ * for NSEC3), so that a query for a name covered by one of them can be answered with a
+ * synthesized NXDOMAIN or NODATA (or wildcard) answer without contacting the authoritative
+ * servers, as long as the SOA of the zone is present and Secure in the record cache.
+ */
+class AggressiveNSECCache
+{
+public:
+  AggressiveNSECCache(uint64_t entries) :
+    d_maxEntries(entries)
+  {
+  }
+
+  /*!
+   * Store a validated NSEC or NSEC3 record, along with its RRSIGs.
+   *
+   * \param zone       The signer of the record
+   * \param record     The NSEC or NSEC3 record, d_ttl being the absolute time to die
+   * \param signatures The RRSIGs covering the record
+   * \param nsec3      Whether record is a NSEC3 one
+   */
+  void insertNSEC(const DNSName& zone, const DNSRecord& record, const std::vector<std::shared_ptr<RRSIGRecordContent>>& signatures, bool nsec3);
+
+  /*!
+   * Try to synthesize a negative (or wildcard) answer for name|type from the stored records.
+   * Returns true and fills ret and res if it was possible.
+   */
+  bool getDenial(time_t now, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, const ComboAddress& who, const boost::optional<std::string>& routingTag, bool doDNSSEC);
+
+  void removeZoneInfo(const DNSName& zone, bool subzones);
+
+  uint64_t getEntriesCount() const
+  {
+    return d_entriesCount;
+  }
+
+  uint64_t getNSECHits() const
+  {
+    return d_nsecHits;
+  }
+
+  uint64_t getNSEC3Hits() const
+  {
+    return d_nsec3Hits;
+  }
+
+  uint64_t getNSECWildcardHits() const
+  {
+    return d_nsecWildcardHits;
+  }
+
+  uint64_t getNSEC3WildcardHits() const
+  {
+    return d_nsec3WildcardHits;
+  }
+
+  /* remove expired entries, then the least recently used ones if we are over the limit */
+  void prune(time_t now);
+  size_t dumpToFile(FILE* fp, const struct timeval& now);
+
+private:
+  struct ZoneEntry
+  {
+    ZoneEntry(const DNSName& zone) :
+      d_zone(zone)
+    {
+    }
+
+    struct SequencedTag
+    {
+    };
+    struct OrderedTag
+    {
+    };
+
+    struct CacheEntry
+    {
+      std::shared_ptr<DNSRecordContent> d_record;
+      std::vector<std::shared_ptr<RRSIGRecordContent>> d_signatures;
+
+      /* for NSEC3, owner and next are the base32hex encoding of the hashes, followed by the zone name */
+      DNSName d_owner;
+      DNSName d_next;
+      time_t d_ttd;
+    };
+
+    typedef boost::multi_index_container<
+      CacheEntry,
+      boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<boost::multi_index::tag<OrderedTag>,
+                                           boost::multi_index::member<CacheEntry, DNSName, &CacheEntry::d_owner>,
+                                           CanonDNSNameCompare>,
+        boost::multi_index::sequenced<boost::multi_index::tag<SequencedTag>>>>
+      cache_t;
+
+    cache_t d_entries;
+    const DNSName d_zone;
+    std::string d_salt;
+    std::mutex d_lock;
+    uint16_t d_iterations{0};
+    bool d_nsec3{false};
+  };
+
+  std::shared_ptr<ZoneEntry> getZone(const DNSName& zone);
+  std::shared_ptr<ZoneEntry> getBestZone(const DNSName& name);
+  bool getEntryBefore(time_t now, ZoneEntry& zoneEntry, const DNSName& name, ZoneEntry::CacheEntry& entry);
+  bool getNSEC3(time_t now, ZoneEntry& zoneEntry, const DNSName& name, const std::string& salt, uint16_t iterations, ZoneEntry::CacheEntry& entry, std::string& hash, bool& exact);
+  bool getNSECDenial(time_t now, ZoneEntry& zoneEntry, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, const ComboAddress& who, const boost::optional<std::string>& routingTag, bool doDNSSEC, std::vector<ZoneEntry::CacheEntry>& proofs, uint32_t& ttl, bool& synthesized);
+  bool getNSEC3Denial(time_t now, ZoneEntry& zoneEntry, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, const ComboAddress& who, const boost::optional<std::string>& routingTag, bool doDNSSEC, std::vector<ZoneEntry::CacheEntry>& proofs, uint32_t& ttl, bool& synthesized);
+  bool synthesizeFromWildcard(time_t now, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, const ComboAddress& who, const boost::optional<std::string>& routingTag, bool doDNSSEC, const DNSName& wildcardName, uint32_t& ttl);
+  static bool isNSEC3Covering(const ZoneEntry::CacheEntry& entry, const std::string& hash);
+  static void addProofs(const std::vector<ZoneEntry::CacheEntry>& proofs, const QType& type, uint32_t ttl, std::vector<DNSRecord>& ret);
+
+  /* zone name -> ZoneEntry, protected by d_lock */
+  std::map<DNSName, std::shared_ptr<ZoneEntry>> d_zones;
+  ReadWriteLock d_lock;
+
+  std::atomic<uint64_t> d_nsecHits{0};
+  std::atomic<uint64_t> d_nsec3Hits{0};
+  std::atomic<uint64_t> d_nsecWildcardHits{0};
+  std::atomic<uint64_t> d_nsec3WildcardHits{0};
+  std::atomic<uint64_t> d_entriesCount{0};
+  uint64_t d_maxEntries{0};
+};
@@ -0,0 +1 @@
+../dolog.hh
\ No newline at end of file
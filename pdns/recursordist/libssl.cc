@@ -0,0 +1 @@
+../libssl.cc
\ No newline at end of file
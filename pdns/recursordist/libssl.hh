@@ -0,0 +1 @@
+../libssl.hh
\ No newline at end of file
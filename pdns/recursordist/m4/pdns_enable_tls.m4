@@ -0,0 +1 @@
+../../../m4/pdns_enable_tls.m4
\ No newline at end of file
@@ -0,0 +1 @@
+../../../m4/pdns_with_gnutls.m4
\ No newline at end of file
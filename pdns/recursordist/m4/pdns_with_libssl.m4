@@ -0,0 +1 @@
+../../../m4/pdns_with_libssl.m4
\ No newline at end of file
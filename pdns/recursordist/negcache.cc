@@ -25,6 +25,8 @@
 #include "misc.hh"
 #include "cachecleaner.hh"
 #include "utility.hh"
+#include "rec-replication.hh"
+#include "rec-snapshot.hh"
 
 NegCache::NegCache(size_t mapsCount) :
   d_maps(mapsCount)
@@ -134,6 +136,20 @@ bool NegCache::get(const DNSName& qname, const QType& qtype, const struct timeva
  * \param ne The NegCacheEntry to add to the cache
  */
 void NegCache::add(const NegCacheEntry& ne)
+{
+  insert(ne);
+
+  if (pdns::CacheReplication::wanted(ne.d_name, ne.d_ttd, time(nullptr))) {
+    pdns::CacheReplication::Update update;
+    {
+      protozero::pbf_writer message(update.get(), static_cast<protozero::pbf_tag_type>(pdns::CacheSnapshot::Field::negCacheEntry));
+      encodeSnapshotEntry(message, ne);
+    }
+    update.send();
+  }
+}
+
+void NegCache::insert(const NegCacheEntry& ne)
 {
   auto& map = getMap(ne.d_name);
   const lock l(map);
@@ -280,3 +296,118 @@ size_t NegCache::dumpToFile(FILE* fp, const struct timeval& now) const
   }
   return ret;
 }
+
+enum class SnapshotEntryField : protozero::pbf_tag_type
+{
+  name = 1,
+  qtype = 2,
+  auth = 3,
+  ttd = 4,
+  state = 5,
+  soaRecord = 6,
+  soaSignature = 7,
+  dnssecRecord = 8,
+  dnssecSignature = 9
+};
+
+void NegCache::encodeSnapshotEntry(protozero::pbf_writer& message, const NegCacheEntry& ne)
+{
+  pdns::CacheSnapshot::encodeName(message, static_cast<protozero::pbf_tag_type>(SnapshotEntryField::name), ne.d_name);
+  message.add_uint32(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::qtype), ne.d_qtype.getCode());
+  pdns::CacheSnapshot::encodeName(message, static_cast<protozero::pbf_tag_type>(SnapshotEntryField::auth), ne.d_auth);
+  message.add_int64(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::ttd), ne.d_ttd);
+  message.add_uint32(static_cast<protozero::pbf_tag_type>(SnapshotEntryField::state), static_cast<uint32_t>(ne.d_validationState));
+  for (const auto& rec : ne.authoritySOA.records) {
+    pdns::CacheSnapshot::encodeRecord(message, static_cast<protozero::pbf_tag_type>(SnapshotEntryField::soaRecord), rec);
+  }
+  for (const auto& sig : ne.authoritySOA.signatures) {
+    pdns::CacheSnapshot::encodeRecord(message, static_cast<protozero::pbf_tag_type>(SnapshotEntryField::soaSignature), sig);
+  }
+  for (const auto& rec : ne.DNSSECRecords.records) {
+    pdns::CacheSnapshot::encodeRecord(message, static_cast<protozero::pbf_tag_type>(SnapshotEntryField::dnssecRecord), rec);
+  }
+  for (const auto& sig : ne.DNSSECRecords.signatures) {
+    pdns::CacheSnapshot::encodeRecord(message, static_cast<protozero::pbf_tag_type>(SnapshotEntryField::dnssecSignature), sig);
+  }
+}
+
+uint64_t NegCache::saveSnapshot(pdns::CacheSnapshot::Writer& writer) const
+{
+  uint64_t count = 0;
+
+  for (const auto& m : d_maps) {
+    {
+      const lock l(m);
+      for (const NegCacheEntry& ne : m.d_map) {
+        protozero::pbf_writer message(writer.get(), static_cast<protozero::pbf_tag_type>(pdns::CacheSnapshot::Field::negCacheEntry));
+        encodeSnapshotEntry(message, ne);
+        count++;
+      }
+    }
+    writer.flushIfNeeded();
+  }
+
+  return count;
+}
+
+bool NegCache::loadSnapshotEntry(const protozero::data_view& data, time_t now)
+{
+  NegCacheEntry ne;
+  ne.d_ttd = 0;
+
+  protozero::pbf_reader message(data);
+  while (message.next()) {
+    switch (static_cast<SnapshotEntryField>(message.tag())) {
+    case SnapshotEntryField::name:
+      ne.d_name = pdns::CacheSnapshot::decodeName(message.get_view());
+      break;
+    case SnapshotEntryField::qtype:
+      ne.d_qtype = message.get_uint32();
+      break;
+    case SnapshotEntryField::auth:
+      ne.d_auth = pdns::CacheSnapshot::decodeName(message.get_view());
+      break;
+    case SnapshotEntryField::ttd:
+      ne.d_ttd = static_cast<time_t>(message.get_int64());
+      break;
+    case SnapshotEntryField::state:
+      ne.d_validationState = static_cast<vState>(message.get_uint32());
+      break;
+    case SnapshotEntryField::soaRecord:
+      ne.authoritySOA.records.push_back(pdns::CacheSnapshot::decodeRecord(message.get_message()));
+      break;
+    case SnapshotEntryField::soaSignature:
+      ne.authoritySOA.signatures.push_back(pdns::CacheSnapshot::decodeRecord(message.get_message()));
+      break;
+    case SnapshotEntryField::dnssecRecord:
+      ne.DNSSECRecords.records.push_back(pdns::CacheSnapshot::decodeRecord(message.get_message()));
+      break;
+    case SnapshotEntryField::dnssecSignature:
+      ne.DNSSECRecords.signatures.push_back(pdns::CacheSnapshot::decodeRecord(message.get_message()));
+      break;
+    default:
+      message.skip();
+    }
+  }
+
+  if (ne.d_name.empty()) {
+    throw std::runtime_error("Invalid negative cache entry in snapshot");
+  }
+  if (ne.d_ttd <= now) {
+    return false;
+  }
+
+  auto& map = getMap(ne.d_name);
+  const lock l(map);
+  const auto& idx = map.d_map.get<CompositeKey>();
+  auto stored = idx.find(boost::make_tuple(ne.d_name, ne.d_qtype));
+  if (stored != idx.end() && stored->d_ttd >= ne.d_ttd) {
+    /* we already have fresher data */
+    return false;
+  }
+  bool inserted = lruReplacingInsert<SequenceTag>(map.d_map, ne);
+  if (inserted) {
+    map.d_entriesCount++;
+  }
+  return true;
+}
@@ -33,6 +33,20 @@
 
 using namespace ::boost::multi_index;
 
+namespace protozero
+{
+class data_view;
+template <typename TBuffer>
+class basic_pbf_writer;
+}
+namespace pdns
+{
+namespace CacheSnapshot
+{
+  class Writer;
+}
+}
+
 /* FIXME should become part of the normal cache (I think) and should become more like
  * struct {
  *   vector<DNSRecord> records;
@@ -77,6 +91,9 @@ public:
   void prune(size_t maxEntries);
   void clear();
   size_t dumpToFile(FILE* fd, const struct timeval& now) const;
+  uint64_t saveSnapshot(pdns::CacheSnapshot::Writer& writer) const;
+  /* returns false if the entry had expired */
+  bool loadSnapshotEntry(const protozero::data_view& message, time_t now);
   size_t wipe(const DNSName& name, bool subtree = false);
   size_t size() const;
 
@@ -85,6 +102,9 @@ public:
   }
 
 private:
+  void insert(const NegCacheEntry& ne);
+  static void encodeSnapshotEntry(protozero::basic_pbf_writer<std::string>& message, const NegCacheEntry& ne);
+
   struct CompositeKey
   {
   };
@@ -0,0 +1,157 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rec-replication.hh"
+#include "rec-snapshot.hh"
+#include "logger.hh"
+
+namespace pdns
+{
+namespace CacheReplication
+{
+  std::unique_ptr<const Config> g_config{nullptr};
+  std::atomic<uint64_t> g_updatesSent{0};
+  std::atomic<uint64_t> g_updatesReceived{0};
+
+  Update::Update() :
+    d_writer(d_buffer)
+  {
+    d_writer.add_uint32(static_cast<protozero::pbf_tag_type>(pdns::CacheSnapshot::Field::version), pdns::CacheSnapshot::s_version);
+  }
+
+  void Update::send() noexcept
+  {
+    if (!g_config) {
+      return;
+    }
+    /* the RemoteLogger framing uses a 16-bit length */
+    if (d_buffer.size() > std::numeric_limits<uint16_t>::max()) {
+      return;
+    }
+
+    try {
+      if (g_config->send) {
+        g_config->send(d_buffer);
+      }
+      ++g_updatesSent;
+    }
+    catch (const std::exception& e) {
+      g_log << Logger::Warning << "Error sending a cache replication update: " << e.what() << endl;
+    }
+  }
+
+  Receiver::Receiver(const ComboAddress& local, const NetmaskGroup& allowFrom) :
+    d_allowFrom(allowFrom), d_socket(local.sin4.sin_family, SOCK_STREAM)
+  {
+    setCloseOnExec(d_socket.getHandle());
+    d_socket.bind(local, true);
+    d_socket.listen(64);
+    d_socket.setNonBlocking();
+  }
+
+  void Receiver::addToMultiplexer(FDMultiplexer& fdm)
+  {
+    d_fdm = &fdm;
+    fdm.addReadFD(d_socket.getHandle(), handleNewConnection, this);
+  }
+
+  uint64_t Receiver::processUpdates(std::string& buffer, time_t now)
+  {
+    uint64_t count = 0;
+    size_t pos = 0;
+
+    while (buffer.size() - pos >= 2) {
+      const size_t len = (static_cast<uint8_t>(buffer.at(pos)) << 8) + static_cast<uint8_t>(buffer.at(pos + 1));
+      if (buffer.size() - pos - 2 < len) {
+        break;
+      }
+      count += pdns::CacheSnapshot::load(buffer.substr(pos + 2, len), now);
+      ++g_updatesReceived;
+      pos += 2 + len;
+    }
+
+    buffer.erase(0, pos);
+    return count;
+  }
+
+  void Receiver::handleNewConnection(int fd, FDMultiplexer::funcparam_t& param)
+  {
+    auto receiver = boost::any_cast<Receiver*>(param);
+
+    std::unique_ptr<Socket> socket;
+    try {
+      socket = receiver->d_socket.accept();
+    }
+    catch (const NetworkError& e) {
+      g_log << Logger::Error << "Error accepting a cache replication connection: " << e.what() << endl;
+      return;
+    }
+    if (!socket) {
+      return;
+    }
+
+    auto conn = std::make_shared<Connection>();
+    if (!socket->getRemote(conn->d_remote) || !receiver->d_allowFrom.match(conn->d_remote)) {
+      g_log << Logger::Warning << "Refusing a cache replication connection from " << conn->d_remote.toStringWithPort() << ", not allowed by cache-replication-allow-from" << endl;
+      return;
+    }
+
+    socket->setNonBlocking();
+    conn->d_fdm = receiver->d_fdm;
+    int connFD = socket->getHandle();
+    conn->d_socket = std::move(socket);
+    g_log << Logger::Info << "New cache replication connection from " << conn->d_remote.toStringWithPort() << endl;
+    conn->d_fdm->addReadFD(connFD, handleReadable, conn);
+  }
+
+  void Receiver::handleReadable(int fd, FDMultiplexer::funcparam_t& param)
+  {
+    auto conn = boost::any_cast<std::shared_ptr<Connection>>(param);
+
+    char buffer[65536];
+    ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return;
+    }
+
+    if (got > 0) {
+      conn->d_buffer.append(buffer, static_cast<size_t>(got));
+      try {
+        processUpdates(conn->d_buffer, time(nullptr));
+        return;
+      }
+      catch (const std::exception& e) {
+        g_log << Logger::Error << "Closing the cache replication connection from " << conn->d_remote.toStringWithPort() << " after receiving an invalid update: " << e.what() << endl;
+      }
+      catch (const PDNSException& e) {
+        g_log << Logger::Error << "Closing the cache replication connection from " << conn->d_remote.toStringWithPort() << " after receiving an invalid update: " << e.reason << endl;
+      }
+    }
+    else {
+      g_log << Logger::Info << "Cache replication connection from " << conn->d_remote.toStringWithPort() << " closed" << endl;
+    }
+
+    /* the socket is closed once the last reference to the connection, held by the multiplexer, is gone */
+    conn->d_fdm->removeReadFD(fd);
+  }
+}
+}
@@ -0,0 +1,125 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <protozero/pbf_writer.hpp>
+
+#include "dnsname.hh"
+#include "iputils.hh"
+#include "mplexer.hh"
+#include "sstuff.hh"
+
+/* Replication of record cache and negative cache updates between recursors.
+
+   Every update is encoded as a snapshot (see rec-snapshot.hh) holding a single entry, and sent
+   to the peers using the RemoteLogger transport, which prefixes it with its length. The peers
+   accept these connections on their handler thread and insert the received entries directly into
+   their caches, so they are not replicated any further. */
+namespace pdns
+{
+namespace CacheReplication
+{
+  struct Config
+  {
+    std::vector<ComboAddress> peers;
+    /* only replicate entries for names under one of these zones, all names if empty */
+    SuffixMatchNode zones;
+    bool allZones{true};
+    /* only replicate entries with at least that many seconds left */
+    uint32_t minTTL{0};
+    /* queues an update on the connections to the peers owned by the calling thread */
+    std::function<void(const std::string&)> send;
+  };
+
+  /* set at startup, before the worker threads are started, nullptr when not replicating */
+  extern std::unique_ptr<const Config> g_config;
+
+  extern std::atomic<uint64_t> g_updatesSent;
+  extern std::atomic<uint64_t> g_updatesReceived;
+
+  /* whether an entry for name, expiring at ttd, should be sent to our peers */
+  inline bool wanted(const DNSName& name, time_t ttd, time_t now)
+  {
+    if (!g_config) {
+      return false;
+    }
+    if (ttd < now || static_cast<uint64_t>(ttd - now) < g_config->minTTL) {
+      return false;
+    }
+    return g_config->allZones || g_config->zones.check(name);
+  }
+
+  /* An update holding a single cache entry, to be sent to all our peers */
+  class Update
+  {
+  public:
+    Update();
+
+    protozero::pbf_writer& get()
+    {
+      return d_writer;
+    }
+
+    /* never throws, since it is called while inserting into the caches */
+    void send() noexcept;
+
+  private:
+    std::string d_buffer;
+    protozero::pbf_writer d_writer;
+  };
+
+  /* Accepts connections from our peers and inserts the entries they send into our caches */
+  class Receiver
+  {
+  public:
+    Receiver(const ComboAddress& local, const NetmaskGroup& allowFrom);
+
+    /* to be called from the thread running fdm, which will be handling the connections */
+    void addToMultiplexer(FDMultiplexer& fdm);
+
+    /* insert the entries of the complete updates at the start of buffer into our caches, removing
+       these updates from buffer. Returns the number of entries inserted, throws on malformed data */
+    static uint64_t processUpdates(std::string& buffer, time_t now);
+
+  private:
+    struct Connection
+    {
+      std::unique_ptr<Socket> d_socket;
+      ComboAddress d_remote;
+      std::string d_buffer;
+      FDMultiplexer* d_fdm;
+    };
+
+    static void handleNewConnection(int fd, FDMultiplexer::funcparam_t& param);
+    static void handleReadable(int fd, FDMultiplexer::funcparam_t& param);
+
+    NetmaskGroup d_allowFrom;
+    Socket d_socket;
+    FDMultiplexer* d_fdm{nullptr};
+  };
+}
+}
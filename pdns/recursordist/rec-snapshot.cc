@@ -0,0 +1,251 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rec-snapshot.hh"
+#include "misc.hh"
+#include "syncres.hh"
+
+namespace pdns
+{
+namespace CacheSnapshot
+{
+  void Writer::flush()
+  {
+    if (d_buffer.empty()) {
+      return;
+    }
+    writen2(d_fd, d_buffer);
+    d_buffer.clear();
+  }
+
+  void encodeName(protozero::pbf_writer& writer, protozero::pbf_tag_type field, const DNSName& name)
+  {
+    if (name.empty()) {
+      return;
+    }
+    writer.add_bytes(field, name.toDNSString());
+  }
+
+  DNSName decodeName(const protozero::data_view& view)
+  {
+    return DNSName(view.data(), view.size(), 0, false);
+  }
+
+  void encodeRecord(protozero::pbf_writer& writer, protozero::pbf_tag_type field, const DNSRecord& record)
+  {
+    protozero::pbf_writer message(writer, field);
+    encodeName(message, static_cast<protozero::pbf_tag_type>(RecordField::name), record.d_name);
+    message.add_uint32(static_cast<protozero::pbf_tag_type>(RecordField::type), record.d_type);
+    message.add_uint32(static_cast<protozero::pbf_tag_type>(RecordField::class_), record.d_class);
+    message.add_uint32(static_cast<protozero::pbf_tag_type>(RecordField::ttl), record.d_ttl);
+    message.add_bytes(static_cast<protozero::pbf_tag_type>(RecordField::content), record.d_content->serialize(record.d_name));
+    message.add_uint32(static_cast<protozero::pbf_tag_type>(RecordField::place), static_cast<uint32_t>(record.d_place));
+  }
+
+  DNSRecord decodeRecord(protozero::pbf_reader reader)
+  {
+    DNSRecord record;
+    std::string content;
+
+    while (reader.next()) {
+      switch (static_cast<RecordField>(reader.tag())) {
+      case RecordField::name:
+        record.d_name = decodeName(reader.get_view());
+        break;
+      case RecordField::type:
+        record.d_type = static_cast<uint16_t>(reader.get_uint32());
+        break;
+      case RecordField::class_:
+        record.d_class = static_cast<uint16_t>(reader.get_uint32());
+        break;
+      case RecordField::ttl:
+        record.d_ttl = reader.get_uint32();
+        break;
+      case RecordField::content:
+        content = reader.get_bytes();
+        break;
+      case RecordField::place:
+        record.d_place = static_cast<DNSResourceRecord::Place>(reader.get_uint32());
+        break;
+      default:
+        reader.skip();
+      }
+    }
+
+    if (record.d_name.empty() || content.empty()) {
+      throw std::runtime_error("Invalid record in snapshot");
+    }
+    record.d_content = DNSRecordContent::deserialize(record.d_name, record.d_type, content);
+    return record;
+  }
+
+  uint64_t save(int fd, time_t now)
+  {
+    uint64_t count = 0;
+    Writer writer(fd);
+
+    writer.get().add_uint32(static_cast<protozero::pbf_tag_type>(Field::version), s_version);
+    writer.get().add_int64(static_cast<protozero::pbf_tag_type>(Field::timestamp), now);
+
+    if (g_recCache) {
+      count += g_recCache->saveSnapshot(writer);
+    }
+    if (g_negCache) {
+      count += g_negCache->saveSnapshot(writer);
+    }
+    count += SyncRes::saveNSSpeedsSnapshot(writer);
+    writer.flush();
+
+    return count;
+  }
+
+  uint64_t load(int fd, time_t now)
+  {
+    std::string data;
+    char buffer[65536];
+    ssize_t got;
+    while ((got = read(fd, buffer, sizeof(buffer))) != 0) {
+      if (got < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        unixDie("reading cache snapshot");
+      }
+      data.append(buffer, static_cast<size_t>(got));
+    }
+
+    return load(data, now);
+  }
+
+  uint64_t load(const std::string& data, time_t now)
+  {
+    if (data.empty()) {
+      return 0;
+    }
+
+    uint64_t count = 0;
+    bool versionSeen = false;
+    protozero::pbf_reader reader(data);
+    while (reader.next()) {
+      switch (static_cast<Field>(reader.tag())) {
+      case Field::version: {
+        auto version = reader.get_uint32();
+        if (version != s_version) {
+          throw std::runtime_error("Unsupported cache snapshot version " + std::to_string(version));
+        }
+        versionSeen = true;
+        break;
+      }
+      case Field::recordCacheEntry: {
+        auto view = reader.get_view();
+        if (g_recCache && g_recCache->loadSnapshotEntry(view, now)) {
+          count++;
+        }
+        break;
+      }
+      case Field::negCacheEntry: {
+        auto view = reader.get_view();
+        if (g_negCache && g_negCache->loadSnapshotEntry(view, now)) {
+          count++;
+        }
+        break;
+      }
+      case Field::nsSpeed:
+        if (SyncRes::loadNSSpeedsSnapshotEntry(reader.get_view(), now)) {
+          count++;
+        }
+        break;
+      default:
+        reader.skip();
+      }
+
+      if (!versionSeen) {
+        throw std::runtime_error("Cache snapshot does not start with a version");
+      }
+    }
+
+    return count;
+  }
+
+  uint64_t saveToFile(const std::string& fname, time_t now)
+  {
+    const std::string tmpName = fname + ".tmp";
+    int fd = open(tmpName.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0640);
+    if (fd < 0) {
+      throw std::runtime_error("Unable to open '" + tmpName + "' for writing: " + stringerror());
+    }
+
+    uint64_t count = 0;
+    try {
+      count = save(fd, now);
+    }
+    catch (...) {
+      close(fd);
+      unlink(tmpName.c_str());
+      throw;
+    }
+
+    /* always close the descriptor, even when fsync() failed */
+    int ret = fsync(fd);
+    int err = errno;
+    if (close(fd) != 0 && ret == 0) {
+      ret = -1;
+      err = errno;
+    }
+    if (ret != 0) {
+      unlink(tmpName.c_str());
+      throw std::runtime_error("Unable to write '" + tmpName + "': " + stringerror(err));
+    }
+    if (rename(tmpName.c_str(), fname.c_str()) != 0) {
+      auto err = stringerror();
+      unlink(tmpName.c_str());
+      throw std::runtime_error("Unable to rename '" + tmpName + "' to '" + fname + "': " + err);
+    }
+    return count;
+  }
+
+  uint64_t loadFromFile(const std::string& fname, time_t now)
+  {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+      if (errno == ENOENT) {
+        return 0;
+      }
+      throw std::runtime_error("Unable to open '" + fname + "' for reading: " + stringerror());
+    }
+
+    uint64_t count = 0;
+    try {
+      count = load(fd, now);
+    }
+    catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+    return count;
+  }
+}
+}
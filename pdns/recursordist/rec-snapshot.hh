@@ -0,0 +1,119 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <string>
+#include <protozero/pbf_reader.hpp>
+#include <protozero/pbf_writer.hpp>
+
+#include "dnsname.hh"
+#include "dnsparser.hh"
+
+/* A binary snapshot of the record cache, the negative cache and the NS speeds table,
+   so that a restarted recursor does not have to start with empty caches.
+
+   The snapshot is a stream of protobuf-encoded fields: a version and the time the snapshot
+   was taken, followed by one embedded message per record cache entry, negative cache entry
+   and NS speed. Each cache knows how to encode and decode its own entries, absolute TTDs and
+   validation states included, so expired data can be discarded when loading. */
+namespace pdns
+{
+namespace CacheSnapshot
+{
+  enum class Field : protozero::pbf_tag_type
+  {
+    version = 1,
+    timestamp = 2,
+    recordCacheEntry = 3,
+    negCacheEntry = 4,
+    nsSpeed = 5
+  };
+  enum class RecordField : protozero::pbf_tag_type
+  {
+    name = 1,
+    type = 2,
+    class_ = 3,
+    ttl = 4,
+    content = 5,
+    place = 6
+  };
+
+  static const uint32_t s_version = 1;
+
+  /* Buffers the encoded snapshot and writes it to a file descriptor in chunks */
+  class Writer
+  {
+  public:
+    Writer(int fd) :
+      d_writer(d_buffer), d_fd(fd)
+    {
+    }
+    ~Writer()
+    {
+      try {
+        flush();
+      }
+      catch (...) {
+      }
+    }
+
+    protozero::pbf_writer& get()
+    {
+      return d_writer;
+    }
+
+    /* write out what has been buffered so far if it is large enough,
+       must not be called while an embedded message is being built */
+    void flushIfNeeded()
+    {
+      if (d_buffer.size() >= s_flushSize) {
+        flush();
+      }
+    }
+    void flush();
+
+  private:
+    static const size_t s_flushSize = 1024 * 1024;
+    std::string d_buffer;
+    protozero::pbf_writer d_writer;
+    int d_fd;
+  };
+
+  /* names are stored in wire format, empty names are not stored at all */
+  void encodeName(protozero::pbf_writer& writer, protozero::pbf_tag_type field, const DNSName& name);
+  DNSName decodeName(const protozero::data_view& view);
+  /* d_ttl is stored as is, so it usually holds a TTD */
+  void encodeRecord(protozero::pbf_writer& writer, protozero::pbf_tag_type field, const DNSRecord& record);
+  DNSRecord decodeRecord(protozero::pbf_reader reader);
+
+  /* save the record cache, negative cache and NS speeds to fd, returns the number of entries saved */
+  uint64_t save(int fd, time_t now);
+  /* load a snapshot from fd, skipping data that expired before now.
+     Returns the number of entries loaded, throws on a malformed snapshot */
+  uint64_t load(int fd, time_t now);
+  uint64_t load(const std::string& data, time_t now);
+
+  /* save to a temporary file then rename it to fname, so an existing snapshot is only replaced by a complete one */
+  uint64_t saveToFile(const std::string& fname, time_t now);
+  uint64_t loadFromFile(const std::string& fname, time_t now);
+}
+}
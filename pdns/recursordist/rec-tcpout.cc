@@ -0,0 +1,132 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rec-tcpout.hh"
+#include "misc.hh"
+
+size_t TCPOutConnectionManager::s_maxQueries = 0;
+size_t TCPOutConnectionManager::s_maxIdlePerAuth = 10;
+size_t TCPOutConnectionManager::s_maxIdlePerThread = 100;
+unsigned int TCPOutConnectionManager::s_maxIdleTimeMsec = 10000;
+
+thread_local TCPOutConnectionManager t_tcp_manager;
+
+TCPOutConnectionManager::Connection TCPOutConnectionManager::get(const ComboAddress& remote)
+{
+  auto range = d_idle.equal_range(remote);
+  while (range.first != range.second) {
+    /* the most recently stored connection is the most likely to still be open */
+    auto it = std::prev(range.second);
+    Connection connection = std::move(it->second);
+    d_idle.erase(it);
+    if (connection.d_socket && isTCPSocketUsable(connection.d_socket->getHandle())) {
+      return connection;
+    }
+    range = d_idle.equal_range(remote);
+  }
+
+  return Connection();
+}
+
+void TCPOutConnectionManager::store(const struct timeval& now, const ComboAddress& remote, Connection&& connection)
+{
+  if (!connection.d_socket || s_maxIdlePerAuth == 0 || s_maxIdlePerThread == 0) {
+    return;
+  }
+
+  ++connection.d_queries;
+  if (s_maxQueries > 0 && connection.d_queries >= s_maxQueries) {
+    return;
+  }
+
+  if (d_idle.count(remote) >= s_maxIdlePerAuth) {
+    return;
+  }
+
+  if (d_idle.size() >= s_maxIdlePerThread) {
+    cleanup(now);
+    if (d_idle.size() >= s_maxIdlePerThread) {
+      return;
+    }
+  }
+
+  connection.d_lastUsed = now;
+  d_idle.emplace(remote, std::move(connection));
+}
+
+void TCPOutConnectionManager::cleanup(const struct timeval& now)
+{
+  struct timeval cutoff = now;
+  cutoff.tv_sec -= s_maxIdleTimeMsec / 1000;
+  cutoff.tv_usec -= static_cast<suseconds_t>(s_maxIdleTimeMsec % 1000) * 1000;
+  if (cutoff.tv_usec < 0) {
+    cutoff.tv_sec--;
+    cutoff.tv_usec += 1000000;
+  }
+
+  for (auto it = d_idle.begin(); it != d_idle.end(); ) {
+    if (it->second.d_lastUsed < cutoff) {
+      it = d_idle.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+std::unique_ptr<TLSSession> TCPOutConnectionManager::getTLSSession(const ComboAddress& remote)
+{
+  auto it = d_tlsSessions.find(remote);
+  if (it == d_tlsSessions.end()) {
+    return nullptr;
+  }
+
+  /* a session is only used once, the new connection will give us a fresh one */
+  auto session = std::move(it->second);
+  d_tlsSessions.erase(it);
+  return session;
+}
+
+void TCPOutConnectionManager::storeTLSSession(const ComboAddress& remote, std::unique_ptr<TLSSession>&& session)
+{
+  if (!session) {
+    return;
+  }
+
+  auto it = d_tlsSessions.find(remote);
+  if (it != d_tlsSessions.end()) {
+    it->second = std::move(session);
+    return;
+  }
+
+  /* we only expect a handful of DoT servers, do not let this grow unbounded */
+  if (d_tlsSessions.size() >= s_maxIdlePerThread) {
+    return;
+  }
+
+  d_tlsSessions.emplace(remote, std::move(session));
+}
+
+uint64_t* pleaseGetTCPOutIdleConnections()
+{
+  return new uint64_t(t_tcp_manager.size());
+}
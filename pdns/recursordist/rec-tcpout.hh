@@ -0,0 +1,84 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <map>
+#include <memory>
+
+#include "iputils.hh"
+#include "sstuff.hh"
+#include "tcpiohandler.hh"
+
+/* A per-thread cache of idle outgoing TCP connections to authoritative servers,
+   so that subsequent TCP queries to the same server can skip the handshake.
+   A connection is only handed back once the answer to its previous query has
+   been fully read, so at most one query is in flight on a given connection.
+   DoT connections are kept the same way, along with the last TLS session
+   seen for each remote so that new connections can resume it. */
+class TCPOutConnectionManager
+{
+public:
+  struct Connection
+  {
+    std::unique_ptr<Socket> d_socket{nullptr};
+    /* only set for DoT, declared after the socket so that it is destroyed first */
+    std::shared_ptr<TCPIOHandler> d_handler{nullptr};
+    struct timeval d_lastUsed{0, 0};
+    size_t d_queries{0};
+  };
+
+  /* return an idle and still usable connection to this remote, if any.
+     d_socket is a nullptr otherwise */
+  Connection get(const ComboAddress& remote);
+  /* give back a connection that successfully completed a query, it will
+     be closed instead of kept if we already have enough idle connections */
+  void store(const struct timeval& now, const ComboAddress& remote, Connection&& connection);
+  /* close the connections that have been idle for too long */
+  void cleanup(const struct timeval& now);
+
+  /* return the TLS session to resume for this remote, if any */
+  std::unique_ptr<TLSSession> getTLSSession(const ComboAddress& remote);
+  void storeTLSSession(const ComboAddress& remote, std::unique_ptr<TLSSession>&& session);
+
+  size_t size() const
+  {
+    return d_idle.size();
+  }
+
+  void clear()
+  {
+    d_idle.clear();
+    d_tlsSessions.clear();
+  }
+
+  static size_t s_maxQueries;
+  static size_t s_maxIdlePerAuth;
+  static size_t s_maxIdlePerThread;
+  static unsigned int s_maxIdleTimeMsec;
+
+private:
+  std::multimap<ComboAddress, Connection> d_idle;
+  std::map<ComboAddress, std::unique_ptr<TLSSession>> d_tlsSessions;
+};
+
+extern thread_local TCPOutConnectionManager t_tcp_manager;
+uint64_t* pleaseGetTCPOutIdleConnections();
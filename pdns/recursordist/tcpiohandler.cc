@@ -0,0 +1 @@
+../tcpiohandler.cc
\ No newline at end of file
@@ -0,0 +1 @@
+../tcpiohandler.hh
\ No newline at end of file
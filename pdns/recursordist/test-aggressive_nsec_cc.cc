@@ -0,0 +1,281 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/unit_test.hpp>
+
+#include "aggressive_nsec.hh"
+#include "base32.hh"
+#include "dnssecinfra.hh"
+#include "syncres.hh"
+
+static const ComboAddress s_who("192.0.2.1");
+
+static std::vector<std::shared_ptr<RRSIGRecordContent>> genSignatures(const DNSName& signer, uint16_t type, unsigned int labels)
+{
+  auto sig = std::make_shared<RRSIGRecordContent>();
+  sig->d_type = type;
+  sig->d_signer = signer;
+  sig->d_algorithm = 13;
+  sig->d_labels = labels;
+  sig->d_originalttl = 600;
+  sig->d_sigexpire = std::numeric_limits<uint32_t>::max();
+  sig->d_signature = "dummy data";
+  return {sig};
+}
+
+static void addSecureRecordToCache(time_t now, const DNSName& zone, const DNSName& name, uint16_t type, const std::string& content)
+{
+  DNSRecord rec;
+  rec.d_name = name;
+  rec.d_type = type;
+  rec.d_class = QClass::IN;
+  rec.d_ttl = now + 600;
+  rec.d_place = DNSResourceRecord::ANSWER;
+  rec.d_content = DNSRecordContent::mastermake(type, QClass::IN, content);
+
+  g_recCache->replace(now, name, QType(type), {rec}, genSignatures(zone, type, name.countLabels() - (name.isWildcard() ? 1 : 0)), {}, true, zone, boost::none, boost::none, vState::Secure);
+}
+
+static void insertNSEC(AggressiveNSECCache& cache, time_t now, const DNSName& zone, const DNSName& owner, const DNSName& next, const std::set<uint16_t>& types)
+{
+  auto content = std::make_shared<NSECRecordContent>();
+  content->d_next = next;
+  for (const auto type : types) {
+    content->set(type);
+  }
+
+  DNSRecord rec;
+  rec.d_name = owner;
+  rec.d_type = QType::NSEC;
+  rec.d_ttl = now + 600;
+  rec.d_place = DNSResourceRecord::AUTHORITY;
+  rec.d_content = content;
+
+  cache.insertNSEC(zone, rec, genSignatures(zone, QType::NSEC, owner.countLabels() - (owner.isWildcard() ? 1 : 0)), false);
+}
+
+static void insertNSEC3(AggressiveNSECCache& cache, time_t now, const DNSName& zone, const std::string& ownerHash, const std::string& nextHash, const std::set<uint16_t>& types, uint16_t iterations = 1)
+{
+  auto content = std::make_shared<NSEC3RecordContent>();
+  content->d_algorithm = 1;
+  content->d_iterations = iterations;
+  content->d_salt = "salt";
+  content->d_nexthash = nextHash;
+  for (const auto type : types) {
+    content->set(type);
+  }
+
+  DNSRecord rec;
+  rec.d_name = DNSName(toBase32Hex(ownerHash)) + zone;
+  rec.d_type = QType::NSEC3;
+  rec.d_ttl = now + 600;
+  rec.d_place = DNSResourceRecord::AUTHORITY;
+  rec.d_content = content;
+
+  cache.insertNSEC(zone, rec, genSignatures(zone, QType::NSEC3, rec.d_name.countLabels()), true);
+}
+
+static std::string addToHash(std::string hash, int delta)
+{
+  for (auto it = hash.rbegin(); it != hash.rend(); ++it) {
+    auto& value = reinterpret_cast<unsigned char&>(*it);
+    auto previous = value;
+    value += delta;
+    if ((delta > 0 && value > previous) || (delta < 0 && value < previous)) {
+      break;
+    }
+  }
+  return hash;
+}
+
+/* inserts a NSEC3 record covering only the hash of name */
+static void insertNarrowNSEC3(AggressiveNSECCache& cache, time_t now, const DNSName& zone, const DNSName& name)
+{
+  auto hash = hashQNameWithSalt("salt", 1, name);
+  insertNSEC3(cache, now, zone, addToHash(hash, -1), addToHash(hash, 1), {QType::A});
+}
+
+static size_t countRecords(const std::vector<DNSRecord>& records, uint16_t type)
+{
+  return std::count_if(records.begin(), records.end(), [type](const DNSRecord& rec) { return rec.d_type == type; });
+}
+
+BOOST_AUTO_TEST_SUITE(aggressive_nsec_cc)
+
+BOOST_AUTO_TEST_CASE(test_aggressive_nsec_nxdomain_nodata)
+{
+  g_recCache = std::unique_ptr<MemRecursorCache>(new MemRecursorCache());
+  const DNSName zone("powerdns.com");
+  const time_t now = time(nullptr);
+
+  AggressiveNSECCache cache(10000);
+  insertNSEC(cache, now, zone, zone, DNSName("a.powerdns.com"), {QType::SOA, QType::NS, QType::NSEC, QType::RRSIG});
+  insertNSEC(cache, now, zone, DNSName("a.powerdns.com"), DNSName("c.powerdns.com"), {QType::A, QType::NSEC, QType::RRSIG});
+  BOOST_CHECK_EQUAL(cache.getEntriesCount(), 2U);
+
+  std::vector<DNSRecord> ret;
+  int res = -1;
+
+  /* no Secure SOA in the record cache yet */
+  BOOST_CHECK(!cache.getDenial(now, DNSName("b.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, true));
+
+  addSecureRecordToCache(now, zone, zone, QType::SOA, "ns1.powerdns.com. hostmaster.powerdns.com. 1 2 3 4 5");
+
+  /* b.powerdns.com is covered by a -> c, and the wildcard by the apex NSEC */
+  BOOST_REQUIRE(cache.getDenial(now, DNSName("b.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, true));
+  BOOST_CHECK_EQUAL(res, RCode::NXDomain);
+  BOOST_CHECK_EQUAL(countRecords(ret, QType::SOA), 1U);
+  BOOST_CHECK_EQUAL(countRecords(ret, QType::NSEC), 2U);
+  BOOST_CHECK_EQUAL(countRecords(ret, QType::RRSIG), 3U);
+  BOOST_CHECK_EQUAL(cache.getNSECHits(), 1U);
+
+  /* without DNSSEC, only the SOA */
+  ret.clear();
+  BOOST_REQUIRE(cache.getDenial(now, DNSName("b.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, false));
+  BOOST_CHECK_EQUAL(res, RCode::NXDomain);
+  BOOST_REQUIRE_EQUAL(ret.size(), 1U);
+  BOOST_CHECK_EQUAL(ret.at(0).d_type, QType::SOA);
+  BOOST_CHECK_EQUAL(ret.at(0).d_place, DNSResourceRecord::AUTHORITY);
+  BOOST_CHECK_LE(ret.at(0).d_ttl, 600U);
+
+  /* a.powerdns.com exists but has no AAAA */
+  ret.clear();
+  BOOST_REQUIRE(cache.getDenial(now, DNSName("a.powerdns.com"), QType(QType::AAAA), ret, res, s_who, boost::none, false));
+  BOOST_CHECK_EQUAL(res, RCode::NoError);
+
+  /* but it does have an A */
+  ret.clear();
+  BOOST_CHECK(!cache.getDenial(now, DNSName("a.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, false));
+
+  /* not covered by anything we know */
+  BOOST_CHECK(!cache.getDenial(now, DNSName("d.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, false));
+  /* different zone */
+  BOOST_CHECK(!cache.getDenial(now, DNSName("b.powerdns.net"), QType(QType::A), ret, res, s_who, boost::none, false));
+
+  /* expired entries are not used */
+  BOOST_CHECK(!cache.getDenial(now + 601, DNSName("a.powerdns.com"), QType(QType::AAAA), ret, res, s_who, boost::none, false));
+}
+
+BOOST_AUTO_TEST_CASE(test_aggressive_nsec_delegation)
+{
+  g_recCache = std::unique_ptr<MemRecursorCache>(new MemRecursorCache());
+  const DNSName zone("powerdns.com");
+  const time_t now = time(nullptr);
+  addSecureRecordToCache(now, zone, zone, QType::SOA, "ns1.powerdns.com. hostmaster.powerdns.com. 1 2 3 4 5");
+
+  AggressiveNSECCache cache(10000);
+  insertNSEC(cache, now, zone, DNSName("sub.powerdns.com"), DNSName("www.powerdns.com"), {QType::NS, QType::NSEC, QType::RRSIG});
+
+  std::vector<DNSRecord> ret;
+  int res = -1;
+  /* the parent is not authoritative for anything below the delegation, except for the DS */
+  BOOST_CHECK(!cache.getDenial(now, DNSName("sub.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, false));
+  BOOST_CHECK(!cache.getDenial(now, DNSName("a.sub.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, false));
+  BOOST_REQUIRE(cache.getDenial(now, DNSName("sub.powerdns.com"), QType(QType::DS), ret, res, s_who, boost::none, false));
+  BOOST_CHECK_EQUAL(res, RCode::NoError);
+}
+
+BOOST_AUTO_TEST_CASE(test_aggressive_nsec_wildcard)
+{
+  g_recCache = std::unique_ptr<MemRecursorCache>(new MemRecursorCache());
+  const DNSName zone("powerdns.com");
+  const DNSName wildcard("*.powerdns.com");
+  const time_t now = time(nullptr);
+  addSecureRecordToCache(now, zone, zone, QType::SOA, "ns1.powerdns.com. hostmaster.powerdns.com. 1 2 3 4 5");
+  addSecureRecordToCache(now, zone, wildcard, QType::A, "192.0.2.42");
+
+  AggressiveNSECCache cache(10000);
+  insertNSEC(cache, now, zone, zone, wildcard, {QType::SOA, QType::NS, QType::NSEC, QType::RRSIG});
+  insertNSEC(cache, now, zone, wildcard, DNSName("c.powerdns.com"), {QType::A, QType::NSEC, QType::RRSIG});
+
+  std::vector<DNSRecord> ret;
+  int res = -1;
+  BOOST_REQUIRE(cache.getDenial(now, DNSName("b.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, true));
+  BOOST_CHECK_EQUAL(res, RCode::NoError);
+  BOOST_REQUIRE_EQUAL(countRecords(ret, QType::A), 1U);
+  BOOST_CHECK_EQUAL(ret.at(0).d_name, DNSName("b.powerdns.com"));
+  BOOST_CHECK_EQUAL(ret.at(0).d_place, DNSResourceRecord::ANSWER);
+  BOOST_CHECK_EQUAL(getRR<ARecordContent>(ret.at(0))->getCA().toString(), "192.0.2.42");
+  /* the NSEC proving that b.powerdns.com does not exist */
+  BOOST_CHECK_EQUAL(countRecords(ret, QType::NSEC), 1U);
+  BOOST_CHECK_EQUAL(countRecords(ret, QType::SOA), 0U);
+  BOOST_CHECK_EQUAL(cache.getNSECWildcardHits(), 1U);
+
+  /* wildcard NODATA */
+  ret.clear();
+  BOOST_REQUIRE(cache.getDenial(now, DNSName("b.powerdns.com"), QType(QType::AAAA), ret, res, s_who, boost::none, true));
+  BOOST_CHECK_EQUAL(res, RCode::NoError);
+  BOOST_CHECK_EQUAL(countRecords(ret, QType::SOA), 1U);
+  /* the same NSEC covers the name and matches the wildcard */
+  BOOST_CHECK_EQUAL(countRecords(ret, QType::NSEC), 1U);
+  BOOST_CHECK_EQUAL(cache.getNSECHits(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_aggressive_nsec3)
+{
+  g_recCache = std::unique_ptr<MemRecursorCache>(new MemRecursorCache());
+  const DNSName zone("powerdns.com");
+  const time_t now = time(nullptr);
+  addSecureRecordToCache(now, zone, zone, QType::SOA, "ns1.powerdns.com. hostmaster.powerdns.com. 1 2 3 4 5");
+
+  AggressiveNSECCache cache(10000);
+  const auto apexHash = hashQNameWithSalt("salt", 1, zone);
+  insertNSEC3(cache, now, zone, apexHash, addToHash(apexHash, 1), {QType::SOA, QType::NS, QType::NSEC3PARAM, QType::RRSIG});
+  insertNarrowNSEC3(cache, now, zone, DNSName("b.powerdns.com"));
+  insertNarrowNSEC3(cache, now, zone, DNSName("*.powerdns.com"));
+  BOOST_CHECK_EQUAL(cache.getEntriesCount(), 3U);
+
+  std::vector<DNSRecord> ret;
+  int res = -1;
+  /* closest encloser, next closer and wildcard */
+  BOOST_REQUIRE(cache.getDenial(now, DNSName("b.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, true));
+  BOOST_CHECK_EQUAL(res, RCode::NXDomain);
+  BOOST_CHECK_EQUAL(countRecords(ret, QType::SOA), 1U);
+  BOOST_CHECK_EQUAL(countRecords(ret, QType::NSEC3), 3U);
+  BOOST_CHECK_EQUAL(cache.getNSEC3Hits(), 1U);
+
+  /* NODATA at the apex */
+  ret.clear();
+  BOOST_REQUIRE(cache.getDenial(now, zone, QType(QType::AAAA), ret, res, s_who, boost::none, false));
+  BOOST_CHECK_EQUAL(res, RCode::NoError);
+
+  /* the next closer name is not covered */
+  ret.clear();
+  BOOST_CHECK(!cache.getDenial(now, DNSName("c.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, false));
+
+  /* the NSEC3 parameters changed, everything we had is now useless */
+  insertNSEC3(cache, now, zone, apexHash, addToHash(apexHash, 1), {QType::SOA, QType::NS, QType::NSEC3PARAM, QType::RRSIG}, 2);
+  BOOST_CHECK_EQUAL(cache.getEntriesCount(), 1U);
+  BOOST_CHECK(!cache.getDenial(now, DNSName("b.powerdns.com"), QType(QType::A), ret, res, s_who, boost::none, false));
+}
+
+BOOST_AUTO_TEST_CASE(test_aggressive_nsec_prune_wipe)
+{
+  const DNSName zone("powerdns.com");
+  const time_t now = time(nullptr);
+
+  AggressiveNSECCache cache(2);
+  insertNSEC(cache, now, zone, zone, DNSName("a.powerdns.com"), {QType::SOA, QType::NS});
+  insertNSEC(cache, now, zone, DNSName("a.powerdns.com"), DNSName("c.powerdns.com"), {QType::A});
+  insertNSEC(cache, now, zone, DNSName("c.powerdns.com"), DNSName("d.powerdns.com"), {QType::A});
+  insertNSEC(cache, now, DNSName("sub.powerdns.com"), DNSName("sub.powerdns.com"), DNSName("a.sub.powerdns.com"), {QType::SOA, QType::NS});
+  BOOST_CHECK_EQUAL(cache.getEntriesCount(), 4U);
+
+  /* over the limit */
+  cache.prune(now);
+  BOOST_CHECK_LE(cache.getEntriesCount(), 2U);
+
+  /* everything is expired */
+  cache.prune(now + 601);
+  BOOST_CHECK_EQUAL(cache.getEntriesCount(), 0U);
+
+  insertNSEC(cache, now, zone, zone, DNSName("a.powerdns.com"), {QType::SOA, QType::NS});
+  insertNSEC(cache, now, DNSName("sub.powerdns.com"), DNSName("sub.powerdns.com"), DNSName("a.sub.powerdns.com"), {QType::SOA, QType::NS});
+  BOOST_CHECK_EQUAL(cache.getEntriesCount(), 2U);
+  cache.removeZoneInfo(DNSName("sub.powerdns.com"), false);
+  BOOST_CHECK_EQUAL(cache.getEntriesCount(), 1U);
+  insertNSEC(cache, now, DNSName("sub.powerdns.com"), DNSName("sub.powerdns.com"), DNSName("a.sub.powerdns.com"), {QType::SOA, QType::NS});
+  cache.removeZoneInfo(zone, true);
+  BOOST_CHECK_EQUAL(cache.getEntriesCount(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
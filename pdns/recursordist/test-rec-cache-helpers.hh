@@ -0,0 +1,81 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include "syncres.hh"
+
+/* the snapshot and replication code work on the global caches, replace them with empty ones */
+inline void resetCaches()
+{
+  g_recCache = std::unique_ptr<MemRecursorCache>(new MemRecursorCache());
+  g_negCache = std::unique_ptr<NegCache>(new NegCache());
+  SyncRes::clearNSSpeeds();
+}
+
+inline void addRecordCacheEntry(const DNSName& name, time_t now, time_t ttd, vState state, const std::string& address = "192.0.2.1")
+{
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+
+  DNSRecord dr;
+  dr.d_name = name;
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress(address));
+  dr.d_ttl = static_cast<uint32_t>(ttd);
+  dr.d_place = DNSResourceRecord::ANSWER;
+  records.push_back(dr);
+
+  signatures.push_back(std::make_shared<RRSIGRecordContent>("A 8 2 600 20370101000000 20200101000000 24567 powerdns.com. data"));
+
+  auto ns = std::make_shared<DNSRecord>();
+  ns->d_name = DNSName("powerdns.com.");
+  ns->d_type = QType::NS;
+  ns->d_class = QClass::IN;
+  ns->d_content = std::make_shared<NSRecordContent>(DNSName("ns1.powerdns.com."));
+  ns->d_ttl = static_cast<uint32_t>(ttd);
+  ns->d_place = DNSResourceRecord::AUTHORITY;
+  authRecords.push_back(ns);
+
+  g_recCache->replace(now, name, QType(QType::A), records, signatures, authRecords, true, DNSName("powerdns.com."), boost::none, boost::none, state, ComboAddress("192.0.2.53"));
+}
+
+inline NegCache::NegCacheEntry makeNegCacheEntry(const DNSName& name, time_t ttd)
+{
+  NegCache::NegCacheEntry ne;
+  ne.d_name = name;
+  ne.d_qtype = QType(QType::AAAA);
+  ne.d_auth = DNSName("powerdns.com.");
+  ne.d_ttd = ttd;
+  ne.d_validationState = vState::Secure;
+
+  DNSRecord soa;
+  soa.d_name = ne.d_auth;
+  soa.d_type = QType::SOA;
+  soa.d_class = QClass::IN;
+  soa.d_ttl = static_cast<uint32_t>(ttd);
+  soa.d_place = DNSResourceRecord::AUTHORITY;
+  soa.d_content = DNSRecordContent::mastermake(QType::SOA, QClass::IN, "ns1 hostmaster 1 2 3 4 5");
+  ne.authoritySOA.records.push_back(soa);
+  return ne;
+}
@@ -0,0 +1,190 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "rec-replication.hh"
+#include "rec-snapshot.hh"
+#include "syncres.hh"
+#include "test-rec-cache-helpers.hh"
+
+/* replicate to no one, so we only count the updates */
+static void setConfig(uint32_t minTTL, const std::vector<DNSName>& zones)
+{
+  auto config = std::make_unique<pdns::CacheReplication::Config>();
+  config->minTTL = minTTL;
+  for (const auto& zone : zones) {
+    config->zones.add(zone);
+  }
+  config->allZones = zones.empty();
+  pdns::CacheReplication::g_config = std::move(config);
+}
+
+/* the content of the caches, as a length-prefixed update */
+static std::string getCachesAsUpdate(time_t now)
+{
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(tmpfile(), fclose);
+  BOOST_REQUIRE(fp);
+  int fd = fileno(fp.get());
+  pdns::CacheSnapshot::save(fd, now);
+  BOOST_REQUIRE_EQUAL(lseek(fd, 0, SEEK_SET), 0);
+
+  std::string data;
+  char buffer[4096];
+  ssize_t got;
+  while ((got = read(fd, buffer, sizeof(buffer))) > 0) {
+    data.append(buffer, got);
+  }
+  BOOST_REQUIRE_LE(data.size(), std::numeric_limits<uint16_t>::max());
+
+  std::string update;
+  update.push_back(static_cast<char>(data.size() / 256));
+  update.push_back(static_cast<char>(data.size() % 256));
+  return update + data;
+}
+
+static std::string getA(const DNSName& name, time_t now)
+{
+  std::vector<DNSRecord> retrieved;
+  if (g_recCache->get(now, name, QType(QType::A), false, &retrieved, ComboAddress("127.0.0.1")) <= 0 || retrieved.size() != 1) {
+    return "";
+  }
+  return getRR<ARecordContent>(retrieved.at(0))->getCA().toString();
+}
+
+BOOST_AUTO_TEST_SUITE(rec_replication_cc)
+
+BOOST_AUTO_TEST_CASE(test_filters)
+{
+  const time_t now = time(nullptr);
+
+  pdns::CacheReplication::g_config.reset();
+  BOOST_CHECK(!pdns::CacheReplication::wanted(DNSName("www.powerdns.com."), now + 3600, now));
+
+  setConfig(60, {});
+  BOOST_CHECK(pdns::CacheReplication::wanted(DNSName("www.powerdns.com."), now + 3600, now));
+  BOOST_CHECK(pdns::CacheReplication::wanted(DNSName("www.powerdns.com."), now + 60, now));
+  BOOST_CHECK(!pdns::CacheReplication::wanted(DNSName("www.powerdns.com."), now + 59, now));
+  BOOST_CHECK(!pdns::CacheReplication::wanted(DNSName("www.powerdns.com."), now - 1, now));
+
+  setConfig(0, {DNSName("powerdns.com."), DNSName("example.org.")});
+  BOOST_CHECK(pdns::CacheReplication::wanted(DNSName("www.powerdns.com."), now + 3600, now));
+  BOOST_CHECK(pdns::CacheReplication::wanted(DNSName("example.org."), now + 3600, now));
+  BOOST_CHECK(!pdns::CacheReplication::wanted(DNSName("www.example.com."), now + 3600, now));
+
+  pdns::CacheReplication::g_config.reset();
+}
+
+BOOST_AUTO_TEST_CASE(test_updates_are_sent)
+{
+  resetCaches();
+  const time_t now = time(nullptr);
+  setConfig(60, {DNSName("powerdns.com.")});
+  const auto sent = pdns::CacheReplication::g_updatesSent.load();
+
+  addRecordCacheEntry(DNSName("www.powerdns.com."), now, now + 3600, vState::Indeterminate);
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::g_updatesSent.load(), sent + 1);
+
+  /* too short-lived */
+  addRecordCacheEntry(DNSName("short.powerdns.com."), now, now + 30, vState::Indeterminate);
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::g_updatesSent.load(), sent + 1);
+
+  /* not in one of the zones */
+  addRecordCacheEntry(DNSName("www.example.com."), now, now + 3600, vState::Indeterminate);
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::g_updatesSent.load(), sent + 1);
+
+  g_negCache->add(makeNegCacheEntry(DNSName("www.powerdns.com."), now + 600));
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::g_updatesSent.load(), sent + 2);
+
+  pdns::CacheReplication::g_config.reset();
+  resetCaches();
+}
+
+BOOST_AUTO_TEST_CASE(test_receive)
+{
+  resetCaches();
+  const time_t now = time(nullptr);
+  const DNSName name("www.powerdns.com.");
+
+  addRecordCacheEntry(name, now, now + 3600, vState::Indeterminate);
+  g_negCache->add(makeNegCacheEntry(name, now + 600));
+  auto update = getCachesAsUpdate(now);
+
+  resetCaches();
+  setConfig(0, {});
+  const auto sent = pdns::CacheReplication::g_updatesSent.load();
+  const auto received = pdns::CacheReplication::g_updatesReceived.load();
+
+  /* partial updates are kept until they are complete */
+  std::string buffer = update.substr(0, update.size() / 2);
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::Receiver::processUpdates(buffer, now), 0U);
+  BOOST_CHECK_EQUAL(buffer.size(), update.size() / 2);
+  buffer.append(update.substr(update.size() / 2));
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::Receiver::processUpdates(buffer, now), 2U);
+  BOOST_CHECK(buffer.empty());
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::g_updatesReceived.load(), received + 1);
+
+  BOOST_CHECK_EQUAL(getA(name, now), "192.0.2.1");
+  NegCache::NegCacheEntry ne;
+  struct timeval tv{now, 0};
+  BOOST_CHECK(g_negCache->get(name, QType(QType::AAAA), tv, ne, true));
+
+  /* received entries are not replicated any further */
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::g_updatesSent.load(), sent);
+
+  pdns::CacheReplication::g_config.reset();
+  resetCaches();
+}
+
+BOOST_AUTO_TEST_CASE(test_receive_keeps_fresher_data)
+{
+  resetCaches();
+  const time_t now = time(nullptr);
+  const DNSName name("www.powerdns.com.");
+
+  addRecordCacheEntry(name, now, now + 600, vState::Indeterminate);
+  auto shorter = getCachesAsUpdate(now);
+  resetCaches();
+  addRecordCacheEntry(name, now, now + 3600, vState::Indeterminate, "192.0.2.2");
+  auto longer = getCachesAsUpdate(now);
+
+  /* an update expiring later replaces what we have */
+  resetCaches();
+  addRecordCacheEntry(name, now, now + 600, vState::Indeterminate);
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::Receiver::processUpdates(longer, now), 1U);
+  BOOST_CHECK_EQUAL(getA(name, now), "192.0.2.2");
+  BOOST_CHECK_EQUAL(g_recCache->size(), 1U);
+
+  /* but not the other way around */
+  resetCaches();
+  addRecordCacheEntry(name, now, now + 3600, vState::Indeterminate, "192.0.2.2");
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::Receiver::processUpdates(shorter, now), 0U);
+  BOOST_CHECK_EQUAL(getA(name, now), "192.0.2.2");
+
+  /* the same goes for negative entries */
+  resetCaches();
+  g_negCache->add(makeNegCacheEntry(name, now + 600));
+  shorter = getCachesAsUpdate(now);
+  resetCaches();
+  g_negCache->add(makeNegCacheEntry(name, now + 3600));
+  BOOST_CHECK_EQUAL(pdns::CacheReplication::Receiver::processUpdates(shorter, now), 0U);
+  NegCache::NegCacheEntry ne;
+  struct timeval tv{now, 0};
+  BOOST_REQUIRE(g_negCache->get(name, QType(QType::AAAA), tv, ne, true));
+  BOOST_CHECK_EQUAL(ne.d_ttd, now + 3600);
+  BOOST_CHECK_EQUAL(g_negCache->size(), 1U);
+
+  resetCaches();
+}
+
+BOOST_AUTO_TEST_CASE(test_receive_invalid)
+{
+  resetCaches();
+  std::string buffer("\x00\x03\x08\x02\x00", 5);
+  BOOST_CHECK_THROW(pdns::CacheReplication::Receiver::processUpdates(buffer, time(nullptr)), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
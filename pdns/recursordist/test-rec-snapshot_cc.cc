@@ -0,0 +1,139 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "rec-snapshot.hh"
+#include "syncres.hh"
+#include "test-rec-cache-helpers.hh"
+#include "utility.hh"
+
+static void saveAndReload(time_t saveTime, time_t loadTime, uint64_t expectedSaved, uint64_t expectedLoaded)
+{
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(tmpfile(), fclose);
+  BOOST_REQUIRE(fp);
+  int fd = fileno(fp.get());
+
+  BOOST_CHECK_EQUAL(pdns::CacheSnapshot::save(fd, saveTime), expectedSaved);
+
+  resetCaches();
+  BOOST_REQUIRE_EQUAL(lseek(fd, 0, SEEK_SET), 0);
+  BOOST_CHECK_EQUAL(pdns::CacheSnapshot::load(fd, loadTime), expectedLoaded);
+}
+
+BOOST_AUTO_TEST_SUITE(rec_snapshot_cc)
+
+BOOST_AUTO_TEST_CASE(test_round_trip)
+{
+  resetCaches();
+  const time_t now = time(nullptr);
+  const DNSName name("www.powerdns.com.");
+  const ComboAddress nsAddr("192.0.2.53");
+  const DNSName nsName("ns1.powerdns.com.");
+
+  addRecordCacheEntry(name, now, now + 3600, vState::Secure);
+  g_negCache->add(makeNegCacheEntry(name, now + 600));
+  struct timeval tv{now, 0};
+  SyncRes::submitNSSpeed(nsName, nsAddr, 1000, tv);
+  /* sets the time of the last use */
+  SyncRes::getNSSpeedEstimate(nsName, tv);
+
+  saveAndReload(now, now, 3, 3);
+
+  std::vector<DNSRecord> retrieved;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecords;
+  vState state = vState::Indeterminate;
+  bool wasAuth = false;
+  DNSName authZone;
+  BOOST_CHECK_EQUAL(g_recCache->get(now, name, QType(QType::A), false, &retrieved, ComboAddress("127.0.0.1"), MemRecursorCache::None, boost::none, &signatures, &authRecords, nullptr, &state, &wasAuth, &authZone), 3600);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+  BOOST_CHECK_EQUAL(getRR<ARecordContent>(retrieved.at(0))->getCA().toString(), "192.0.2.1");
+  BOOST_CHECK_EQUAL(signatures.size(), 1U);
+  BOOST_REQUIRE_EQUAL(authRecords.size(), 1U);
+  BOOST_CHECK_EQUAL(authRecords.at(0)->d_content->getZoneRepresentation(), "ns1.powerdns.com.");
+  BOOST_CHECK(state == vState::Secure);
+  BOOST_CHECK(wasAuth);
+  BOOST_CHECK_EQUAL(authZone, DNSName("powerdns.com."));
+
+  NegCache::NegCacheEntry ne;
+  BOOST_REQUIRE(g_negCache->get(name, QType(QType::AAAA), tv, ne, true));
+  BOOST_CHECK_EQUAL(ne.d_ttd, now + 600);
+  BOOST_CHECK(ne.d_validationState == vState::Secure);
+  BOOST_CHECK_EQUAL(ne.authoritySOA.records.size(), 1U);
+
+  BOOST_CHECK_EQUAL(SyncRes::getNSSpeedsSize(), 1U);
+  BOOST_CHECK_EQUAL(SyncRes::getNSSpeed(nsName, nsAddr), 1000);
+
+  resetCaches();
+}
+
+BOOST_AUTO_TEST_CASE(test_expired_entries_are_discarded)
+{
+  resetCaches();
+  const time_t now = time(nullptr);
+
+  addRecordCacheEntry(DNSName("short.powerdns.com."), now, now + 10, vState::Indeterminate);
+  addRecordCacheEntry(DNSName("long.powerdns.com."), now, now + 3600, vState::Indeterminate);
+  g_negCache->add(makeNegCacheEntry(DNSName("short.powerdns.com."), now + 10));
+  g_negCache->add(makeNegCacheEntry(DNSName("long.powerdns.com."), now + 3600));
+  struct timeval tv{now, 0};
+  SyncRes::submitNSSpeed(DNSName("ns1.powerdns.com."), ComboAddress("192.0.2.53"), 1000, tv);
+  SyncRes::getNSSpeedEstimate(DNSName("ns1.powerdns.com."), tv);
+
+  /* loaded an hour minus one second later, only the long-lived entries remain */
+  saveAndReload(now, now + 3599, 5, 2);
+  BOOST_CHECK_EQUAL(g_recCache->size(), 1U);
+  BOOST_CHECK_EQUAL(g_negCache->size(), 1U);
+  BOOST_CHECK_EQUAL(SyncRes::getNSSpeedsSize(), 0U);
+
+  std::vector<DNSRecord> retrieved;
+  BOOST_CHECK_EQUAL(g_recCache->get(now + 3599, DNSName("long.powerdns.com."), QType(QType::A), false, &retrieved, ComboAddress("127.0.0.1")), 1);
+
+  resetCaches();
+}
+
+BOOST_AUTO_TEST_CASE(test_stale_entries)
+{
+  resetCaches();
+  MemRecursorCache::s_maxServedStaleExtensions = 1;
+  const time_t now = time(nullptr);
+  std::vector<DNSRecord> retrieved;
+
+  /* this one is served stale once, which is the maximum */
+  addRecordCacheEntry(DNSName("served.powerdns.com."), now, now + 10, vState::Indeterminate);
+  BOOST_CHECK_GT(g_recCache->get(now + 11, DNSName("served.powerdns.com."), QType(QType::A), false, &retrieved, ComboAddress("127.0.0.1"), MemRecursorCache::ServeStale), 0);
+  /* and this one could still be */
+  addRecordCacheEntry(DNSName("unserved.powerdns.com."), now, now + 15, vState::Indeterminate);
+
+  /* both have expired, only the one that has not used its extensions yet is worth loading */
+  saveAndReload(now + 22, now + 22, 2, 1);
+  BOOST_CHECK_EQUAL(g_recCache->get(now + 22, DNSName("served.powerdns.com."), QType(QType::A), false, &retrieved, ComboAddress("127.0.0.1"), MemRecursorCache::ServeStale), -1);
+  BOOST_CHECK_GT(g_recCache->get(now + 22, DNSName("unserved.powerdns.com."), QType(QType::A), false, &retrieved, ComboAddress("127.0.0.1"), MemRecursorCache::ServeStale), 0);
+
+  MemRecursorCache::s_maxServedStaleExtensions = 0;
+  resetCaches();
+}
+
+BOOST_AUTO_TEST_CASE(test_invalid_snapshot)
+{
+  resetCaches();
+
+  auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(tmpfile(), fclose);
+  BOOST_REQUIRE(fp);
+  int fd = fileno(fp.get());
+
+  std::string data;
+  protozero::pbf_writer writer(data);
+  writer.add_uint32(static_cast<protozero::pbf_tag_type>(pdns::CacheSnapshot::Field::version), pdns::CacheSnapshot::s_version + 1);
+  BOOST_REQUIRE_EQUAL(write(fd, data.data(), data.size()), static_cast<ssize_t>(data.size()));
+  BOOST_REQUIRE_EQUAL(lseek(fd, 0, SEEK_SET), 0);
+
+  BOOST_CHECK_THROW(pdns::CacheSnapshot::load(fd, time(nullptr)), std::runtime_error);
+  BOOST_CHECK_EQUAL(g_recCache->size(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
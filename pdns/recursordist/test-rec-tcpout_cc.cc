@@ -0,0 +1,147 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/unit_test.hpp>
+
+#include "rec-tcpout.hh"
+#include "utility.hh"
+
+/* returns a connection whose remote end is kept open in 'remotes' */
+static TCPOutConnectionManager::Connection makeConnection(std::vector<std::unique_ptr<Socket>>& remotes)
+{
+  int fds[2];
+  BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  remotes.push_back(std::make_unique<Socket>(fds[1]));
+  TCPOutConnectionManager::Connection connection;
+  connection.d_socket = std::make_unique<Socket>(fds[0]);
+  connection.d_socket->setNonBlocking();
+  return connection;
+}
+
+BOOST_AUTO_TEST_SUITE(rec_tcpout_cc)
+
+BOOST_AUTO_TEST_CASE(test_reuse)
+{
+  TCPOutConnectionManager manager;
+  std::vector<std::unique_ptr<Socket>> remotes;
+  const ComboAddress auth1("192.0.2.1:53");
+  const ComboAddress auth2("192.0.2.2:53");
+  struct timeval now;
+  Utility::gettimeofday(&now, nullptr);
+
+  BOOST_CHECK(manager.get(auth1).d_socket == nullptr);
+
+  auto connection = makeConnection(remotes);
+  int fd = connection.d_socket->getHandle();
+  manager.store(now, auth1, std::move(connection));
+  BOOST_CHECK_EQUAL(manager.size(), 1U);
+
+  /* not for this remote */
+  BOOST_CHECK(manager.get(auth2).d_socket == nullptr);
+
+  connection = manager.get(auth1);
+  BOOST_REQUIRE(connection.d_socket != nullptr);
+  BOOST_CHECK_EQUAL(connection.d_socket->getHandle(), fd);
+  BOOST_CHECK_EQUAL(connection.d_queries, 1U);
+  BOOST_CHECK_EQUAL(manager.size(), 0U);
+
+  /* the remote end closes the connection while it is idle */
+  manager.store(now, auth1, std::move(connection));
+  remotes.clear();
+  BOOST_CHECK(manager.get(auth1).d_socket == nullptr);
+  BOOST_CHECK_EQUAL(manager.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_limits)
+{
+  TCPOutConnectionManager manager;
+  std::vector<std::unique_ptr<Socket>> remotes;
+  const ComboAddress auth1("192.0.2.1:53");
+  const ComboAddress auth2("192.0.2.2:53");
+  struct timeval now;
+  Utility::gettimeofday(&now, nullptr);
+
+  const auto oldMaxIdlePerAuth = TCPOutConnectionManager::s_maxIdlePerAuth;
+  const auto oldMaxIdlePerThread = TCPOutConnectionManager::s_maxIdlePerThread;
+  const auto oldMaxQueries = TCPOutConnectionManager::s_maxQueries;
+  TCPOutConnectionManager::s_maxIdlePerAuth = 2;
+  TCPOutConnectionManager::s_maxIdlePerThread = 3;
+  TCPOutConnectionManager::s_maxQueries = 2;
+
+  for (size_t idx = 0; idx < 3; idx++) {
+    manager.store(now, auth1, makeConnection(remotes));
+  }
+  BOOST_CHECK_EQUAL(manager.size(), 2U);
+
+  for (size_t idx = 0; idx < 3; idx++) {
+    manager.store(now, auth2, makeConnection(remotes));
+  }
+  BOOST_CHECK_EQUAL(manager.size(), 3U);
+
+  /* this connection has now been used for two queries, it should be closed instead of kept */
+  auto connection = manager.get(auth1);
+  BOOST_REQUIRE(connection.d_socket != nullptr);
+  manager.store(now, auth1, std::move(connection));
+  BOOST_CHECK_EQUAL(manager.size(), 2U);
+
+  TCPOutConnectionManager::s_maxIdlePerAuth = oldMaxIdlePerAuth;
+  TCPOutConnectionManager::s_maxIdlePerThread = oldMaxIdlePerThread;
+  TCPOutConnectionManager::s_maxQueries = oldMaxQueries;
+}
+
+BOOST_AUTO_TEST_CASE(test_cleanup)
+{
+  TCPOutConnectionManager manager;
+  std::vector<std::unique_ptr<Socket>> remotes;
+  const ComboAddress auth1("192.0.2.1:53");
+  const ComboAddress auth2("192.0.2.2:53");
+  struct timeval now;
+  Utility::gettimeofday(&now, nullptr);
+
+  struct timeval before = now;
+  before.tv_sec -= (TCPOutConnectionManager::s_maxIdleTimeMsec / 1000) + 1;
+  manager.store(before, auth1, makeConnection(remotes));
+  manager.store(now, auth2, makeConnection(remotes));
+  BOOST_CHECK_EQUAL(manager.size(), 2U);
+
+  manager.cleanup(now);
+  BOOST_CHECK_EQUAL(manager.size(), 1U);
+  BOOST_CHECK(manager.get(auth1).d_socket == nullptr);
+  BOOST_CHECK(manager.get(auth2).d_socket != nullptr);
+}
+
+class DummyTLSSession : public TLSSession
+{
+public:
+  DummyTLSSession(int id) :
+    d_id(id)
+  {
+  }
+
+  int d_id;
+};
+
+BOOST_AUTO_TEST_CASE(test_tls_sessions)
+{
+  TCPOutConnectionManager manager;
+  const ComboAddress dot1("192.0.2.1:853");
+  const ComboAddress dot2("192.0.2.2:853");
+
+  BOOST_CHECK(manager.getTLSSession(dot1) == nullptr);
+
+  manager.storeTLSSession(dot1, std::make_unique<DummyTLSSession>(1));
+  /* a newer session replaces the existing one */
+  manager.storeTLSSession(dot1, std::make_unique<DummyTLSSession>(2));
+  manager.storeTLSSession(dot2, std::make_unique<DummyTLSSession>(3));
+
+  auto session = manager.getTLSSession(dot1);
+  BOOST_REQUIRE(session != nullptr);
+  BOOST_CHECK_EQUAL(dynamic_cast<DummyTLSSession*>(session.get())->d_id, 2);
+  /* and it can only be used once */
+  BOOST_CHECK(manager.getTLSSession(dot1) == nullptr);
+
+  session = manager.getTLSSession(dot2);
+  BOOST_REQUIRE(session != nullptr);
+  BOOST_CHECK_EQUAL(dynamic_cast<DummyTLSSession*>(session.get())->d_id, 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
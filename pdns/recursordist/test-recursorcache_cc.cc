@@ -5,6 +5,8 @@
 #include "config.h"
 #endif
 #include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <thread>
 
 #include "iputils.hh"
 #include "recursor_cache.hh"
@@ -517,6 +519,75 @@ BOOST_AUTO_TEST_CASE(test_RecursorCache_ExpungingExpiredEntries)
   BOOST_CHECK_EQUAL(MRC.get(ttd - 1, power2, QType(dr2.d_type), false, &retrieved, who, 0, boost::none, nullptr), -1);
 }
 
+BOOST_AUTO_TEST_CASE(test_RecursorCache_ServeStale)
+{
+  MemRecursorCache MRC(1);
+  MemRecursorCache::s_maxServedStaleExtensions = 2;
+
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecs;
+  const DNSName authZone(".");
+  const time_t now = time(nullptr);
+  const DNSName power("powerdns.com.");
+  const time_t ttd = now + 120;
+  std::vector<DNSRecord> retrieved;
+  const ComboAddress who("192.0.2.1");
+
+  DNSRecord dr;
+  ComboAddress drContent("192.0.2.2");
+  dr.d_name = power;
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_content = std::make_shared<ARecordContent>(drContent);
+  dr.d_ttl = static_cast<uint32_t>(ttd); // XXX truncation
+  dr.d_place = DNSResourceRecord::ANSWER;
+  records.push_back(dr);
+  MRC.replace(now, power, QType(QType::A), records, signatures, authRecs, true, authZone, boost::none);
+
+  /* expired, not served unless asked to */
+  time_t later = ttd + 10;
+  BOOST_CHECK_EQUAL(MRC.get(later, power, QType(QType::A), false, &retrieved, who), -1);
+  BOOST_CHECK_EQUAL(MRC.get(later, power, QType(QType::A), false, &retrieved, who, MemRecursorCache::ServeStale), MemRecursorCache::s_serveStaleExtensionPeriod);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+  BOOST_CHECK_EQUAL(getRR<ARecordContent>(retrieved.at(0))->getCA().toString(), drContent.toString());
+  BOOST_CHECK_EQUAL(MRC.servedStale, 1U);
+
+  /* the entry has been extended, so it can now be retrieved normally */
+  BOOST_CHECK_EQUAL(MRC.get(later + 1, power, QType(QType::A), false, &retrieved, who), MemRecursorCache::s_serveStaleExtensionPeriod - 1);
+
+  later += MemRecursorCache::s_serveStaleExtensionPeriod + 1;
+  BOOST_CHECK_EQUAL(MRC.get(later, power, QType(QType::A), false, &retrieved, who), -1);
+  BOOST_CHECK_EQUAL(MRC.get(later, power, QType(QType::A), false, &retrieved, who, MemRecursorCache::ServeStale), MemRecursorCache::s_serveStaleExtensionPeriod);
+  BOOST_CHECK_EQUAL(MRC.servedStale, 2U);
+
+  /* we reached the maximum number of extensions */
+  later += MemRecursorCache::s_serveStaleExtensionPeriod + 1;
+  BOOST_CHECK_EQUAL(MRC.get(later, power, QType(QType::A), false, &retrieved, who, MemRecursorCache::ServeStale), -1);
+  BOOST_CHECK_EQUAL(MRC.servedStale, 2U);
+
+  /* a new version of the record resets the count */
+  dr.d_ttl = static_cast<uint32_t>(later + 120);
+  records.clear();
+  records.push_back(dr);
+  MRC.replace(later, power, QType(QType::A), records, signatures, authRecs, true, authZone, boost::none);
+  later += 130;
+  BOOST_CHECK_EQUAL(MRC.get(later, power, QType(QType::A), false, &retrieved, who, MemRecursorCache::ServeStale), MemRecursorCache::s_serveStaleExtensionPeriod);
+  BOOST_CHECK_EQUAL(MRC.servedStale, 3U);
+
+  /* pruning does not remove an expired entry while it can still be served stale */
+  dr.d_ttl = static_cast<uint32_t>(now - 10);
+  records.clear();
+  records.push_back(dr);
+  MRC.replace(now - 130, power, QType(QType::A), records, signatures, authRecs, true, authZone, boost::none);
+  MRC.doPrune(10);
+  BOOST_CHECK_EQUAL(MRC.size(), 1U);
+
+  MemRecursorCache::s_maxServedStaleExtensions = 0;
+  MRC.doPrune(10);
+  BOOST_CHECK_EQUAL(MRC.size(), 0U);
+}
+
 BOOST_AUTO_TEST_CASE(test_RecursorCache_ExpungingValidEntries)
 {
   MemRecursorCache MRC(1);
@@ -695,6 +766,131 @@ BOOST_AUTO_TEST_CASE(test_RecursorCache_ExpungingValidEntries)
   BOOST_CHECK_EQUAL(MRC.ecsIndexSize(), 0U);
 }
 
+BOOST_AUTO_TEST_CASE(test_RecursorCache_ClockEviction)
+{
+  MemRecursorCache MRC(1);
+  MemRecursorCache::s_clockEviction = true;
+
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecs;
+  const DNSName authZone(".");
+  const time_t now = time(nullptr);
+  std::vector<DNSRecord> retrieved;
+  const ComboAddress who("192.0.2.1");
+  const size_t namesCount = 10;
+
+  for (size_t idx = 0; idx < namesCount; idx++) {
+    DNSName name(std::to_string(idx) + ".powerdns.com.");
+    DNSRecord dr;
+    dr.d_name = name;
+    dr.d_type = QType::A;
+    dr.d_class = QClass::IN;
+    dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.2"));
+    dr.d_ttl = static_cast<uint32_t>(now + 3600); // XXX truncation
+    dr.d_place = DNSResourceRecord::ANSWER;
+    records.clear();
+    records.push_back(dr);
+    MRC.replace(now, name, QType(QType::A), records, signatures, authRecs, true, authZone, boost::none);
+  }
+  BOOST_CHECK_EQUAL(MRC.size(), namesCount);
+
+  /* hit the first half of the entries, which were inserted first */
+  for (size_t idx = 0; idx < namesCount / 2; idx++) {
+    BOOST_CHECK_GT(MRC.get(now, DNSName(std::to_string(idx) + ".powerdns.com."), QType(QType::A), false, &retrieved, who), 0);
+  }
+
+  /* with LRU they would have been moved to the back, with CLOCK they get a second chance */
+  MRC.doPrune(namesCount / 2);
+  BOOST_CHECK_EQUAL(MRC.size(), namesCount / 2);
+  for (size_t idx = 0; idx < namesCount; idx++) {
+    BOOST_CHECK_EQUAL(MRC.get(now, DNSName(std::to_string(idx) + ".powerdns.com."), QType(QType::A), false, &retrieved, who) > 0, idx < namesCount / 2);
+  }
+
+  /* the remaining entries have all been hit again, so the first sweep only clears their bit,
+     then the oldest one goes */
+  MRC.doPrune(namesCount / 2 - 1);
+  BOOST_CHECK_EQUAL(MRC.size(), namesCount / 2);
+  MRC.doPrune(namesCount / 2 - 1);
+  BOOST_CHECK_EQUAL(MRC.size(), namesCount / 2 - 1);
+  BOOST_CHECK_EQUAL(MRC.get(now, DNSName("0.powerdns.com."), QType(QType::A), false, &retrieved, who), -1);
+
+  MemRecursorCache::s_clockEviction = false;
+}
+
+/* lookups of the same entries from several threads, with LRU and CLOCK eviction,
+   reporting the time taken and the number of contended lock acquisitions */
+static void runConcurrentLookups(size_t namesCount, size_t threadsCount, size_t lookupsPerThread)
+{
+  const time_t now = time(nullptr);
+  const ComboAddress who("192.0.2.1");
+
+  for (const bool clock : {false, true}) {
+    MemRecursorCache::s_clockEviction = clock;
+    MemRecursorCache MRC(16);
+
+    std::vector<DNSRecord> records;
+    std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+    std::vector<std::shared_ptr<DNSRecord>> authRecs;
+    std::vector<DNSName> names;
+    for (size_t idx = 0; idx < namesCount; idx++) {
+      names.emplace_back(std::to_string(idx) + ".powerdns.com.");
+      DNSRecord dr;
+      dr.d_name = names.back();
+      dr.d_type = QType::A;
+      dr.d_class = QClass::IN;
+      dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.2"));
+      dr.d_ttl = static_cast<uint32_t>(now + 3600); // XXX truncation
+      dr.d_place = DNSResourceRecord::ANSWER;
+      records.clear();
+      records.push_back(dr);
+      MRC.replace(now, names.back(), QType(QType::A), records, signatures, authRecs, true, DNSName("."), boost::none);
+    }
+    const auto before = MRC.stats();
+
+    std::atomic<uint64_t> found{0};
+    std::vector<std::thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t idx = 0; idx < threadsCount; idx++) {
+      threads.emplace_back([&MRC, &names, &found, &who, now, namesCount, lookupsPerThread]() {
+        std::vector<DNSRecord> retrieved;
+        uint64_t hits = 0;
+        for (size_t lookup = 0; lookup < lookupsPerThread; lookup++) {
+          if (MRC.get(now, names.at(lookup % namesCount), QType(QType::A), false, &retrieved, who) > 0) {
+            hits++;
+          }
+        }
+        found += hits;
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    const auto after = MRC.stats();
+
+    BOOST_CHECK_EQUAL(found.load(), threadsCount * lookupsPerThread);
+    BOOST_CHECK_GE(after.second - before.second, threadsCount * lookupsPerThread);
+    BOOST_CHECK_EQUAL(MRC.size(), namesCount);
+    BOOST_TEST_MESSAGE((clock ? "CLOCK" : "LRU") << ": " << threadsCount * lookupsPerThread << " lookups from " << threadsCount << " threads in " << elapsed << " us, " << (after.first - before.first) << " contended lock acquisitions");
+  }
+
+  MemRecursorCache::s_clockEviction = false;
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCache_ConcurrentLookups)
+{
+  runConcurrentLookups(100, 4, 1000);
+}
+
+/* Not a proper benchmark, but it gives an idea of the lock contention caused by several
+   threads hitting the same entries. Disabled by default, run it with
+   --run_test=recursorcache_cc/test_RecursorCache_ContentionBenchmark --log_level=message */
+BOOST_AUTO_TEST_CASE(test_RecursorCache_ContentionBenchmark, *boost::unit_test::disabled())
+{
+  runConcurrentLookups(1000, 4, 100000);
+}
+
 BOOST_AUTO_TEST_CASE(test_RecursorCacheECSIndex)
 {
   MemRecursorCache MRC(1);
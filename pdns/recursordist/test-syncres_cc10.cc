@@ -135,4 +135,148 @@ BOOST_AUTO_TEST_CASE(test_outgoing_v6_only_no_AAAA_in_delegation)
   BOOST_CHECK_EQUAL(ret.size(), 0U);
 }
 
+BOOST_AUTO_TEST_CASE(test_servestale)
+{
+  std::unique_ptr<SyncRes> sr;
+  const time_t now = time(nullptr);
+  initSR(sr, false, false, now);
+  MemRecursorCache::s_maxServedStaleExtensions = 1440;
+  primeHints();
+
+  const DNSName target("powerdns.com.");
+  bool serversDown = false;
+  size_t queries = 0;
+  auto callback = [target, &serversDown, &queries](const ComboAddress& ip, const DNSName& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, boost::optional<Netmask>& srcmask, boost::optional<const ResolveContext&> context, LWResult* res, bool* chained) {
+    queries++;
+    if (serversDown) {
+      return LWResult::Result::Timeout;
+    }
+    if (isRootServer(ip)) {
+      setLWResult(res, 0, false, false, true);
+      addRecordToLW(res, domain, QType::NS, "ns1.powerdns.com.", DNSResourceRecord::AUTHORITY, 172800);
+      addRecordToLW(res, "ns1.powerdns.com.", QType::A, "192.0.2.1", DNSResourceRecord::ADDITIONAL, 3600);
+      return LWResult::Result::Success;
+    }
+    else if (ip == ComboAddress("192.0.2.1:53")) {
+      setLWResult(res, 0, true, false, false);
+      addRecordToLW(res, domain, QType::A, "192.0.2.2", DNSResourceRecord::ANSWER, 60);
+      return LWResult::Result::Success;
+    }
+    return LWResult::Result::Timeout;
+  };
+  sr->setAsyncCallback(callback);
+
+  vector<DNSRecord> ret;
+  int rcode = sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+  BOOST_CHECK_EQUAL(rcode, RCode::NoError);
+  BOOST_REQUIRE_EQUAL(ret.size(), 1U);
+  BOOST_CHECK_EQUAL(queries, 2U);
+
+  /* the record has now expired and the servers are unreachable */
+  serversDown = true;
+  struct timeval later = {now + 61, 0};
+  sr = std::make_unique<SyncRes>(later);
+  sr->setDoEDNS0(true);
+  sr->setLogMode(SyncRes::LogNone);
+  sr->setAsyncCallback(callback);
+
+  ret.clear();
+  rcode = sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+  BOOST_CHECK_EQUAL(rcode, RCode::NoError);
+  BOOST_REQUIRE_EQUAL(ret.size(), 1U);
+  BOOST_CHECK(ret[0].d_type == QType::A);
+  BOOST_CHECK_EQUAL(ret[0].d_ttl, MemRecursorCache::s_serveStaleExtensionPeriod);
+  BOOST_CHECK_EQUAL(g_recCache->servedStale, 1U);
+
+  /* without serve-stale, the same query fails */
+  MemRecursorCache::s_maxServedStaleExtensions = 0;
+  later.tv_sec += MemRecursorCache::s_serveStaleExtensionPeriod + 1;
+  sr = std::make_unique<SyncRes>(later);
+  sr->setDoEDNS0(true);
+  sr->setLogMode(SyncRes::LogNone);
+  sr->setAsyncCallback(callback);
+
+  ret.clear();
+  rcode = sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+  BOOST_CHECK_EQUAL(rcode, RCode::ServFail);
+  BOOST_CHECK_EQUAL(ret.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_servestale_deadline)
+{
+  std::unique_ptr<SyncRes> sr;
+  const time_t now = time(nullptr);
+  initSR(sr, false, false, now);
+  MemRecursorCache::s_maxServedStaleExtensions = 1440;
+  SyncRes::s_serveStaleDeadlineUsec = 100000;
+  SyncRes::s_nonresolvingnsmaxfails = 10;
+  primeHints();
+
+  const DNSName target("powerdns.com.");
+  const DNSName ns("ns1.stale-deadline.net.");
+  bool slow = false;
+  auto callback = [target, ns, &slow](const ComboAddress& ip, const DNSName& domain, int type, bool doTCP, bool sendRDQuery, int EDNS0Level, struct timeval* now, boost::optional<Netmask>& srcmask, boost::optional<const ResolveContext&> context, LWResult* res, bool* chained) {
+    if (slow) {
+      /* every answer takes 200 ms */
+      res->d_usec = 200000;
+    }
+    if (isRootServer(ip)) {
+      if (domain == target) {
+        /* out-of-bailiwick NS, without glue */
+        setLWResult(res, 0, false, false, true);
+        addRecordToLW(res, target, QType::NS, ns.toString(), DNSResourceRecord::AUTHORITY, 172800);
+        return LWResult::Result::Success;
+      }
+      setLWResult(res, 0, false, false, true);
+      addRecordToLW(res, "stale-deadline.net.", QType::NS, "ns.stale-deadline.net.", DNSResourceRecord::AUTHORITY, 172800);
+      addRecordToLW(res, "ns.stale-deadline.net.", QType::A, "192.0.2.4", DNSResourceRecord::ADDITIONAL, 172800);
+      return LWResult::Result::Success;
+    }
+    else if (ip == ComboAddress("192.0.2.4:53")) {
+      /* resolving the name of the NS takes two queries, the second one is not sent once the deadline is reached */
+      setLWResult(res, 0, true, false, false);
+      if (domain == ns) {
+        addRecordToLW(res, ns, QType::CNAME, "ns2.stale-deadline.net.", DNSResourceRecord::ANSWER, 60);
+      }
+      else if (type == QType::A) {
+        addRecordToLW(res, domain, QType::A, "192.0.2.1", DNSResourceRecord::ANSWER, 60);
+      }
+      else {
+        addRecordToLW(res, "stale-deadline.net.", QType::SOA, "ns.stale-deadline.net. hostmaster.stale-deadline.net. 1 3600 600 86400 60", DNSResourceRecord::AUTHORITY, 60);
+      }
+      return LWResult::Result::Success;
+    }
+    else if (ip == ComboAddress("192.0.2.1:53")) {
+      setLWResult(res, 0, true, false, false);
+      addRecordToLW(res, domain, QType::A, "192.0.2.2", DNSResourceRecord::ANSWER, 60);
+      return LWResult::Result::Success;
+    }
+    return LWResult::Result::Timeout;
+  };
+  sr->setAsyncCallback(callback);
+
+  vector<DNSRecord> ret;
+  int rcode = sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+  BOOST_CHECK_EQUAL(rcode, RCode::NoError);
+  BOOST_REQUIRE_EQUAL(ret.size(), 1U);
+
+  /* the record and the addresses of the NS have now expired, and the servers are slow:
+     the deadline is reached while resolving the name of the NS */
+  slow = true;
+  struct timeval later = {now + 61, 0};
+  sr = std::make_unique<SyncRes>(later);
+  sr->setDoEDNS0(true);
+  sr->setLogMode(SyncRes::LogNone);
+  sr->setAsyncCallback(callback);
+
+  ret.clear();
+  rcode = sr->beginResolve(target, QType(QType::A), QClass::IN, ret);
+  BOOST_CHECK_EQUAL(rcode, RCode::NoError);
+  BOOST_REQUIRE_EQUAL(ret.size(), 1U);
+  BOOST_CHECK(ret[0].d_type == QType::A);
+  BOOST_CHECK_EQUAL(ret[0].d_ttl, MemRecursorCache::s_serveStaleExtensionPeriod);
+  /* the NS did not fail to resolve, we just stopped waiting for it */
+  BOOST_CHECK_EQUAL(SyncRes::getNonResolvingCount(ns), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
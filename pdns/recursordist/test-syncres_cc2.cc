@@ -1,6 +1,8 @@
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/unit_test.hpp>
 
+#include <thread>
+
 #include "test-syncres_cc.hh"
 
 BOOST_AUTO_TEST_SUITE(syncres_cc2)
@@ -291,6 +293,33 @@ BOOST_AUTO_TEST_CASE(test_throttled_server_time)
   BOOST_CHECK(!SyncRes::isThrottled(now + 2, ns));
 }
 
+BOOST_AUTO_TEST_CASE(test_throttled_server_shared_between_threads)
+{
+  std::unique_ptr<SyncRes> sr;
+  initSR(sr);
+
+  primeHints();
+
+  const ComboAddress ns("192.0.2.1:53");
+  const DNSName nsName("ns1.example.net.");
+  const struct timeval now = sr->getNow();
+
+  /* what is learned by one thread about a server should be known to all the other ones */
+  std::thread worker([&]() {
+    SyncRes::doThrottle(now.tv_sec, ns, SyncRes::s_serverdownthrottletime, 10000);
+    SyncRes::submitNSSpeed(nsName, ns, 1000000, now);
+    SyncRes::incrServerFailsCount(ns, now);
+  });
+  worker.join();
+
+  BOOST_CHECK(SyncRes::isThrottled(now.tv_sec, ns));
+  BOOST_CHECK_EQUAL(SyncRes::getThrottledServersSize(), 1U);
+  BOOST_CHECK_EQUAL(SyncRes::getNSSpeed(nsName, ns), 1000000U);
+  BOOST_CHECK_EQUAL(SyncRes::getNSSpeedsSize(), 1U);
+  BOOST_CHECK_EQUAL(SyncRes::getServerFailsCount(ns), 1U);
+  BOOST_CHECK_EQUAL(SyncRes::getFailedServersSize(), 1U);
+}
+
 BOOST_AUTO_TEST_CASE(test_dont_query_server)
 {
   std::unique_ptr<SyncRes> sr;
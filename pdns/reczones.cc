@@ -338,6 +338,9 @@ string reloadAuthAndForwards()
       g_recCache->doWipeCache(i, true, 0xffff);
       broadcastAccFunction<uint64_t>([&]{return pleaseWipePacketCache(i, true, 0xffff);});
       g_negCache->wipe(i, true);
+      if (g_aggressiveNSECCache) {
+        g_aggressiveNSECCache->removeZoneInfo(i, true);
+      }
     }
 
     broadcastFunction([=]{return pleaseUseNewSDomainsMap(newDomainMap);});
@@ -60,6 +60,33 @@ void StatNode::submit(const DNSName& domain, int rcode, unsigned int bytes, boos
   children[*last].submit(last, tmp.begin(), "", rcode, bytes, remote, 1);
 }
 
+void StatNode::submit(const DNSName& domain, const Stat& stat)
+{
+  std::vector<string> tmp = domain.getRawLabels();
+  if (tmp.empty()) {
+    return;
+  }
+
+  StatNode* node = this;
+  std::string parent;
+  uint8_t count = 1;
+  for (auto label = tmp.rbegin(); label != tmp.rend(); ++label, ++count) {
+    node = &node->children[*label];
+    if (node->name.empty()) {
+      node->name = *label;
+    }
+    if (node->fullname.empty()) {
+      node->fullname = node->name;
+      node->fullname.append(".");
+      node->fullname.append(parent);
+      node->labelsCount = count;
+    }
+    parent = node->fullname;
+  }
+
+  node->s += stat;
+}
+
 /* www.powerdns.com. -> 
    .                 <- fullnames
    com.
@@ -35,8 +35,14 @@
 #include "syncres.hh"
 #include "dnsseckeeper.hh"
 #include "validate-recursor.hh"
+#include "rec-snapshot.hh"
 
 thread_local SyncRes::ThreadLocalStorage SyncRes::t_sstorage;
+ShardedTable<SyncRes::nsspeeds_t> SyncRes::s_nsSpeeds;
+ShardedTable<SyncRes::throttle_t> SyncRes::s_throttle;
+ShardedTable<SyncRes::ednsstatus_t> SyncRes::s_ednsstatus;
+ShardedTable<fails_t<ComboAddress>> SyncRes::s_fails;
+ShardedTable<fails_t<DNSName>> SyncRes::s_nonresolving;
 thread_local std::unique_ptr<addrringbuf_t> t_timeouts;
 
 std::unordered_set<DNSName> SyncRes::s_delegationOnly;
@@ -72,6 +78,7 @@ std::atomic<uint64_t> SyncRes::s_outgoing4timeouts;
 std::atomic<uint64_t> SyncRes::s_outgoing6timeouts;
 std::atomic<uint64_t> SyncRes::s_outqueries;
 std::atomic<uint64_t> SyncRes::s_tcpoutqueries;
+std::atomic<uint64_t> SyncRes::s_dotoutqueries;
 std::atomic<uint64_t> SyncRes::s_throttledqueries;
 std::atomic<uint64_t> SyncRes::s_dontqueries;
 std::atomic<uint64_t> SyncRes::s_qnameminfallbacksuccess;
@@ -95,8 +102,12 @@ bool SyncRes::s_nopacketcache;
 bool SyncRes::s_rootNXTrust;
 bool SyncRes::s_noEDNS;
 bool SyncRes::s_qnameminimization;
+bool SyncRes::s_dot_to_port_853;
+std::map<ComboAddress, std::string, ComboAddress::addressOnlyLessThan> SyncRes::s_dot_names;
+std::string SyncRes::s_dot_ca_store;
 SyncRes::HardenNXD SyncRes::s_hardenNXD;
 unsigned int SyncRes::s_refresh_ttlperc;
+unsigned int SyncRes::s_serveStaleDeadlineUsec;
 
 #define LOG(x) if(d_lm == Log) { g_log <<Logger::Warning << x; } else if(d_lm == Store) { d_trace << x; }
 
@@ -142,8 +153,31 @@ int SyncRes::beginResolve(const DNSName &qname, const QType qtype, uint16_t qcla
   else if(qclass!=QClass::IN)
     return -1;
 
+  if (MemRecursorCache::s_maxServedStaleExtensions > 0 && s_serveStaleDeadlineUsec > 0) {
+    d_serveStaleQName = qname;
+    d_serveStaleQType = qtype;
+  }
+
   set<GetBestNSAnswer> beenthere;
-  int res=doResolve(qname, qtype, ret, depth, beenthere, state);
+  int res;
+  try {
+    res = doResolve(qname, qtype, ret, depth, beenthere, state);
+  }
+  catch (const ImmediateServFailException& e) {
+    if (!serveStaleFromCache(qname, qtype, ret, depth, state, res)) {
+      throw;
+    }
+  }
+  catch (const ServeStaleDeadlineException& e) {
+    LOG(d_prefix<<qname<<": "<<e.reason<<endl);
+    if (!serveStaleFromCache(qname, qtype, ret, depth, state, res)) {
+      throw ImmediateServFailException(e.reason);
+    }
+  }
+
+  if (res == -1 || res == RCode::ServFail) {
+    serveStaleFromCache(qname, qtype, ret, depth, state, res);
+  }
   d_queryValidationState = state;
 
   if (shouldValidate()) {
@@ -161,6 +195,42 @@ int SyncRes::beginResolve(const DNSName &qname, const QType qtype, uint16_t qcla
   return res;
 }
 
+/* RFC 8767: when resolving failed, see if the record cache still holds expired data
+   for this query and use it, with a short TTL. The expired entries that are served get
+   a background refresh queued by the record cache. */
+bool SyncRes::serveStaleFromCache(const DNSName& qname, const QType qtype, vector<DNSRecord>& ret, unsigned int depth, vState& state, int& res)
+{
+  if (MemRecursorCache::s_maxServedStaleExtensions == 0 || d_serveStale || d_refresh) {
+    return false;
+  }
+
+  LOG(d_prefix<<qname<<": Resolution failed, trying to serve stale data from the cache"<<endl);
+  d_serveStale = true;
+  bool oldCacheOnly = setCacheOnly(true);
+
+  vector<DNSRecord> staleRet;
+  vState staleState = vState::Indeterminate;
+  set<GetBestNSAnswer> beenthere;
+  int staleRes;
+  try {
+    staleRes = doResolveNoQNameMinimization(qname, qtype, staleRet, depth, beenthere, staleState, nullptr, nullptr, false);
+  }
+  catch (const ImmediateServFailException& e) {
+    staleRes = RCode::ServFail;
+  }
+  setCacheOnly(oldCacheOnly);
+
+  if (staleRes != RCode::NoError || staleRet.empty()) {
+    LOG(d_prefix<<qname<<": No stale data available"<<endl);
+    return false;
+  }
+
+  ret = std::move(staleRet);
+  state = staleState;
+  res = staleRes;
+  return true;
+}
+
 /*! Handles all special, built-in names
  * Fills ret with an answer and returns true if it handled the query.
  *
@@ -418,12 +488,14 @@ uint64_t SyncRes::doEDNSDump(int fd)
   }
   uint64_t count = 0;
 
-  fprintf(fp.get(),"; edns from thread follows\n;\n");
-  for(const auto& eds : t_sstorage.ednsstatus) {
-    count++;
-    char tmp[26];
-    fprintf(fp.get(), "%s\t%d\t%s", eds.address.toString().c_str(), (int)eds.mode, ctime_r(&eds.modeSetAt, tmp));
-  }
+  fprintf(fp.get(),"; edns dump follows\n;\n");
+  s_ednsstatus.forEach([&fp, &count](const ednsstatus_t& ednsstatus) {
+    for(const auto& eds : ednsstatus) {
+      count++;
+      char tmp[26];
+      fprintf(fp.get(), "%s\t%d\t%s", eds.address.toString().c_str(), (int)eds.mode, ctime_r(&eds.modeSetAt, tmp));
+    }
+  });
   return count;
 }
 
@@ -438,25 +510,101 @@ uint64_t SyncRes::doDumpNSSpeeds(int fd)
     close(newfd);
     return 0;
   }
-  fprintf(fp.get(), "; nsspeed dump from thread follows\n;\n");
+  fprintf(fp.get(), "; nsspeed dump follows\n;\n");
   uint64_t count=0;
 
-  for(const auto& i : t_sstorage.nsSpeeds)
-  {
-    count++;
-
-    // an <empty> can appear hear in case of authoritative (hosted) zones
-    fprintf(fp.get(), "%s -> ", i.first.toLogString().c_str());
-    for(const auto& j : i.second.d_collection)
+  s_nsSpeeds.forEach([&fp, &count](const nsspeeds_t& nsSpeeds) {
+    for(const auto& i : nsSpeeds)
     {
-      // typedef vector<pair<ComboAddress, DecayingEwma> > collection_t;
-      fprintf(fp.get(), "%s/%f ", j.first.toString().c_str(), j.second.peek());
+      count++;
+
+      // an <empty> can appear hear in case of authoritative (hosted) zones
+      fprintf(fp.get(), "%s -> ", i.first.toLogString().c_str());
+      for(const auto& j : i.second.d_collection)
+      {
+        // typedef vector<pair<ComboAddress, DecayingEwma> > collection_t;
+        fprintf(fp.get(), "%s/%f ", j.first.toString().c_str(), j.second.peek());
+      }
+      fprintf(fp.get(), "\n");
     }
-    fprintf(fp.get(), "\n");
-  }
+  });
+  return count;
+}
+
+enum class NSSpeedSnapshotField : protozero::pbf_tag_type
+{
+  name = 1,
+  lastGet = 2,
+  address = 3,
+  speed = 4
+};
+
+uint64_t SyncRes::saveNSSpeedsSnapshot(pdns::CacheSnapshot::Writer& writer)
+{
+  uint64_t count = 0;
+
+  s_nsSpeeds.forEach([&writer, &count](const nsspeeds_t& nsSpeeds) {
+    for (const auto& i : nsSpeeds) {
+      protozero::pbf_writer message(writer.get(), static_cast<protozero::pbf_tag_type>(pdns::CacheSnapshot::Field::nsSpeed));
+      // the name is empty for authoritative (hosted) zones, and encodeName() does not store empty names
+      pdns::CacheSnapshot::encodeName(message, static_cast<protozero::pbf_tag_type>(NSSpeedSnapshotField::name), i.first);
+      message.add_int64(static_cast<protozero::pbf_tag_type>(NSSpeedSnapshotField::lastGet), i.second.d_lastget.tv_sec);
+      /* addresses and speeds are stored as two parallel lists */
+      for (const auto& j : i.second.d_collection) {
+        message.add_string(static_cast<protozero::pbf_tag_type>(NSSpeedSnapshotField::address), j.first.toStringWithPort());
+        message.add_float(static_cast<protozero::pbf_tag_type>(NSSpeedSnapshotField::speed), j.second.peek());
+      }
+      count++;
+    }
+  });
+  writer.flushIfNeeded();
+
   return count;
 }
 
+bool SyncRes::loadNSSpeedsSnapshotEntry(const protozero::data_view& data, time_t now)
+{
+  DNSName name;
+  time_t lastGet = 0;
+  std::vector<ComboAddress> addresses;
+  std::vector<float> speeds;
+
+  protozero::pbf_reader message(data);
+  while (message.next()) {
+    switch (static_cast<NSSpeedSnapshotField>(message.tag())) {
+    case NSSpeedSnapshotField::name:
+      name = pdns::CacheSnapshot::decodeName(message.get_view());
+      break;
+    case NSSpeedSnapshotField::lastGet:
+      lastGet = static_cast<time_t>(message.get_int64());
+      break;
+    case NSSpeedSnapshotField::address:
+      addresses.push_back(ComboAddress(message.get_string()));
+      break;
+    case NSSpeedSnapshotField::speed:
+      speeds.push_back(message.get_float());
+      break;
+    default:
+      message.skip();
+    }
+  }
+
+  if (addresses.size() != speeds.size()) {
+    throw std::runtime_error("Invalid NS speed entry in snapshot");
+  }
+  /* same limit as the full scan done by the housekeeping */
+  if (name.empty() || addresses.empty() || lastGet < now - 300) {
+    return false;
+  }
+
+  struct timeval tv{now, 0};
+  for (size_t idx = 0; idx < addresses.size(); idx++) {
+    // the first value submitted is stored as is
+    submitNSSpeed(name, addresses.at(idx), static_cast<uint32_t>(speeds.at(idx)), tv);
+  }
+  return true;
+}
+
 uint64_t SyncRes::doDumpThrottleMap(int fd)
 {
   int newfd = dup(fd);
@@ -472,14 +620,16 @@ uint64_t SyncRes::doDumpThrottleMap(int fd)
   fprintf(fp.get(), "; remote IP\tqname\tqtype\tcount\tttd\n");
   uint64_t count=0;
 
-  const auto& throttleMap = t_sstorage.throttle.getThrottleMap();
-  for(const auto& i : throttleMap)
-  {
-    count++;
-    char tmp[26];
-    // remote IP, dns name, qtype, count, ttd
-    fprintf(fp.get(), "%s\t%s\t%d\t%u\t%s", i.thing.get<0>().toString().c_str(), i.thing.get<1>().toLogString().c_str(), i.thing.get<2>(), i.count, ctime_r(&i.ttd, tmp));
-  }
+  s_throttle.forEach([&fp, &count](const throttle_t& throttle) {
+    const auto& throttleMap = throttle.getThrottleMap();
+    for(const auto& i : throttleMap)
+    {
+      count++;
+      char tmp[26];
+      // remote IP, dns name, qtype, count, ttd
+      fprintf(fp.get(), "%s\t%s\t%d\t%u\t%s", i.thing.get<0>().toString().c_str(), i.thing.get<1>().toLogString().c_str(), i.thing.get<2>(), i.count, ctime_r(&i.ttd, tmp));
+    }
+  });
 
   return count;
 }
@@ -499,13 +649,15 @@ uint64_t SyncRes::doDumpFailedServers(int fd)
   fprintf(fp.get(), "; remote IP\tcount\ttimestamp\n");
   uint64_t count=0;
 
-  for(const auto& i : t_sstorage.fails.getMap())
-  {
-    count++;
-    char tmp[26];
-    ctime_r(&i.last, tmp);
-    fprintf(fp.get(), "%s\t%llu\t%s", i.key.toString().c_str(), i.value, tmp);
-  }
+  s_fails.forEach([&fp, &count](const fails_t<ComboAddress>& fails) {
+    for(const auto& i : fails.getMap())
+    {
+      count++;
+      char tmp[26];
+      ctime_r(&i.last, tmp);
+      fprintf(fp.get(), "%s\t%llu\t%s", i.key.toString().c_str(), i.value, tmp);
+    }
+  });
 
   return count;
 }
@@ -525,13 +677,15 @@ uint64_t SyncRes::doDumpNonResolvingNS(int fd)
   fprintf(fp.get(), "; name\tcount\ttimestamp\n");
   uint64_t count=0;
 
-  for(const auto& i : t_sstorage.nonresolving.getMap())
-  {
-    count++;
-    char tmp[26];
-    ctime_r(&i.last, tmp);
-    fprintf(fp.get(), "%s\t%llu\t%s", i.key.toString().c_str(), i.value, tmp);
-  }
+  s_nonresolving.forEach([&fp, &count](const fails_t<DNSName>& nonresolving) {
+    for(const auto& i : nonresolving.getMap())
+    {
+      count++;
+      char tmp[26];
+      ctime_r(&i.last, tmp);
+      fprintf(fp.get(), "%s\t%llu\t%s", i.key.toString().c_str(), i.value, tmp);
+    }
+  });
 
   return count;
 }
@@ -579,15 +733,19 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
      If '3', send bare queries
   */
 
-  auto ednsstatus = t_sstorage.ednsstatus.insert(ip).first; // does this include port? YES
-  auto &ind = t_sstorage.ednsstatus.get<ComboAddress>();
-  if (ednsstatus->modeSetAt && ednsstatus->modeSetAt + 3600 < d_now.tv_sec) {
-    t_sstorage.ednsstatus.reset(ind, ednsstatus);
-    //    cerr<<"Resetting EDNS Status for "<<ip.toString()<<endl);
-  }
-
-  const SyncRes::EDNSStatus::EDNSMode *mode = &ednsstatus->mode;
-  const SyncRes::EDNSStatus::EDNSMode oldmode = *mode;
+  /* the EDNS status table is shared with the other threads, so we can't keep a reference to
+     our entry while we are waiting for the answer: only hold the lock while reading or updating it */
+  const size_t ednsHash = getShardHash(ip);
+  SyncRes::EDNSStatus::EDNSMode mode = s_ednsstatus.apply(ednsHash, [&ip, this](ednsstatus_t& ednsstatus) {
+    auto it = ednsstatus.insert(ip).first; // does this include port? YES
+    auto &ind = ednsstatus.get<ComboAddress>();
+    if (it->modeSetAt && it->modeSetAt + 3600 < d_now.tv_sec) {
+      ednsstatus.reset(ind, it);
+      //    cerr<<"Resetting EDNS Status for "<<ip.toString()<<endl);
+    }
+    return it->mode;
+  });
+  const SyncRes::EDNSStatus::EDNSMode oldmode = mode;
   int EDNSLevel = 0;
   auto luaconfsLocal = g_luaconfs.getLocal();
   ResolveContext ctx;
@@ -600,11 +758,11 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
   for(int tries = 0; tries < 3; ++tries) {
     //    cerr<<"Remote '"<<ip.toString()<<"' currently in mode "<<mode<<endl;
     
-    if (*mode == EDNSStatus::NOEDNS) {
+    if (mode == EDNSStatus::NOEDNS) {
       g_stats.noEdnsOutQueries++;
       EDNSLevel = 0; // level != mode
     }
-    else if (ednsMANDATORY || *mode == EDNSStatus::UNKNOWN || *mode == EDNSStatus::EDNSOK || *mode == EDNSStatus::EDNSIGNORANT)
+    else if (ednsMANDATORY || mode == EDNSStatus::UNKNOWN || mode == EDNSStatus::EDNSOK || mode == EDNSStatus::EDNSIGNORANT)
       EDNSLevel = 1;
 
     DNSName sendQname(domain);
@@ -617,9 +775,6 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
     else {
       ret = asyncresolve(ip, sendQname, type, doTCP, sendRDQuery, EDNSLevel, now, srcmask, ctx, d_outgoingProtobufServers, d_frameStreamServers, luaconfsLocal->outgoingProtobufExportConfig.exportTypes, res, chained);
     }
-    // ednsstatus might be cleared, so do a new lookup
-    ednsstatus = t_sstorage.ednsstatus.insert(ip).first;
-    mode = &ednsstatus->mode;
     if (ret == LWResult::Result::PermanentError || ret == LWResult::Result::OSLimitError || ret == LWResult::Result::Spoofed) {
       return ret; // transport error, nothing to learn here
     }
@@ -627,26 +782,39 @@ LWResult::Result SyncRes::asyncresolveWrapper(const ComboAddress& ip, bool ednsM
     if (ret == LWResult::Result::Timeout) { // timeout, not doing anything with it now
       return ret;
     }
-    else if (*mode == EDNSStatus::UNKNOWN || *mode == EDNSStatus::EDNSOK || *mode == EDNSStatus::EDNSIGNORANT ) {
-      if(res->d_validpacket && !res->d_haveEDNS && res->d_rcode == RCode::FormErr)  {
-	//	cerr<<"Downgrading to NOEDNS because of "<<RCode::to_s(res->d_rcode)<<" for query to "<<ip.toString()<<" for '"<<domain<<"'"<<endl;
-        t_sstorage.ednsstatus.setMode(ind, ednsstatus, EDNSStatus::NOEDNS);
-        continue;
-      }
-      else if(!res->d_haveEDNS) {
-        if (*mode != EDNSStatus::EDNSIGNORANT) {
-          t_sstorage.ednsstatus.setMode(ind, ednsstatus, EDNSStatus::EDNSIGNORANT);
-	  //	  cerr<<"We find that "<<ip.toString()<<" is an EDNS-ignorer for '"<<domain<<"', moving to mode 2"<<endl;
-	}
+
+    // ednsstatus might have been cleared or updated by another thread in the meantime, so do a new lookup
+    bool retry = s_ednsstatus.apply(ednsHash, [&ip, &mode, oldmode, res, this](ednsstatus_t& ednsstatus) {
+      auto it = ednsstatus.insert(ip).first;
+      auto &ind = ednsstatus.get<ComboAddress>();
+      if (it->mode == EDNSStatus::UNKNOWN || it->mode == EDNSStatus::EDNSOK || it->mode == EDNSStatus::EDNSIGNORANT) {
+        if(res->d_validpacket && !res->d_haveEDNS && res->d_rcode == RCode::FormErr)  {
+          //	cerr<<"Downgrading to NOEDNS because of "<<RCode::to_s(res->d_rcode)<<" for query to "<<ip.toString()<<endl;
+          ednsstatus.setMode(ind, it, EDNSStatus::NOEDNS);
+          mode = it->mode;
+          return true;
+        }
+        else if(!res->d_haveEDNS) {
+          if (it->mode != EDNSStatus::EDNSIGNORANT) {
+            ednsstatus.setMode(ind, it, EDNSStatus::EDNSIGNORANT);
+            //	  cerr<<"We find that "<<ip.toString()<<" is an EDNS-ignorer, moving to mode 2"<<endl;
+          }
+        }
+        else {
+          ednsstatus.setMode(ind, it, EDNSStatus::EDNSOK);
+          //	cerr<<"We find that "<<ip.toString()<<" is EDNS OK!"<<endl;
+        }
       }
-      else {
-        t_sstorage.ednsstatus.setMode(ind, ednsstatus, EDNSStatus::EDNSOK);
-	//	cerr<<"We find that "<<ip.toString()<<" is EDNS OK!"<<endl;
+
+      mode = it->mode;
+      if (oldmode != mode || !it->modeSetAt) {
+        ednsstatus.setTS(ind, it, d_now.tv_sec);
       }
-    }
+      return false;
+    });
 
-    if (oldmode != *mode || !ednsstatus->modeSetAt) {
-      t_sstorage.ednsstatus.setTS(ind, ednsstatus, d_now.tv_sec);
+    if (retry) {
+      continue;
     }
     //    cerr<<"Result: ret="<<ret<<", EDNS-level: "<<EDNSLevel<<", haveEDNS: "<<res->d_haveEDNS<<", new mode: "<<mode<<endl;  
     return LWResult::Result::Success;
@@ -1107,7 +1275,7 @@ vector<ComboAddress> SyncRes::getAddrs(const DNSName &qname, unsigned int depth,
         // We have some IPv4 records, don't bother with going out to get IPv6, but do consult the cache
         // Once IPv6 adoption matters, this needs to be revisited
         res_t cset;
-        if (g_recCache->get(d_now.tv_sec, qname, QType::AAAA, false, &cset, d_cacheRemote, d_refresh, d_routingTag) > 0) {
+        if (g_recCache->get(d_now.tv_sec, qname, QType::AAAA, false, &cset, d_cacheRemote, getCacheFlags(), d_routingTag) > 0) {
           for (const auto &i : cset) {
             if (i.d_ttl > (unsigned int)d_now.tv_sec ) {
               if (auto rec = getRR<AAAARecordContent>(i)) {
@@ -1138,13 +1306,15 @@ vector<ComboAddress> SyncRes::getAddrs(const DNSName &qname, unsigned int depth,
      is only one or none at all in the current set.
   */
   map<ComboAddress, float> speeds;
-  auto& collection = t_sstorage.nsSpeeds[qname];
-  float factor = collection.getFactor(d_now);
-  for(const auto& val: ret) {
-    speeds[val] = collection.d_collection[val].get(factor);
-  }
+  s_nsSpeeds.apply(getShardHash(qname), [&](nsspeeds_t& nsSpeeds) {
+    auto& collection = nsSpeeds[qname];
+    float factor = collection.getFactor(d_now);
+    for(const auto& val: ret) {
+      speeds[val] = collection.d_collection[val].get(factor);
+    }
 
-  t_sstorage.nsSpeeds[qname].purge(speeds);
+    collection.purge(speeds);
+  });
 
   if (ret.size() > 1) {
     shuffle(ret.begin(), ret.end(), pdns::dns_random_engine());
@@ -1191,7 +1361,7 @@ void SyncRes::getBestNSFromCache(const DNSName &qname, const QType qtype, vector
     vector<DNSRecord> ns;
     *flawedNSSet = false;
 
-    if(g_recCache->get(d_now.tv_sec, subdomain, QType::NS, false, &ns, d_cacheRemote, d_refresh, d_routingTag) > 0) {
+    if(g_recCache->get(d_now.tv_sec, subdomain, QType::NS, false, &ns, d_cacheRemote, getCacheFlags(), d_routingTag) > 0) {
       bestns.reserve(ns.size());
 
       for(auto k=ns.cbegin();k!=ns.cend(); ++k) {
@@ -1207,7 +1377,7 @@ void SyncRes::getBestNSFromCache(const DNSName &qname, const QType qtype, vector
           const DNSRecord& dr=*k;
 	  auto nrr = getRR<NSRecordContent>(dr);
           if(nrr && (!nrr->getNS().isPartOf(subdomain) || g_recCache->get(d_now.tv_sec, nrr->getNS(), nsqt,
-                                                                          false, doLog() ? &aset : 0, d_cacheRemote, d_refresh, d_routingTag) > 5)) {
+                                                                          false, doLog() ? &aset : 0, d_cacheRemote, getCacheFlags(), d_routingTag) > 5)) {
             bestns.push_back(dr);
             LOG(prefix<<qname<<": NS (with ip, or non-glue) in cache for '"<<subdomain<<"' -> '"<<nrr->getNS()<<"'"<<endl);
             LOG(prefix<<qname<<": within bailiwick: "<< nrr->getNS().isPartOf(subdomain));
@@ -1408,7 +1578,7 @@ bool SyncRes::doCNAMECacheCheck(const DNSName &qname, const QType qtype, vector<
   QType foundQT = QType::ENT;
 
   /* we don't require auth data for forward-recurse lookups */
-  if (g_recCache->get(d_now.tv_sec, qname, QType::CNAME, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, d_refresh, d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &state, &wasAuth, &authZone) > 0) {
+  if (g_recCache->get(d_now.tv_sec, qname, QType::CNAME, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, getCacheFlags(), d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &state, &wasAuth, &authZone) > 0) {
     foundName = qname;
     foundQT = QType::CNAME;
   }
@@ -1424,7 +1594,7 @@ bool SyncRes::doCNAMECacheCheck(const DNSName &qname, const QType qtype, vector<
       if (dnameName == qname && qtype != QType::DNAME) { // The client does not want a DNAME, but we've reached the QNAME already. So there is no match
         break;
       }
-      if (g_recCache->get(d_now.tv_sec, dnameName, QType::DNAME, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, d_refresh, d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &state, &wasAuth, &authZone) > 0) {
+      if (g_recCache->get(d_now.tv_sec, dnameName, QType::DNAME, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, getCacheFlags(), d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &state, &wasAuth, &authZone) > 0) {
         foundName = dnameName;
         foundQT = QType::DNAME;
         break;
@@ -1812,7 +1982,7 @@ bool SyncRes::doCacheCheck(const DNSName &qname, const DNSName& authname, bool w
   uint32_t capTTL = std::numeric_limits<uint32_t>::max();
   bool wasCachedAuth;
 
-  if(g_recCache->get(d_now.tv_sec, sqname, sqt, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, d_refresh, d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &cachedState, &wasCachedAuth) > 0) {
+  if(g_recCache->get(d_now.tv_sec, sqname, sqt, !wasForwardRecurse && d_requireAuthData, &cset, d_cacheRemote, getCacheFlags(), d_routingTag, d_doDNSSEC ? &signatures : nullptr, d_doDNSSEC ? &authorityRecs : nullptr, &d_wasVariable, &cachedState, &wasCachedAuth) > 0) {
 
     LOG(prefix<<sqname<<": Found cache hit for "<<sqt.getName()<<": ");
 
@@ -1925,6 +2095,17 @@ bool SyncRes::doCacheCheck(const DNSName &qname, const DNSName& authname, bool w
       LOG(prefix<<qname<<": cache had only stale entries"<<endl);
   }
 
+  /* let's see if we have validated NSEC(3) records covering that name (RFC 8198) */
+  if (g_aggressiveNSECCache && !wasForwardedOrAuthZone && !d_refresh) {
+    vector<DNSRecord> synthesized;
+    if (g_aggressiveNSECCache->getDenial(d_now.tv_sec, qname, qtype, synthesized, res, d_cacheRemote, d_routingTag, d_doDNSSEC)) {
+      LOG(prefix<<qname<<": synthesized a "<<RCode::to_s(res)<<" answer for "<<qtype.getName()<<" from the aggressive NSEC cache"<<endl);
+      ret.insert(ret.end(), std::make_move_iterator(synthesized.begin()), std::make_move_iterator(synthesized.end()));
+      state = vState::Secure;
+      return true;
+    }
+  }
+
   return false;
 }
 
@@ -1946,7 +2127,7 @@ inline std::vector<std::pair<DNSName, float>> SyncRes::shuffleInSpeedOrder(NsSet
   std::vector<std::pair<DNSName, float>> rnameservers;
   rnameservers.reserve(tnameservers.size());
   for(const auto& tns: tnameservers) {
-    float speed = t_sstorage.nsSpeeds[tns.first].get(d_now);
+    float speed = getNSSpeedEstimate(tns.first, d_now);
     rnameservers.push_back({tns.first, speed});
     if(tns.first.empty()) // this was an authoritative OOB zone, don't pollute the nsSpeeds with that
       return rnameservers;
@@ -1980,7 +2161,7 @@ inline vector<ComboAddress> SyncRes::shuffleForwardSpeed(const vector<ComboAddre
   for(const auto& val: nameservers) {
     float speed;
     DNSName nsName = DNSName(val.toStringWithPort());
-    speed=t_sstorage.nsSpeeds[nsName].get(d_now);
+    speed=getNSSpeedEstimate(nsName, d_now);
     speeds[val]=speed;
   }
   shuffle(nameservers.begin(),nameservers.end(), pdns::dns_random_engine());
@@ -2281,7 +2462,7 @@ vector<ComboAddress> SyncRes::retrieveAddressesForNS(const std::string& prefix,
 
 
   if (!tns->first.empty()) {
-    if (s_nonresolvingnsmaxfails > 0 && t_sstorage.nonresolving.value(tns->first) >= s_nonresolvingnsmaxfails) {
+    if (s_nonresolvingnsmaxfails > 0 && getNonResolvingCount(tns->first) >= s_nonresolvingnsmaxfails) {
       LOG(prefix<<qname<<": NS "<<tns->first<< " in non-resolving map, skipping"<<endl);
       return result;
     }
@@ -2295,7 +2476,7 @@ vector<ComboAddress> SyncRes::retrieveAddressesForNS(const std::string& prefix,
       if (s_nonresolvingnsmaxfails > 0) {
         auto dontThrottleNames = g_dontThrottleNames.getLocal();
         if (!dontThrottleNames->check(tns->first)) {
-          t_sstorage.nonresolving.incr(tns->first, d_now);
+          incrNonResolving(tns->first, d_now);
         }
       }
       throw ex;
@@ -2303,7 +2484,7 @@ vector<ComboAddress> SyncRes::retrieveAddressesForNS(const std::string& prefix,
     if (s_nonresolvingnsmaxfails > 0 && result.empty()) {
       auto dontThrottleNames = g_dontThrottleNames.getLocal();
       if (!dontThrottleNames->check(tns->first)) {
-        t_sstorage.nonresolving.incr(tns->first, d_now);
+        incrNonResolving(tns->first, d_now);
       }
     }
     pierceDontQuery=false;
@@ -2325,12 +2506,12 @@ vector<ComboAddress> SyncRes::retrieveAddressesForNS(const std::string& prefix,
 
 bool SyncRes::throttledOrBlocked(const std::string& prefix, const ComboAddress& remoteIP, const DNSName& qname, const QType qtype, bool pierceDontQuery)
 {
-  if(t_sstorage.throttle.shouldThrottle(d_now.tv_sec, boost::make_tuple(remoteIP, "", 0))) {
+  if(isThrottled(d_now.tv_sec, remoteIP)) {
     LOG(prefix<<qname<<": server throttled "<<endl);
     s_throttledqueries++; d_throttledqueries++;
     return true;
   }
-  else if(t_sstorage.throttle.shouldThrottle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()))) {
+  else if(isThrottled(d_now.tv_sec, remoteIP, qname, qtype.getCode())) {
     LOG(prefix<<qname<<": query throttled "<<remoteIP.toString()<<", "<<qname<<"; "<<qtype.getName()<<endl);
     s_throttledqueries++; d_throttledqueries++;
     return true;
@@ -3280,6 +3461,19 @@ RCode::rcodes_ SyncRes::updateCacheFromRecords(unsigned int depth, LWResult& lwr
       }
     }
 
+    if (g_aggressiveNSECCache && recordState == vState::Secure && i->first.place == DNSResourceRecord::AUTHORITY && (i->first.type == QType::NSEC || i->first.type == QType::NSEC3) && i->second.records.size() == 1 && !i->second.signatures.empty()) {
+      /* RFC 8198: we keep validated NSEC(3) records around to synthesize negative answers later,
+         as long as they are not the result of a wildcard expansion */
+      const auto& rrsig = i->second.signatures.at(0);
+      const unsigned int labelsCount = i->first.name.countLabels() - (i->first.name.isWildcard() ? 1 : 0);
+      if (i->first.name.isPartOf(rrsig->d_signer) && rrsig->d_labels == labelsCount) {
+        DNSRecord record(i->second.records.at(0));
+        /* this is a TTD already */
+        record.d_ttl = std::min({record.d_ttl, static_cast<uint32_t>(d_now.tv_sec + s_maxnegttl), rrsig->d_sigexpire});
+        g_aggressiveNSECCache->insertNSEC(rrsig->d_signer, record, i->second.signatures, i->first.type == QType::NSEC3);
+      }
+    }
+
     /* We don't need to store NSEC3 records in the positive cache because:
        - we don't allow direct NSEC3 queries
        - denial of existence proofs in wildcard expanded positive responses are stored in authorityRecs
@@ -3651,12 +3845,29 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
     throw ImmediateServFailException("more than "+std::to_string(s_maxqperq)+" (max-qperq) queries sent while resolving "+qname.toLogString());
   }
 
+  /* past the serve-stale deadline, give up on the network if the cache can still answer this query.
+     This is only checked before sending the next query, so the resolution can last up to the deadline
+     plus the time taken by the query in flight when it was reached, at most the network timeout */
+  if (s_serveStaleDeadlineUsec && d_totUsec > s_serveStaleDeadlineUsec && !d_serveStaleQName.empty() && !d_serveStale) {
+    DNSName staleQName;
+    std::swap(staleQName, d_serveStaleQName); // only check once
+    if (g_recCache->get(d_now.tv_sec, staleQName, d_serveStaleQType, false, nullptr, d_cacheRemote, MemRecursorCache::ServeStale, d_routingTag) > 0) {
+      throw ServeStaleDeadlineException("Serve-stale deadline reached for "+staleQName.toLogString()+"|"+d_serveStaleQType.getName()+" after "+std::to_string(d_totUsec/1000)+"msec");
+    }
+  }
+
   if(s_maxtotusec && d_totUsec > s_maxtotusec) {
     throw ImmediateServFailException("Too much time waiting for "+qname.toLogString()+"|"+qtype.getName()+", timeouts: "+std::to_string(d_timeouts) +", throttles: "+std::to_string(d_throttledqueries) + ", queries: "+std::to_string(d_outqueries)+", "+std::to_string(d_totUsec/1000)+"msec");
   }
 
   if(doTCP) {
-    LOG(prefix<<qname<<": using TCP with "<< remoteIP.toStringWithPort() <<endl);
+    if (s_dot_to_port_853 && remoteIP.getPort() == 853) {
+      LOG(prefix<<qname<<": using DoT with "<< remoteIP.toStringWithPort() <<endl);
+      s_dotoutqueries++;
+    }
+    else {
+      LOG(prefix<<qname<<": using TCP with "<< remoteIP.toStringWithPort() <<endl);
+    }
     s_tcpoutqueries++;
     d_tcpoutqueries++;
   }
@@ -3738,21 +3949,21 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
     if (resolveret != LWResult::Result::OSLimitError && !chained && !dontThrottle) {
       // don't account for resource limits, they are our own fault
       // And don't throttle when the IP address is on the dontThrottleNetmasks list or the name is part of dontThrottleNames
-      t_sstorage.nsSpeeds[nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName].submit(remoteIP, 1000000, d_now); // 1 sec
+      submitNSSpeed(nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName, remoteIP, 1000000, d_now); // 1 sec
 
       // code below makes sure we don't filter COM or the root
-      if (s_serverdownmaxfails > 0 && (auth != g_rootdnsname) && t_sstorage.fails.incr(remoteIP, d_now) >= s_serverdownmaxfails) {
+      if (s_serverdownmaxfails > 0 && (auth != g_rootdnsname) && incrServerFailsCount(remoteIP, d_now) >= s_serverdownmaxfails) {
         LOG(prefix<<qname<<": Max fails reached resolving on "<< remoteIP.toString() <<". Going full throttle for "<< s_serverdownthrottletime <<" seconds" <<endl);
         // mark server as down
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, "", 0), s_serverdownthrottletime, 10000);
+        doThrottle(d_now.tv_sec, remoteIP, s_serverdownthrottletime, 10000);
       }
       else if (resolveret == LWResult::Result::Timeout) {
         // unreachable, 1 minute or 100 queries
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 60, 100);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 60, 100);
       }
       else {
         // timeout, 10 seconds or 5 queries
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 10, 5);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 10, 5);
       }
     }
 
@@ -3764,14 +3975,14 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
     if (!chained && !dontThrottle) {
 
       // let's make sure we prefer a different server for some time, if there is one available
-      t_sstorage.nsSpeeds[nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName].submit(remoteIP, 1000000, d_now); // 1 sec
+      submitNSSpeed(nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName, remoteIP, 1000000, d_now); // 1 sec
 
       if (doTCP) {
         // we can be more heavy-handed over TCP
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 60, 10);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 60, 10);
       }
       else {
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 10, 2);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 10, 2);
       }
     }
     return false;
@@ -3785,10 +3996,10 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
           // rather than throttling what could be the only server we have for this destination, let's make sure we try a different one if there is one available
           // on the other hand, we might keep hammering a server under attack if there is no other alternative, or the alternative is overwhelmed as well, but
           // at the very least we will detect that if our packets stop being answered
-          t_sstorage.nsSpeeds[nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName].submit(remoteIP, 1000000, d_now); // 1 sec
+          submitNSSpeed(nsName.empty()? DNSName(remoteIP.toStringWithPort()) : nsName, remoteIP, 1000000, d_now); // 1 sec
         }
         else {
-          t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 60, 3);
+          doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 60, 3);
         }
       }
       return false;
@@ -3797,7 +4008,7 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
 
   /* this server sent a valid answer, mark it backup up if it was down */
   if(s_serverdownmaxfails > 0) {
-    t_sstorage.fails.clear(remoteIP);
+    clearServerFailsCount(remoteIP);
   }
 
   if (lwr.d_tcbit) {
@@ -3807,7 +4018,7 @@ bool SyncRes::doResolveAtThisIP(const std::string& prefix, const DNSName& qname,
       LOG(prefix<<qname<<": truncated bit set, over TCP?"<<endl);
       if (!dontThrottle) {
         /* let's treat that as a ServFail answer from this server */
-        t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(remoteIP, qname, qtype.getCode()), 60, 3);
+        doThrottle(d_now.tv_sec, remoteIP, qname, qtype.getCode(), 60, 3);
       }
       return false;
     }
@@ -4132,9 +4343,11 @@ int SyncRes::doResolveAt(NsSet &nameservers, DNSName auth, bool flawedNSSet, con
 
           bool truncated = false;
           bool spoofed = false;
+          /* DoT servers are only reached over TCP */
+          const bool doDoT = s_dot_to_port_853 && remoteIP->getPort() == 853;
           bool gotAnswer = doResolveAtThisIP(prefix, qname, qtype, lwr, ednsmask, auth, sendRDQuery, wasForwarded,
-                                             tns->first, *remoteIP, false, truncated, spoofed);
-          if (spoofed || (gotAnswer && truncated) ) {
+                                             tns->first, *remoteIP, doDoT, truncated, spoofed);
+          if (!doDoT && (spoofed || (gotAnswer && truncated))) {
             /* retry, over TCP this time */
             gotAnswer = doResolveAtThisIP(prefix, qname, qtype, lwr, ednsmask, auth, sendRDQuery, wasForwarded,
                                           tns->first, *remoteIP, true, truncated, spoofed);
@@ -4152,7 +4365,7 @@ int SyncRes::doResolveAt(NsSet &nameservers, DNSName auth, bool flawedNSSet, con
           */
           //        cout<<"msec: "<<lwr.d_usec/1000.0<<", "<<g_avgLatency/1000.0<<'\n';
 
-          t_sstorage.nsSpeeds[tns->first.empty()? DNSName(remoteIP->toStringWithPort()) : tns->first].submit(*remoteIP, lwr.d_usec, d_now);
+          submitNSSpeed(tns->first.empty()? DNSName(remoteIP->toStringWithPort()) : tns->first, *remoteIP, lwr.d_usec, d_now);
 
           /* we have received an answer, are we done ? */
           bool done = processAnswer(depth, lwr, qname, qtype, auth, wasForwarded, ednsmask, sendRDQuery, nameservers, ret, luaconfsLocal->dfe, &gotNewServers, &rcode, state, *remoteIP);
@@ -4167,7 +4380,7 @@ int SyncRes::doResolveAt(NsSet &nameservers, DNSName auth, bool flawedNSSet, con
             break;
           }
           /* was lame */
-          t_sstorage.throttle.throttle(d_now.tv_sec, boost::make_tuple(*remoteIP, qname, qtype.getCode()), 60, 100);
+          doThrottle(d_now.tv_sec, *remoteIP, qname, qtype.getCode(), 60, 100);
         }
 
         if (gotNewServers) {
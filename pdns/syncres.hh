@@ -29,6 +29,7 @@
 #include <set>
 #include <unordered_set>
 #include <map>
+#include <mutex>
 #include <cmath>
 #include <iostream>
 #include <utility>
@@ -49,9 +50,11 @@
 #include "ednssubnet.hh"
 #include "filterpo.hh"
 #include "negcache.hh"
+#include "aggressive_nsec.hh"
 #include "proxy-protocol.hh"
 #include "sholder.hh"
 #include "histogram.hh"
+#include "tcpiohandler.hh"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -67,6 +70,17 @@ extern GlobalStateHolder<SuffixMatchNode> g_dontThrottleNames;
 extern GlobalStateHolder<NetmaskGroup> g_dontThrottleNetmasks;
 
 class RecursorLua4;
+namespace protozero
+{
+class data_view;
+}
+namespace pdns
+{
+namespace CacheSnapshot
+{
+  class Writer;
+}
+}
 
 typedef std::unordered_map<
   DNSName,
@@ -256,7 +270,60 @@ private:
   cont_t d_cont;
 };
 
+/** A table shared by all the threads, split into shards each protected by its own mutex,
+    so that threads updating entries for different keys rarely have to wait for each other.
+    The lock is only held for the duration of the function passed to apply() or forEach(),
+    which must therefore never yield to another MThread.
+*/
+template<class T>
+class ShardedTable : public boost::noncopyable
+{
+public:
+  ShardedTable(size_t shardsCount = 128) : d_shards(shardsCount)
+  {
+  }
+
+  template<typename F>
+  auto apply(size_t hash, F&& func)
+  {
+    auto& shard = d_shards.at(hash % d_shards.size());
+    std::lock_guard<std::mutex> lock(shard.d_mutex);
+    return func(shard.d_table);
+  }
+
+  template<typename F>
+  void forEach(F&& func)
+  {
+    for (auto& shard : d_shards) {
+      std::lock_guard<std::mutex> lock(shard.d_mutex);
+      func(shard.d_table);
+    }
+  }
+
+  size_t size()
+  {
+    size_t count = 0;
+    forEach([&count](const T& table) { count += table.size(); });
+    return count;
+  }
+
+  void clear()
+  {
+    forEach([](T& table) { table.clear(); });
+  }
+
+private:
+  struct Shard
+  {
+    T d_table;
+    std::mutex d_mutex;
+  };
+
+  std::vector<Shard> d_shards;
+};
+
 extern std::unique_ptr<NegCache> g_negCache;
+extern std::unique_ptr<AggressiveNSECCache> g_aggressiveNSECCache;
 
 class SyncRes : public boost::noncopyable
 {
@@ -403,11 +470,6 @@ public:
   };
 
   struct ThreadLocalStorage {
-    nsspeeds_t nsSpeeds;
-    throttle_t throttle;
-    ednsstatus_t ednsstatus;
-    fails_t<ComboAddress> fails;
-    fails_t<DNSName> nonresolving;
     std::shared_ptr<domainmap_t> domainmap;
   };
 
@@ -417,6 +479,8 @@ public:
   }
   static uint64_t doEDNSDump(int fd);
   static uint64_t doDumpNSSpeeds(int fd);
+  static uint64_t saveNSSpeedsSnapshot(pdns::CacheSnapshot::Writer& writer);
+  static bool loadNSSpeedsSnapshotEntry(const protozero::data_view& message, time_t now);
   static uint64_t doDumpThrottleMap(int fd);
   static uint64_t doDumpFailedServers(int fd);
   static uint64_t doDumpNonResolvingNS(int fd);
@@ -475,94 +539,122 @@ public:
   }
   static void pruneNSSpeeds(time_t limit)
   {
-    for(auto i = t_sstorage.nsSpeeds.begin(), end = t_sstorage.nsSpeeds.end(); i != end; ) {
-      if(i->second.stale(limit)) {
-        i = t_sstorage.nsSpeeds.erase(i);
-      }
-      else {
-        ++i;
+    s_nsSpeeds.forEach([limit](nsspeeds_t& nsSpeeds) {
+      for (auto i = nsSpeeds.begin(), end = nsSpeeds.end(); i != end; ) {
+        if (i->second.stale(limit)) {
+          i = nsSpeeds.erase(i);
+        }
+        else {
+          ++i;
+        }
       }
-    }
+    });
   }
   static uint64_t getNSSpeedsSize()
   {
-    return t_sstorage.nsSpeeds.size();
+    return s_nsSpeeds.size();
   }
   static void submitNSSpeed(const DNSName& server, const ComboAddress& ca, uint32_t usec, const struct timeval& now)
   {
-    t_sstorage.nsSpeeds[server].submit(ca, usec, now);
+    s_nsSpeeds.apply(getShardHash(server), [&](nsspeeds_t& nsSpeeds) { nsSpeeds[server].submit(ca, usec, now); });
   }
   static void clearNSSpeeds()
   {
-    t_sstorage.nsSpeeds.clear();
+    s_nsSpeeds.clear();
   }
   static float getNSSpeed(const DNSName& server, const ComboAddress& ca)
   {
-    return t_sstorage.nsSpeeds[server].d_collection[ca].peek();
+    return s_nsSpeeds.apply(getShardHash(server), [&](nsspeeds_t& nsSpeeds) { return nsSpeeds[server].d_collection[ca].peek(); });
+  }
+  static float getNSSpeedEstimate(const DNSName& server, const struct timeval& now)
+  {
+    return s_nsSpeeds.apply(getShardHash(server), [&](nsspeeds_t& nsSpeeds) { return nsSpeeds[server].get(now); });
   }
   static EDNSStatus::EDNSMode getEDNSStatus(const ComboAddress& server)
   {
-    const auto& it = t_sstorage.ednsstatus.find(server);
-    if (it == t_sstorage.ednsstatus.end())
-      return EDNSStatus::UNKNOWN;
-
-    return it->mode;
+    return s_ednsstatus.apply(getShardHash(server), [&](const ednsstatus_t& ednsstatus) {
+      const auto& it = ednsstatus.find(server);
+      if (it == ednsstatus.end()) {
+        return EDNSStatus::UNKNOWN;
+      }
+      return it->mode;
+    });
   }
   static uint64_t getEDNSStatusesSize()
   {
-    return t_sstorage.ednsstatus.size();
+    return s_ednsstatus.size();
   }
   static void clearEDNSStatuses()
   {
-    t_sstorage.ednsstatus.clear();
+    s_ednsstatus.clear();
   }
   static void pruneEDNSStatuses(time_t cutoff)
   {
-    t_sstorage.ednsstatus.prune(cutoff);
+    s_ednsstatus.forEach([cutoff](ednsstatus_t& ednsstatus) { ednsstatus.prune(cutoff); });
   }
   static uint64_t getThrottledServersSize()
   {
-    return t_sstorage.throttle.size();
+    return s_throttle.size();
   }
   static void pruneThrottledServers()
   {
-    t_sstorage.throttle.prune();
+    s_throttle.forEach([](throttle_t& throttle) { throttle.prune(); });
   }
   static void clearThrottle()
   {
-    t_sstorage.throttle.clear();
+    s_throttle.clear();
   }
   static bool isThrottled(time_t now, const ComboAddress& server, const DNSName& target, uint16_t qtype)
   {
-    return t_sstorage.throttle.shouldThrottle(now, boost::make_tuple(server, target, qtype));
+    return s_throttle.apply(getShardHash(server), [&](throttle_t& throttle) { return throttle.shouldThrottle(now, boost::make_tuple(server, target, qtype)); });
   }
   static bool isThrottled(time_t now, const ComboAddress& server)
   {
-    return t_sstorage.throttle.shouldThrottle(now, boost::make_tuple(server, "", 0));
+    return s_throttle.apply(getShardHash(server), [&](throttle_t& throttle) { return throttle.shouldThrottle(now, boost::make_tuple(server, "", 0)); });
   }
   static void doThrottle(time_t now, const ComboAddress& server, time_t duration, unsigned int tries)
   {
-    t_sstorage.throttle.throttle(now, boost::make_tuple(server, "", 0), duration, tries);
+    s_throttle.apply(getShardHash(server), [&](throttle_t& throttle) { throttle.throttle(now, boost::make_tuple(server, "", 0), duration, tries); });
+  }
+  static void doThrottle(time_t now, const ComboAddress& server, const DNSName& target, uint16_t qtype, time_t duration, unsigned int tries)
+  {
+    s_throttle.apply(getShardHash(server), [&](throttle_t& throttle) { throttle.throttle(now, boost::make_tuple(server, target, qtype), duration, tries); });
   }
   static uint64_t getFailedServersSize()
   {
-    return t_sstorage.fails.size();
+    return s_fails.size();
   }
   static void clearFailedServers()
   {
-    t_sstorage.fails.clear();
+    s_fails.clear();
   }
   static void pruneFailedServers(time_t cutoff)
   {
-    t_sstorage.fails.prune(cutoff);
+    s_fails.forEach([cutoff](fails_t<ComboAddress>& fails) { fails.prune(cutoff); });
   }
   static unsigned long getServerFailsCount(const ComboAddress& server)
   {
-    return t_sstorage.fails.value(server);
+    return s_fails.apply(getShardHash(server), [&](const fails_t<ComboAddress>& fails) { return fails.value(server); });
+  }
+  static unsigned long incrServerFailsCount(const ComboAddress& server, const struct timeval& now)
+  {
+    return s_fails.apply(getShardHash(server), [&](fails_t<ComboAddress>& fails) { return fails.incr(server, now); });
+  }
+  static void clearServerFailsCount(const ComboAddress& server)
+  {
+    s_fails.apply(getShardHash(server), [&](fails_t<ComboAddress>& fails) { fails.clear(server); });
+  }
+  static unsigned long getNonResolvingCount(const DNSName& server)
+  {
+    return s_nonresolving.apply(getShardHash(server), [&](const fails_t<DNSName>& nonresolving) { return nonresolving.value(server); });
+  }
+  static void incrNonResolving(const DNSName& server, const struct timeval& now)
+  {
+    s_nonresolving.apply(getShardHash(server), [&](fails_t<DNSName>& nonresolving) { nonresolving.incr(server, now); });
   }
   static void pruneNonResolving(time_t cutoff)
   {
-    t_sstorage.nonresolving.prune(cutoff);
+    s_nonresolving.forEach([cutoff](fails_t<DNSName>& nonresolving) { nonresolving.prune(cutoff); });
   }
   static void setDomainMap(std::shared_ptr<domainmap_t> newMap)
   {
@@ -626,6 +718,18 @@ public:
     return old;
   }
 
+  MemRecursorCache::Flags getCacheFlags() const
+  {
+    MemRecursorCache::Flags flags = MemRecursorCache::None;
+    if (d_refresh) {
+      flags |= MemRecursorCache::Refresh;
+    }
+    if (d_serveStale) {
+      flags |= MemRecursorCache::ServeStale;
+    }
+    return flags;
+  }
+
   void setQNameMinimization(bool state=true)
   {
     d_qNameMinimization=state;
@@ -732,6 +836,13 @@ public:
 
   static thread_local ThreadLocalStorage t_sstorage;
 
+  /* what we learned about the authoritative servers, shared by all threads */
+  static ShardedTable<nsspeeds_t> s_nsSpeeds;
+  static ShardedTable<throttle_t> s_throttle;
+  static ShardedTable<ednsstatus_t> s_ednsstatus;
+  static ShardedTable<fails_t<ComboAddress>> s_fails;
+  static ShardedTable<fails_t<DNSName>> s_nonresolving;
+
   static std::atomic<uint64_t> s_queries;
   static std::atomic<uint64_t> s_outgoingtimeouts;
   static std::atomic<uint64_t> s_outgoing4timeouts;
@@ -742,6 +853,7 @@ public:
   static std::atomic<uint64_t> s_authzonequeries;
   static std::atomic<uint64_t> s_outqueries;
   static std::atomic<uint64_t> s_tcpoutqueries;
+  static std::atomic<uint64_t> s_dotoutqueries;
   static std::atomic<uint64_t> s_nodelegated;
   static std::atomic<uint64_t> s_unreachables;
   static std::atomic<uint64_t> s_ecsqueries;
@@ -781,8 +893,13 @@ public:
   static bool s_rootNXTrust;
   static bool s_nopacketcache;
   static bool s_qnameminimization;
+  static bool s_dot_to_port_853;
+  /* name expected in the certificate of a DoT server, the certificate of servers not listed is not validated */
+  static std::map<ComboAddress, std::string, ComboAddress::addressOnlyLessThan> s_dot_names;
+  static std::string s_dot_ca_store;
   static HardenNXD s_hardenNXD;
   static unsigned int s_refresh_ttlperc;
+  static unsigned int s_serveStaleDeadlineUsec;
 
   std::unordered_map<std::string,bool> d_discardedPolicies;
   DNSFilterEngine::Policy d_appliedPolicy;
@@ -810,6 +927,16 @@ private:
   static std::unique_ptr<NetmaskGroup> s_dontQuery;
   const static std::unordered_set<QType> s_redirectionQTypes;
 
+  static size_t getShardHash(const ComboAddress& address)
+  {
+    return ComboAddress::addressOnlyHash()(address);
+  }
+
+  static size_t getShardHash(const DNSName& name)
+  {
+    return name.hash();
+  }
+
   struct GetBestNSAnswer
   {
     DNSName qname;
@@ -831,6 +958,7 @@ private:
   bool processAnswer(unsigned int depth, LWResult& lwr, const DNSName& qname, const QType qtype, DNSName& auth, bool wasForwarded, const boost::optional<Netmask> ednsmask, bool sendRDQuery, NsSet &nameservers, std::vector<DNSRecord>& ret, const DNSFilterEngine& dfe, bool* gotNewServers, int* rcode, vState& state, const ComboAddress& remoteIP);
 
   int doResolve(const DNSName &qname, QType qtype, vector<DNSRecord>&ret, unsigned int depth, set<GetBestNSAnswer>& beenthere, vState& state);
+  bool serveStaleFromCache(const DNSName& qname, QType qtype, vector<DNSRecord>& ret, unsigned int depth, vState& state, int& res);
   int doResolveNoQNameMinimization(const DNSName &qname, QType qtype, vector<DNSRecord>&ret, unsigned int depth, set<GetBestNSAnswer>& beenthere, vState& state, bool* fromCache = NULL, StopAtDelegation* stopAtDelegation = NULL, bool considerforwards = true);
   bool doOOBResolve(const AuthDomain& domain, const DNSName &qname, QType qtype, vector<DNSRecord>&ret, int& res);
   bool doOOBResolve(const DNSName &qname, QType qtype, vector<DNSRecord>&ret, unsigned int depth, int &res);
@@ -899,6 +1027,10 @@ private:
   struct timeval d_now;
   string d_prefix;
   vState d_queryValidationState{vState::Indeterminate};
+  /* the query being resolved, set when we might give up after s_serveStaleDeadlineUsec
+     and answer with stale data instead */
+  DNSName d_serveStaleQName;
+  QType d_serveStaleQType;
 
   /* When d_cacheonly is set to true, we will only check the cache.
    * This is set when the RD bit is unset in the incoming query
@@ -916,6 +1048,7 @@ private:
   bool d_queryReceivedOverTCP{false};
   bool d_followCNAME{true};
   bool d_refresh{false};
+  bool d_serveStale{false};
 
   LogMode d_lm;
 };
@@ -924,6 +1057,8 @@ class Socket;
 /* external functions, opaque to us */
 LWResult::Result asendtcp(const string& data, Socket* sock);
 LWResult::Result arecvtcp(string& data, size_t len, Socket* sock, bool incompleteOkay);
+/* wait until the socket becomes readable (NeedRead) or writable (NeedWrite), used for DoT */
+LWResult::Result awaittcp(Socket* sock, IOState state);
 
 struct PacketID
 {
@@ -980,6 +1115,7 @@ struct PacketIDBirthdayCompare: public std::binary_function<PacketID, PacketID,
 };
 extern std::unique_ptr<MemRecursorCache> g_recCache;
 extern thread_local std::unique_ptr<RecursorPacketCache> t_packetCache;
+extern std::unique_ptr<SharedRecursorPacketCache> g_packetCache;
 typedef MTasker<PacketID,string> MT_t;
 MT_t* getMT();
 
@@ -1034,6 +1170,12 @@ struct RecursorStats
   std::atomic<uint64_t> rebalancedQueries{0};
   std::atomic<uint64_t> proxyProtocolInvalidCount{0};
   std::atomic<uint64_t> nodLookupsDroppedOversize{0};
+  std::atomic<uint64_t> tcpOutNewConnections{0};
+  std::atomic<uint64_t> udpBatchReceives{0};
+  std::atomic<uint64_t> udpBatchQueries{0};
+  std::atomic<uint64_t> udpBatchAnswers{0};
+  std::atomic<uint64_t> tcpOutReusedConnections{0};
+  std::atomic<uint64_t> dotResumedSessions{0};
 
   RecursorStats() :
     answers("answers", { 1000, 10000, 100000, 1000000 }),
@@ -1084,6 +1226,18 @@ public:
   string reason; //! Print this to tell the user what went wrong
 };
 
+/* thrown once the serve-stale deadline has been reached and the cache holds stale data for the query,
+   caught by beginResolve() which serves it. This is not an ImmediateServFailException because the
+   servers being queried at that point did not fail, so the handlers accounting their failures should
+   not see it */
+class ServeStaleDeadlineException
+{
+public:
+  ServeStaleDeadlineException(string r) : reason(r) {};
+
+  string reason;
+};
+
 class PolicyHitException
 {
 };
@@ -1124,11 +1278,7 @@ int getFakePTRRecords(const DNSName& qname, vector<DNSRecord>& ret);
 template<class T> T broadcastAccFunction(const boost::function<T*()>& func);
 
 std::shared_ptr<SyncRes::domainmap_t> parseAuthAndForwards();
-uint64_t* pleaseGetNsSpeedsSize();
-uint64_t* pleaseGetFailedServersSize();
-uint64_t* pleaseGetEDNSStatusesSize();
 uint64_t* pleaseGetConcurrentQueries();
-uint64_t* pleaseGetThrottleSize();
 uint64_t* pleaseGetPacketCacheHits();
 uint64_t* pleaseGetPacketCacheSize();
 uint64_t* pleaseWipePacketCache(const DNSName& canon, bool subtree, uint16_t qtype=0xffff);
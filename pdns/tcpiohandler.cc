@@ -9,6 +9,27 @@
 #include <sodium.h>
 #endif /* HAVE_LIBSODIUM */
 
+IOState TLSConnection::tryWriteToKTLSSocket(PacketBuffer& buffer, size_t& pos, size_t toWrite)
+{
+  do {
+    ssize_t res = ::write(d_socket, reinterpret_cast<const char*>(&buffer.at(pos)), toWrite - pos);
+    if (res == 0) {
+      throw std::runtime_error("EOF while writing to TLS connection");
+    }
+    if (res < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return IOState::NeedWrite;
+      }
+      throw std::runtime_error("Error writing to TLS connection: " + stringerror());
+    }
+
+    pos += static_cast<size_t>(res);
+  }
+  while (pos < toWrite);
+
+  return IOState::Done;
+}
+
 #ifdef HAVE_DNS_OVER_TLS
 #ifdef HAVE_LIBSSL
 
@@ -47,6 +68,22 @@ public:
   std::unique_ptr<FILE, int(*)(FILE*)> d_keyLogFile{nullptr, fclose};
 };
 
+class OpenSSLSession : public TLSSession
+{
+public:
+  OpenSSLSession(std::unique_ptr<SSL_SESSION, void(*)(SSL_SESSION*)>&& sess): d_sess(std::move(sess))
+  {
+  }
+
+  SSL_SESSION* getNative()
+  {
+    return d_sess.get();
+  }
+
+private:
+  std::unique_ptr<SSL_SESSION, void(*)(SSL_SESSION*)> d_sess;
+};
+
 class OpenSSLTLSConnection: public TLSConnection
 {
 public:
@@ -209,6 +246,7 @@ public:
   {
     int res = SSL_accept(d_conn.get());
     if (res == 1) {
+      checkKTLS();
       return IOState::Done;
     }
     else if (res < 0) {
@@ -232,10 +270,16 @@ public:
     if (res != 1) {
       throw std::runtime_error("Error accepting TLS connection");
     }
+
+    checkKTLS();
   }
 
   IOState tryWrite(PacketBuffer& buffer, size_t& pos, size_t toWrite) override
   {
+    if (d_ktlsSend) {
+      return tryWriteToKTLSSocket(buffer, pos, toWrite);
+    }
+
     do {
       int res = SSL_write(d_conn.get(), reinterpret_cast<const char *>(&buffer.at(pos)), static_cast<int>(toWrite - pos));
       if (res <= 0) {
@@ -368,9 +412,49 @@ public:
     return false;
   }
 
+  std::unique_ptr<TLSSession> getSession() override
+  {
+    auto sess = std::unique_ptr<SSL_SESSION, void(*)(SSL_SESSION*)>(SSL_get1_session(d_conn.get()), SSL_SESSION_free);
+    if (!sess) {
+      return nullptr;
+    }
+#if (OPENSSL_VERSION_NUMBER >= 0x1010100fL) && !defined(LIBRESSL_VERSION_NUMBER)
+    /* with TLS 1.3 the session ticket is only sent after the handshake */
+    if (SSL_SESSION_is_resumable(sess.get()) != 1) {
+      return nullptr;
+    }
+#endif
+    return std::make_unique<OpenSSLSession>(std::move(sess));
+  }
+
+  void setSession(std::unique_ptr<TLSSession>& session) override
+  {
+    auto sess = dynamic_cast<OpenSSLSession*>(session.get());
+    if (!sess) {
+      throw std::runtime_error("Unable to convert OpenSSL session");
+    }
+
+    /* SSL_set_session() increments the reference count of the session */
+    if (SSL_set_session(d_conn.get(), sess->getNative()) != 1) {
+      throw std::runtime_error("Error setting up session resumption");
+    }
+    session.reset();
+  }
+
   static int s_tlsConnIndex;
 
 private:
+  void checkKTLS()
+  {
+#ifdef BIO_get_ktls_send
+    /* OpenSSL silently falls back to user-space encryption if the kernel does not support
+       kTLS or the negotiated cipher, so we need to check whether it actually happened */
+    if (BIO_get_ktls_send(SSL_get_wbio(d_conn.get()))) {
+      d_ktlsSend = true;
+    }
+#endif /* BIO_get_ktls_send */
+  }
+
   static std::atomic_flag s_initTLSConnIndex;
 
   std::shared_ptr<OpenSSLFrontendContext> d_feContext;
@@ -567,6 +651,9 @@ private:
 #ifdef HAVE_GNUTLS
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
+#if GNUTLS_VERSION_NUMBER >= 0x030703
+#include <gnutls/socket.h>
+#endif /* GNUTLS_VERSION_NUMBER >= 0x030703 */
 
 static void safe_memory_lock(void* data, size_t size)
 {
@@ -657,6 +744,30 @@ private:
   gnutls_datum_t d_key{nullptr, 0};
 };
 
+class GnuTLSSession : public TLSSession
+{
+public:
+  GnuTLSSession(gnutls_datum_t& sess): d_sess(sess)
+  {
+    sess.data = nullptr;
+    sess.size = 0;
+  }
+
+  ~GnuTLSSession() override
+  {
+    gnutls_free(d_sess.data);
+    d_sess.data = nullptr;
+  }
+
+  const gnutls_datum_t& getNative()
+  {
+    return d_sess;
+  }
+
+private:
+  gnutls_datum_t d_sess{nullptr, 0};
+};
+
 class GnuTLSConnection: public TLSConnection
 {
 public:
@@ -824,6 +935,10 @@ public:
       }
     }
     while (ret < 0 && ret == GNUTLS_E_INTERRUPTED);
+
+    if (ret == GNUTLS_E_SUCCESS) {
+      checkKTLS();
+    }
   }
 
   IOState tryHandshake() override
@@ -833,6 +948,7 @@ public:
     do {
       ret = gnutls_handshake(d_conn.get());
       if (ret == GNUTLS_E_SUCCESS) {
+        checkKTLS();
         return IOState::Done;
       }
       else if (ret == GNUTLS_E_AGAIN) {
@@ -848,6 +964,10 @@ public:
 
   IOState tryWrite(PacketBuffer& buffer, size_t& pos, size_t toWrite) override
   {
+    if (d_ktlsSend) {
+      return tryWriteToKTLSSocket(buffer, pos, toWrite);
+    }
+
     do {
       ssize_t res = gnutls_record_send(d_conn.get(), reinterpret_cast<const char *>(&buffer.at(pos)), toWrite - pos);
       if (res == 0) {
@@ -1026,6 +1146,30 @@ public:
     return false;
   }
 
+  std::unique_ptr<TLSSession> getSession() override
+  {
+    gnutls_datum_t sess{nullptr, 0};
+    if (gnutls_session_get_data2(d_conn.get(), &sess) != GNUTLS_E_SUCCESS) {
+      return nullptr;
+    }
+    return std::make_unique<GnuTLSSession>(sess);
+  }
+
+  void setSession(std::unique_ptr<TLSSession>& session) override
+  {
+    auto sess = dynamic_cast<GnuTLSSession*>(session.get());
+    if (!sess) {
+      throw std::runtime_error("Unable to convert GnuTLS session");
+    }
+
+    auto native = sess->getNative();
+    auto ret = gnutls_session_set_data(d_conn.get(), native.data, native.size);
+    if (ret != GNUTLS_E_SUCCESS) {
+      throw std::runtime_error("Error setting up GnuTLS session: " + std::string(gnutls_strerror(ret)));
+    }
+    session.reset();
+  }
+
   void close() override
   {
     if (d_conn) {
@@ -1034,6 +1178,16 @@ public:
   }
 
 private:
+  void checkKTLS()
+  {
+#if GNUTLS_VERSION_NUMBER >= 0x030703
+    /* whether GnuTLS uses kTLS is decided by the system-wide GnuTLS configuration */
+    if (gnutls_transport_is_ktls_enabled(d_conn.get()) & GNUTLS_KTLS_SEND) {
+      d_ktlsSend = true;
+    }
+#endif /* GNUTLS_VERSION_NUMBER >= 0x030703 */
+  }
+
   std::unique_ptr<gnutls_session_int, void(*)(gnutls_session_t)> d_conn;
   std::shared_ptr<GnuTLSTicketsKey> d_ticketsKey;
   std::string d_host;
@@ -8,6 +8,14 @@
 
 enum class IOState { Done, NeedRead, NeedWrite };
 
+/* opaque TLS session state that a client can keep around to resume
+   a session when it opens a new connection to the same server */
+class TLSSession
+{
+public:
+  virtual ~TLSSession() { }
+};
+
 class TLSConnection
 {
 public:
@@ -24,6 +32,10 @@ public:
   virtual std::string getServerNameIndication() const = 0;
   virtual LibsslTLSVersion getTLSVersion() const = 0;
   virtual bool hasSessionBeenResumed() const = 0;
+  /* client-side only: get the current session so that it can be resumed later,
+     or set a session to resume before connecting */
+  virtual std::unique_ptr<TLSSession> getSession() = 0;
+  virtual void setSession(std::unique_ptr<TLSSession>& session) = 0;
   virtual void close() = 0;
 
   void setUnknownTicketKey()
@@ -46,10 +58,21 @@ public:
     return d_resumedFromInactiveTicketKey;
   }
 
+  /* whether the encryption of outgoing records has been offloaded to the kernel (kTLS) */
+  bool isKTLSEnabled() const
+  {
+    return d_ktlsSend;
+  }
+
 protected:
+  /* once the kernel handles the encryption we can write to the socket directly,
+     bypassing the TLS library */
+  IOState tryWriteToKTLSSocket(PacketBuffer& buffer, size_t& pos, size_t toWrite);
+
   int d_socket{-1};
   bool d_unknownTicketKey{false};
   bool d_resumedFromInactiveTicketKey{false};
+  bool d_ktlsSend{false};
 };
 
 class TLSCtx
@@ -362,6 +385,26 @@ public:
     return d_conn && d_conn->hasSessionBeenResumed();
   }
 
+  std::unique_ptr<TLSSession> getTLSSession()
+  {
+    if (d_conn) {
+      return d_conn->getSession();
+    }
+    return nullptr;
+  }
+
+  void setTLSSession(std::unique_ptr<TLSSession>& session)
+  {
+    if (d_conn) {
+      d_conn->setSession(session);
+    }
+  }
+
+  bool isKTLSEnabled() const
+  {
+    return d_conn && d_conn->isKTLSEnabled();
+  }
+
   bool getResumedFromInactiveTicketKey() const
   {
     return d_conn && d_conn->getResumedFromInactiveTicketKey();
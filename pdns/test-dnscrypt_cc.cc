@@ -293,6 +293,53 @@ BOOST_AUTO_TEST_CASE(DNSCryptEncryptedQueryInvalidWithWrongKey) {
   BOOST_CHECK_EQUAL(query->isValid(), false);
 }
 
+#ifdef HAVE_CRYPTO_BOX_EASY_AFTERNM
+// two encrypted queries from the same client, the second one should reuse the cached shared key
+BOOST_AUTO_TEST_CASE(DNSCryptEncryptedQueriesSharedKeyCache) {
+  DNSCryptPrivateKey resolverPrivateKey;
+  DNSCryptCert resolverCert;
+  unsigned char providerPublicKey[DNSCRYPT_PROVIDER_PUBLIC_KEY_SIZE];
+  unsigned char providerPrivateKey[DNSCRYPT_PROVIDER_PRIVATE_KEY_SIZE];
+  time_t now = time(nullptr);
+  DNSCryptContext::generateProviderKeys(providerPublicKey, providerPrivateKey);
+  DNSCryptContext::generateCertificate(1, now, now + (24 * 60 * 3600), DNSCryptExchangeVersion::VERSION1, providerPrivateKey, resolverPrivateKey, resolverCert);
+  auto ctx = std::make_shared<DNSCryptContext>("2.name", resolverCert, resolverPrivateKey);
+
+  DNSCryptPrivateKey clientPrivateKey;
+  unsigned char clientPublicKey[DNSCRYPT_PUBLIC_KEY_SIZE];
+
+  DNSCryptContext::generateResolverKeyPair(clientPrivateKey, clientPublicKey);
+
+  unsigned char clientNonce[DNSCRYPT_NONCE_SIZE / 2] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x08, 0x09, 0x0A, 0x0B };
+
+  DNSName name("www.powerdns.com.");
+  const auto hitsBefore = DNSCryptSharedKeyCache::s_hits.load();
+  const auto missesBefore = DNSCryptSharedKeyCache::s_misses.load();
+
+  for (size_t idx = 0; idx < 2; idx++) {
+    PacketBuffer plainQuery;
+    GenericDNSPacketWriter<PacketBuffer> pw(plainQuery, name, QType::AAAA, QClass::IN, 0);
+    pw.getHeader()->rd = 1;
+
+    int res = ctx->encryptQuery(plainQuery, 4096, clientPublicKey, clientPrivateKey, clientNonce, false, std::make_shared<DNSCryptCert>(resolverCert));
+    BOOST_CHECK_EQUAL(res, 0);
+
+    std::shared_ptr<DNSCryptQuery> query = std::make_shared<DNSCryptQuery>(ctx);
+    query->parsePacket(plainQuery, false, now);
+
+    BOOST_CHECK_EQUAL(query->isValid(), true);
+    BOOST_CHECK_EQUAL(query->isEncrypted(), true);
+
+    MOADNSParser mdp(true, (char*) plainQuery.data(), plainQuery.size());
+    BOOST_CHECK_EQUAL(mdp.d_qname, name);
+    BOOST_CHECK(mdp.d_qtype == QType::AAAA);
+  }
+
+  BOOST_CHECK_EQUAL(DNSCryptSharedKeyCache::s_misses.load(), missesBefore + 1);
+  BOOST_CHECK_EQUAL(DNSCryptSharedKeyCache::s_hits.load(), hitsBefore + 1);
+}
+#endif /* HAVE_CRYPTO_BOX_EASY_AFTERNM */
+
 #endif
 
 BOOST_AUTO_TEST_SUITE_END();
@@ -2020,4 +2020,175 @@ BOOST_AUTO_TEST_CASE(getEDNSOptionsWithoutEDNS) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_PassiveHealthCheckWindow) {
+  PassiveHealthCheckWindow window;
+  BOOST_CHECK_EQUAL(window.getSize(), 0U);
+  window.setSize(10);
+  BOOST_CHECK_EQUAL(window.getSize(), 10U);
+
+  uint64_t failures = 0;
+  uint64_t samples = 0;
+  for (size_t idx = 0; idx < 5; idx++) {
+    window.submit(false, failures, samples);
+  }
+  BOOST_CHECK_EQUAL(failures, 0U);
+  BOOST_CHECK_EQUAL(samples, 5U);
+
+  for (size_t idx = 0; idx < 5; idx++) {
+    window.submit(true, failures, samples);
+  }
+  BOOST_CHECK_EQUAL(failures, 5U);
+  BOOST_CHECK_EQUAL(samples, 10U);
+
+  /* the window is full, older outcomes (successes) are now replaced */
+  for (size_t idx = 0; idx < 3; idx++) {
+    window.submit(true, failures, samples);
+  }
+  BOOST_CHECK_EQUAL(failures, 8U);
+  BOOST_CHECK_EQUAL(samples, 10U);
+
+  /* and now failures get replaced by successes */
+  for (size_t idx = 0; idx < 10; idx++) {
+    window.submit(false, failures, samples);
+  }
+  BOOST_CHECK_EQUAL(failures, 0U);
+  BOOST_CHECK_EQUAL(samples, 10U);
+
+  window.submit(true, failures, samples);
+  BOOST_CHECK_EQUAL(failures, 1U);
+  window.reset();
+  window.submit(false, failures, samples);
+  BOOST_CHECK_EQUAL(failures, 0U);
+  BOOST_CHECK_EQUAL(samples, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_LatencyHistogram) {
+  /* exact values below 2^s_subBucketsBits */
+  for (uint64_t value = 0; value < LatencyHistogram::s_subBuckets; value++) {
+    BOOST_CHECK_EQUAL(LatencyHistogram::getBucketUpperBound(LatencyHistogram::getBucketIndex(value)), value);
+  }
+
+  /* then every value should be lower than or equal to the upper bound of its bucket, within the relative error */
+  for (uint64_t value = LatencyHistogram::s_subBuckets; value < (1ULL << LatencyHistogram::s_maxExponent); value += value / 7) {
+    auto idx = LatencyHistogram::getBucketIndex(value);
+    BOOST_REQUIRE_LT(idx, LatencyHistogram::s_bucketsCount);
+    auto upperBound = LatencyHistogram::getBucketUpperBound(idx);
+    BOOST_CHECK_GE(upperBound, value);
+    BOOST_CHECK_LE(upperBound - value, value / LatencyHistogram::s_subBuckets);
+    BOOST_CHECK_LT(LatencyHistogram::getBucketUpperBound(idx - 1), value);
+  }
+
+  /* and very large values end up in the last bucket */
+  BOOST_CHECK_EQUAL(LatencyHistogram::getBucketIndex(std::numeric_limits<uint64_t>::max()), LatencyHistogram::s_bucketsCount - 1);
+
+  LatencyHistogram first;
+  LatencyHistogram second;
+  HistogramSnapshot empty;
+  empty.add(first);
+  BOOST_CHECK_EQUAL(empty.getCount(), 0U);
+  BOOST_CHECK_EQUAL(empty.getPercentile(99), 0U);
+
+  /* 1000 responses from 10us to 10ms in the first one, 10 very slow ones in the second one */
+  for (uint64_t idx = 1; idx <= 1000; idx++) {
+    first.record(idx * 10);
+  }
+  for (uint64_t idx = 0; idx < 10; idx++) {
+    second.record(1000000);
+  }
+
+  HistogramSnapshot snapshot;
+  snapshot.add(first);
+  BOOST_CHECK_EQUAL(snapshot.getCount(), 1000U);
+  BOOST_CHECK_EQUAL(snapshot.getSum(), 5005000U);
+  BOOST_CHECK_GE(snapshot.getPercentile(50), 5000U);
+  BOOST_CHECK_LE(snapshot.getPercentile(50), 5000U + 5000U / LatencyHistogram::s_subBuckets);
+  BOOST_CHECK_GE(snapshot.getPercentile(99), 9900U);
+  BOOST_CHECK_LE(snapshot.getPercentile(99), 9900U + 9900U / LatencyHistogram::s_subBuckets);
+  /* 10 to 1020 */
+  BOOST_CHECK_EQUAL(snapshot.getCountUpTo(1023), 102U);
+
+  snapshot.add(second);
+  BOOST_CHECK_EQUAL(snapshot.getCount(), 1010U);
+  BOOST_CHECK_GE(snapshot.getPercentile(99.9), 1000000U);
+  BOOST_CHECK_LE(snapshot.getPercentile(99.9), 1000000U + 1000000U / LatencyHistogram::s_subBuckets);
+
+  /* until the first rotation the recent window covers everything */
+  HistogramSnapshot recent;
+  recent.addRecent(second);
+  BOOST_CHECK_EQUAL(recent.getCount(), 10U);
+
+  /* the slow responses are still in the window after one rotation, but not after two */
+  second.rotate();
+  second.record(127);
+  HistogramSnapshot afterOne;
+  afterOne.addRecent(second);
+  BOOST_CHECK_EQUAL(afterOne.getCount(), 11U);
+
+  second.rotate();
+  HistogramSnapshot afterTwo;
+  afterTwo.addRecent(second);
+  BOOST_CHECK_EQUAL(afterTwo.getCount(), 1U);
+  BOOST_CHECK_EQUAL(afterTwo.getSum(), 127U);
+  BOOST_CHECK_EQUAL(afterTwo.getPercentile(99), 127U);
+
+  /* the cumulative counters are not affected */
+  HistogramSnapshot cumulative;
+  cumulative.add(second);
+  BOOST_CHECK_EQUAL(cumulative.getCount(), 11U);
+}
+
+BOOST_AUTO_TEST_CASE(test_PacketBufferPool) {
+  BOOST_CHECK_EQUAL(PacketBufferPool::getClassForSize(1), 0U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::getClassForSize(512), 0U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::getClassForSize(513), 1U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::getClassForSize(65536), 7U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::getClassForSize(65537), PacketBufferPool::s_classesCount);
+  BOOST_CHECK_EQUAL(PacketBufferPool::getClassForCapacity(512), 0U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::getClassForCapacity(1023), 0U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::getClassForCapacity(1024), 1U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::getClassForCapacity(1000000), 7U);
+
+  PacketBufferPool pool;
+  const auto hits = PacketBufferPool::s_hits.load();
+  const auto misses = PacketBufferPool::s_misses.load();
+
+  auto buffer = pool.acquire(1500);
+  BOOST_CHECK(buffer.empty());
+  BOOST_CHECK_GE(buffer.capacity(), 2048U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::s_misses.load(), misses + 1);
+  buffer.resize(1500);
+  const auto capacity = buffer.capacity();
+  const auto data = buffer.data();
+
+  pool.release(std::move(buffer));
+  BOOST_CHECK_EQUAL(pool.getBuffersCount(), 1U);
+
+  /* a larger class can't be served by that buffer */
+  auto larger = pool.acquire(4096);
+  BOOST_CHECK_EQUAL(pool.getBuffersCount(), 1U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::s_misses.load(), misses + 2);
+
+  /* but the same one can */
+  auto reused = pool.acquire(2000);
+  BOOST_CHECK_EQUAL(pool.getBuffersCount(), 0U);
+  BOOST_CHECK_EQUAL(PacketBufferPool::s_hits.load(), hits + 1);
+  BOOST_CHECK(reused.empty());
+  BOOST_CHECK_EQUAL(reused.capacity(), capacity);
+  BOOST_CHECK(reused.data() == data);
+
+  /* buffers too small to be useful are not kept */
+  PacketBuffer tiny;
+  tiny.reserve(100);
+  pool.release(std::move(tiny));
+  BOOST_CHECK_EQUAL(pool.getBuffersCount(), 0U);
+
+  /* and the pool does not grow without bound */
+  for (size_t idx = 0; idx < PacketBufferPool::s_maxBuffersPerClass + 10; idx++) {
+    PacketBuffer tmp;
+    tmp.reserve(512);
+    pool.release(std::move(tmp));
+  }
+  BOOST_CHECK_EQUAL(pool.getBuffersCount(), PacketBufferPool::s_maxBuffersPerClass);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -553,4 +553,263 @@ BOOST_AUTO_TEST_CASE(test_PCDNSSECCollision) {
 
 }
 
+BOOST_AUTO_TEST_CASE(test_PacketCacheGetFromWire) {
+  const size_t maxEntries = 150000;
+  DNSDistPacketCache PC(maxEntries, 86400, 1);
+  struct timespec queryTime;
+  gettime(&queryTime);  // does not have to be accurate ("realTime") in tests
+
+  ComboAddress remote;
+  bool dnssecOK = false;
+  const DNSName name("www.powerdns.com.");
+  const DNSName mixedCaseName("WWW.PowerDNS.com.");
+
+  PacketBuffer query;
+  GenericDNSPacketWriter<PacketBuffer> pwQ(query, name, QType::A, QClass::IN, 0);
+  pwQ.getHeader()->rd = 1;
+
+  PacketBuffer response;
+  GenericDNSPacketWriter<PacketBuffer> pwR(response, name, QType::A, QClass::IN, 0);
+  pwR.getHeader()->rd = 1;
+  pwR.getHeader()->ra = 1;
+  pwR.getHeader()->qr = 1;
+  pwR.getHeader()->id = pwQ.getHeader()->id;
+  pwR.startRecord(name, QType::A, 7200, QClass::IN, DNSResourceRecord::ANSWER);
+  pwR.xfr32BitInt(0x01020304);
+  pwR.commit();
+
+  uint32_t key = 0;
+  boost::optional<Netmask> subnet;
+  DNSQuestion dq(&name, QType::A, QClass::IN, &remote, &remote, query, false, &queryTime);
+  BOOST_CHECK_EQUAL(PC.get(dq, 0, &key, subnet, dnssecOK), false);
+  PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, name, QType::A, QClass::IN, response, false, 0, boost::none);
+  BOOST_CHECK_EQUAL(PC.getMisses(), 1U);
+
+  {
+    /* same name with a different case, the case of the query should be preserved in the response */
+    PacketBuffer wireQuery;
+    GenericDNSPacketWriter<PacketBuffer> pw(wireQuery, mixedCaseName, QType::A, QClass::IN, 0);
+    pw.getHeader()->rd = 1;
+    pw.getHeader()->id = htons(4242);
+    pw.commit();
+
+    BOOST_CHECK_EQUAL(PC.getFromWire(wireQuery, false), true);
+    BOOST_CHECK_EQUAL(PC.getHits(), 1U);
+    BOOST_REQUIRE_EQUAL(wireQuery.size(), response.size());
+    const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(wireQuery.data());
+    BOOST_CHECK_EQUAL(dh->id, htons(4242));
+    BOOST_CHECK(dh->qr);
+    BOOST_CHECK_EQUAL(ntohs(dh->ancount), 1U);
+    const auto mixedCaseStorage = mixedCaseName.getStorage();
+    BOOST_CHECK_EQUAL(memcmp(&wireQuery.at(sizeof(dnsheader)), mixedCaseStorage.data(), mixedCaseStorage.size()), 0);
+    BOOST_CHECK_EQUAL(memcmp(&wireQuery.at(sizeof(dnsheader) + mixedCaseStorage.size()), &response.at(sizeof(dnsheader) + mixedCaseStorage.size()), response.size() - sizeof(dnsheader) - mixedCaseStorage.size()), 0);
+  }
+
+  {
+    /* different qtype, not in the cache, and the miss is not accounted for */
+    PacketBuffer wireQuery;
+    GenericDNSPacketWriter<PacketBuffer> pw(wireQuery, name, QType::AAAA, QClass::IN, 0);
+    pw.getHeader()->rd = 1;
+    pw.commit();
+    const auto original = wireQuery;
+
+    BOOST_CHECK_EQUAL(PC.getFromWire(wireQuery, false), false);
+    BOOST_CHECK(wireQuery == original);
+    BOOST_CHECK_EQUAL(PC.getMisses(), 1U);
+    BOOST_CHECK_EQUAL(PC.getHits(), 1U);
+  }
+
+  {
+    /* over TCP */
+    PacketBuffer wireQuery = query;
+    BOOST_CHECK_EQUAL(PC.getFromWire(wireQuery, true), false);
+  }
+
+  {
+    /* invalid qname: label too long */
+    PacketBuffer wireQuery = query;
+    wireQuery.at(sizeof(dnsheader)) = 64;
+    const auto original = wireQuery;
+    BOOST_CHECK_EQUAL(PC.getFromWire(wireQuery, false), false);
+    BOOST_CHECK(wireQuery == original);
+  }
+
+  {
+    /* truncated before the end of the qname */
+    PacketBuffer wireQuery = query;
+    wireQuery.resize(sizeof(dnsheader) + 4);
+    BOOST_CHECK_EQUAL(PC.getFromWire(wireQuery, false), false);
+  }
+
+  {
+    /* two questions */
+    PacketBuffer wireQuery = query;
+    reinterpret_cast<struct dnsheader*>(wireQuery.data())->qdcount = htons(2);
+    BOOST_CHECK_EQUAL(PC.getFromWire(wireQuery, false), false);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_PacketCacheMemoryBudget) {
+  const size_t maxEntries = 1000;
+  const size_t maxBytes = 2000;
+  DNSDistPacketCache PC(maxEntries, 86400, 1);
+  PC.setMaxBytes(maxBytes);
+  BOOST_CHECK_EQUAL(PC.getMaxBytes(), maxBytes);
+  struct timespec queryTime;
+  gettime(&queryTime);  // does not have to be accurate ("realTime") in tests
+
+  ComboAddress remote;
+  bool dnssecOK = false;
+  size_t expectedBytes = 0;
+
+  auto insertOrLookup = [&](const DNSName& name, bool insert) {
+    PacketBuffer query;
+    GenericDNSPacketWriter<PacketBuffer> pwQ(query, name, QType::A, QClass::IN, 0);
+    pwQ.getHeader()->rd = 1;
+
+    uint32_t key = 0;
+    boost::optional<Netmask> subnet;
+    DNSQuestion dq(&name, QType::A, QClass::IN, &remote, &remote, query, false, &queryTime);
+    bool found = PC.get(dq, 0, &key, subnet, dnssecOK);
+    if (found || !insert) {
+      return found;
+    }
+
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pwR(response, name, QType::A, QClass::IN, 0);
+    pwR.getHeader()->rd = 1;
+    pwR.getHeader()->ra = 1;
+    pwR.getHeader()->qr = 1;
+    pwR.getHeader()->id = pwQ.getHeader()->id;
+    pwR.startRecord(name, QType::A, 7200, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfr32BitInt(0x01020304);
+    pwR.commit();
+
+    PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, name, QType::A, QClass::IN, response, false, 0, boost::none);
+    expectedBytes = response.size() + name.wirelength();
+    return false;
+  };
+
+  const DNSName hot("hot.powerdns.com.");
+  insertOrLookup(hot, true);
+  BOOST_CHECK_EQUAL(PC.getBytes(), expectedBytes);
+  BOOST_CHECK(insertOrLookup(hot, false));
+
+  for (size_t counter = 0; counter < 100; ++counter) {
+    insertOrLookup(DNSName(std::to_string(counter)) + DNSName("cold.powerdns.com."), true);
+    /* the hot entry is hit after every insertion, so it should never be evicted */
+    BOOST_CHECK(insertOrLookup(hot, false));
+    BOOST_CHECK_LE(PC.getBytes(), maxBytes);
+  }
+
+  BOOST_CHECK_GT(PC.getSpaceEvictions(), 0U);
+  BOOST_CHECK_EQUAL(PC.getSize() + PC.getSpaceEvictions(), 101U);
+
+  /* an entry larger than the whole budget is never inserted */
+  const DNSName large("large.powerdns.com.");
+  {
+    PacketBuffer query;
+    GenericDNSPacketWriter<PacketBuffer> pwQ(query, large, QType::TXT, QClass::IN, 0);
+    uint32_t key = 0;
+    boost::optional<Netmask> subnet;
+    DNSQuestion dq(&large, QType::TXT, QClass::IN, &remote, &remote, query, false, &queryTime);
+    BOOST_CHECK_EQUAL(PC.get(dq, 0, &key, subnet, dnssecOK), false);
+
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pwR(response, large, QType::TXT, QClass::IN, 0);
+    pwR.getHeader()->qr = 1;
+    pwR.startRecord(large, QType::TXT, 7200, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfrText("\"" + std::string(200, 'a') + "\" \"" + std::string(200, 'b') + "\"");
+    pwR.commit();
+    for (size_t idx = 0; idx < 10; idx++) {
+      pwR.startRecord(large, QType::TXT, 7200, QClass::IN, DNSResourceRecord::ANSWER);
+      pwR.xfrText("\"" + std::string(200, 'c') + "\"");
+      pwR.commit();
+    }
+    BOOST_REQUIRE_GT(response.size(), maxBytes);
+
+    const auto bytesBefore = PC.getBytes();
+    PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, large, QType::TXT, QClass::IN, response, false, 0, boost::none);
+    BOOST_CHECK_EQUAL(PC.get(dq, 0, &key, subnet, dnssecOK), false);
+    BOOST_CHECK_EQUAL(PC.getBytes(), bytesBefore);
+  }
+
+  /* expunging and purging keep the accounting in sync */
+  auto removed = PC.expungeByName(hot);
+  BOOST_CHECK_EQUAL(removed, 1U);
+  BOOST_CHECK_EQUAL(PC.getExpungedEntries(), 1U);
+  PC.expunge(0);
+  BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+  BOOST_CHECK_EQUAL(PC.getBytes(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_PacketCacheLocalCache) {
+  const size_t maxEntries = 1000;
+  DNSDistPacketCache PC(maxEntries, 86400, 1);
+  PC.setLocalCache(1000, 60);
+  /* rounded up to the next power of two */
+  BOOST_CHECK_EQUAL(PC.getLocalCacheSize(), 1024U);
+  struct timespec queryTime;
+  gettime(&queryTime);  // does not have to be accurate ("realTime") in tests
+
+  ComboAddress remote;
+  bool dnssecOK = false;
+  const DNSName name("hot.powerdns.com.");
+
+  PacketBuffer query;
+  GenericDNSPacketWriter<PacketBuffer> pwQ(query, name, QType::A, QClass::IN, 0);
+  pwQ.getHeader()->rd = 1;
+
+  PacketBuffer response;
+  GenericDNSPacketWriter<PacketBuffer> pwR(response, name, QType::A, QClass::IN, 0);
+  pwR.getHeader()->rd = 1;
+  pwR.getHeader()->ra = 1;
+  pwR.getHeader()->qr = 1;
+  pwR.getHeader()->id = pwQ.getHeader()->id;
+  pwR.startRecord(name, QType::A, 7200, QClass::IN, DNSResourceRecord::ANSWER);
+  pwR.xfr32BitInt(0x01020304);
+  pwR.commit();
+
+  auto lookup = [&]() {
+    PacketBuffer copy(query);
+    uint32_t key = 0;
+    boost::optional<Netmask> subnet;
+    DNSQuestion dq(&name, QType::A, QClass::IN, &remote, &remote, copy, false, &queryTime);
+    bool found = PC.get(dq, pwR.getHeader()->id, &key, subnet, dnssecOK, 0, true);
+    if (found) {
+      BOOST_CHECK_EQUAL(dq.getData().size(), response.size());
+      BOOST_CHECK_EQUAL(memcmp(dq.getData().data(), response.data(), response.size()), 0);
+    }
+    return found;
+  };
+
+  {
+    uint32_t key = 0;
+    boost::optional<Netmask> subnet;
+    DNSQuestion dq(&name, QType::A, QClass::IN, &remote, &remote, query, false, &queryTime);
+    BOOST_CHECK_EQUAL(PC.get(dq, 0, &key, subnet, dnssecOK), false);
+    PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, name, QType::A, QClass::IN, response, false, 0, boost::none);
+  }
+
+  /* the first hit comes from the shared cache, and populates the local one */
+  BOOST_CHECK(lookup());
+  BOOST_CHECK_EQUAL(PC.getHits(), 1U);
+  BOOST_CHECK_EQUAL(PC.getLocalHits(), 0U);
+
+  for (size_t idx = 0; idx < 3; idx++) {
+    BOOST_CHECK(lookup());
+  }
+
+  /* local hits are only accounted once per second */
+  sleep(1);
+  BOOST_CHECK(lookup());
+  BOOST_CHECK_EQUAL(PC.getHits(), 4U);
+  BOOST_CHECK_EQUAL(PC.getLocalHits(), 3U);
+
+  /* removing the entry from the shared cache invalidates the local copies */
+  BOOST_CHECK_EQUAL(PC.expungeByName(name), 1U);
+  BOOST_CHECK_EQUAL(lookup(), false);
+  BOOST_CHECK_EQUAL(PC.getMisses(), 2U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 #include "dns_random.hh"
 #include "iputils.hh"
 #include "recpacketcache.hh"
+#include <thread>
 #include <utility>
 
 
@@ -393,4 +394,87 @@ BOOST_AUTO_TEST_CASE(test_recPacketCache_TCP) {
   BOOST_CHECK_EQUAL(fpacket, r1packet);
 }
 
+BOOST_AUTO_TEST_CASE(test_sharedRecPacketCache) {
+  SharedRecursorPacketCache rpc(16);
+  string fpacket;
+  unsigned int tag = 0;
+  uint32_t age = 0;
+  uint32_t qhash = 0;
+  uint32_t ttd = 3600;
+  vState valState;
+  BOOST_CHECK_EQUAL(rpc.size(), 0U);
+
+  ::arg().set("rng") = "auto";
+  ::arg().set("entropy-source") = "/dev/urandom";
+
+  const size_t namesCount = 100;
+  std::vector<std::pair<std::string, std::string>> queriesAndResponses;
+  for (size_t idx = 0; idx < namesCount; idx++) {
+    DNSName qname(std::to_string(idx) + ".powerdns.com");
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, qname, QType::A);
+    pw.getHeader()->rd = true;
+    pw.getHeader()->qr = false;
+    pw.getHeader()->id = dns_random_uint16();
+    string qpacket((const char*)&packet[0], packet.size());
+    pw.startRecord(qname, QType::A, ttd);
+
+    BOOST_CHECK_EQUAL(rpc.getResponsePacket(tag, qpacket, qname, QType::A, QClass::IN, time(nullptr), &fpacket, &age, &valState, &qhash, nullptr, false), false);
+
+    ARecordContent ar("127.0.0.1");
+    ar.toPacket(pw);
+    pw.commit();
+    string rpacket((const char*)&packet[0], packet.size());
+
+    rpc.insertResponsePacket(tag, qhash, string(qpacket), qname, QType::A, QClass::IN, string(rpacket), time(nullptr), ttd, vState::Indeterminate, boost::none, false);
+    queriesAndResponses.push_back({qpacket, rpacket});
+  }
+  BOOST_CHECK_EQUAL(rpc.size(), namesCount);
+  BOOST_CHECK_EQUAL(rpc.getMisses(), namesCount);
+  BOOST_CHECK_GT(rpc.bytes(), 0U);
+
+  /* every thread can read what the others inserted */
+  std::vector<std::thread> threads;
+  std::atomic<uint64_t> found{0};
+  for (size_t idx = 0; idx < 4; idx++) {
+    threads.emplace_back([&rpc, &queriesAndResponses, &found, tag]() {
+      for (const auto& entry : queriesAndResponses) {
+        string response;
+        DNSName qname;
+        uint16_t qtype, qclass;
+        uint32_t entryAge, entryHash;
+        vState state;
+        if (rpc.getResponsePacket(tag, entry.first, qname, &qtype, &qclass, time(nullptr), &response, &entryAge, &state, &entryHash, nullptr, false) && response == entry.second) {
+          ++found;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  BOOST_CHECK_EQUAL(found.load(), 4 * namesCount);
+  BOOST_CHECK_EQUAL(rpc.getHits(), 4 * namesCount);
+  BOOST_CHECK_GE(rpc.stats().second, rpc.getHits() + rpc.getMisses());
+
+  BOOST_CHECK_EQUAL(rpc.doWipePacketCache(DNSName("1.powerdns.com")), 1U);
+  BOOST_CHECK_EQUAL(rpc.size(), namesCount - 1);
+  BOOST_CHECK_EQUAL(rpc.doWipePacketCache(DNSName("powerdns.com"), 0xffff, true), namesCount - 1);
+  BOOST_CHECK_EQUAL(rpc.size(), 0U);
+
+  for (const auto& entry : queriesAndResponses) {
+    DNSName qname;
+    uint16_t qtype, qclass;
+    BOOST_CHECK_EQUAL(rpc.getResponsePacket(tag, entry.first, qname, &qtype, &qclass, time(nullptr), &fpacket, &age, &valState, &qhash, nullptr, false), false);
+    rpc.insertResponsePacket(tag, qhash, string(entry.first), qname, qtype, qclass, string(entry.second), time(nullptr), ttd, vState::Indeterminate, boost::none, false);
+  }
+  BOOST_CHECK_EQUAL(rpc.size(), namesCount);
+  /* fewer entries than shards, every shard keeps at most one */
+  rpc.doPruneTo(8);
+  BOOST_CHECK_GT(rpc.size(), 0U);
+  BOOST_CHECK_LE(rpc.size(), 16U);
+  rpc.doPruneTo(0);
+  BOOST_CHECK_EQUAL(rpc.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
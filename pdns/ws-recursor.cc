@@ -392,6 +392,9 @@ static void apiServerCacheFlush(HttpRequest* req, HttpResponse* resp) {
   int count = g_recCache->doWipeCache(canon, subtree, qtype);
   count += broadcastAccFunction<uint64_t>([=]{return pleaseWipePacketCache(canon, subtree, qtype);});
   count += g_negCache->wipe(canon, subtree);
+  if (g_aggressiveNSECCache) {
+    g_aggressiveNSECCache->removeZoneInfo(canon, subtree);
+  }
   resp->setJsonBody(Json::object {
     { "count", count },
     { "result", "Flushed cache." }
@@ -508,6 +511,22 @@ static void serveStuff(HttpRequest* req, HttpResponse* resp)
 }
 
 const std::map<std::string, MetricDefinition> MetricDefinitionStorage::metrics = {
+  {"aggressive-nsec-cache-entries",
+   MetricDefinition(PrometheusMetricType::gauge,
+                    "Number of entries in the aggressive NSEC cache")},
+  {"aggressive-nsec-cache-nsec-hits",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of negative answers synthesized from the NSEC entries of the aggressive NSEC cache")},
+  {"aggressive-nsec-cache-nsec3-hits",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of negative answers synthesized from the NSEC3 entries of the aggressive NSEC cache")},
+  {"aggressive-nsec-cache-nsec-wc-hits",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of answers synthesized from a wildcard and the NSEC entries of the aggressive NSEC cache")},
+  {"aggressive-nsec-cache-nsec3-wc-hits",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of answers synthesized from a wildcard and the NSEC3 entries of the aggressive NSEC cache")},
+
   {"all-outqueries",
    MetricDefinition(PrometheusMetricType::counter,
                     "Number of outgoing UDP queries since starting")},
@@ -640,6 +659,12 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::metrics =
   {"dont-outqueries",
    MetricDefinition(PrometheusMetricType::counter,
                     "Number of outgoing queries dropped because of `setting-dont-query` setting")},
+  {"dot-outqueries",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of outgoing DoT queries since starting")},
+  {"dot-resumed-sessions",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of outgoing DoT connections that resumed a previous TLS session")},
   {"qname-min-fallback-success",
    MetricDefinition(PrometheusMetricType::counter,
                     "Number of successful queries due to fallback mechanism within 'qname-minimization' setting")},
@@ -719,9 +744,15 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::metrics =
   {"over-capacity-drops",
    MetricDefinition(PrometheusMetricType::counter,
                     "Number of questions dropped because over maximum concurrent query limit")},
+  {"packetcache-acquired",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of lock acquisitions on the shared packet cache")},
   {"packetcache-bytes",
    MetricDefinition(PrometheusMetricType::gauge,
                     "Size of the packet cache in bytes")},
+  {"packetcache-contended",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of contended lock acquisitions on the shared packet cache")},
   {"packetcache-entries",
    MetricDefinition(PrometheusMetricType::gauge,
                     "Number of packet cache entries")},
@@ -790,6 +821,15 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::metrics =
   {"tcp-clients",
    MetricDefinition(PrometheusMetricType::gauge,
                     "Number of currently active TCP/IP clients")},
+  {"tcp-out-idle-connections",
+   MetricDefinition(PrometheusMetricType::gauge,
+                    "Number of idle outgoing TCP connections to authoritative servers currently kept open")},
+  {"tcp-out-new-connections",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of new outgoing TCP connections opened to authoritative servers")},
+  {"tcp-out-reused-connections",
+   MetricDefinition(PrometheusMetricType::counter,
+                    "Number of outgoing TCP queries sent over an already established connection")},
   {"tcp-outqueries",
    MetricDefinition(PrometheusMetricType::counter,
                     "Number of outgoing TCP queries since starting")},
@@ -1016,6 +1056,30 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::metrics =
     MetricDefinition(PrometheusMetricType::counter,
                      "number of contented record cache lock acquisitions")},
 
+  { "record-cache-served-stale",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "number of times an expired record cache entry was extended to be served stale")},
+
+  { "cache-replication-sent",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "number of cache updates sent to the cache replication peers")},
+
+  { "cache-replication-received",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "number of cache updates received from the cache replication peers")},
+
+  { "udp-batch-receives",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "number of recvmmsg() calls that returned at least one UDP query")},
+
+  { "udp-batch-queries",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "number of UDP queries received via recvmmsg()")},
+
+  { "udp-batch-answers",
+    MetricDefinition(PrometheusMetricType::counter,
+                     "number of packet cache answers sent via sendmmsg()")},
+
   { "taskqueue-expired",
     MetricDefinition(PrometheusMetricType::counter,
                      "number of tasks expired before they could be run")},